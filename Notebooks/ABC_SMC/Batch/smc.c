@@ -0,0 +1,223 @@
+/*
+Performing approximate Bayesian computation sequential Monte Carlo (Toni et al.
+2009) on many observed datasets in one run.
+
+Usage: `./smc.ce [DATA_PATH]`, where DATA_PATH is either a directory with one
+.csv file per dataset, or a stacked file whose rows are a dataset label followed
+by one observation (see ../engine/smc_datasets.h). For the beta-binomial model
+an observation is a number of successes, as in `binom_data.csv`; for linear
+regression it is a row x,y.
+
+BATCH_MODEL selects the model. Every dataset gets an independent SMC
+population, seeded with SEED plus the index of the dataset, and the runs share
+a pool of N_THREADS threads (0 for one per processor), each taking the next
+dataset when its current run ends. Each run itself is single-threaded, so results
+are reproducible.
+
+This script writes BATCH_SUMMARY_FILE_NAME, with the columns of summary.csv for
+every dataset, round and parameter, preceded by the name of the dataset, its
+number of observations and the reason its run stopped (see smc_engine.h).
+
+Defining #DEBUG_MODE will silence all writing to stdout.
+
+Author: Juvid Aryaman
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_sort_double.h>
+#include <gsl/gsl_statistics.h>
+#include <gsl/gsl_fit.h>
+
+#define BATCH_BETA_BINOMIAL 0
+#define BATCH_LIN_REG 1
+#define BATCH_MODEL BATCH_BETA_BINOMIAL
+
+#define DATA_PATH "datasets"
+#define BATCH_SUMMARY_FILE_NAME "batch_summary.csv"
+#define N_THREADS 0
+
+/*Beta-binomial model*/
+#define N_TRUTH 10
+#define PRIOR_ALPHA 0.5
+#define PRIOR_BETA 0.5
+#define KERNEL_SD 0.05
+#define DISTANCE_THRESHOLD_INIT_BB 10
+
+/*Linear regression, with the mean absolute residual distance*/
+#define PRIOR_GRADIENT_LOWER 0.0
+#define PRIOR_INTERCEPT_LOWER 3.0
+#define PRIOR_SIGMA_LOWER 0.0
+#define PRIOR_GRADIENT_UPPER 10.0
+#define PRIOR_INTERCEPT_UPPER 500.0
+#define PRIOR_SIGMA_UPPER 10.0
+#define KERNEL_SD_GRADIENT 0.05
+#define KERNEL_SD_INTERCEPT 5.0
+#define KERNEL_SD_SIGMA 0.1
+#define DISTANCE_THRESHOLD_INIT_LR 7.0
+
+#define N_PARTICLES 2000
+#define N_ROUNDS_SMC 50
+#define QUANTILE_ACCEPT_DISTANCE 0.8
+#define ESS_RESAMPLE_FRACTION 0.5
+#define THRESHOLD_TOLERANCE 0.01
+#define POSTERIOR_TOLERANCE 0.01
+#define SEED 1
+#define INFERENCE_MODE SMC_MODE_REJECTION
+#define N_SIMULATIONS_PER_PARTICLE 1
+#define N_HISTOGRAM_BINS 50
+
+//#define DEBUG_MODE
+
+#include "smc_engine.h"
+#include "smc_io.h"
+#include "smc_datasets.h"
+#include "smc_batch.h"
+#include "beta_binomial.h"
+#include "lin_reg.h"
+
+int main(int argc, char *argv[]) {
+
+/////////////////////////
+/*Read data*/
+/////////////////////////
+
+const char *data_path = (argc > 1) ? argv[1] : DATA_PATH;
+int n_columns = (BATCH_MODEL == BATCH_LIN_REG) ? 2 : 1;
+int n_datasets, i, j;
+smc_dataset *datasets = read_datasets(data_path, n_columns, &n_datasets);
+if (datasets == NULL) return -1;
+
+#ifndef DEBUG_MODE
+	printf("Read %d datasets from %s\n", n_datasets, data_path);
+#endif
+
+/////////////////////////
+/*Initialise variables*/
+/////////////////////////
+
+smc_model *model = malloc(n_datasets * sizeof(smc_model));
+smc_settings *settings = malloc(n_datasets * sizeof(smc_settings));
+smc_job *job = malloc(n_datasets * sizeof(smc_job));
+beta_binomial_params *bb_params = calloc(n_datasets,
+	sizeof(beta_binomial_params));
+lin_reg_params *lr_params = calloc(n_datasets, sizeof(lin_reg_params));
+if ((model == NULL) || (settings == NULL) || (job == NULL) ||
+	(bb_params == NULL) || (lr_params == NULL)) {
+	printf("Error allocating batch\n");
+	return -1;
+}
+
+double distance_threshold_init_bb[] = {DISTANCE_THRESHOLD_INIT_BB};
+double distance_threshold_init_lr[] = {DISTANCE_THRESHOLD_INIT_LR};
+double histogram_lower_bb[] = {0.0};
+double histogram_upper_bb[] = {1.0};
+lin_reg_params lr_defaults = {0, NULL, NULL,
+	{PRIOR_GRADIENT_LOWER, PRIOR_INTERCEPT_LOWER, PRIOR_SIGMA_LOWER},
+	{PRIOR_GRADIENT_UPPER, PRIOR_INTERCEPT_UPPER, PRIOR_SIGMA_UPPER},
+	{KERNEL_SD_GRADIENT, KERNEL_SD_INTERCEPT, KERNEL_SD_SIGMA}
+};
+
+for (i = 0; i < n_datasets; i++) {
+	settings[i] = smc_default_settings();
+	settings[i].n_particles = N_PARTICLES;
+	settings[i].n_rounds = N_ROUNDS_SMC;
+	settings[i].seed = SEED + i;
+	settings[i].quantile_accept_distance = QUANTILE_ACCEPT_DISTANCE;
+	settings[i].ess_resample_fraction = ESS_RESAMPLE_FRACTION;
+	settings[i].threshold_tolerance = THRESHOLD_TOLERANCE;
+	settings[i].posterior_tolerance = POSTERIOR_TOLERANCE;
+	settings[i].inference_mode = INFERENCE_MODE;
+	settings[i].n_simulations_per_particle = N_SIMULATIONS_PER_PARTICLE;
+	settings[i].n_histogram_bins = N_HISTOGRAM_BINS;
+
+	if (BATCH_MODEL == BATCH_LIN_REG) {
+		/*Split the rows x,y into the x and y arrays the model reads*/
+		lr_params[i] = lr_defaults;
+		lr_params[i].n_data = datasets[i].n_rows;
+		lr_params[i].data_x = malloc(datasets[i].n_rows * 2 * sizeof(double));
+		if (lr_params[i].data_x == NULL) {printf("Error allocating batch\n"); return -1;}
+		lr_params[i].data_y = lr_params[i].data_x + datasets[i].n_rows;
+		for (j = 0; j < datasets[i].n_rows; j++) {
+			lr_params[i].data_x[j] = datasets[i].values[2*j];
+			lr_params[i].data_y[j] = datasets[i].values[2*j + 1];
+		}
+		if ((datasets[i].n_rows < 3) || (lin_reg_fit_data(&lr_params[i]) != 0)) {
+			printf("Fit failed for dataset %s\n", datasets[i].name);
+			return -1;
+		}
+		model[i] = lin_reg_model(&lr_params[i], LIN_REG_DISTANCE_ABS_RES);
+		settings[i].threshold_init = distance_threshold_init_lr;
+		settings[i].histogram_lower = lr_params[i].prior_lower;
+		settings[i].histogram_upper = lr_params[i].prior_upper;
+	}
+	else{
+		bb_params[i].n_data = datasets[i].n_rows;
+		bb_params[i].data = malloc(datasets[i].n_rows * sizeof(int));
+		if (bb_params[i].data == NULL) {printf("Error allocating batch\n"); return -1;}
+		for (j = 0; j < datasets[i].n_rows; j++) {
+			bb_params[i].data[j] = (int)datasets[i].values[j];
+		}
+		bb_params[i].n_truth = N_TRUTH;
+		bb_params[i].prior_alpha = PRIOR_ALPHA;
+		bb_params[i].prior_beta = PRIOR_BETA;
+		bb_params[i].kernel_sd = KERNEL_SD;
+		model[i] = beta_binomial_model(&bb_params[i]);
+		settings[i].threshold_init = distance_threshold_init_bb;
+		settings[i].histogram_lower = histogram_lower_bb;
+		settings[i].histogram_upper = histogram_upper_bb;
+	}
+
+	job[i].model = &model[i];
+	job[i].settings = &settings[i];
+	job[i].population = smc_population_alloc(&model[i], &settings[i]);
+	if (job[i].population == NULL) return -1;
+}
+
+/////////////////////////
+/*Perform ABC SMC*/
+/////////////////////////
+
+int verbose = 1;
+#ifdef DEBUG_MODE
+	verbose = 0;
+#endif
+int n_failed = smc_run_batch(job, n_datasets, N_THREADS, verbose);
+if (n_failed != 0) {printf("%d runs failed\n", n_failed); return -1;}
+
+/////////////////////////
+/*Write summaries*/
+/////////////////////////
+
+FILE *outfile_pointer = fopen(BATCH_SUMMARY_FILE_NAME, "w");
+char leading_values[DATASET_NAME_LENGTH + 64];
+write_summaries_header(outfile_pointer, job[0].population,
+	"dataset,n_data,stop_reason,");
+for (i = 0; i < n_datasets; i++) {
+	snprintf(leading_values, sizeof(leading_values), "%s,%d,%d,",
+		datasets[i].name, datasets[i].n_rows, job[i].population->stop_reason);
+	write_summaries_rows(outfile_pointer, job[i].population, leading_values);
+}
+fclose(outfile_pointer);
+
+#ifndef DEBUG_MODE
+	printf("Done!\n");
+#endif
+
+for (i = 0; i < n_datasets; i++) {
+	smc_population_free(job[i].population);
+	free(lr_params[i].data_x);
+	free(bb_params[i].data);
+}
+free(model);
+free(settings);
+free(job);
+free(bb_params);
+free(lr_params);
+free_datasets(datasets, n_datasets);
+return 0; //return from main
+} //close main
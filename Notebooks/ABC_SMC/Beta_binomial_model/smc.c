@@ -5,14 +5,56 @@ Performing approximate Bayesian computation sequential Monte Carlo (Toni et al.
 Synthetic data is generated by `ground_truth_and_analysis.ipynb`.
 
 This script writes particles.csv, where each row corresponds to a particle and
-each column corresponds to a round of SMC.
+each column corresponds to a round of SMC. At most N_ROUNDS_SMC rounds are run;
+the run ends early once the distance threshold decreases by less than
+THRESHOLD_TOLERANCE (relative), or the posterior mean, spread and quantiles move
+by less than POSTERIOR_TOLERANCE posterior standard deviations, between rounds.
+The previous population is resampled whenever its effective sample size falls
+below ESS_RESAMPLE_FRACTION*N_PARTICLES.
+
+Each run also writes summary.csv, with the ESS, threshold, weighted mean,
+variance, quantiles and a fixed-bin histogram of every parameter at every round.
+Defining #SUMMARY_ONLY skips writing the full particle history, for routine
+monitoring.
+
+Defining #WRITE_EACH_ROUND also writes each round to GENERATION_FILE_NAME
+(theta and weight of every particle) from a background thread while the next
+round is sampled, gzip-compressed if COMPRESS_OUTPUT is 1 and the engine is
+built with -DSMC_WRITER_ZLIB -lz.
+
+INFERENCE_MODE selects how a proposed particle is scored (see
+smc_engine.h): SMC_MODE_REJECTION, SMC_MODE_AVERAGED_ACCEPTANCE or
+SMC_MODE_SYNTHETIC_LIKELIHOOD, the latter two with N_SIMULATIONS_PER_PARTICLE
+simulations per particle.
+
+Each round is sampled by N_THREADS threads. Runs with more than one thread
+are not reproducible from SEED.
+Defining NUMA_AWARE as 1 pins the threads and keeps each thread's share of
+the population on its own NUMA node.
+
+Each round ends after MAX_SIMULATIONS_PER_ROUND simulations or ROUND_TIME_LIMIT
+seconds, whichever comes first (0 for no limit). A round which runs out of
+budget then either keeps its best proposals at a relaxed threshold
+(SMC_FALLBACK_RELAX_THRESHOLD) or only the particles accepted so far
+(SMC_FALLBACK_SHRINK_POPULATION), as set by BUDGET_FALLBACK. summary.csv records
+the fallback and the number of particles of every round.
+
+Defining SURROGATE_SCREENING as 1 skips simulating proposals which a
+nearest-neighbour surrogate, trained on the previous round's simulations,
+predicts will be rejected, with an importance correction to the weights (see
+smc_engine.h). It pays off only when simulations are expensive.
+
+PRIOR_SAMPLING draws the first round from a randomised quasi-Monte Carlo
+sequence mapped through the prior's inverse CDF (SMC_QMC_SOBOL or
+SMC_QMC_HALTON) instead of independent draws (SMC_QMC_NONE), which covers the
+prior more evenly.
 
 Defining #DEBUG_MODE will silence all writing to stdout. One may then add
 printf statements in the code, and perhaps write the output to file as:
 `./run.sh > output.txt`
 
-TODO: Export all functions which are specific to the beta-binomial model into
-smc.h, and perhaps rename smc.h as beta_binomial.h
+The model itself lives in ../engine/beta_binomial.h, and the SMC loop in
+../engine/smc_engine.h.
 
 Author: Juvid Aryaman
 */
@@ -37,24 +79,39 @@ Author: Juvid Aryaman
 #define KERNEL_SD 0.05
 #define QUANTILE_ACCEPT_DISTANCE 0.8
 
-#define RND gsl_rng_uniform(r)
+#define ESS_RESAMPLE_FRACTION 0.5
+#define THRESHOLD_TOLERANCE 0.01
+#define POSTERIOR_TOLERANCE 0.01
+
 #define SEED 1
+#define INFERENCE_MODE SMC_MODE_REJECTION
+#define N_SIMULATIONS_PER_PARTICLE 1
+#define N_THREADS 1
+#define NUMA_AWARE 0
+#define MAX_SIMULATIONS_PER_ROUND 0
+#define ROUND_TIME_LIMIT 600.0
+#define BUDGET_FALLBACK SMC_FALLBACK_RELAX_THRESHOLD
+#define SURROGATE_SCREENING 0
+#define PRIOR_SAMPLING SMC_QMC_NONE
 #define DISTANCE_THRESHOLD_INIT 10
 
 #define OUTFILE_NAME "particles.csv"
+#define SUMMARY_FILE_NAME "summary.csv"
+#define N_HISTOGRAM_BINS 50
+#define GENERATION_FILE_NAME "generation_%d.csv"
+#define COMPRESS_OUTPUT 0
 
 //#define DEBUG_MODE
+//#define SUMMARY_ONLY
+//#define WRITE_EACH_ROUND
 
-#include "smc.h"
+#include "smc_engine.h"
+#include "smc_io.h"
+#include "smc_writer.h"
+#include "beta_binomial.h"
 
 int main(int argc, char *argv[]) {
 
-/* set up GSL RNG */
-gsl_rng *r = gsl_rng_alloc(gsl_rng_mt19937);
-/* end of GSL setup */
-
-gsl_rng_set(r, SEED);
-
 /////////////////////////
 /*Read data*/
 /////////////////////////
@@ -64,7 +121,7 @@ FILE *data_pointer;
 data_pointer = fopen("binom_data.csv", "r");
 
 int data[N_DATA];
-int i, j, read_error_status;
+int i, read_error_status;
 for (i=0; i < N_DATA; i++){
 	read_error_status = fscanf(data_pointer, "%d\n", &data[i]);
 }
@@ -75,102 +132,76 @@ if (read_error_status != 1){printf("Error reading data\n"); return 0;}
 /*Initialise variables*/
 /////////////////////////
 
-/*Make a (N_ROUNDS_SMC X N_PARTICLES) array to store all particles at all rounds
-of SMC*/
-double** theta_particle;
-theta_particle = (double**) malloc(N_ROUNDS_SMC * sizeof(double*));
-for (i = 0; i < N_ROUNDS_SMC; i++){
-	theta_particle[i] = (double*) malloc(N_PARTICLES * sizeof(double));
-}
-
-double distance_threshold = DISTANCE_THRESHOLD_INIT;
-int *simulated_data = (int*) malloc(N_DATA * sizeof(int));
-double *distance = malloc(N_PARTICLES * sizeof(double));
-double *weight = malloc(N_PARTICLES * sizeof(double));
-double weight_normalizer = 0.0;
+beta_binomial_params params;
+params.n_data = N_DATA;
+params.data = data;
+params.n_truth = N_TRUTH;
+params.prior_alpha = PRIOR_ALPHA;
+params.prior_beta = PRIOR_BETA;
+params.kernel_sd = KERNEL_SD;
+smc_model model = beta_binomial_model(&params);
+
+double distance_threshold_init[] = {DISTANCE_THRESHOLD_INIT};
+double histogram_lower[] = {0.0};
+double histogram_upper[] = {1.0};
+smc_settings settings = smc_default_settings();
+settings.n_particles = N_PARTICLES;
+settings.n_rounds = N_ROUNDS_SMC;
+settings.seed = SEED;
+settings.threshold_init = distance_threshold_init;
+settings.quantile_accept_distance = QUANTILE_ACCEPT_DISTANCE;
+settings.ess_resample_fraction = ESS_RESAMPLE_FRACTION;
+settings.threshold_tolerance = THRESHOLD_TOLERANCE;
+settings.posterior_tolerance = POSTERIOR_TOLERANCE;
+settings.inference_mode = INFERENCE_MODE;
+settings.n_simulations_per_particle = N_SIMULATIONS_PER_PARTICLE;
+settings.n_threads = N_THREADS;
+settings.numa_aware = NUMA_AWARE;
+settings.max_simulations_per_round = MAX_SIMULATIONS_PER_ROUND;
+settings.round_time_limit = ROUND_TIME_LIMIT;
+settings.budget_fallback = BUDGET_FALLBACK;
+settings.surrogate_screening = SURROGATE_SCREENING;
+settings.prior_sampling = PRIOR_SAMPLING;
+settings.n_histogram_bins = N_HISTOGRAM_BINS;
+settings.histogram_lower = histogram_lower;
+settings.histogram_upper = histogram_upper;
+#ifndef DEBUG_MODE
+	settings.verbose = 1;
+#endif
 
-int time_smc=0; // an index of each round of SMC
-int param_index_chosen;
+smc_population *population = smc_population_alloc(&model, &settings);
+if (population == NULL) return -1;
 
 /////////////////////////
 /*Perform ABC SMC*/
 /////////////////////////
 
-/*For every round of SMC*/
-for (time_smc = 0; time_smc < N_ROUNDS_SMC; time_smc++) {
-	#ifndef DEBUG_MODE
-		printf("Round %d of SMC\n", time_smc);
-	#endif
-
-	/*Draw or perturb a particle and compute distance*/
-	for (i = 0; i < N_PARTICLES; i++) {
-		distance[i] = distance_threshold + 1.0; // reset distance of particle i
-		while (distance[i] > distance_threshold) {
-			if (time_smc == 0) {
-				// Sample from the prior
-				theta_particle[0][i] = gsl_ran_beta(r, PRIOR_ALPHA, PRIOR_BETA);
-			}
-			else{
-				/*Sample from the old weights and perturb*/
-				param_index_chosen = weighted_choice(r, weight);
-				if ((param_index_chosen < 0)||(param_index_chosen >= N_PARTICLES)) {
-					printf("Error in param_index_chosen\n"); return -1;
-			}
-				theta_particle[time_smc][i] =
-					theta_particle[time_smc-1][param_index_chosen] +
-					gsl_ran_gaussian(r, KERNEL_SD);
-
-				// check if bounds of prior exceeded
-				if((theta_particle[time_smc][i]<0) || (theta_particle[time_smc][i] > 1)) continue;
-			}
-
-			// Simulate a candidate dataset
-			for (j = 0; j < N_DATA; j++) {
-				simulated_data[j] = gsl_ran_binomial(r, theta_particle[time_smc][i], N_TRUTH);
-			}
-
-			// Compute distance between data and simulation
-			distance[i] = distance_metric(data, simulated_data);
-
-		}
+#ifdef WRITE_EACH_ROUND
+	smc_writer writer;
+	if (smc_writer_start(&writer, GENERATION_FILE_NAME, model.n_parameters,
+			N_PARTICLES, COMPRESS_OUTPUT) != 0) {
+		return -1;
 	}
-	#ifndef DEBUG_MODE
-		printf("Particles sampled.\n");
-	#endif
-
-	/*Compute weights*/
-	if (time_smc==0){ for (i = 0; i < N_PARTICLES; i++) weight[i] = 1.0;}
-	else{
-		weight_normalizer = 0.0;
-		for (i = 0; i < N_PARTICLES; i++) {
-			weight_normalizer += weight[i]*kernel_pdf(theta_particle[time_smc-1][i],
-				theta_particle[time_smc][i]);
-		}
-
-		for (i = 0; i < N_PARTICLES; i++) {
-			weight[i] = prior_pdf(theta_particle[time_smc][i])/weight_normalizer;
-		}
-
-	}
-
-	/*Normalise weights*/
-	weight_normalizer = 0.0;
-	for (i = 0; i < N_PARTICLES; i++)	weight_normalizer += weight[i];
-	for (i = 0; i < N_PARTICLES; i++)	weight[i] = weight[i]/weight_normalizer;
-
+	smc_writer_attach(&writer, &settings);
+#endif
 
-	/* Resample weights*/
-	distance_threshold = update_distance_threshold(distance);
+if (smc_run(&model, &settings, population) != 0) return -1;
 
-}
+#ifdef WRITE_EACH_ROUND
+	if (smc_writer_finish(&writer) != 0) return -1;
+#endif
 
+#ifndef SUMMARY_ONLY
 #ifndef DEBUG_MODE
 	printf("Writing particles to file\n");
 #endif
-	write_particles_to_csv(theta_particle);
+	write_particles_to_csv(population, OUTFILE_NAME);
+#endif
+	write_summaries_to_csv(population, SUMMARY_FILE_NAME);
 #ifndef DEBUG_MODE
 	printf("Done!\n");
 #endif
 
+smc_population_free(population);
 return 0; //return from main
 } //close main
@@ -4,8 +4,61 @@ Performing approximate Bayesian computation sequential Monte Carlo (Toni et al.
 
 Synthetic data is generated by `ground_truth_and_analysis.ipynb`.
 
-This script writes particles.csv, where each row corresponds to a particle and
-each column corresponds to a round of SMC.
+This script writes particle_<k>.csv for each parameter k, where each row
+corresponds to a particle and each column corresponds to a round of SMC, and
+distances.txt, the distance threshold of each parameter (rows, one row if the
+distances are scaled) at each round (columns). At most N_ROUNDS_SMC rounds are
+run; the run ends early once no threshold decreases by more than
+THRESHOLD_TOLERANCE (relative), or the posterior mean, spread and quantiles move
+by less than POSTERIOR_TOLERANCE posterior standard deviations, between rounds.
+The previous population is resampled whenever its effective sample size falls
+below ESS_RESAMPLE_FRACTION*N_PARTICLES.
+
+Each run also writes summary.csv, with the ESS, threshold, weighted mean,
+variance, quantiles and a fixed-bin histogram of every parameter at every round.
+Defining #SUMMARY_ONLY skips writing the full particle history, for routine
+monitoring.
+
+Defining #WRITE_EACH_ROUND also writes each round to GENERATION_FILE_NAME
+(theta and weight of every particle) from a background thread while the next
+round is sampled, gzip-compressed if COMPRESS_OUTPUT is 1 and the engine is
+built with -DSMC_WRITER_ZLIB -lz.
+
+INFERENCE_MODE selects how a proposed particle is scored (see
+smc_engine.h): SMC_MODE_REJECTION, SMC_MODE_AVERAGED_ACCEPTANCE or
+SMC_MODE_SYNTHETIC_LIKELIHOOD, the latter two with N_SIMULATIONS_PER_PARTICLE
+simulations per particle.
+
+Each round is sampled by N_THREADS threads. Runs with more than one thread
+are not reproducible from SEED.
+Defining NUMA_AWARE as 1 pins the threads and keeps each thread's share of
+the population on its own NUMA node.
+
+Each round ends after MAX_SIMULATIONS_PER_ROUND simulations or ROUND_TIME_LIMIT
+seconds, whichever comes first (0 for no limit). A round which runs out of
+budget then either keeps its best proposals at a relaxed threshold
+(SMC_FALLBACK_RELAX_THRESHOLD) or only the particles accepted so far
+(SMC_FALLBACK_SHRINK_POPULATION), as set by BUDGET_FALLBACK. summary.csv records
+the fallback and the number of particles of every round.
+
+Defining SURROGATE_SCREENING as 1 skips simulating proposals which a
+nearest-neighbour surrogate, trained on the previous round's simulations,
+predicts will be rejected, with an importance correction to the weights (see
+smc_engine.h). It pays off only when simulations are expensive.
+
+PRIOR_SAMPLING draws the first round from a randomised quasi-Monte Carlo
+sequence mapped through the prior's inverse CDF (SMC_QMC_SOBOL or
+SMC_QMC_HALTON) instead of independent draws (SMC_QMC_NONE), which covers the
+prior more evenly.
+
+By default a particle is accepted when each of its three distances is within
+its own threshold. DISTANCE_SCALING as SMC_SCALING_MAD or SMC_SCALING_MAHALANOBIS
+instead scales the distance vector by N_PILOT_SIMULATIONS pilot simulations from
+the prior and accepts on its length, with a single threshold starting from
+DISTANCE_THRESHOLD_INIT_SCALED (see ../../engine/smc_scaling.h). A positive
+TARGET_ACCEPTANCE_RATE sets the thresholds of each round jointly, to keep about
+that fraction of simulations accepted, rather than by QUANTILE_ACCEPT_DISTANCE
+separately for each distance.
 
 Defining #DEBUG_MODE will silence all writing to stdout. One may then add
 printf statements in the code, and perhaps write the output to file as:
@@ -16,6 +69,9 @@ Parameter ordering convention:
 1 - intercept
 2 - standard deviation
 
+The model itself lives in ../../engine/lin_reg.h, and the SMC loop in
+../../engine/smc_engine.h.
+
 Author: Juvid Aryaman
 */
 
@@ -37,28 +93,60 @@ Author: Juvid Aryaman
 #define N_ROUNDS_SMC 25
 #define QUANTILE_ACCEPT_DISTANCE 0.8
 
-#define RND gsl_rng_uniform(r)
+#define PRIOR_GRADIENT_LOWER 0.0
+#define PRIOR_INTERCEPT_LOWER 0.0
+#define PRIOR_SIGMA_LOWER 0.0
+
+#define PRIOR_GRADIENT_UPPER 10.0
+#define PRIOR_INTERCEPT_UPPER 500.0
+#define PRIOR_SIGMA_UPPER 10.0
+
+#define KERNEL_SD_GRADIENT 0.1
+#define KERNEL_SD_INTERCEPT 10.0
+#define KERNEL_SD_SIGMA 0.1
+
+#define ESS_RESAMPLE_FRACTION 0.5
+#define THRESHOLD_TOLERANCE 0.01
+#define POSTERIOR_TOLERANCE 0.01
+
 #define SEED 1
+#define INFERENCE_MODE SMC_MODE_REJECTION
+#define N_SIMULATIONS_PER_PARTICLE 1
+#define N_THREADS 1
+#define NUMA_AWARE 0
+#define MAX_SIMULATIONS_PER_ROUND 0
+#define ROUND_TIME_LIMIT 600.0
+#define BUDGET_FALLBACK SMC_FALLBACK_RELAX_THRESHOLD
+#define SURROGATE_SCREENING 0
+#define PRIOR_SAMPLING SMC_QMC_NONE
 #define DISTANCE_THRESHOLD_INIT_GRADIENT 2
 #define DISTANCE_THRESHOLD_INIT_INTERCEPT 50
 #define DISTANCE_THRESHOLD_INIT_SIGMA 2
+#define DISTANCE_SCALING SMC_SCALING_NONE
+#define N_PILOT_SIMULATIONS 2000
+#define PILOT_SEED 1000
+#define DISTANCE_THRESHOLD_INIT_SCALED 3.0
+#define TARGET_ACCEPTANCE_RATE 0.0
 
 #define X_DATA_FILENAME "x.csv"
 #define Y_DATA_FILENAME "y.csv"
+#define SUMMARY_FILE_NAME "summary.csv"
+#define N_HISTOGRAM_BINS 50
+#define GENERATION_FILE_NAME "generation_%d.csv"
+#define COMPRESS_OUTPUT 0
 
 //#define DEBUG_MODE
+//#define SUMMARY_ONLY
+//#define WRITE_EACH_ROUND
 
-#include "smc.h"
+#include "smc_engine.h"
+#include "smc_io.h"
+#include "smc_writer.h"
+#include "smc_scaling.h"
 #include "lin_reg.h"
 
 int main(int argc, char *argv[]) {
 
-/* set up GSL RNG */
-gsl_rng *r = gsl_rng_alloc(gsl_rng_mt19937);
-/* end of GSL setup */
-
-gsl_rng_set(r, SEED);
-
 /////////////////////////
 /*Read data*/
 /////////////////////////
@@ -70,7 +158,7 @@ data_pointer_y = fopen(Y_DATA_FILENAME, "r");
 
 double data_x[N_DATA];
 double data_y[N_DATA];
-int i, j, read_error_status_x, read_error_status_y;
+int i, read_error_status_x, read_error_status_y;
 for (i=0; i < N_DATA; i++){
 	read_error_status_x = fscanf(data_pointer_x, "%lf\n", &data_x[i]);
 	read_error_status_y = fscanf(data_pointer_y, "%lf\n", &data_y[i]);
@@ -82,169 +170,105 @@ if (read_error_status_y != 1){printf("Error reading Y data\n"); return 0;}
 /*Initialise variables*/
 /////////////////////////
 
+lin_reg_params params = {
+	N_DATA, data_x, data_y,
+	{PRIOR_GRADIENT_LOWER, PRIOR_INTERCEPT_LOWER, PRIOR_SIGMA_LOWER},
+	{PRIOR_GRADIENT_UPPER, PRIOR_INTERCEPT_UPPER, PRIOR_SIGMA_UPPER},
+	{KERNEL_SD_GRADIENT, KERNEL_SD_INTERCEPT, KERNEL_SD_SIGMA}
+};
+
 /*Fit a linear model to the data, which will be used as summary statistics of
 the data*/
-double gradient_fit_data, intercept_fit_data, sigma_fit_data, cov00, cov01, cov11, sumsq;
-int gsl_fit_return_value;
-gsl_fit_return_value = gsl_fit_linear(data_x, 1, data_y, 1, N_DATA,
-																			&intercept_fit_data, &gradient_fit_data,
-																			&cov00, &cov01, &cov11, &sumsq);
-if (gsl_fit_return_value != 0) {printf("Fit failed.\n"); return -1;}
-sigma_fit_data = sqrt(sumsq/(N_DATA-2));
+if (lin_reg_fit_data(&params) != 0) {printf("Fit failed.\n"); return -1;}
 
 #ifndef DEBUG_MODE
-	printf("gradient ML = %.8f\n", gradient_fit_data);
-	printf("intercept ML = %.8f\n", intercept_fit_data);
-	printf("sigma ML = %.8f\n", sigma_fit_data);
+	printf("gradient ML = %.8f\n", params.gradient_fit_data);
+	printf("intercept ML = %.8f\n", params.intercept_fit_data);
+	printf("sigma ML = %.8f\n", params.sigma_fit_data);
 #endif
 
+smc_model lr_model = lin_reg_model(&params, LIN_REG_DISTANCE_SUM_STATS_3D);
+smc_model model = lr_model;
 
-
-/*Make a (N_PARAMETERS X N_ROUNDS_SMC X N_PARTICLES) array to store all
-particles at all rounds of SMC*/
-double*** theta_particle;
-theta_particle = (double***) malloc(N_PARAMETERS * sizeof(double**));
-for (i = 0; i < N_PARAMETERS; i++){
-	theta_particle[i] = (double**) malloc(N_ROUNDS_SMC * sizeof(double*));
-}
-for (i = 0; i < N_PARAMETERS; i++){
-	for (j = 0; j < N_ROUNDS_SMC; j++){
-		theta_particle[i][j] = (double*) malloc(N_PARTICLES * sizeof(double));
-	}
-}
-
-double** distance;
-distance = (double**) malloc(N_PARAMETERS * sizeof(double*));
-for (i = 0; i < N_PARAMETERS; i++) {
-	distance[i] = (double*) malloc(N_PARTICLES * sizeof(double));
-}
-double **distance_threshold_all = malloc(N_PARAMETERS * sizeof(double*));
-for (i = 0; i < N_PARAMETERS; i++) {
-	distance_threshold_all[i] = (double*) malloc(N_ROUNDS_SMC * sizeof(double));
-}
-
-double distance_threshold[] = {DISTANCE_THRESHOLD_INIT_GRADIENT,
+double distance_threshold_init[] = {DISTANCE_THRESHOLD_INIT_GRADIENT,
 															 DISTANCE_THRESHOLD_INIT_INTERCEPT,
 														   DISTANCE_THRESHOLD_INIT_SIGMA};
+double distance_threshold_init_scaled[] = {DISTANCE_THRESHOLD_INIT_SCALED};
+
+/*Reduce the three distances to one, scaled by pilot simulations*/
+smc_scaled_distance scaled;
+if (DISTANCE_SCALING != SMC_SCALING_NONE) {
+	if (smc_scaled_distance_init(&scaled, &lr_model, DISTANCE_SCALING,
+			N_PILOT_SIMULATIONS, PILOT_SEED) != 0) {
+		return -1;
+	}
+	model = smc_scaled_model(&scaled);
+}
+smc_settings settings = smc_default_settings();
+settings.n_particles = N_PARTICLES;
+settings.n_rounds = N_ROUNDS_SMC;
+settings.seed = SEED;
+settings.threshold_init = (DISTANCE_SCALING != SMC_SCALING_NONE) ?
+	distance_threshold_init_scaled : distance_threshold_init;
+settings.quantile_accept_distance = QUANTILE_ACCEPT_DISTANCE;
+settings.target_acceptance_rate = TARGET_ACCEPTANCE_RATE;
+settings.ess_resample_fraction = ESS_RESAMPLE_FRACTION;
+settings.threshold_tolerance = THRESHOLD_TOLERANCE;
+settings.posterior_tolerance = POSTERIOR_TOLERANCE;
+settings.inference_mode = INFERENCE_MODE;
+settings.n_simulations_per_particle = N_SIMULATIONS_PER_PARTICLE;
+settings.n_threads = N_THREADS;
+settings.numa_aware = NUMA_AWARE;
+settings.max_simulations_per_round = MAX_SIMULATIONS_PER_ROUND;
+settings.round_time_limit = ROUND_TIME_LIMIT;
+settings.budget_fallback = BUDGET_FALLBACK;
+settings.surrogate_screening = SURROGATE_SCREENING;
+settings.prior_sampling = PRIOR_SAMPLING;
+settings.n_histogram_bins = N_HISTOGRAM_BINS;
+settings.histogram_lower = params.prior_lower;
+settings.histogram_upper = params.prior_upper;
+#ifndef DEBUG_MODE
+	settings.verbose = 1;
+#endif
 
-double *simulated_data = (double*) malloc(N_DATA * sizeof(double));
-double *weight = malloc(N_PARTICLES * sizeof(double));
-
-double weight_normalizer = 0.0;
+smc_population *population = smc_population_alloc(&model, &settings);
+if (population == NULL) return -1;
 
-int time_smc=0; // an index of each round of SMC
-int param_index_chosen, prior_violated;
-int particle_index;
 /////////////////////////
 /*Perform ABC SMC*/
 /////////////////////////
 
-/*For every round of SMC*/
-for (time_smc = 0; time_smc < N_ROUNDS_SMC; time_smc++) {
-	#ifndef DEBUG_MODE
-		printf("Round %d of SMC\n", time_smc);
-	#endif
-	for (i = 0; i < N_PARAMETERS; i++) {
-		distance_threshold_all[i][time_smc] = distance_threshold[i];
-	}
-
-	/*Draw or perturb a particle and compute distance*/
-	for (particle_index = 0; particle_index < N_PARTICLES; particle_index++) {
-		// printf("%d\n", particle_index);
-		for (i = 0; i < N_PARAMETERS; i++) {
-			// reset distance of particle along each dimension
-			distance[i][particle_index] = distance_threshold[i] + 1.0;
-		}
-		while ((distance[0][particle_index] > distance_threshold[0])||
-					 (distance[1][particle_index] > distance_threshold[1])||
-				   (distance[2][particle_index] > distance_threshold[2])) {
-			if (time_smc == 0) {
-				// Sample from the prior
-				sample_prior(r, theta_particle, particle_index);
-			}
-			else{
-				/*Sample from the old weights*/
-				param_index_chosen = weighted_choice(r, weight);
-				if ((param_index_chosen < 0)||(param_index_chosen >= N_PARTICLES)) {
-					printf("Error in param_index_chosen\n");
-					printf("time_smc = %d\n", time_smc);
-					return -1;
-				}
-
-				perturb_particle(r, theta_particle, time_smc, param_index_chosen,
-												 particle_index);
-
-				// Check if prior support is 0
-				prior_violated = check_prior_violated(theta_particle, time_smc,
-																							particle_index);
-				if(prior_violated == 1) continue;
-				}
-
-			simulate_dataset(r, theta_particle, data_x, simulated_data, time_smc,
-											 particle_index);
-
-
-
-
-			// Compute distance between data and simulation
-			distance_metric_sum_stats(simulated_data,
-															 data_x,
-															 gradient_fit_data,
-															 intercept_fit_data,
-															 sigma_fit_data,
-														   distance, particle_index);
-			//distance[particle_index] = distance_metric_sum_res(simulated_data, data_y);
-			// distance[particle_index] = distance_metric_sum_abs_res(simulated_data, data_y);
-
-		}
-	}
-
-	#ifndef DEBUG_MODE
-		printf("Particles sampled.\n");
-	#endif
-
-
-	/*Compute weights*/
-	if (time_smc==0){ for (i = 0; i < N_PARTICLES; i++) weight[i] = 1.0;}
-	else{
-		weight_normalizer = 0.0;
-		for (particle_index = 0; particle_index < N_PARTICLES; particle_index++) {
-			weight_normalizer +=  weight[particle_index]*kernel_pdf();
-		}
-		// print_double_array(weight, N_PARTICLES);
-		// printf("\n" );
-		// printf("weight_normalizer=%f\n", weight_normalizer);
-		// printf("kernel_pdf()=%f\n", kernel_pdf());
-		for (particle_index = 0; particle_index < N_PARTICLES; particle_index++) {
-			weight[particle_index] = prior_pdf(theta_particle, time_smc,
-																				 particle_index)/weight_normalizer;
-		}
-
+#ifdef WRITE_EACH_ROUND
+	smc_writer writer;
+	if (smc_writer_start(&writer, GENERATION_FILE_NAME, model.n_parameters,
+			N_PARTICLES, COMPRESS_OUTPUT) != 0) {
+		return -1;
 	}
+	smc_writer_attach(&writer, &settings);
+#endif
 
-	/*Normalise weights*/
-	weight_normalizer = 0.0;
-	for (i = 0; i < N_PARTICLES; i++)	weight_normalizer += weight[i];
-	for (i = 0; i < N_PARTICLES; i++)	weight[i] = weight[i]/weight_normalizer;
-
-	/* Resample weights*/
-	distance_threshold[0] = update_distance_threshold(distance[0]);
-	distance_threshold[1] = update_distance_threshold(distance[1]);
-	distance_threshold[2] = update_distance_threshold(distance[2]);
-
+if (smc_run(&model, &settings, population) != 0) return -1;
 
-}
+#ifdef WRITE_EACH_ROUND
+	if (smc_writer_finish(&writer) != 0) return -1;
+#endif
 
+#ifndef SUMMARY_ONLY
 #ifndef DEBUG_MODE
 	printf("Writing particles to file\n");
 #endif
-	write_particles_to_csv(theta_particle);
+	write_particles_to_csv(population, "particle_%d.csv");
+#endif
+	write_summaries_to_csv(population, SUMMARY_FILE_NAME);
 
 	char *dist_filename = "distances.txt";
-	write_2d_double_array_to_csv(distance_threshold_all, N_PARAMETERS, N_ROUNDS_SMC, dist_filename);
+	write_2d_double_array_to_csv(population->distance_threshold,
+		population->n_distances, population->n_rounds_completed, dist_filename);
 #ifndef DEBUG_MODE
 	printf("Done!\n");
 #endif
 
+smc_population_free(population);
+if (DISTANCE_SCALING != SMC_SCALING_NONE) smc_scaled_distance_free(&scaled);
 return 0; //return from main
 } //close main
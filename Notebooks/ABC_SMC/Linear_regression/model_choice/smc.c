@@ -0,0 +1,171 @@
+/*
+Performing approximate Bayesian computation sequential Monte Carlo model choice
+(Toni et al. 2009, section 3) between three linear regression models of the data
+in ../x.csv and ../y.csv, which differ in their noise:
+0 - Gaussian, N(0, sigma^2)
+1 - robust, sigma times a Student-t variate with NOISE_DOF degrees of freedom
+2 - heteroscedastic, Gaussian with standard deviation proportional to |x|
+
+All three models are fit by one population, whose particles carry a model index.
+A proposal first picks a model from the previous round's model probabilities,
+moves it with a model-jump kernel which keeps it with probability
+MODEL_STAY_PROBABILITY, then perturbs a particle of that model. Simulations are
+therefore shared between the models, rather than each model being run to
+convergence separately. The distance is the mean absolute residual, with an
+adaptive threshold.
+
+This script writes model_probabilities.csv, with the threshold, ESS, number of
+simulations and the marginal posterior probability of every model at every
+round, and model_choice_particles.csv with the model, weight and parameters of
+every particle of the last round.
+
+Defining #DEBUG_MODE will silence all writing to stdout.
+
+Parameter ordering convention, for every model:
+0 - gradient
+1 - intercept
+2 - standard deviation (scale of the noise)
+
+The models live in ../../engine/lin_reg.h, and the model choice loop in
+../../engine/smc_model_choice.h.
+
+Author: Juvid Aryaman
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_sort_double.h>
+#include <gsl/gsl_statistics.h>
+#include <gsl/gsl_fit.h>
+
+
+#define N_DATA 30
+#define N_MODELS 3
+
+#define N_PARTICLES 5000
+#define N_ROUNDS_SMC 30
+
+#define PRIOR_GRADIENT_LOWER 0.0
+#define PRIOR_INTERCEPT_LOWER 3.0
+#define PRIOR_SIGMA_LOWER 0.0
+
+#define PRIOR_GRADIENT_UPPER 10.0
+#define PRIOR_INTERCEPT_UPPER 500.0
+#define PRIOR_SIGMA_UPPER 10.0
+
+#define KERNEL_SD_GRADIENT 0.05
+#define KERNEL_SD_INTERCEPT 5.0
+#define KERNEL_SD_SIGMA 0.1
+
+#define NOISE_DOF 4.0
+#define MODEL_STAY_PROBABILITY 0.7
+
+#define DISTANCE_THRESHOLD_INIT 7.0
+#define QUANTILE_ACCEPT_DISTANCE 0.8
+#define THRESHOLD_TOLERANCE 0.01
+#define POSTERIOR_TOLERANCE 0.0
+
+#define SEED 1
+
+#define X_DATA_FILENAME "../x.csv"
+#define Y_DATA_FILENAME "../y.csv"
+#define MODEL_PROBABILITY_FILE_NAME "model_probabilities.csv"
+#define PARTICLE_FILE_NAME "model_choice_particles.csv"
+
+#include "smc_engine.h"
+#include "smc_io.h"
+#include "smc_model_choice.h"
+#include "lin_reg.h"
+
+//#define DEBUG_MODE
+
+int main(int argc, char *argv[]) {
+
+/////////////////////////
+/*Read data*/
+/////////////////////////
+
+FILE *data_pointer_x, *data_pointer_y;
+
+data_pointer_x = fopen(X_DATA_FILENAME, "r");
+data_pointer_y = fopen(Y_DATA_FILENAME, "r");
+if ((data_pointer_x == NULL) || (data_pointer_y == NULL)) {
+	printf("Error opening data\n"); return -1;
+}
+
+double data_x[N_DATA];
+double data_y[N_DATA];
+int i, m, read_error_status_x, read_error_status_y;
+for (i=0; i < N_DATA; i++){
+	read_error_status_x = fscanf(data_pointer_x, "%lf\n", &data_x[i]);
+	read_error_status_y = fscanf(data_pointer_y, "%lf\n", &data_y[i]);
+}
+if (read_error_status_x != 1){printf("Error reading X data\n"); return 0;}
+if (read_error_status_y != 1){printf("Error reading Y data\n"); return 0;}
+fclose(data_pointer_x);
+fclose(data_pointer_y);
+
+/////////////////////////
+/*Initialise variables*/
+/////////////////////////
+
+int noise[N_MODELS] = {LIN_REG_NOISE_GAUSSIAN, LIN_REG_NOISE_STUDENT_T,
+	LIN_REG_NOISE_HETEROSCEDASTIC};
+lin_reg_params params[N_MODELS];
+smc_model models[N_MODELS];
+double model_prior[N_MODELS];
+
+for (m = 0; m < N_MODELS; m++) {
+	lin_reg_params model_params = {
+		N_DATA, data_x, data_y,
+		{PRIOR_GRADIENT_LOWER, PRIOR_INTERCEPT_LOWER, PRIOR_SIGMA_LOWER},
+		{PRIOR_GRADIENT_UPPER, PRIOR_INTERCEPT_UPPER, PRIOR_SIGMA_UPPER},
+		{KERNEL_SD_GRADIENT, KERNEL_SD_INTERCEPT, KERNEL_SD_SIGMA}
+	};
+	params[m] = model_params;
+	params[m].noise = noise[m];
+	params[m].noise_dof = NOISE_DOF;
+	models[m] = lin_reg_model(&params[m], LIN_REG_DISTANCE_ABS_RES);
+	model_prior[m] = 1.0/N_MODELS;
+}
+
+smc_model_choice choice = {N_MODELS, models, model_prior,
+	MODEL_STAY_PROBABILITY};
+
+double distance_threshold_init[] = {DISTANCE_THRESHOLD_INIT};
+smc_settings settings = smc_default_settings();
+settings.n_particles = N_PARTICLES;
+settings.n_rounds = N_ROUNDS_SMC;
+settings.seed = SEED;
+settings.threshold_init = distance_threshold_init;
+settings.quantile_accept_distance = QUANTILE_ACCEPT_DISTANCE;
+settings.threshold_tolerance = THRESHOLD_TOLERANCE;
+settings.posterior_tolerance = POSTERIOR_TOLERANCE;
+#ifndef DEBUG_MODE
+	settings.verbose = 1;
+#endif
+
+smc_choice_population *population = smc_choice_population_alloc(&choice,
+	&settings);
+if (population == NULL) return -1;
+
+/////////////////////////
+/*Perform ABC SMC model choice*/
+/////////////////////////
+
+if (smc_run_model_choice(&choice, &settings, population) != 0) return -1;
+
+write_model_probabilities_to_csv(population, MODEL_PROBABILITY_FILE_NAME);
+write_model_choice_particles_to_csv(population, PARTICLE_FILE_NAME);
+
+#ifndef DEBUG_MODE
+	printf("Done!\n");
+#endif
+
+smc_choice_population_free(population);
+return 0; //return from main
+} //close main
@@ -4,8 +4,69 @@ Performing approximate Bayesian computation sequential Monte Carlo (Toni et al.
 
 Synthetic data is generated by `ground_truth_and_analysis.ipynb`.
 
-This script writes particles.csv, where each row corresponds to a particle and
-each column corresponds to a round of SMC.
+This script writes particle_<k>.csv for each parameter k, where each row
+corresponds to a particle and each column corresponds to a round of SMC, and
+weights.csv, where each row corresponds to a round of SMC. Rounds follow
+distance_threshold_schedule, unless the posterior mean, spread and quantiles
+move by less than POSTERIOR_TOLERANCE posterior standard deviations between
+rounds, in which case the run ends early. The previous population is resampled
+whenever its effective sample size falls below
+ESS_RESAMPLE_FRACTION*N_PARTICLES.
+
+Each run also writes summary.csv, with the ESS, threshold, weighted mean,
+variance, quantiles and a fixed-bin histogram of every parameter at every round.
+Defining #SUMMARY_ONLY skips writing the full particle history, for routine
+monitoring.
+
+Defining #WRITE_EACH_ROUND also writes each round to GENERATION_FILE_NAME
+(theta and weight of every particle) from a background thread while the next
+round is sampled, gzip-compressed if COMPRESS_OUTPUT is 1 and the engine is
+built with -DSMC_WRITER_ZLIB -lz.
+
+INFERENCE_MODE selects how a proposed particle is scored (see
+smc_engine.h): SMC_MODE_REJECTION, SMC_MODE_AVERAGED_ACCEPTANCE or
+SMC_MODE_SYNTHETIC_LIKELIHOOD, the latter two with N_SIMULATIONS_PER_PARTICLE
+simulations per particle.
+
+Each round is sampled by N_THREADS threads. Runs with more than one thread
+are not reproducible from SEED.
+Defining NUMA_AWARE as 1 pins the threads and keeps each thread's share of
+the population on its own NUMA node.
+
+Each round ends after MAX_SIMULATIONS_PER_ROUND simulations or ROUND_TIME_LIMIT
+seconds, whichever comes first (0 for no limit). A round which runs out of
+budget then either keeps its best proposals at a relaxed threshold
+(SMC_FALLBACK_RELAX_THRESHOLD) or only the particles accepted so far
+(SMC_FALLBACK_SHRINK_POPULATION), as set by BUDGET_FALLBACK. summary.csv records
+the fallback and the number of particles of every round.
+
+Defining SURROGATE_SCREENING as 1 skips simulating proposals which a
+nearest-neighbour surrogate, trained on the previous round's simulations,
+predicts will be rejected, with an importance correction to the weights (see
+smc_engine.h). It pays off only when simulations are expensive.
+
+PRIOR_SAMPLING draws the first round from a randomised quasi-Monte Carlo
+sequence mapped through the prior's inverse CDF (SMC_QMC_SOBOL or
+SMC_QMC_HALTON) instead of independent draws (SMC_QMC_NONE), which covers the
+prior more evenly.
+
+The final population is saved to POPULATION_FILE_NAME (theta and weight of
+every particle). When new observations are appended to x.csv and y.csv,
+defining #UPDATE_POSTERIOR updates that posterior instead of rerunning from the
+prior: N_DATA is the new number of observations, of which the first
+N_DATA_SAVED were used by the saved population. The fit to the data is updated
+with the new observations only, and the run follows update_threshold_schedule,
+starting from the saved population rather than the prior (see smc_engine.h).
+The updated population replaces the saved one, ready for the next update.
+
+Setting N_REPLICATES above 1 runs that many independent replicates, with seeds
+SEED, SEED + 1, ..., at once on REPLICATE_THREADS threads (0 for one per
+processor), sharing the data (see ../engine/smc_replicates.h). The particle,
+weight and summary files are those of replicate 0, the run SEED alone gives.
+REPLICATE_FILE_NAME reports the posterior mean, standard deviation and quantiles
+of every parameter for the final rounds of the replicates pooled, with their
+mean and standard deviation across replicates as error bars, and the pooled
+population is the one saved to POPULATION_FILE_NAME.
 
 Defining #DEBUG_MODE will silence all writing to stdout. One may then add
 printf statements in the code, and perhaps write the output to file as:
@@ -16,6 +77,9 @@ Parameter ordering convention:
 1 - intercept
 2 - standard deviation
 
+The model itself lives in ../engine/lin_reg.h, and the SMC loop in
+../engine/smc_engine.h.
+
 Author: Juvid Aryaman
 */
 
@@ -35,11 +99,43 @@ Author: Juvid Aryaman
 
 #define N_PARTICLES 20000
 
-#define RND gsl_rng_uniform(r)
+#define PRIOR_GRADIENT_LOWER 0.0
+#define PRIOR_INTERCEPT_LOWER 3.0
+#define PRIOR_SIGMA_LOWER 0.0
+
+#define PRIOR_GRADIENT_UPPER 10.0
+#define PRIOR_INTERCEPT_UPPER 500.0
+#define PRIOR_SIGMA_UPPER 10.0
+
+#define KERNEL_SD_GRADIENT 0.05
+#define KERNEL_SD_INTERCEPT 5.0
+#define KERNEL_SD_SIGMA 0.1
+
+#define ESS_RESAMPLE_FRACTION 0.5
+#define POSTERIOR_TOLERANCE 0.01
+
 #define SEED 1
+#define INFERENCE_MODE SMC_MODE_REJECTION
+#define N_SIMULATIONS_PER_PARTICLE 1
+#define N_THREADS 1
+#define NUMA_AWARE 0
+#define MAX_SIMULATIONS_PER_ROUND 0
+#define ROUND_TIME_LIMIT 600.0
+#define BUDGET_FALLBACK SMC_FALLBACK_RELAX_THRESHOLD
+#define SURROGATE_SCREENING 0
+#define PRIOR_SAMPLING SMC_QMC_NONE
 
 #define X_DATA_FILENAME "x.csv"
 #define Y_DATA_FILENAME "y.csv"
+#define SUMMARY_FILE_NAME "summary.csv"
+#define N_HISTOGRAM_BINS 50
+#define GENERATION_FILE_NAME "generation_%d.csv"
+#define COMPRESS_OUTPUT 0
+#define POPULATION_FILE_NAME "population.csv"
+#define N_REPLICATES 1
+#define REPLICATE_THREADS 0
+#define REPLICATE_FILE_NAME "replicates.csv"
+#define N_DATA_SAVED 30
 
 // Global variables
 /*Define the distance threshold for every round of SMC*/
@@ -47,11 +143,21 @@ double distance_threshold_schedule[] = {7.0, 6.375, 5.75, 5.125, 4.5, 3.875,
 	3.25, 2.625, 2.0};
 int N_ROUNDS_SMC = (int)(sizeof(distance_threshold_schedule) / sizeof(double));
 
+/*Thresholds of the rounds updating a saved posterior with new data*/
+double update_threshold_schedule[] = {2.0, 2.0, 2.0};
 
-#include "smc.h"
+
+#include "smc_engine.h"
+#include "smc_io.h"
+#include "smc_writer.h"
+#include "smc_batch.h"
+#include "smc_replicates.h"
 #include "lin_reg.h"
 
 //#define DEBUG_MODE
+//#define SUMMARY_ONLY
+//#define WRITE_EACH_ROUND
+//#define UPDATE_POSTERIOR
 
 int main(int argc, char *argv[]) {
 
@@ -61,12 +167,6 @@ int main(int argc, char *argv[]) {
 	printf("\n");
 #endif
 
-/* set up GSL RNG */
-gsl_rng *r = gsl_rng_alloc(gsl_rng_mt19937);
-/* end of GSL setup */
-
-gsl_rng_set(r, SEED);
-
 /////////////////////////
 /*Read data*/
 /////////////////////////
@@ -78,7 +178,7 @@ data_pointer_y = fopen(Y_DATA_FILENAME, "r");
 
 double data_x[N_DATA];
 double data_y[N_DATA];
-int i, j, read_error_status_x, read_error_status_y;
+int i, read_error_status_x, read_error_status_y;
 for (i=0; i < N_DATA; i++){
 	read_error_status_x = fscanf(data_pointer_x, "%lf\n", &data_x[i]);
 	read_error_status_y = fscanf(data_pointer_y, "%lf\n", &data_y[i]);
@@ -90,138 +190,142 @@ if (read_error_status_y != 1){printf("Error reading Y data\n"); return 0;}
 /*Initialise variables*/
 /////////////////////////
 
+lin_reg_params params = {
+	N_DATA, data_x, data_y,
+	{PRIOR_GRADIENT_LOWER, PRIOR_INTERCEPT_LOWER, PRIOR_SIGMA_LOWER},
+	{PRIOR_GRADIENT_UPPER, PRIOR_INTERCEPT_UPPER, PRIOR_SIGMA_UPPER},
+	{KERNEL_SD_GRADIENT, KERNEL_SD_INTERCEPT, KERNEL_SD_SIGMA}
+};
+
 /*Fit a linear model to the data, which will be used as summary statistics of
 the data*/
-double gradient_fit_data, intercept_fit_data, sigma_fit_data, cov00, cov01, cov11, sumsq;
-int gsl_fit_return_value;
-gsl_fit_return_value = gsl_fit_linear(data_x, 1, data_y, 1, N_DATA,
-																			&intercept_fit_data, &gradient_fit_data,
-																			&cov00, &cov01, &cov11, &sumsq);
-if (gsl_fit_return_value != 0) {printf("Fit failed.\n"); return -1;}
-sigma_fit_data = sqrt(sumsq/(N_DATA-2));
+#ifdef UPDATE_POSTERIOR
+	/*Fit the saved observations, then update the fit with the new ones*/
+	params.n_data = N_DATA_SAVED;
+	if (lin_reg_fit_data(&params) != 0) {printf("Fit failed.\n"); return -1;}
+	if (lin_reg_append_data(&params, N_DATA - N_DATA_SAVED) != 0) {
+		printf("Fit failed.\n");
+		return -1;
+	}
+#else
+	if (lin_reg_fit_data(&params) != 0) {printf("Fit failed.\n"); return -1;}
+#endif
 
 #ifndef DEBUG_MODE
-	printf("gradient ML = %.8f\n", gradient_fit_data);
-	printf("intercept ML = %.8f\n", intercept_fit_data);
-	printf("sigma ML = %.8f\n", sigma_fit_data);
+	printf("gradient ML = %.8f\n", params.gradient_fit_data);
+	printf("intercept ML = %.8f\n", params.intercept_fit_data);
+	printf("sigma ML = %.8f\n", params.sigma_fit_data);
 #endif
 
+smc_model model = lin_reg_model(&params, LIN_REG_DISTANCE_ABS_RES);
+
+smc_settings settings = smc_default_settings();
+settings.n_particles = N_PARTICLES;
+settings.n_rounds = N_ROUNDS_SMC;
+settings.seed = SEED;
+settings.threshold_schedule = distance_threshold_schedule;
+settings.ess_resample_fraction = ESS_RESAMPLE_FRACTION;
+settings.posterior_tolerance = POSTERIOR_TOLERANCE;
+settings.inference_mode = INFERENCE_MODE;
+settings.n_simulations_per_particle = N_SIMULATIONS_PER_PARTICLE;
+settings.n_threads = N_THREADS;
+settings.numa_aware = NUMA_AWARE;
+settings.max_simulations_per_round = MAX_SIMULATIONS_PER_ROUND;
+settings.round_time_limit = ROUND_TIME_LIMIT;
+settings.budget_fallback = BUDGET_FALLBACK;
+settings.surrogate_screening = SURROGATE_SCREENING;
+settings.prior_sampling = PRIOR_SAMPLING;
+settings.n_histogram_bins = N_HISTOGRAM_BINS;
+settings.histogram_lower = params.prior_lower;
+settings.histogram_upper = params.prior_upper;
+#ifndef DEBUG_MODE
+	settings.verbose = 1;
+#endif
 
-
-/*Make a (N_PARAMETERS X N_ROUNDS_SMC X N_PARTICLES) array to store all
-particles at all rounds of SMC*/
-double*** theta_particle;
-theta_particle = (double***) malloc(N_PARAMETERS * sizeof(double**));
-for (i = 0; i < N_PARAMETERS; i++){
-	theta_particle[i] = (double**) malloc(N_ROUNDS_SMC * sizeof(double*));
-}
-for (i = 0; i < N_PARAMETERS; i++){
-	for (j = 0; j < N_ROUNDS_SMC; j++){
-		theta_particle[i][j] = (double*) malloc(N_PARTICLES * sizeof(double));
+#ifdef UPDATE_POSTERIOR
+	/*Start from the saved population, at the thresholds of an update*/
+	double *saved_theta, *saved_weight;
+	int n_saved;
+	if (read_population_from_csv(POPULATION_FILE_NAME, N_PARAMETERS, &n_saved,
+			&saved_theta, &saved_weight) != 0) {
+		return -1;
 	}
-}
-
-double *simulated_data = (double*) malloc(N_DATA * sizeof(double));
-double *distance = malloc(N_PARTICLES * sizeof(double));
-double **weight;
-weight = (double**) malloc(N_ROUNDS_SMC * sizeof(double*));
-for (i = 0; i < N_ROUNDS_SMC; i++) {
-	weight[i] = (double*) malloc(N_PARTICLES * sizeof(double));
-}
-
+	settings.initial_theta = saved_theta;
+	settings.initial_weight = saved_weight;
+	settings.n_initial = n_saved;
+	settings.threshold_schedule = update_threshold_schedule;
+	settings.n_rounds = (int)(sizeof(update_threshold_schedule) / sizeof(double));
+#endif
 
-double weight_normalizer = 0.0;
+#if N_REPLICATES == 1
+	smc_population *population = smc_population_alloc(&model, &settings);
+	if (population == NULL) return -1;
+#endif
 
-int time_smc=0; // an index of each round of SMC
-int param_index_chosen, prior_violated;
-int particle_index;
 /////////////////////////
 /*Perform ABC SMC*/
 /////////////////////////
 
-/*For every round of SMC*/
-for (time_smc = 0; time_smc < N_ROUNDS_SMC; time_smc++) {
-	#ifndef DEBUG_MODE
-		printf("Round %d of SMC\n", time_smc);
-	#endif
-
-	/*Draw or perturb a particle and compute distance*/
-	for (particle_index = 0; particle_index < N_PARTICLES; particle_index++) {
-		// reset distance of particle
-		distance[particle_index] = distance_threshold_schedule[time_smc] + 1.0;
-
-		while (distance[particle_index] > distance_threshold_schedule[time_smc]) {
-			if (time_smc == 0) {
-				// Sample from the prior
-				sample_prior(r, theta_particle, particle_index);
-			}
-			else{
-				/*Sample from the old weights*/
-				param_index_chosen = weighted_choice(r, weight[time_smc-1]);
-				if ((param_index_chosen < 0)||(param_index_chosen >= N_PARTICLES)) {
-					printf("Error in param_index_chosen\n");
-					printf("time_smc = %d\n", time_smc);
-					return -1;
-				}
-
-				perturb_particle(r, theta_particle, time_smc, param_index_chosen,
-												 particle_index);
-
-				// Check if prior support is 0
-				prior_violated = check_prior_violated(theta_particle, time_smc,
-																							particle_index);
-				if(prior_violated == 1) continue;
-			}
-
-			simulate_dataset(r, theta_particle, data_x, simulated_data, time_smc,
-											 particle_index);
-
-			distance[particle_index] = distance_metric_sum_abs_res(simulated_data, data_y);
-		}
+#ifdef WRITE_EACH_ROUND
+	smc_writer writer;
+	if (smc_writer_start(&writer, GENERATION_FILE_NAME, model.n_parameters,
+			N_PARTICLES, COMPRESS_OUTPUT) != 0) {
+		return -1;
 	}
+	smc_writer_attach(&writer, &settings);
+#endif
 
-	#ifndef DEBUG_MODE
-		printf("Particles sampled.\n");
-	#endif
-
-
-
-	/*Compute & Normalise weights. For uniform priors, and a uniform perturbation
-	kernel, all surviving particles are weighted identically as 1/N_PARTICLES.
-	Whilst seemingly inefficient, I keep this code here for clarity/generality.
-	The bottleneck in computation time is the while loop above.*/
-	if (time_smc==0){ for (i = 0; i < N_PARTICLES; i++) weight[0][i] = 1.0;}
-	else{
-		weight_normalizer = 0.0;
-		for (particle_index = 0; particle_index < N_PARTICLES; particle_index++) {
-			// kernel_pdf is uniform, so is independent of the parameters
-			weight_normalizer +=  weight[time_smc-1][particle_index]*kernel_pdf();
-		}
-		for (particle_index = 0; particle_index < N_PARTICLES; particle_index++) {
-			weight[time_smc][particle_index] = prior_pdf(theta_particle, time_smc,
-																				 particle_index)/weight_normalizer;
-		}
-	}
-	weight_normalizer = 0.0;
-	for (i = 0; i < N_PARTICLES; i++)	weight_normalizer += weight[time_smc][i];
-	for (i = 0; i < N_PARTICLES; i++){
-		weight[time_smc][i] = weight[time_smc][i]/weight_normalizer;
+#if N_REPLICATES > 1
+	smc_replicates replicates;
+	if (smc_run_replicates(&replicates, &model, &settings, N_REPLICATES,
+			REPLICATE_THREADS, settings.verbose) != 0) {
+		return -1;
 	}
+	smc_population *population = replicates.job[0].population;
+#else
+	if (smc_run(&model, &settings, population) != 0) return -1;
+#endif
 
+#ifdef WRITE_EACH_ROUND
+	if (smc_writer_finish(&writer) != 0) return -1;
+#endif
 
-}
-
+#ifndef SUMMARY_ONLY
 #ifndef DEBUG_MODE
 	printf("Writing particles to file\n");
 #endif
-	write_particles_to_csv(theta_particle);
+	write_particles_to_csv(population, "particle_%d.csv");
 
 char weight_filename[] = "weights.csv";
-write_2d_double_array_to_csv(weight, N_ROUNDS_SMC, N_PARTICLES, weight_filename);
+write_2d_double_array_to_csv(population->weight, population->n_rounds_completed,
+	N_PARTICLES, weight_filename);
+#endif
+write_summaries_to_csv(population, SUMMARY_FILE_NAME);
+#if N_REPLICATES > 1
+	write_replicates_to_csv(&replicates, REPLICATE_FILE_NAME);
+	if (write_population_round_to_csv(replicates.pooled, 0,
+			POPULATION_FILE_NAME) != 0) {
+		return -1;
+	}
+#else
+	if (write_population_round_to_csv(population,
+			population->n_rounds_completed - 1, POPULATION_FILE_NAME) != 0) {
+		return -1;
+	}
+#endif
 
 #ifndef DEBUG_MODE
 	printf("Done!\n");
 #endif
 
+#if N_REPLICATES > 1
+	smc_replicates_free(&replicates);
+#else
+	smc_population_free(population);
+#endif
+#ifdef UPDATE_POSTERIOR
+	free(saved_theta);
+	free(saved_weight);
+#endif
 return 0; //return from main
 } //close main
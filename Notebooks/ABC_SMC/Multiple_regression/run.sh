@@ -0,0 +1,5 @@
+#!/usr/bin/env bash
+set -e
+gcc -Wall -O3 -pthread -I/home/juvid/gsl-2.5/include -I../engine -c smc.c
+gcc -pthread -L/home/juvid/gsl/lib smc.o -lgsl -lgslcblas -lm -o smc.ce
+./smc.ce
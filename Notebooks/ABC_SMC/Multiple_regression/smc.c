@@ -0,0 +1,229 @@
+/*
+Performing approximate Bayesian computation sequential Monte Carlo (Toni et al.
+2009) for multiple linear regression, on the prostate cancer data of
+Data/prostate.csv: the log prostate-specific antigen (lpsa) regressed on the
+N_PREDICTORS clinical measurements before it.
+
+Each predictor is standardised to zero mean and unit variance, so that every
+coefficient shares the prior [PRIOR_COEFFICIENT_LOWER, PRIOR_COEFFICIENT_UPPER]
+and the intercept is the mean lpsa.
+
+This script writes particle_<k>.csv for each parameter k, where each row
+corresponds to a particle and each column corresponds to a round of SMC, and
+summary.csv, with the ESS, threshold, weighted mean, variance, quantiles and a
+fixed-bin histogram of every parameter at every round. At most N_ROUNDS_SMC
+rounds are run; the run ends early once the threshold decreases by less than
+THRESHOLD_TOLERANCE (relative), or the posterior mean, spread and quantiles move
+by less than POSTERIOR_TOLERANCE posterior standard deviations, between rounds.
+Defining #SUMMARY_ONLY skips writing the full particle history.
+
+The distance between a simulated dataset and the data is the difference between
+their least-squares fits (LIN_REG_MULTI_DISTANCE_SUM_STATS), one dimension per
+parameter. By default the dimensions are reduced to one, scaled by
+N_PILOT_SIMULATIONS pilot simulations from the prior (DISTANCE_SCALING, see
+../engine/smc_scaling.h), whose threshold is set each round to keep about
+TARGET_ACCEPTANCE_RATE of simulations accepted. With DISTANCE_SCALING as
+SMC_SCALING_NONE, each dimension has its own threshold instead.
+
+The engine simulates LIN_REG_MULTI_BLOCK proposals at a time as one matrix
+product (see ../engine/lin_reg_multi.h). Each round is sampled by N_THREADS
+threads. Runs with more than one thread are not reproducible from SEED.
+
+Defining #DEBUG_MODE will silence all writing to stdout.
+
+Parameter ordering convention:
+0, ..., N_PREDICTORS - 1 - the coefficient of each predictor, in the order of
+	predictor_columns
+N_PREDICTORS - intercept
+N_PREDICTORS + 1 - standard deviation
+
+The model itself lives in ../engine/lin_reg_multi.h, and the SMC loop in
+../engine/smc_engine.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_sort_double.h>
+#include <gsl/gsl_statistics.h>
+
+
+#define N_PREDICTORS 8
+#define N_PARAMETERS (N_PREDICTORS + 2)
+
+#define N_PARTICLES 2000
+#define N_ROUNDS_SMC 30
+
+#define PRIOR_COEFFICIENT_LOWER -2.0
+#define PRIOR_INTERCEPT_LOWER 0.0
+#define PRIOR_SIGMA_LOWER 0.0
+
+#define PRIOR_COEFFICIENT_UPPER 2.0
+#define PRIOR_INTERCEPT_UPPER 5.0
+#define PRIOR_SIGMA_UPPER 3.0
+
+#define KERNEL_WIDTH_COEFFICIENT 0.1
+#define KERNEL_WIDTH_INTERCEPT 0.1
+#define KERNEL_WIDTH_SIGMA 0.1
+
+#define ESS_RESAMPLE_FRACTION 0.5
+#define THRESHOLD_TOLERANCE 0.01
+#define POSTERIOR_TOLERANCE 0.01
+#define QUANTILE_ACCEPT_DISTANCE 0.8
+#define TARGET_ACCEPTANCE_RATE 0.05
+
+#define SEED 1
+#define N_THREADS 1
+#define DISTANCE_SCALING SMC_SCALING_MAHALANOBIS
+#define N_PILOT_SIMULATIONS 2000
+#define PILOT_SEED 1000
+#define DISTANCE_THRESHOLD_INIT_SCALED 10.0
+#define DISTANCE_THRESHOLD_INIT 2.0
+
+#define DATA_FILE_NAME "../../../Data/prostate.csv"
+#define DATA_DELIMITER '\t'
+#define SUMMARY_FILE_NAME "summary.csv"
+#define N_HISTOGRAM_BINS 50
+
+/*Columns of the data file: lcavol, lweight, age, lbph, svi, lcp, gleason and
+pgg45, then the response lpsa*/
+int data_columns[] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+
+//#define DEBUG_MODE
+//#define SUMMARY_ONLY
+
+#include "smc_engine.h"
+#include "smc_io.h"
+#include "smc_scaling.h"
+#include "lin_reg_multi.h"
+
+int main(int argc, char *argv[]) {
+
+/////////////////////////
+/*Read data*/
+/////////////////////////
+
+double *table;
+int n_data, i, k;
+if (read_table_columns(DATA_FILE_NAME, DATA_DELIMITER, N_PREDICTORS + 1,
+		data_columns, &n_data, &table) != 0) {
+	return -1;
+}
+
+/*Standardise each predictor*/
+double *data_x = malloc((size_t)n_data * N_PREDICTORS * sizeof(double));
+double *data_y = malloc(n_data * sizeof(double));
+double mean, sd;
+if ((data_x == NULL) || (data_y == NULL)) {printf("Error allocating data\n"); return -1;}
+for (k = 0; k < N_PREDICTORS; k++) {
+	mean = gsl_stats_mean(table + k, N_PREDICTORS + 1, n_data);
+	sd = gsl_stats_sd_m(table + k, N_PREDICTORS + 1, n_data, mean);
+	for (i = 0; i < n_data; i++) {
+		data_x[i*N_PREDICTORS + k] = (table[i*(N_PREDICTORS + 1) + k] - mean)/sd;
+	}
+}
+for (i = 0; i < n_data; i++) data_y[i] = table[i*(N_PREDICTORS + 1) + N_PREDICTORS];
+free(table);
+
+/////////////////////////
+/*Initialise variables*/
+/////////////////////////
+
+double prior_lower[N_PARAMETERS], prior_upper[N_PARAMETERS];
+double kernel_width[N_PARAMETERS];
+for (k = 0; k < N_PREDICTORS; k++) {
+	prior_lower[k] = PRIOR_COEFFICIENT_LOWER;
+	prior_upper[k] = PRIOR_COEFFICIENT_UPPER;
+	kernel_width[k] = KERNEL_WIDTH_COEFFICIENT;
+}
+prior_lower[N_PREDICTORS] = PRIOR_INTERCEPT_LOWER;
+prior_upper[N_PREDICTORS] = PRIOR_INTERCEPT_UPPER;
+kernel_width[N_PREDICTORS] = KERNEL_WIDTH_INTERCEPT;
+prior_lower[N_PREDICTORS + 1] = PRIOR_SIGMA_LOWER;
+prior_upper[N_PREDICTORS + 1] = PRIOR_SIGMA_UPPER;
+kernel_width[N_PREDICTORS + 1] = KERNEL_WIDTH_SIGMA;
+
+lin_reg_multi_params params = {
+	n_data, N_PREDICTORS, data_x, data_y, prior_lower, prior_upper, kernel_width
+};
+
+/*Fit a linear model to the data, which will be used as summary statistics of
+the data*/
+if (lin_reg_multi_fit_data(&params) != 0) return -1;
+
+#ifndef DEBUG_MODE
+	printf("%d observations, least-squares fit:\n", n_data);
+	print_double_array(params.observed_summary, N_PARAMETERS);
+	printf("\n");
+#endif
+
+smc_model lr_model = lin_reg_multi_model(&params,
+	LIN_REG_MULTI_DISTANCE_SUM_STATS);
+smc_model model = lr_model;
+
+double distance_threshold_init[N_PARAMETERS];
+double distance_threshold_init_scaled[] = {DISTANCE_THRESHOLD_INIT_SCALED};
+for (k = 0; k < N_PARAMETERS; k++) {
+	distance_threshold_init[k] = DISTANCE_THRESHOLD_INIT;
+}
+
+/*Reduce the distances to one, scaled by pilot simulations*/
+smc_scaled_distance scaled;
+if (DISTANCE_SCALING != SMC_SCALING_NONE) {
+	if (smc_scaled_distance_init(&scaled, &lr_model, DISTANCE_SCALING,
+			N_PILOT_SIMULATIONS, PILOT_SEED) != 0) {
+		return -1;
+	}
+	model = smc_scaled_model(&scaled);
+}
+
+smc_settings settings = smc_default_settings();
+settings.n_particles = N_PARTICLES;
+settings.n_rounds = N_ROUNDS_SMC;
+settings.seed = SEED;
+settings.threshold_init = (DISTANCE_SCALING != SMC_SCALING_NONE) ?
+	distance_threshold_init_scaled : distance_threshold_init;
+settings.quantile_accept_distance = QUANTILE_ACCEPT_DISTANCE;
+settings.target_acceptance_rate = TARGET_ACCEPTANCE_RATE;
+settings.ess_resample_fraction = ESS_RESAMPLE_FRACTION;
+settings.threshold_tolerance = THRESHOLD_TOLERANCE;
+settings.posterior_tolerance = POSTERIOR_TOLERANCE;
+settings.n_threads = N_THREADS;
+settings.n_histogram_bins = N_HISTOGRAM_BINS;
+settings.histogram_lower = prior_lower;
+settings.histogram_upper = prior_upper;
+#ifndef DEBUG_MODE
+	settings.verbose = 1;
+#endif
+
+smc_population *population = smc_population_alloc(&model, &settings);
+if (population == NULL) return -1;
+
+/////////////////////////
+/*Perform ABC SMC*/
+/////////////////////////
+
+if (smc_run(&model, &settings, population) != 0) return -1;
+
+#ifndef SUMMARY_ONLY
+#ifndef DEBUG_MODE
+	printf("Writing particles to file\n");
+#endif
+	write_particles_to_csv(population, "particle_%d.csv");
+#endif
+write_summaries_to_csv(population, SUMMARY_FILE_NAME);
+
+#ifndef DEBUG_MODE
+	printf("Done!\n");
+#endif
+
+smc_population_free(population);
+if (DISTANCE_SCALING != SMC_SCALING_NONE) smc_scaled_distance_free(&scaled);
+lin_reg_multi_free(&params);
+free(data_x);
+free(data_y);
+return 0; //return from main
+} //close main
@@ -0,0 +1,211 @@
+/*
+Serving approximate Bayesian computation sequential Monte Carlo (Toni et al.
+2009) jobs from a long-running process.
+
+Usage: `./smc.ce [SOCKET_PATH]`. The server reads the beta-binomial datasets in
+BB_DATA_PATH and the linear regression datasets in LR_DATA_PATH (directories or
+stacked files, see ../engine/smc_datasets.h), builds their models once, and
+then answers requests on the Unix socket SOCKET_PATH with N_WORKERS jobs at a
+time (0 for one per processor). A dataset is referred to by its model,
+beta_binomial or lin_reg, and its name: its file name, or its label in a stacked
+file. For example
+
+	echo "run model=beta_binomial data=binom_data.csv n_particles=2000 seed=3" |
+		socat - UNIX-CONNECT:abc_smc.sock
+
+streams the progress of each round, then the summary csv of the run. The
+request protocol and the settings a request may override are described in
+../engine/smc_server.h. Settings not given take the values defined below.
+`echo datasets | socat - UNIX-CONNECT:abc_smc.sock` lists the datasets, and
+`shutdown`, SIGINT or SIGTERM stop the server once its queued jobs are done.
+
+Defining #DEBUG_MODE will silence all writing to stdout.
+
+Author: Juvid Aryaman
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <signal.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_sort_double.h>
+#include <gsl/gsl_statistics.h>
+#include <gsl/gsl_fit.h>
+
+#define SOCKET_PATH "abc_smc.sock"
+#define BB_DATA_PATH "datasets/beta_binomial"
+#define LR_DATA_PATH "datasets/lin_reg"
+#define N_WORKERS 0
+
+/*Beta-binomial model*/
+#define N_TRUTH 10
+#define PRIOR_ALPHA 0.5
+#define PRIOR_BETA 0.5
+#define KERNEL_SD 0.05
+#define DISTANCE_THRESHOLD_INIT_BB 10
+
+/*Linear regression, with the mean absolute residual distance*/
+#define PRIOR_GRADIENT_LOWER 0.0
+#define PRIOR_INTERCEPT_LOWER 3.0
+#define PRIOR_SIGMA_LOWER 0.0
+#define PRIOR_GRADIENT_UPPER 10.0
+#define PRIOR_INTERCEPT_UPPER 500.0
+#define PRIOR_SIGMA_UPPER 10.0
+#define KERNEL_SD_GRADIENT 0.05
+#define KERNEL_SD_INTERCEPT 5.0
+#define KERNEL_SD_SIGMA 0.1
+#define DISTANCE_THRESHOLD_INIT_LR 7.0
+
+/*Defaults of every request*/
+#define N_PARTICLES 2000
+#define N_ROUNDS_SMC 50
+#define QUANTILE_ACCEPT_DISTANCE 0.8
+#define ESS_RESAMPLE_FRACTION 0.5
+#define THRESHOLD_TOLERANCE 0.01
+#define POSTERIOR_TOLERANCE 0.01
+#define SEED 1
+#define N_HISTOGRAM_BINS 50
+
+//#define DEBUG_MODE
+
+#include "smc_engine.h"
+#include "smc_io.h"
+#include "smc_datasets.h"
+#include "smc_batch.h"
+#include "smc_server.h"
+#include "beta_binomial.h"
+#include "lin_reg.h"
+
+smc_server server;
+
+void stop_server(int signal_number){
+	/*Stop the server on SIGINT or SIGTERM*/
+	smc_server_stop(&server);
+}
+
+int main(int argc, char *argv[]) {
+
+/////////////////////////
+/*Preload data and build models*/
+/////////////////////////
+
+const char *socket_path = (argc > 1) ? argv[1] : SOCKET_PATH;
+int n_bb = 0, n_lr = 0, i, j;
+smc_dataset *bb_datasets = read_datasets(BB_DATA_PATH, 1, &n_bb);
+smc_dataset *lr_datasets = read_datasets(LR_DATA_PATH, 2, &n_lr);
+if (bb_datasets == NULL) n_bb = 0;
+if (lr_datasets == NULL) n_lr = 0;
+if (n_bb + n_lr == 0) {printf("No datasets to serve\n"); return -1;}
+
+beta_binomial_params *bb_params = calloc(n_bb + 1, sizeof(beta_binomial_params));
+lin_reg_params *lr_params = calloc(n_lr + 1, sizeof(lin_reg_params));
+server.dataset = calloc(n_bb + n_lr, sizeof(smc_server_dataset));
+if ((bb_params == NULL) || (lr_params == NULL) || (server.dataset == NULL)) {
+	printf("Error allocating server\n");
+	return -1;
+}
+
+double distance_threshold_init_bb[] = {DISTANCE_THRESHOLD_INIT_BB};
+double distance_threshold_init_lr[] = {DISTANCE_THRESHOLD_INIT_LR};
+double histogram_lower_bb[] = {0.0};
+double histogram_upper_bb[] = {1.0};
+lin_reg_params lr_defaults = {0, NULL, NULL,
+	{PRIOR_GRADIENT_LOWER, PRIOR_INTERCEPT_LOWER, PRIOR_SIGMA_LOWER},
+	{PRIOR_GRADIENT_UPPER, PRIOR_INTERCEPT_UPPER, PRIOR_SIGMA_UPPER},
+	{KERNEL_SD_GRADIENT, KERNEL_SD_INTERCEPT, KERNEL_SD_SIGMA}
+};
+smc_server_dataset *dataset;
+
+server.n_datasets = 0;
+for (i = 0; i < n_bb; i++) {
+	bb_params[i].n_data = bb_datasets[i].n_rows;
+	bb_params[i].data = malloc(bb_datasets[i].n_rows * sizeof(int));
+	if (bb_params[i].data == NULL) {printf("Error allocating server\n"); return -1;}
+	for (j = 0; j < bb_datasets[i].n_rows; j++) {
+		bb_params[i].data[j] = (int)bb_datasets[i].values[j];
+	}
+	bb_params[i].n_truth = N_TRUTH;
+	bb_params[i].prior_alpha = PRIOR_ALPHA;
+	bb_params[i].prior_beta = PRIOR_BETA;
+	bb_params[i].kernel_sd = KERNEL_SD;
+
+	dataset = &server.dataset[server.n_datasets++];
+	snprintf(dataset->model_name, SMC_SERVER_NAME_LENGTH, "beta_binomial");
+	snprintf(dataset->name, DATASET_NAME_LENGTH, "%s", bb_datasets[i].name);
+	dataset->n_data = bb_datasets[i].n_rows;
+	dataset->model = beta_binomial_model(&bb_params[i]);
+	dataset->threshold_init = distance_threshold_init_bb;
+	dataset->histogram_lower = histogram_lower_bb;
+	dataset->histogram_upper = histogram_upper_bb;
+}
+for (i = 0; i < n_lr; i++) {
+	/*Split the rows x,y into the x and y arrays the model reads*/
+	lr_params[i] = lr_defaults;
+	lr_params[i].n_data = lr_datasets[i].n_rows;
+	lr_params[i].data_x = malloc(lr_datasets[i].n_rows * 2 * sizeof(double));
+	if (lr_params[i].data_x == NULL) {printf("Error allocating server\n"); return -1;}
+	lr_params[i].data_y = lr_params[i].data_x + lr_datasets[i].n_rows;
+	for (j = 0; j < lr_datasets[i].n_rows; j++) {
+		lr_params[i].data_x[j] = lr_datasets[i].values[2*j];
+		lr_params[i].data_y[j] = lr_datasets[i].values[2*j + 1];
+	}
+	if ((lr_datasets[i].n_rows < 3) || (lin_reg_fit_data(&lr_params[i]) != 0)) {
+		printf("Fit failed for dataset %s, not serving it\n", lr_datasets[i].name);
+		continue;
+	}
+
+	dataset = &server.dataset[server.n_datasets++];
+	snprintf(dataset->model_name, SMC_SERVER_NAME_LENGTH, "lin_reg");
+	snprintf(dataset->name, DATASET_NAME_LENGTH, "%s", lr_datasets[i].name);
+	dataset->n_data = lr_datasets[i].n_rows;
+	dataset->model = lin_reg_model(&lr_params[i], LIN_REG_DISTANCE_ABS_RES);
+	dataset->threshold_init = distance_threshold_init_lr;
+	dataset->histogram_lower = lr_params[i].prior_lower;
+	dataset->histogram_upper = lr_params[i].prior_upper;
+}
+
+server.defaults = smc_default_settings();
+server.defaults.n_particles = N_PARTICLES;
+server.defaults.n_rounds = N_ROUNDS_SMC;
+server.defaults.seed = SEED;
+server.defaults.quantile_accept_distance = QUANTILE_ACCEPT_DISTANCE;
+server.defaults.ess_resample_fraction = ESS_RESAMPLE_FRACTION;
+server.defaults.threshold_tolerance = THRESHOLD_TOLERANCE;
+server.defaults.posterior_tolerance = POSTERIOR_TOLERANCE;
+server.defaults.n_histogram_bins = N_HISTOGRAM_BINS;
+
+/////////////////////////
+/*Serve requests*/
+/////////////////////////
+
+if (smc_server_start(&server, socket_path, N_WORKERS) != 0) return -1;
+struct sigaction action;
+memset(&action, 0, sizeof(action));
+action.sa_handler = stop_server;
+sigaction(SIGINT, &action, NULL);
+sigaction(SIGTERM, &action, NULL);
+
+#ifndef DEBUG_MODE
+	printf("Serving %d datasets on %s with %d workers\n", server.n_datasets,
+		socket_path, server.n_workers);
+	fflush(stdout);
+#endif
+
+int status = smc_server_serve(&server);
+
+#ifndef DEBUG_MODE
+	printf("Done!\n");
+#endif
+
+for (i = 0; i < n_bb; i++) free(bb_params[i].data);
+for (i = 0; i < n_lr; i++) free(lr_params[i].data_x);
+free(bb_params);
+free(lr_params);
+free(server.dataset);
+free_datasets(bb_datasets, n_bb);
+free_datasets(lr_datasets, n_lr);
+return status; //return from main
+} //close main
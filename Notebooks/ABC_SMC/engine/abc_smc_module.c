@@ -0,0 +1,639 @@
+/*
+A Python extension module, abc_smc, which runs the ABC SMC engine in-process.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('../engine')
+	import abc_smc
+	result = abc_smc.run_beta_binomial(data, n_particles=5000, seed=1)
+	result['theta'] # (n_parameters X n_rounds X n_particles)
+
+Observed data is read directly from the NumPy buffers passed in when they are
+C-contiguous arrays of the expected type (int32 for the beta-binomial model,
+float64 for linear regression); anything else is converted once. The arrays
+returned (theta, weight, threshold, ess, n_simulations, n_screened, n_accepted,
+fallback) are views of the memory
+of the engine's smc_population, which is freed once every view has been garbage
+collected.
+
+The GIL is released while the engine runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "smc_engine.h"
+#include "beta_binomial.h"
+#include "lin_reg.h"
+
+#define POPULATION_CAPSULE_NAME "abc_smc.population"
+
+void population_capsule_destructor(PyObject *capsule){
+	/*Free the smc_population owned by a capsule*/
+	smc_population_free((smc_population*)PyCapsule_GetPointer(capsule,
+		POPULATION_CAPSULE_NAME));
+}
+
+PyObject *population_view(PyObject *capsule, void *data, int type_num, int nd,
+	npy_intp *shape, npy_intp *strides){
+	/*A NumPy array viewing data owned by capsule, which the array keeps alive*/
+	PyObject *array = PyArray_New(&PyArray_Type, nd, shape, type_num, strides,
+		data, 0, NPY_ARRAY_ALIGNED | NPY_ARRAY_WRITEABLE, NULL);
+	if (array == NULL) return NULL;
+	Py_INCREF(capsule);
+	if (PyArray_SetBaseObject((PyArrayObject*)array, capsule) != 0) {
+		Py_DECREF(array);
+		return NULL;
+	}
+	return array;
+}
+
+PyObject *population_to_dict(smc_population *population){
+	/*Wrap a completed smc_population in a dict of NumPy views, taking ownership
+	of it*/
+	int n_rounds = population->n_rounds;
+	int n_completed = population->n_rounds_completed;
+	int n_particles = population->n_particles;
+	npy_intp shape[3], strides[3];
+	PyObject *result, *capsule, *array;
+
+	capsule = PyCapsule_New(population, POPULATION_CAPSULE_NAME,
+		population_capsule_destructor);
+	if (capsule == NULL) {
+		smc_population_free(population);
+		return NULL;
+	}
+	result = PyDict_New();
+	if (result == NULL) {
+		Py_DECREF(capsule);
+		return NULL;
+	}
+
+	shape[0] = population->n_parameters;
+	shape[1] = n_completed;
+	shape[2] = n_particles;
+	strides[0] = (npy_intp)n_rounds*n_particles*sizeof(double);
+	strides[1] = (npy_intp)n_particles*sizeof(double);
+	strides[2] = sizeof(double);
+	array = population_view(capsule, population->theta_block, NPY_DOUBLE, 3,
+		shape, strides);
+	if ((array == NULL) || (PyDict_SetItemString(result, "theta", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	array = population_view(capsule, population->weight_block, NPY_DOUBLE, 2,
+		shape + 1, strides + 1);
+	if ((array == NULL) || (PyDict_SetItemString(result, "weight", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	shape[0] = population->n_distances;
+	shape[1] = n_completed;
+	strides[0] = (npy_intp)n_rounds*sizeof(double);
+	strides[1] = sizeof(double);
+	array = population_view(capsule, population->threshold_block, NPY_DOUBLE, 2,
+		shape, strides);
+	if ((array == NULL) || (PyDict_SetItemString(result, "threshold", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	array = population_view(capsule, population->ess, NPY_DOUBLE, 1, shape + 1,
+		strides + 1);
+	if ((array == NULL) || (PyDict_SetItemString(result, "ess", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	strides[1] = sizeof(long);
+	array = population_view(capsule, population->n_simulations, NPY_LONG, 1,
+		shape + 1, strides + 1);
+	if ((array == NULL) || (PyDict_SetItemString(result, "n_simulations", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	array = population_view(capsule, population->n_screened, NPY_LONG, 1,
+		shape + 1, strides + 1);
+	if ((array == NULL) || (PyDict_SetItemString(result, "n_screened", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	strides[1] = sizeof(int);
+	array = population_view(capsule, population->n_accepted, NPY_INT, 1,
+		shape + 1, strides + 1);
+	if ((array == NULL) || (PyDict_SetItemString(result, "n_accepted", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	array = population_view(capsule, population->fallback, NPY_INT, 1,
+		shape + 1, strides + 1);
+	if ((array == NULL) || (PyDict_SetItemString(result, "fallback", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	array = PyLong_FromLong(population->stop_reason);
+	if ((array == NULL) || (PyDict_SetItemString(result, "stop_reason", array) != 0)) goto fail;
+	Py_DECREF(array);
+
+	Py_DECREF(capsule);
+	return result;
+
+fail:
+	Py_XDECREF(array);
+	Py_DECREF(result);
+	Py_DECREF(capsule);
+	return NULL;
+}
+
+int parse_double_vector(PyObject *object, double *out, int n, const char *name){
+	/*Copy a sequence of n numbers into out. None leaves out unchanged.
+
+	Returns
+	----------------
+	0 on success, -1 with a Python exception set otherwise
+	*/
+	PyArrayObject *array;
+	int i;
+	if ((object == NULL) || (object == Py_None)) return 0;
+	array = (PyArrayObject*)PyArray_FROMANY(object, NPY_DOUBLE, 0, 1,
+		NPY_ARRAY_IN_ARRAY);
+	if (array == NULL) return -1;
+	if (PyArray_SIZE(array) != n) {
+		PyErr_Format(PyExc_ValueError, "%s must have %d element(s)", name, n);
+		Py_DECREF(array);
+		return -1;
+	}
+	for (i = 0; i < n; i++) out[i] = ((double*)PyArray_DATA(array))[i];
+	Py_DECREF(array);
+	return 0;
+}
+
+int parse_initial_population(PyObject *theta_object, PyObject *weight_object,
+	int n_parameters, smc_settings *settings, double **initial_theta,
+	double **initial_weight){
+	/*Set the population round 0 is proposed from, as the theta of one round of
+	a result, (n_parameters X n_particles), and its weights (uniform if None).
+	None leaves round 0 drawn from the prior. The copies made are returned in
+	initial_theta and initial_weight, for the caller to free.
+
+	Returns
+	----------------
+	0 on success, -1 with a Python exception set otherwise
+	*/
+	PyArrayObject *theta, *weight = NULL;
+	npy_intp i, n;
+	int k;
+
+	*initial_theta = NULL;
+	*initial_weight = NULL;
+	if ((theta_object == NULL) || (theta_object == Py_None)) return 0;
+	theta = (PyArrayObject*)PyArray_FROMANY(theta_object, NPY_DOUBLE, 1, 2,
+		NPY_ARRAY_IN_ARRAY);
+	if (theta == NULL) return -1;
+	n = PyArray_SIZE(theta)/n_parameters;
+	if ((n < 1) || (PyArray_DIM(theta, 0) != ((PyArray_NDIM(theta) == 2) ?
+			n_parameters : n_parameters*n))) {
+		PyErr_Format(PyExc_ValueError,
+			"initial_theta must have shape (%d, n_particles)", n_parameters);
+		Py_DECREF(theta);
+		return -1;
+	}
+	if ((weight_object != NULL) && (weight_object != Py_None)) {
+		weight = (PyArrayObject*)PyArray_FROMANY(weight_object, NPY_DOUBLE, 1, 1,
+			NPY_ARRAY_IN_ARRAY);
+		if (weight == NULL) {Py_DECREF(theta); return -1;}
+		if (PyArray_SIZE(weight) != n) {
+			PyErr_SetString(PyExc_ValueError,
+				"initial_weight must have one weight per particle");
+			Py_DECREF(theta);
+			Py_DECREF(weight);
+			return -1;
+		}
+	}
+
+	*initial_theta = malloc((size_t)n * n_parameters * sizeof(double));
+	*initial_weight = malloc(n * sizeof(double));
+	if ((*initial_theta == NULL) || (*initial_weight == NULL)) {
+		free(*initial_theta);
+		free(*initial_weight);
+		*initial_theta = NULL;
+		*initial_weight = NULL;
+		Py_DECREF(theta);
+		Py_XDECREF(weight);
+		PyErr_NoMemory();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < n_parameters; k++) {
+			(*initial_theta)[i*n_parameters + k] =
+				((double*)PyArray_DATA(theta))[k*n + i];
+		}
+		(*initial_weight)[i] = (weight != NULL) ?
+			((double*)PyArray_DATA(weight))[i] : 1.0;
+	}
+	Py_DECREF(theta);
+	Py_XDECREF(weight);
+	settings->initial_theta = *initial_theta;
+	settings->initial_weight = *initial_weight;
+	settings->n_initial = (int)n;
+	return 0;
+}
+
+int parse_mode(const char *mode, int n_simulations_per_particle,
+	const smc_model *model, smc_settings *settings){
+	/*Set the inference mode and simulations per particle of settings from their
+	keyword arguments, raising ValueError and returning -1 if they are invalid*/
+	if (strcmp(mode, "rejection") == 0) {
+		settings->inference_mode = SMC_MODE_REJECTION;
+	}
+	else if (strcmp(mode, "averaged") == 0) {
+		settings->inference_mode = SMC_MODE_AVERAGED_ACCEPTANCE;
+	}
+	else if (strcmp(mode, "synthetic_likelihood") == 0) {
+		settings->inference_mode = SMC_MODE_SYNTHETIC_LIKELIHOOD;
+	}
+	else{
+		PyErr_SetString(PyExc_ValueError,
+			"mode must be 'rejection', 'averaged' or 'synthetic_likelihood'");
+		return -1;
+	}
+	settings->n_simulations_per_particle = n_simulations_per_particle;
+	if (n_simulations_per_particle < 1) {
+		PyErr_SetString(PyExc_ValueError,
+			"n_simulations_per_particle must be positive");
+		return -1;
+	}
+	if ((settings->inference_mode == SMC_MODE_SYNTHETIC_LIKELIHOOD) &&
+		(n_simulations_per_particle <= model->n_summaries)) {
+		PyErr_Format(PyExc_ValueError,
+			"synthetic likelihood needs more than %d simulations per particle",
+			model->n_summaries);
+		return -1;
+	}
+	return 0;
+}
+
+int parse_budget_fallback(const char *budget_fallback, smc_settings *settings){
+	/*Set the fallback of settings for rounds which run out of budget from its
+	keyword argument, raising ValueError and returning -1 if it is invalid*/
+	if (strcmp(budget_fallback, "relax") == 0) {
+		settings->budget_fallback = SMC_FALLBACK_RELAX_THRESHOLD;
+	}
+	else if (strcmp(budget_fallback, "shrink") == 0) {
+		settings->budget_fallback = SMC_FALLBACK_SHRINK_POPULATION;
+	}
+	else{
+		PyErr_SetString(PyExc_ValueError, "budget_fallback must be 'relax' or 'shrink'");
+		return -1;
+	}
+	return 0;
+}
+
+int parse_prior_sampling(const char *prior_sampling, smc_settings *settings){
+	/*Set how round 0 draws from the prior from its keyword argument, raising
+	ValueError and returning -1 if it is invalid*/
+	if (strcmp(prior_sampling, "random") == 0) {
+		settings->prior_sampling = SMC_QMC_NONE;
+	}
+	else if (strcmp(prior_sampling, "sobol") == 0) {
+		settings->prior_sampling = SMC_QMC_SOBOL;
+	}
+	else if (strcmp(prior_sampling, "halton") == 0) {
+		settings->prior_sampling = SMC_QMC_HALTON;
+	}
+	else{
+		PyErr_SetString(PyExc_ValueError,
+			"prior_sampling must be 'random', 'sobol' or 'halton'");
+		return -1;
+	}
+	return 0;
+}
+
+PyObject *run_model(smc_model *model, smc_settings *settings){
+	/*Run the engine with the GIL released and wrap the result*/
+	int status;
+	smc_population *population;
+	const char *error = smc_settings_error(model, settings);
+	if (error != NULL) {
+		PyErr_SetString(PyExc_ValueError, error);
+		return NULL;
+	}
+	population = smc_population_alloc(model, settings);
+	if (population == NULL) return PyErr_NoMemory();
+
+	Py_BEGIN_ALLOW_THREADS
+	status = smc_run(model, settings, population);
+	Py_END_ALLOW_THREADS
+
+	if (status != 0) {
+		smc_population_free(population);
+		PyErr_SetString(PyExc_RuntimeError, "ABC SMC failed");
+		return NULL;
+	}
+	return population_to_dict(population);
+}
+
+PyObject *abc_smc_run_beta_binomial(PyObject *self, PyObject *args,
+	PyObject *kwargs){
+	/*Run ABC SMC on the beta-binomial model, see the module docstring*/
+	static char *keywords[] = {"data", "n_truth", "prior_alpha", "prior_beta",
+		"kernel_sd", "n_particles", "n_rounds", "threshold_init",
+		"quantile_accept_distance", "seed", "ess_resample_fraction",
+		"threshold_tolerance", "posterior_tolerance", "mode",
+		"n_simulations_per_particle", "n_threads", "numa_aware",
+		"max_simulations_per_round", "round_time_limit", "budget_fallback",
+		"surrogate_screening", "prior_sampling", "initial_theta",
+		"initial_weight", "verbose", NULL};
+	PyObject *data_object;
+	PyObject *initial_theta_object = NULL, *initial_weight_object = NULL;
+	double *initial_theta, *initial_weight;
+	PyArrayObject *data;
+	PyObject *result;
+	double threshold_init = 10.0;
+	const char *mode = "rejection";
+	const char *budget_fallback = "relax";
+	const char *prior_sampling = "random";
+	int n_simulations_per_particle = 1;
+	beta_binomial_params params;
+	smc_model model;
+	smc_settings settings = smc_default_settings();
+	double histogram_lower[] = {0.0};
+	double histogram_upper[] = {1.0};
+	int i;
+
+	params.n_truth = 10;
+	params.prior_alpha = 0.5;
+	params.prior_beta = 0.5;
+	params.kernel_sd = 0.05;
+	settings.n_particles = 5000;
+	settings.n_rounds = 50;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|idddiiddkdddsiipldspsOOp",
+			keywords,
+			&data_object, &params.n_truth, &params.prior_alpha, &params.prior_beta,
+			&params.kernel_sd, &settings.n_particles, &settings.n_rounds,
+			&threshold_init, &settings.quantile_accept_distance, &settings.seed,
+			&settings.ess_resample_fraction, &settings.threshold_tolerance,
+			&settings.posterior_tolerance, &mode, &n_simulations_per_particle,
+			&settings.n_threads, &settings.numa_aware,
+			&settings.max_simulations_per_round, &settings.round_time_limit,
+			&budget_fallback, &settings.surrogate_screening, &prior_sampling,
+			&initial_theta_object, &initial_weight_object, &settings.verbose)) {
+		return NULL;
+	}
+	if ((settings.n_particles < 1) || (settings.n_rounds < 1)) {
+		PyErr_SetString(PyExc_ValueError, "n_particles and n_rounds must be positive");
+		return NULL;
+	}
+	if ((parse_budget_fallback(budget_fallback, &settings) != 0) ||
+		(parse_prior_sampling(prior_sampling, &settings) != 0)) {
+		return NULL;
+	}
+
+	data = (PyArrayObject*)PyArray_FROMANY(data_object, NPY_INT32, 1, 1,
+		NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+	if (data == NULL) return NULL;
+	params.n_data = (int)PyArray_SIZE(data);
+	params.data = (int*)PyArray_DATA(data);
+	if (params.n_data < 1) {
+		PyErr_SetString(PyExc_ValueError, "at least 1 observation is needed");
+		Py_DECREF(data);
+		return NULL;
+	}
+	for (i = 0; i < params.n_data; i++) {
+		if ((params.data[i] < 0) || (params.data[i] > params.n_truth)) {
+			PyErr_Format(PyExc_ValueError, "data must be counts between 0 and n_truth = %d",
+				params.n_truth);
+			Py_DECREF(data);
+			return NULL;
+		}
+	}
+
+	settings.threshold_init = &threshold_init;
+	settings.histogram_lower = histogram_lower;
+	settings.histogram_upper = histogram_upper;
+	model = beta_binomial_model(&params);
+
+	if ((parse_mode(mode, n_simulations_per_particle, &model, &settings) != 0) ||
+		(parse_initial_population(initial_theta_object, initial_weight_object,
+			model.n_parameters, &settings, &initial_theta, &initial_weight) != 0)) {
+		Py_DECREF(data);
+		return NULL;
+	}
+	result = run_model(&model, &settings);
+	Py_DECREF(data);
+	free(initial_theta);
+	free(initial_weight);
+	return result;
+}
+
+PyObject *abc_smc_run_lin_reg(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Run ABC SMC on the linear regression model, see the module docstring*/
+	static char *keywords[] = {"x", "y", "prior_lower", "prior_upper",
+		"kernel_width", "distance", "n_particles", "n_rounds", "schedule",
+		"threshold_init", "quantile_accept_distance", "seed",
+		"ess_resample_fraction", "threshold_tolerance", "posterior_tolerance",
+		"mode", "n_simulations_per_particle", "n_threads", "numa_aware",
+		"max_simulations_per_round", "round_time_limit", "budget_fallback",
+		"surrogate_screening", "prior_sampling", "initial_theta",
+		"initial_weight", "verbose", NULL};
+	PyObject *x_object, *y_object;
+	PyObject *initial_theta_object = NULL, *initial_weight_object = NULL;
+	double *initial_theta = NULL, *initial_weight = NULL;
+	PyObject *prior_lower = NULL, *prior_upper = NULL, *kernel_width = NULL;
+	PyObject *schedule_object = NULL, *threshold_init_object = NULL;
+	PyArrayObject *x = NULL, *y = NULL, *schedule = NULL;
+	PyObject *result = NULL;
+	const char *distance = "abs_res";
+	const char *mode = "rejection";
+	const char *budget_fallback = "relax";
+	const char *prior_sampling = "random";
+	int n_simulations_per_particle = 1;
+	double threshold_init[LIN_REG_N_PARAMETERS];
+	lin_reg_params params = {0, NULL, NULL,
+		{0.0, 3.0, 0.0}, {10.0, 500.0, 10.0}, {0.05, 5.0, 0.1}};
+	smc_model model;
+	smc_settings settings = smc_default_settings();
+	int i, distance_type;
+
+	settings.n_particles = 20000;
+	settings.n_rounds = 10;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OOOsiiOOdkdddsiipldspsOOp",
+			keywords, &x_object, &y_object, &prior_lower, &prior_upper,
+			&kernel_width, &distance, &settings.n_particles, &settings.n_rounds,
+			&schedule_object, &threshold_init_object,
+			&settings.quantile_accept_distance, &settings.seed,
+			&settings.ess_resample_fraction, &settings.threshold_tolerance,
+			&settings.posterior_tolerance, &mode, &n_simulations_per_particle,
+			&settings.n_threads, &settings.numa_aware,
+			&settings.max_simulations_per_round, &settings.round_time_limit,
+			&budget_fallback, &settings.surrogate_screening, &prior_sampling,
+			&initial_theta_object, &initial_weight_object, &settings.verbose)) {
+		return NULL;
+	}
+	if (strcmp(distance, "abs_res") == 0) distance_type = LIN_REG_DISTANCE_ABS_RES;
+	else if (strcmp(distance, "sum_stats_3d") == 0) {
+		distance_type = LIN_REG_DISTANCE_SUM_STATS_3D;
+	}
+	else{
+		PyErr_SetString(PyExc_ValueError,
+			"distance must be 'abs_res' or 'sum_stats_3d'");
+		return NULL;
+	}
+	if ((settings.n_particles < 1) || (settings.n_rounds < 1)) {
+		PyErr_SetString(PyExc_ValueError, "n_particles and n_rounds must be positive");
+		return NULL;
+	}
+	if ((parse_budget_fallback(budget_fallback, &settings) != 0) ||
+		(parse_prior_sampling(prior_sampling, &settings) != 0)) {
+		return NULL;
+	}
+	if ((parse_double_vector(prior_lower, params.prior_lower,
+			LIN_REG_N_PARAMETERS, "prior_lower") != 0) ||
+		(parse_double_vector(prior_upper, params.prior_upper,
+			LIN_REG_N_PARAMETERS, "prior_upper") != 0) ||
+		(parse_double_vector(kernel_width, params.kernel_width,
+			LIN_REG_N_PARAMETERS, "kernel_width") != 0)) {
+		return NULL;
+	}
+
+	x = (PyArrayObject*)PyArray_FROMANY(x_object, NPY_DOUBLE, 1, 1,
+		NPY_ARRAY_IN_ARRAY);
+	y = (PyArrayObject*)PyArray_FROMANY(y_object, NPY_DOUBLE, 1, 1,
+		NPY_ARRAY_IN_ARRAY);
+	if ((x == NULL) || (y == NULL)) goto done;
+	if (PyArray_SIZE(x) != PyArray_SIZE(y)) {
+		PyErr_SetString(PyExc_ValueError, "x and y must have the same length");
+		goto done;
+	}
+	params.n_data = (int)PyArray_SIZE(x);
+	params.data_x = (double*)PyArray_DATA(x);
+	params.data_y = (double*)PyArray_DATA(y);
+	if (params.n_data < 3) {
+		PyErr_SetString(PyExc_ValueError, "at least 3 observations are needed");
+		goto done;
+	}
+	if (lin_reg_fit_data(&params) != 0) {
+		PyErr_SetString(PyExc_RuntimeError, "Fit failed");
+		goto done;
+	}
+	model = lin_reg_model(&params, distance_type);
+	if ((parse_mode(mode, n_simulations_per_particle, &model, &settings) != 0) ||
+		(parse_initial_population(initial_theta_object, initial_weight_object,
+			model.n_parameters, &settings, &initial_theta, &initial_weight) != 0)) {
+		goto done;
+	}
+
+	/*Either a schedule of thresholds, one row per round, or an initial
+	threshold which adapts. Synthetic likelihood needs neither.*/
+	if (settings.inference_mode == SMC_MODE_SYNTHETIC_LIKELIHOOD) {
+		for (i = 0; i < model.n_distances; i++) threshold_init[i] = NAN;
+		settings.threshold_init = threshold_init;
+	}
+	else if ((schedule_object != NULL) && (schedule_object != Py_None)) {
+		schedule = (PyArrayObject*)PyArray_FROMANY(schedule_object, NPY_DOUBLE, 1,
+			2, NPY_ARRAY_IN_ARRAY);
+		if (schedule == NULL) goto done;
+		if (PyArray_SIZE(schedule) % model.n_distances != 0) {
+			PyErr_SetString(PyExc_ValueError,
+				"schedule must have one threshold per distance per round");
+			goto done;
+		}
+		settings.n_rounds = (int)(PyArray_SIZE(schedule)/model.n_distances);
+		settings.threshold_schedule = (double*)PyArray_DATA(schedule);
+	}
+	else{
+		if ((threshold_init_object == NULL) || (threshold_init_object == Py_None)) {
+			PyErr_SetString(PyExc_ValueError,
+				"one of schedule or threshold_init is required");
+			goto done;
+		}
+		if (PyFloat_Check(threshold_init_object) || PyLong_Check(threshold_init_object) ||
+			PyArray_IsScalar(threshold_init_object, Number) ||
+			(PyArray_Check(threshold_init_object) &&
+				(PyArray_NDIM((PyArrayObject*)threshold_init_object) == 0))) {
+			threshold_init[0] = PyFloat_AsDouble(threshold_init_object);
+			if (PyErr_Occurred()) goto done;
+			for (i = 1; i < model.n_distances; i++) threshold_init[i] = threshold_init[0];
+		}
+		else if (parse_double_vector(threshold_init_object, threshold_init,
+				model.n_distances, "threshold_init") != 0) {
+			goto done;
+		}
+		settings.threshold_init = threshold_init;
+	}
+	settings.histogram_lower = params.prior_lower;
+	settings.histogram_upper = params.prior_upper;
+
+	result = run_model(&model, &settings);
+
+done:
+	Py_XDECREF(x);
+	Py_XDECREF(y);
+	Py_XDECREF(schedule);
+	free(initial_theta);
+	free(initial_weight);
+	return result;
+}
+
+PyMethodDef abc_smc_methods[] = {
+	{"run_beta_binomial", (PyCFunction)(void(*)(void))abc_smc_run_beta_binomial,
+		METH_VARARGS | METH_KEYWORDS,
+		"run_beta_binomial(data, n_truth=10, prior_alpha=0.5, prior_beta=0.5,\n"
+		"    kernel_sd=0.05, n_particles=5000, n_rounds=50, threshold_init=10.0,\n"
+		"    quantile_accept_distance=0.8, seed=1, ess_resample_fraction=0.5,\n"
+		"    threshold_tolerance=0.0, posterior_tolerance=0.0, mode='rejection',\n"
+		"    n_simulations_per_particle=1, n_threads=1, numa_aware=False,\n"
+		"    max_simulations_per_round=0, round_time_limit=0.0,\n"
+		"    budget_fallback='relax', surrogate_screening=False,\n"
+		"    prior_sampling='random', initial_theta=None, initial_weight=None,\n"
+		"    verbose=False)\n\n"
+		"Run ABC SMC on the beta-binomial model. Returns a dict of arrays theta\n"
+		"(1 X rounds X particles), weight (rounds X particles), threshold\n"
+		"(1 X rounds), ess, n_simulations, n_screened, n_accepted and fallback\n"
+		"(rounds), and the stop_reason.\n"
+		"mode is 'rejection', 'averaged' (keep a particle if any of its\n"
+		"n_simulations_per_particle simulations is accepted, weighted by the\n"
+		"fraction accepted) or 'synthetic_likelihood' (weight every particle by\n"
+		"a Gaussian likelihood fitted to its simulated summaries). Each round is\n"
+		"sampled by n_threads threads; only n_threads=1 is reproducible.\n"
+		"numa_aware pins the threads and keeps their memory on their NUMA node.\n"
+		"A round stops after max_simulations_per_round simulations or\n"
+		"round_time_limit seconds (0 for no limit), then either keeps its best\n"
+		"proposals at a relaxed threshold (budget_fallback='relax') or only the\n"
+		"particles accepted so far ('shrink'). fallback records which was used\n"
+		"(0 none, 1 relax, 2 shrink) and n_accepted the particles kept; the\n"
+		"others have NaN theta and zero weight. surrogate_screening skips\n"
+		"simulating proposals a nearest-neighbour surrogate predicts will be\n"
+		"rejected, correcting the weights, in 'rejection' mode; n_screened\n"
+		"counts them. prior_sampling='sobol' or 'halton' draws round 0 from a\n"
+		"randomised quasi-Monte Carlo sequence through the prior's inverse CDF,\n"
+		"which covers the prior more evenly than 'random' draws. initial_theta\n"
+		"(parameters X particles), e.g. result['theta'][:, -1, :] of an earlier\n"
+		"run, with its initial_weight, proposes round 0 from that population\n"
+		"instead of the prior, to update a posterior when new data arrive."},
+	{"run_lin_reg", (PyCFunction)(void(*)(void))abc_smc_run_lin_reg,
+		METH_VARARGS | METH_KEYWORDS,
+		"run_lin_reg(x, y, prior_lower=(0, 3, 0), prior_upper=(10, 500, 10),\n"
+		"    kernel_width=(0.05, 5, 0.1), distance='abs_res', n_particles=20000,\n"
+		"    n_rounds=10, schedule=None, threshold_init=None,\n"
+		"    quantile_accept_distance=0.8, seed=1, ess_resample_fraction=0.5,\n"
+		"    threshold_tolerance=0.0, posterior_tolerance=0.0, mode='rejection',\n"
+		"    n_simulations_per_particle=1, n_threads=1, numa_aware=False,\n"
+		"    max_simulations_per_round=0, round_time_limit=0.0,\n"
+		"    budget_fallback='relax', surrogate_screening=False,\n"
+		"    prior_sampling='random', initial_theta=None, initial_weight=None,\n"
+		"    verbose=False)\n\n"
+		"Run ABC SMC on the linear regression model (gradient, intercept, sigma).\n"
+		"distance is 'abs_res' or 'sum_stats_3d'. Give either a schedule of\n"
+		"thresholds (rounds X distances), or threshold_init to adapt the\n"
+		"threshold each round, unless mode is 'synthetic_likelihood', whose\n"
+		"summaries are the fitted gradient, intercept and sigma. mode, the\n"
+		"round budget, prior_sampling and the initial population are as in\n"
+		"run_beta_binomial(). Returns a dict as run_beta_binomial()."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef abc_smc_module = {
+	PyModuleDef_HEAD_INIT, "abc_smc",
+	"Approximate Bayesian computation sequential Monte Carlo, run in-process",
+	-1, abc_smc_methods
+};
+
+PyMODINIT_FUNC PyInit_abc_smc(void){
+	import_array();
+	return PyModule_Create(&abc_smc_module);
+}
@@ -0,0 +1,177 @@
+/*
+The beta-binomial model for the ABC SMC engine.
+
+Each of n_data observations is the number of successes in n_truth Bernoulli
+trials with success probability theta, and theta has a Beta(prior_alpha,
+prior_beta) prior. Particles are perturbed with a Gaussian kernel of standard
+deviation kernel_sd.
+
+The distance is the absolute difference between the mean number of successes
+per observation of the data and of a simulated dataset, and for synthetic
+likelihood this mean is the summary statistic. As the observations share theta,
+the total number of successes of a simulated dataset is
+Binomial(n_data*n_truth, theta), so every simulation draws one binomial instead
+of n_data. Binomials are drawn by smc_random.h, whose set-up is shared by the
+whole batch of simulations of a particle.
+*/
+
+#ifndef BETA_BINOMIAL_H
+#define BETA_BINOMIAL_H
+
+#include <stdlib.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_cdf.h>
+
+#include "smc_random.h"
+
+typedef struct {
+	int n_data;
+	int *data;
+	int n_truth;
+	double prior_alpha;
+	double prior_beta;
+	double kernel_sd;
+
+	/*Mean number of successes per observation, set by beta_binomial_model()*/
+	double data_mean;
+} beta_binomial_params;
+
+void beta_binomial_sample_prior(gsl_rng *r, const smc_model *model,
+	double *theta){
+	/*Sample theta from the Beta prior*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	theta[0] = gsl_ran_beta(r, params->prior_alpha, params->prior_beta);
+}
+
+void beta_binomial_prior_quantile(const smc_model *model, const double *u,
+	double *theta){
+	/*Map u in (0,1) to the Beta prior by its inverse CDF*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	theta[0] = gsl_cdf_beta_Pinv(u[0], params->prior_alpha, params->prior_beta);
+}
+
+double beta_binomial_prior_pdf(const smc_model *model, const double *theta){
+	/*The probability density of a parameter under the prior*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	if ((theta[0] < 0) || (theta[0] > 1)) return 0.0;
+	return gsl_ran_beta_pdf(theta[0], params->prior_alpha, params->prior_beta);
+}
+
+void beta_binomial_perturb(gsl_rng *r, const smc_model *model,
+	const double *theta_old, double *theta_new){
+	/*Perturb a particle with the Gaussian kernel*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	theta_new[0] = theta_old[0] + gsl_ran_gaussian(r, params->kernel_sd);
+}
+
+double beta_binomial_kernel_pdf(const smc_model *model, const double *theta_old,
+	const double *theta_new){
+	/*The probability density of a new parameter given an old parameter under the
+	perturbation kernel
+
+	Parameters
+	----------------
+	theta_old : the value of the parameter at the previous time step
+	theta_new : the value of the parameter at the current time step
+
+	Returns
+	----------------
+	Transition probability density from theta_old to theta_new
+
+	*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	return gsl_ran_gaussian_pdf(theta_new[0] - theta_old[0], params->kernel_sd);
+}
+
+void beta_binomial_simulate_distance(gsl_rng *r, const smc_model *model,
+	const double *theta, void *workspace, double *distance){
+	/*Simulate a candidate dataset and compute its distance to the data
+
+	Parameters
+	----------------
+	r : A GSL random number generator
+	model : The beta-binomial model
+	theta : The success probability
+	workspace : Unused
+	distance : Filled with the distance between the data and simulation
+	*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	smc_binomial binomial;
+
+	smc_binomial_init(&binomial, theta[0], params->n_data*params->n_truth);
+	distance[0] = fabs(smc_binomial_draw(r, &binomial)/(double)params->n_data -
+		params->data_mean);
+}
+
+void beta_binomial_simulate_distance_batch(gsl_rng *r, const smc_model *model,
+	const double *theta, int n_simulations, void *workspace, double *distance){
+	/*Simulate n_simulations datasets by their total number of successes, and
+	fill distance with the distance of each to the data*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	unsigned int successes[SMC_RANDOM_BLOCK];
+	smc_binomial binomial;
+	int first, n, j;
+
+	smc_binomial_init(&binomial, theta[0], params->n_data*params->n_truth);
+	for (first = 0; first < n_simulations; first += SMC_RANDOM_BLOCK) {
+		n = (n_simulations - first < SMC_RANDOM_BLOCK) ? n_simulations - first :
+			SMC_RANDOM_BLOCK;
+		smc_binomial_fill(r, &binomial, n, successes);
+		for (j = 0; j < n; j++) {
+			distance[first + j] = fabs(successes[j]/(double)params->n_data -
+				params->data_mean);
+		}
+	}
+}
+
+void beta_binomial_simulate_summary_batch(gsl_rng *r, const smc_model *model,
+	const double *theta, int n_simulations, void *workspace, double *summary){
+	/*Fill summary with the mean number of successes per observation of
+	n_simulations simulated datasets*/
+	beta_binomial_params *params = (beta_binomial_params*)model->params;
+	unsigned int successes[SMC_RANDOM_BLOCK];
+	smc_binomial binomial;
+	int first, n, j;
+
+	smc_binomial_init(&binomial, theta[0], params->n_data*params->n_truth);
+	for (first = 0; first < n_simulations; first += SMC_RANDOM_BLOCK) {
+		n = (n_simulations - first < SMC_RANDOM_BLOCK) ? n_simulations - first :
+			SMC_RANDOM_BLOCK;
+		smc_binomial_fill(r, &binomial, n, successes);
+		for (j = 0; j < n; j++) summary[first + j] = successes[j]/(double)params->n_data;
+	}
+}
+
+smc_model beta_binomial_model(beta_binomial_params *params){
+	/*An smc_model for the beta-binomial model with the given data and settings*/
+	smc_model model;
+	int j;
+
+	params->data_mean = 0.0;
+	for (j = 0; j < params->n_data; j++) params->data_mean += params->data[j];
+	params->data_mean /= params->n_data;
+
+	model.n_parameters = 1;
+	model.n_distances = 1;
+	model.workspace_size = 0;
+	model.params = params;
+	model.sample_prior = beta_binomial_sample_prior;
+	model.prior_quantile = beta_binomial_prior_quantile;
+	model.prior_pdf = beta_binomial_prior_pdf;
+	model.perturb = beta_binomial_perturb;
+	model.kernel_pdf = beta_binomial_kernel_pdf;
+	model.simulate_distance = beta_binomial_simulate_distance;
+	model.simulate_distance_batch = beta_binomial_simulate_distance_batch;
+	model.block_size = 0;
+	model.simulate_distance_block = NULL;
+	model.n_summaries = 1;
+	model.observed_summary = &params->data_mean;
+	model.simulate_summary_batch = beta_binomial_simulate_summary_batch;
+	model.simulate_summary_block = NULL;
+	return model;
+}
+
+#endif
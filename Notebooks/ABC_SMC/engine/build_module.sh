@@ -0,0 +1,7 @@
+#!/usr/bin/env bash
+set -e
+gcc -Wall -O3 -shared -fPIC -pthread -I/home/juvid/gsl-2.5/include \
+	$(python3-config --includes) \
+	-I$(python3 -c "import numpy; print(numpy.get_include())") \
+	abc_smc_module.c -L/home/juvid/gsl/lib -lgsl -lgslcblas -lm \
+	-o abc_smc$(python3-config --extension-suffix)
@@ -0,0 +1,541 @@
+/*
+The linear regression model y = gradient*x + intercept + N(0, sigma^2) for the
+ABC SMC engine.
+
+Parameter ordering convention:
+0 - gradient
+1 - intercept
+2 - standard deviation
+
+All three parameters have uniform priors on [prior_lower, prior_upper], and
+particles are perturbed with a uniform kernel of half-width kernel_width.
+
+Two distances are available:
+LIN_REG_DISTANCE_ABS_RES - the mean absolute residual between the simulation and
+	the data (1 distance dimension)
+LIN_REG_DISTANCE_SUM_STATS_3D - the absolute difference between the maximum-
+	likelihood gradient, intercept and sigma of the simulation and of the data
+	(3 distance dimensions)
+
+For synthetic likelihood the summary statistics are the maximum-likelihood
+gradient, intercept and sigma of a simulated dataset.
+
+The noise may be changed through the noise field of lin_reg_params, giving the
+alternatives compared by model choice (smc_model_choice.h):
+LIN_REG_NOISE_GAUSSIAN - N(0, sigma^2), the default
+LIN_REG_NOISE_STUDENT_T - sigma times a Student-t variate with noise_dof degrees
+	of freedom, as in robust regression
+LIN_REG_NOISE_HETEROSCEDASTIC - N(0, (sigma |x|/mean(|x|))^2), noise growing
+	with x, with sigma the noise at the mean of |x|
+
+When observations are appended to the data, lin_reg_append_data() updates the
+maximum-likelihood fit from running moments of the data in time proportional to
+the number of new observations, rather than refitting every observation.
+*/
+
+#ifndef LIN_REG_H
+#define LIN_REG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include <gsl/gsl_fit.h>
+
+#define LIN_REG_N_PARAMETERS 3
+
+#define LIN_REG_DISTANCE_ABS_RES 0
+#define LIN_REG_DISTANCE_SUM_STATS_3D 1
+
+#define LIN_REG_NOISE_GAUSSIAN 0
+#define LIN_REG_NOISE_STUDENT_T 1
+#define LIN_REG_NOISE_HETEROSCEDASTIC 2
+
+typedef struct {
+	int n_data;
+	double *data_x;
+	double *data_y;
+	double prior_lower[LIN_REG_N_PARAMETERS];
+	double prior_upper[LIN_REG_N_PARAMETERS];
+	double kernel_width[LIN_REG_N_PARAMETERS];
+
+	/*Maximum-likelihood fit to the data, set by lin_reg_fit_data()*/
+	double gradient_fit_data;
+	double intercept_fit_data;
+	double sigma_fit_data;
+	double observed_summary[LIN_REG_N_PARAMETERS]; // the three fits above
+
+	int noise; // one of LIN_REG_NOISE_*, 0 (Gaussian) unless set
+	double noise_dof; // degrees of freedom of LIN_REG_NOISE_STUDENT_T
+	double mean_abs_x; // mean of |data_x|, set by lin_reg_model()
+
+	/*Centred moments of the data fitted so far, set by lin_reg_fit_data() and
+	updated by lin_reg_append_data()*/
+	int n_fit;
+	double mean_x, mean_y, m_xx, m_xy, m_yy;
+} lin_reg_params;
+
+double unif_neg_pos(gsl_rng *r){
+  /*Return a unif(-1,1)*/
+  return 2.0*gsl_rng_uniform(r) - 1.0;
+}
+
+int lin_reg_fit(double *data_x, double *data_y, int n_data, double *gradient,
+                double *intercept, double *sigma){
+  /*Fit a linear model by maximum likelihood
+
+  Parameters
+  ----------------
+  data_x : An array of length n_data of the independent variable
+  data_y : An array of length n_data of the dependent variable
+  n_data : The number of observations
+  gradient, intercept, sigma : Filled with the maximum-likelihood estimates
+
+  Returns
+  ----------------
+  The return value of gsl_fit_linear, 0 on success
+  */
+  double cov00, cov01, cov11, sumsq;
+  int gsl_fit_return_value;
+  gsl_fit_return_value = gsl_fit_linear(data_x, 1, data_y, 1, n_data,
+                                        intercept, gradient,
+                                        &cov00, &cov01, &cov11, &sumsq);
+  *sigma = sqrt(sumsq/(n_data-2));
+  return gsl_fit_return_value;
+}
+
+void lin_reg_add_moments(lin_reg_params *params, int first, int last){
+  /*Add observations first to last-1 to the centred moments of the data, by
+  Welford's update*/
+  int i;
+  double dx, dy;
+  for (i = first; i < last; i++) {
+    params->n_fit++;
+    dx = params->data_x[i] - params->mean_x;
+    dy = params->data_y[i] - params->mean_y;
+    params->mean_x += dx/params->n_fit;
+    params->mean_y += dy/params->n_fit;
+    params->m_xx += dx*(params->data_x[i] - params->mean_x);
+    params->m_xy += dx*(params->data_y[i] - params->mean_y);
+    params->m_yy += dy*(params->data_y[i] - params->mean_y);
+  }
+}
+
+int lin_reg_fit_data(lin_reg_params *params){
+  /*Fit a linear model to the data, which will be used as summary statistics of
+  the data*/
+  int gsl_fit_return_value;
+  params->n_fit = 0;
+  params->mean_x = params->mean_y = 0.0;
+  params->m_xx = params->m_xy = params->m_yy = 0.0;
+  lin_reg_add_moments(params, 0, params->n_data);
+  gsl_fit_return_value = lin_reg_fit(params->data_x, params->data_y,
+                                     params->n_data, &params->gradient_fit_data,
+                                     &params->intercept_fit_data,
+                                     &params->sigma_fit_data);
+  params->observed_summary[0] = params->gradient_fit_data;
+  params->observed_summary[1] = params->intercept_fit_data;
+  params->observed_summary[2] = params->sigma_fit_data;
+  return gsl_fit_return_value;
+}
+
+int lin_reg_append_data(lin_reg_params *params, int n_new){
+  /*Update the fit to the data after n_new observations were appended
+
+  Parameters
+  ----------------
+  params : The model's data and settings, fitted by lin_reg_fit_data(). data_x
+    and data_y must hold the n_data + n_new observations, and n_data is
+    increased by n_new. The model must then be rebuilt by lin_reg_model(), as
+    its workspace grows with the data.
+  n_new : The number of observations appended
+
+  Returns
+  ----------------
+  0 on success, -1 if the fit is degenerate
+  */
+  double gradient;
+  if (params->n_fit != params->n_data) {
+    printf("lin_reg_fit_data() must be called before appending data\n");
+    return -1;
+  }
+  lin_reg_add_moments(params, params->n_data, params->n_data + n_new);
+  params->n_data += n_new;
+  if ((params->n_data < 3) || (params->m_xx <= 0.0)) return -1;
+
+  gradient = params->m_xy/params->m_xx;
+  params->gradient_fit_data = gradient;
+  params->intercept_fit_data = params->mean_y - gradient*params->mean_x;
+  params->sigma_fit_data = sqrt(fmax(params->m_yy - gradient*params->m_xy, 0.0)/
+    (params->n_data - 2));
+  params->observed_summary[0] = params->gradient_fit_data;
+  params->observed_summary[1] = params->intercept_fit_data;
+  params->observed_summary[2] = params->sigma_fit_data;
+  return 0;
+}
+
+void lin_reg_sample_prior(gsl_rng *r, const smc_model *model, double *theta){
+  /*Sample from prior for linear regression
+
+  Parameters
+	----------------
+	r : A GSL random number generator
+	model : The linear regression model
+	theta : Filled with a sample from the prior
+  */
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  int i;
+  for (i = 0; i < LIN_REG_N_PARAMETERS; i++) {
+    theta[i] = (params->prior_upper[i] - params->prior_lower[i])*gsl_rng_uniform(r) +
+      params->prior_lower[i];
+  }
+}
+
+void lin_reg_prior_quantile(const smc_model *model, const double *u,
+  double *theta){
+  /*Map u, a point of the unit cube, to the uniform prior*/
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  int i;
+  for (i = 0; i < LIN_REG_N_PARAMETERS; i++) {
+    theta[i] = (params->prior_upper[i] - params->prior_lower[i])*u[i] +
+      params->prior_lower[i];
+  }
+}
+
+int check_prior_violated(const lin_reg_params *params, const double *theta){
+  /*Check if the support of the prior for any parameter is 0
+
+  Returns
+  ----------------
+  1 if priors are violated, 0 otherwise
+
+  */
+  int i;
+  for (i = 0; i < LIN_REG_N_PARAMETERS; i++) {
+    if ((theta[i] < params->prior_lower[i]) || (theta[i] > params->prior_upper[i])){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+double lin_reg_prior_pdf(const smc_model *model, const double *theta){
+	/*The probability density of a parameter under the prior*/
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  int i;
+  double prior = 1.0;
+  if (check_prior_violated(params, theta) == 1) return 0.0;
+  for (i = 0; i < LIN_REG_N_PARAMETERS; i++) {
+    prior = prior/(params->prior_upper[i] - params->prior_lower[i]);
+  }
+  return prior;
+}
+
+void lin_reg_perturb(gsl_rng *r, const smc_model *model,
+                     const double *theta_old, double *theta_new){
+  /* Perturb a particle with a uniform kernel
+
+  Parameters
+  ----------------
+  r : A GSL random number generator
+  model : The linear regression model
+  theta_old : The particle to be perturbed
+  theta_new : Filled with the perturbed particle
+
+  */
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  int i;
+  double u;
+  for (i = 0; i < LIN_REG_N_PARAMETERS; i++) {
+    u = unif_neg_pos(r); // Unif(-1,1)
+    theta_new[i] = theta_old[i] + params->kernel_width[i]*u;
+  }
+}
+
+double lin_reg_kernel_pdf(const smc_model *model, const double *theta_old,
+                          const double *theta_new){
+	/*The probability density of a new parameter given an old parameter under the
+	perturbation kernel
+
+	Parameters
+	----------------
+	theta_old : the value of the parameter at the previous time step
+	theta_new : the value of the parameter at the current time step
+
+	Returns
+	----------------
+	Transition probability density from theta_old to theta_new
+
+	*/
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  int i;
+  double density = 1.0;
+  for (i = 0; i < LIN_REG_N_PARAMETERS; i++) {
+    if (fabs(theta_new[i] - theta_old[i]) > params->kernel_width[i]) return 0.0;
+    density = density/(2.0*params->kernel_width[i]);
+  }
+  return density;
+}
+
+void simulate_dataset(gsl_rng *r, const double *theta, double *data_x,
+  double *simulated_data, int n_data){
+  /*Simulate a linear regression dataset and add to simulated_data
+
+  Parameters
+  ----------------
+  r : A GSL random number generator
+  theta : The gradient, intercept and standard deviation
+  data_x : an array corresponding to the independent variable x
+  simulated_data : an array of length n_data, where each element is a regression
+  against x, using parameters theta
+  n_data : The number of observations
+
+  Returns
+  ----------------
+  Augments simulated_data, filling it with a simulated dataset
+  */
+
+  int i;
+  double gradient, intercept, sigma;
+
+  gradient = theta[0];
+  intercept = theta[1];
+  sigma = theta[2];
+
+  for (i = 0; i < n_data; i++) {
+    simulated_data[i] = gradient*data_x[i] + intercept +
+                        gsl_ran_gaussian(r, sigma);
+  }
+}
+
+void lin_reg_simulate_dataset(gsl_rng *r, const lin_reg_params *params,
+  const double *theta, double *simulated_data){
+  /*Simulate a dataset at theta with the noise of the model, see
+  simulate_dataset()*/
+  int i;
+  double scale;
+
+  if (params->noise == LIN_REG_NOISE_GAUSSIAN) {
+    simulate_dataset(r, theta, params->data_x, simulated_data, params->n_data);
+    return;
+  }
+  for (i = 0; i < params->n_data; i++) {
+    simulated_data[i] = theta[0]*params->data_x[i] + theta[1];
+    if (params->noise == LIN_REG_NOISE_STUDENT_T) {
+      simulated_data[i] += theta[2]*gsl_ran_tdist(r, params->noise_dof);
+    }
+    else{
+      scale = (params->mean_abs_x > 0.0) ?
+        fabs(params->data_x[i])/params->mean_abs_x : 1.0;
+      simulated_data[i] += gsl_ran_gaussian(r, theta[2]*scale);
+    }
+  }
+}
+
+double distance_metric_sum_stats(const lin_reg_params *params,
+                                 double *simulated_data){
+  /* Compute a distance metric between the data and the simulation as the sum
+  of relative absolute distances between maximum-likelihood estimates of the
+  three parameters of linear regression.
+
+  Parameters
+  ----------------
+  params : The data, and the maximum-likelihood fit of the data
+  simulated_data : An array of length n_data of simulated data
+
+
+  Returns
+  ----------------
+  distance metric between the data and the simulation
+
+  */
+
+  double gradient_fit_sim, intercept_fit_sim, sigma_fit_sim;
+  double distance_metric;
+
+  if (lin_reg_fit(params->data_x, simulated_data, params->n_data,
+                  &gradient_fit_sim, &intercept_fit_sim, &sigma_fit_sim) != 0) {
+    printf("Fit failed.\n"); exit(99);
+  }
+  distance_metric = fabs(gradient_fit_sim - params->gradient_fit_data)/params->gradient_fit_data +
+                   fabs(intercept_fit_sim - params->intercept_fit_data)/params->intercept_fit_data +
+                   fabs(sigma_fit_sim - params->sigma_fit_data)/params->sigma_fit_data;
+  if (distance_metric < 0) {printf("Negative distance!\n");  exit(99);}
+
+  return distance_metric;
+}
+
+void distance_metric_sum_stats_3d(const lin_reg_params *params,
+                                  double *simulated_data, double *distance){
+  /* Compute a 3D distance metric between the data and the simulation as the
+  absolute distances between maximum-likelihood estimates of each of the three
+  parameters of linear regression.
+
+  Parameters
+  ----------------
+  params : The data, and the maximum-likelihood fit of the data
+  simulated_data : An array of length n_data of simulated data
+  distance : An array of length 3, filled with the distance along each
+    parameter
+
+  */
+
+  double gradient_fit_sim, intercept_fit_sim, sigma_fit_sim;
+
+  if (lin_reg_fit(params->data_x, simulated_data, params->n_data,
+                  &gradient_fit_sim, &intercept_fit_sim, &sigma_fit_sim) != 0) {
+    printf("Fit failed.\n"); exit(99);
+  }
+  distance[0] = fabs(gradient_fit_sim - params->gradient_fit_data);
+  distance[1] = fabs(intercept_fit_sim - params->intercept_fit_data);
+  distance[2] = fabs(sigma_fit_sim - params->sigma_fit_data);
+}
+
+double distance_metric_sum_sq_res(double *simulated_data, double *data_y,
+                                  int n_data){
+  /* Compute a distance metric between the data and the simulation as the sum
+  of squared residuals/n_data.
+
+  NOTE: This is not a good distance metric for SMC because it will attempt to
+  find a maximum-likelihood estimate for the gradient and intercept, which will
+  cause the noise parameter to overfit.
+
+  Parameters
+  ----------------
+  simulated_data : An array of length n_data of simulated data
+  data_y : An array of length n_data of the dependent variable
+  n_data : The number of observations
+
+
+  Returns
+  ----------------
+  distance metric between the data and the simulation
+
+  */
+
+  int i;
+  double res = 0.0;
+  for (i = 0; i < n_data; i++) {
+    res += (data_y[i] - simulated_data[i])*(data_y[i] - simulated_data[i]);
+  }
+  return res/n_data;
+}
+
+double distance_metric_sum_abs_res(double *simulated_data, double *data_y,
+                                   int n_data){
+  /* Compute a distance metric between the data and the simulation as the sum
+  of absolute residuals.
+
+  NOTE: This is not a good distance metric for SMC because it will attempt to
+  find a maximum-likelihood estimate for the gradient and intercept, which will
+  cause the noise parameter to overfit.
+
+  Parameters
+  ----------------
+  simulated_data : An array of length n_data of simulated data
+  data_y : An array of length n_data of the dependent variable
+  n_data : The number of observations
+
+
+  Returns
+  ----------------
+  distance metric between the data and the simulation
+
+  */
+
+  int i;
+  double res = 0.0;
+  for (i = 0; i < n_data; i++) {
+    res += fabs(data_y[i] - simulated_data[i]);
+  }
+  return res/n_data;
+}
+
+void lin_reg_simulate_abs_res(gsl_rng *r, const smc_model *model,
+                              const double *theta, void *workspace,
+                              double *distance){
+  /*Simulate a dataset and compute its mean absolute residual to the data*/
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  double *simulated_data = (double*)workspace;
+  lin_reg_simulate_dataset(r, params, theta, simulated_data);
+  distance[0] = distance_metric_sum_abs_res(simulated_data, params->data_y,
+                                            params->n_data);
+}
+
+void lin_reg_simulate_sum_stats_3d(gsl_rng *r, const smc_model *model,
+                                   const double *theta, void *workspace,
+                                   double *distance){
+  /*Simulate a dataset and compute its 3D summary statistic distance*/
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  double *simulated_data = (double*)workspace;
+  lin_reg_simulate_dataset(r, params, theta, simulated_data);
+  distance_metric_sum_stats_3d(params, simulated_data, distance);
+}
+
+void lin_reg_simulate_summary_batch(gsl_rng *r, const smc_model *model,
+                                    const double *theta, int n_simulations,
+                                    void *workspace, double *summary){
+  /*Simulate n_simulations datasets and fill summary, (n_simulations X 3), with
+  the maximum-likelihood gradient, intercept and sigma of each*/
+  lin_reg_params *params = (lin_reg_params*)model->params;
+  double *simulated_data = (double*)workspace;
+  int j;
+  for (j = 0; j < n_simulations; j++) {
+    lin_reg_simulate_dataset(r, params, theta, simulated_data);
+    if (lin_reg_fit(params->data_x, simulated_data, params->n_data,
+                    &summary[j*LIN_REG_N_PARAMETERS],
+                    &summary[j*LIN_REG_N_PARAMETERS + 1],
+                    &summary[j*LIN_REG_N_PARAMETERS + 2]) != 0) {
+      printf("Fit failed.\n"); exit(99);
+    }
+  }
+}
+
+smc_model lin_reg_model(lin_reg_params *params, int distance_type){
+  /*An smc_model for linear regression with the given data and settings
+
+  Parameters
+  ----------------
+  params : The data and settings of the model. lin_reg_fit_data() must have been
+    called if distance_type is LIN_REG_DISTANCE_SUM_STATS_3D, or for synthetic
+    likelihood
+  distance_type : LIN_REG_DISTANCE_ABS_RES or LIN_REG_DISTANCE_SUM_STATS_3D
+  */
+  smc_model model;
+  int i;
+  params->mean_abs_x = 0.0;
+  for (i = 0; i < params->n_data; i++) params->mean_abs_x += fabs(params->data_x[i]);
+  if (params->n_data > 0) params->mean_abs_x /= params->n_data;
+  if ((params->noise == LIN_REG_NOISE_STUDENT_T) && (params->noise_dof <= 0.0)) {
+    printf("noise_dof must be positive for Student-t noise\n"); exit(99);
+  }
+
+  model.n_parameters = LIN_REG_N_PARAMETERS;
+  model.workspace_size = params->n_data * sizeof(double);
+  model.params = params;
+  model.sample_prior = lin_reg_sample_prior;
+  model.prior_quantile = lin_reg_prior_quantile;
+  model.prior_pdf = lin_reg_prior_pdf;
+  model.perturb = lin_reg_perturb;
+  model.kernel_pdf = lin_reg_kernel_pdf;
+  model.simulate_distance_batch = NULL;
+  model.block_size = 0;
+  model.simulate_distance_block = NULL;
+  model.n_summaries = LIN_REG_N_PARAMETERS;
+  model.observed_summary = params->observed_summary;
+  model.simulate_summary_batch = lin_reg_simulate_summary_batch;
+  model.simulate_summary_block = NULL;
+  if (distance_type == LIN_REG_DISTANCE_SUM_STATS_3D) {
+    model.n_distances = LIN_REG_N_PARAMETERS;
+    model.simulate_distance = lin_reg_simulate_sum_stats_3d;
+  }
+  else{
+    model.n_distances = 1;
+    model.simulate_distance = lin_reg_simulate_abs_res;
+  }
+  return model;
+}
+
+#endif
@@ -0,0 +1,500 @@
+/*
+The multiple linear regression model y = X beta + intercept + N(0, sigma^2) for
+the ABC SMC engine, with n_predictors columns of X.
+
+Parameter ordering convention:
+0, ..., n_predictors - 1 - the coefficient of each predictor
+n_predictors - intercept
+n_predictors + 1 - standard deviation
+
+Every parameter has a uniform prior on [prior_lower, prior_upper], and particles
+are perturbed with a uniform kernel of half-width kernel_width, as in lin_reg.h.
+
+Two distances are available:
+LIN_REG_MULTI_DISTANCE_ABS_RES - the mean absolute residual between the
+	simulation and the data (1 distance dimension)
+LIN_REG_MULTI_DISTANCE_SUM_STATS - the absolute difference between the
+	least-squares coefficients, intercept and sigma of the simulation and of the
+	data (n_predictors + 2 distance dimensions)
+
+For synthetic likelihood the summary statistics are the least-squares
+coefficients, intercept and sigma of a simulated dataset.
+
+The engine simulates blocks of up to LIN_REG_MULTI_BLOCK particles at once
+(simulate_distance_block). The coefficients and intercepts of a block are the
+columns of a matrix B, and the means of all of its datasets are the one product
+D B, where D = [X 1] is the design matrix. Products are computed by
+lin_reg_multi_gemm() in tiles of LIN_REG_MULTI_TILE rows and columns, so that
+the tiles in use stay in cache. Noise is then added one observation at a time
+across the whole block, in loops over particles which the compiler can
+vectorise, and so are the residuals. Least-squares fits of a block are two more
+products: H Y, with H = (D^T D)^-1 D^T computed once from the data, gives the
+coefficients, and D (H Y) the fitted values. Batches of simulations at one
+particle are simulated as a block of copies of that particle.
+*/
+
+#ifndef LIN_REG_MULTI_H
+#define LIN_REG_MULTI_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#define LIN_REG_MULTI_DISTANCE_ABS_RES 0
+#define LIN_REG_MULTI_DISTANCE_SUM_STATS 1
+
+#define LIN_REG_MULTI_BLOCK 64
+#define LIN_REG_MULTI_TILE 64
+
+typedef struct {
+	int n_data;
+	int n_predictors;
+	double *data_x; // (n_data X n_predictors)
+	double *data_y; // (n_data)
+	double *prior_lower; // (n_predictors + 2)
+	double *prior_upper; // (n_predictors + 2)
+	double *kernel_width; // (n_predictors + 2)
+
+	/*Set by lin_reg_multi_fit_data(), freed by lin_reg_multi_free()*/
+	double *design; // (n_data X (n_predictors + 1)), D = [X 1]
+	double *hat; // ((n_predictors + 1) X n_data), H = (D^T D)^-1 D^T
+	double *observed_summary; // (n_predictors + 2), least-squares fit to the data
+} lin_reg_multi_params;
+
+void lin_reg_multi_gemm(int m, int n, int k, const double *a, const double *b,
+	double *c){
+	/*C += A B for row-major A, (m X k), B, (k X n), and C, (m X n).
+
+	The product is taken one tile of LIN_REG_MULTI_TILE rows of A and C and
+	LIN_REG_MULTI_TILE columns of B and C at a time, over tiles of k, so that a
+	tile of B is reused by every row of a tile of A while it is in cache. The
+	innermost loop runs along a row of B and C, and is vectorised.
+	*/
+	int i0, j0, p0, i1, j1, p1, i, j, p;
+	double a_ip;
+	const double *b_row;
+	double *c_row;
+
+	for (j0 = 0; j0 < n; j0 += LIN_REG_MULTI_TILE) {
+		j1 = (j0 + LIN_REG_MULTI_TILE < n) ? j0 + LIN_REG_MULTI_TILE : n;
+		for (p0 = 0; p0 < k; p0 += LIN_REG_MULTI_TILE) {
+			p1 = (p0 + LIN_REG_MULTI_TILE < k) ? p0 + LIN_REG_MULTI_TILE : k;
+			for (i0 = 0; i0 < m; i0 += LIN_REG_MULTI_TILE) {
+				i1 = (i0 + LIN_REG_MULTI_TILE < m) ? i0 + LIN_REG_MULTI_TILE : m;
+				for (i = i0; i < i1; i++) {
+					c_row = c + (size_t)i*n;
+					for (p = p0; p < p1; p++) {
+						a_ip = a[(size_t)i*k + p];
+						b_row = b + (size_t)p*n;
+						for (j = j0; j < j1; j++) c_row[j] += a_ip*b_row[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+size_t lin_reg_multi_workspace_length(const lin_reg_multi_params *params){
+	/*The number of doubles of workspace needed to simulate a block. It holds,
+	for LIN_REG_MULTI_BLOCK particles, their theta, coefficients, sigma and
+	noise, the simulated data and fitted values, and the fit of each dataset*/
+	size_t n_coefficients = params->n_predictors + 1;
+	return (size_t)LIN_REG_MULTI_BLOCK*((params->n_predictors + 2) + // theta
+		n_coefficients + 2 + // coefficients, sigma and noise
+		2*(size_t)params->n_data + // simulated data and fitted values
+		n_coefficients + 1); // the fit of each dataset
+}
+
+int lin_reg_multi_fit(const lin_reg_multi_params *params, int n_theta,
+	double *data, double *fit, double *fitted){
+	/*Least-squares fits of n_theta datasets
+
+	Parameters
+	----------------
+	params : The model, fitted by lin_reg_multi_fit_data()
+	n_theta : The number of datasets
+	data : (n_data X n_theta), dataset j in column j
+	fit : Filled with ((n_predictors + 2) X n_theta), the coefficients,
+		intercept and sigma of dataset j in column j
+	fitted : (n_data X n_theta), scratch for the fitted values
+
+	Returns
+	----------------
+	0 on success, -1 if there are too few observations to estimate sigma
+	*/
+	int n_data = params->n_data;
+	int n_coefficients = params->n_predictors + 1;
+	double *rss = fit + (size_t)n_coefficients*n_theta;
+	double residual;
+	int i, j;
+
+	if (n_data <= n_coefficients) return -1;
+	memset(fit, 0, (size_t)n_coefficients*n_theta*sizeof(double));
+	memset(fitted, 0, (size_t)n_data*n_theta*sizeof(double));
+	lin_reg_multi_gemm(n_coefficients, n_theta, n_data, params->hat, data, fit);
+	lin_reg_multi_gemm(n_data, n_theta, n_coefficients, params->design, fit,
+		fitted);
+	for (j = 0; j < n_theta; j++) rss[j] = 0.0;
+	for (i = 0; i < n_data; i++) {
+		for (j = 0; j < n_theta; j++) {
+			residual = data[(size_t)i*n_theta + j] - fitted[(size_t)i*n_theta + j];
+			rss[j] += residual*residual;
+		}
+	}
+	for (j = 0; j < n_theta; j++) rss[j] = sqrt(rss[j]/(n_data - n_coefficients));
+	return 0;
+}
+
+int lin_reg_multi_fit_data(lin_reg_multi_params *params){
+	/*Build the design matrix and H = (D^T D)^-1 D^T, and fit the data, whose
+	fit is used as summary statistics of the data. Returns 0 on success, -1 if
+	the predictors are collinear or too few*/
+	int n_data = params->n_data;
+	int n_predictors = params->n_predictors;
+	int n_coefficients = n_predictors + 1;
+	int i, j, k, status = 0;
+	double sum;
+	double *gram = malloc((size_t)n_coefficients*n_coefficients*sizeof(double));
+	double *fitted = malloc((size_t)n_data*sizeof(double));
+
+	params->design = malloc((size_t)n_data*n_coefficients*sizeof(double));
+	params->hat = calloc((size_t)n_coefficients*n_data, sizeof(double));
+	params->observed_summary = malloc((n_predictors + 2)*sizeof(double));
+	if ((gram == NULL) || (fitted == NULL) || (params->design == NULL) ||
+		(params->hat == NULL) || (params->observed_summary == NULL)) {
+		printf("Error allocating the design matrix\n");
+		return -1;
+	}
+
+	for (i = 0; i < n_data; i++) {
+		for (k = 0; k < n_predictors; k++) {
+			params->design[(size_t)i*n_coefficients + k] =
+				params->data_x[(size_t)i*n_predictors + k];
+		}
+		params->design[(size_t)i*n_coefficients + n_predictors] = 1.0;
+	}
+
+	/*Cholesky factorise D^T D = L L^T, in the lower triangle of gram*/
+	for (j = 0; j < n_coefficients; j++) {
+		for (k = 0; k <= j; k++) {
+			sum = 0.0;
+			for (i = 0; i < n_data; i++) {
+				sum += params->design[(size_t)i*n_coefficients + j]*
+					params->design[(size_t)i*n_coefficients + k];
+			}
+			gram[j*n_coefficients + k] = sum;
+		}
+	}
+	for (j = 0; (j < n_coefficients) && (status == 0); j++) {
+		for (k = 0; k <= j; k++) {
+			sum = gram[j*n_coefficients + k];
+			for (i = 0; i < k; i++) {
+				sum -= gram[j*n_coefficients + i]*gram[k*n_coefficients + i];
+			}
+			if (k < j) gram[j*n_coefficients + k] = sum/gram[k*n_coefficients + k];
+			else if (sum > 0.0) gram[j*n_coefficients + j] = sqrt(sum);
+			else status = -1;
+		}
+	}
+
+	/*Column i of H solves L L^T h = D_i, row i of D*/
+	for (i = 0; (i < n_data) && (status == 0); i++) {
+		for (j = 0; j < n_coefficients; j++) {
+			sum = params->design[(size_t)i*n_coefficients + j];
+			for (k = 0; k < j; k++) {
+				sum -= gram[j*n_coefficients + k]*params->hat[(size_t)k*n_data + i];
+			}
+			params->hat[(size_t)j*n_data + i] = sum/gram[j*n_coefficients + j];
+		}
+		for (j = n_coefficients - 1; j >= 0; j--) {
+			sum = params->hat[(size_t)j*n_data + i];
+			for (k = j + 1; k < n_coefficients; k++) {
+				sum -= gram[k*n_coefficients + j]*params->hat[(size_t)k*n_data + i];
+			}
+			params->hat[(size_t)j*n_data + i] = sum/gram[j*n_coefficients + j];
+		}
+	}
+
+	if (status == 0) {
+		status = lin_reg_multi_fit(params, 1, params->data_y,
+			params->observed_summary, fitted);
+	}
+	if (status != 0) printf("The predictors are collinear, or too few observations\n");
+	free(gram);
+	free(fitted);
+	return status;
+}
+
+void lin_reg_multi_free(lin_reg_multi_params *params){
+	/*Free the arrays set by lin_reg_multi_fit_data()*/
+	free(params->design);
+	free(params->hat);
+	free(params->observed_summary);
+	params->design = NULL;
+	params->hat = NULL;
+	params->observed_summary = NULL;
+}
+
+void lin_reg_multi_sample_prior(gsl_rng *r, const smc_model *model,
+	double *theta){
+	/*Sample theta from the uniform prior*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int i;
+	for (i = 0; i < model->n_parameters; i++) {
+		theta[i] = (params->prior_upper[i] - params->prior_lower[i])*
+			gsl_rng_uniform(r) + params->prior_lower[i];
+	}
+}
+
+void lin_reg_multi_prior_quantile(const smc_model *model, const double *u,
+	double *theta){
+	/*Map u, a point of the unit cube, to the uniform prior*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int i;
+	for (i = 0; i < model->n_parameters; i++) {
+		theta[i] = (params->prior_upper[i] - params->prior_lower[i])*u[i] +
+			params->prior_lower[i];
+	}
+}
+
+double lin_reg_multi_prior_pdf(const smc_model *model, const double *theta){
+	/*The probability density of a parameter under the prior*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int i;
+	double prior = 1.0;
+	for (i = 0; i < model->n_parameters; i++) {
+		if ((theta[i] < params->prior_lower[i]) ||
+			(theta[i] > params->prior_upper[i])) {
+			return 0.0;
+		}
+		prior = prior/(params->prior_upper[i] - params->prior_lower[i]);
+	}
+	return prior;
+}
+
+void lin_reg_multi_perturb(gsl_rng *r, const smc_model *model,
+	const double *theta_old, double *theta_new){
+	/*Perturb a particle with a uniform kernel*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int i;
+	for (i = 0; i < model->n_parameters; i++) {
+		theta_new[i] = theta_old[i] +
+			params->kernel_width[i]*(2.0*gsl_rng_uniform(r) - 1.0);
+	}
+}
+
+double lin_reg_multi_kernel_pdf(const smc_model *model, const double *theta_old,
+	const double *theta_new){
+	/*The probability density of theta_new given theta_old under the
+	perturbation kernel*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int i;
+	double density = 1.0;
+	for (i = 0; i < model->n_parameters; i++) {
+		if (fabs(theta_new[i] - theta_old[i]) > params->kernel_width[i]) return 0.0;
+		density = density/(2.0*params->kernel_width[i]);
+	}
+	return density;
+}
+
+void lin_reg_multi_block_means(const lin_reg_multi_params *params, int n_theta,
+	const double *theta, double *workspace){
+	/*Fill the simulated data of the workspace with the mean of every
+	observation for each of the n_theta particles of theta,
+	(n_theta X (n_predictors + 2)), and its sigma with their standard
+	deviations*/
+	int n_parameters = params->n_predictors + 2;
+	int n_coefficients = params->n_predictors + 1;
+	double *coefficient = workspace + (size_t)LIN_REG_MULTI_BLOCK*n_parameters;
+	double *sigma = coefficient + (size_t)LIN_REG_MULTI_BLOCK*n_coefficients;
+	double *data = sigma + 2*LIN_REG_MULTI_BLOCK;
+	int j, k;
+
+	/*B holds the coefficients and intercept of particle j in column j*/
+	for (k = 0; k < n_coefficients; k++) {
+		for (j = 0; j < n_theta; j++) {
+			coefficient[(size_t)k*n_theta + j] = theta[(size_t)j*n_parameters + k];
+		}
+	}
+	for (j = 0; j < n_theta; j++) {
+		sigma[j] = theta[(size_t)j*n_parameters + n_coefficients];
+	}
+	memset(data, 0, (size_t)params->n_data*n_theta*sizeof(double));
+	lin_reg_multi_gemm(params->n_data, n_theta, n_coefficients, params->design,
+		coefficient, data);
+}
+
+void lin_reg_multi_simulate_block(gsl_rng *r, const lin_reg_multi_params *params,
+	int n_theta, const double *theta, double *workspace, double *summary){
+	/*Simulate a dataset at each of the n_theta particles of theta, and fill
+	summary, (n_theta X (n_predictors + 2)), with the least-squares fit of
+	each*/
+	int n_data = params->n_data;
+	int n_parameters = params->n_predictors + 2;
+	double *sigma = workspace + (size_t)LIN_REG_MULTI_BLOCK*(2*n_parameters - 1);
+	double *noise = sigma + LIN_REG_MULTI_BLOCK;
+	double *data = noise + LIN_REG_MULTI_BLOCK;
+	double *fitted = data + (size_t)LIN_REG_MULTI_BLOCK*n_data;
+	double *fit = fitted + (size_t)LIN_REG_MULTI_BLOCK*n_data;
+	int i, j, k;
+
+	lin_reg_multi_block_means(params, n_theta, theta, workspace);
+	for (i = 0; i < n_data; i++) {
+		for (j = 0; j < n_theta; j++) noise[j] = gsl_ran_gaussian_ziggurat(r, 1.0);
+		for (j = 0; j < n_theta; j++) data[(size_t)i*n_theta + j] += sigma[j]*noise[j];
+	}
+	if (lin_reg_multi_fit(params, n_theta, data, fit, fitted) != 0) {
+		printf("Fit failed.\n"); exit(99);
+	}
+	for (k = 0; k < n_parameters; k++) {
+		for (j = 0; j < n_theta; j++) {
+			summary[(size_t)j*n_parameters + k] = fit[(size_t)k*n_theta + j];
+		}
+	}
+}
+
+void lin_reg_multi_simulate_abs_res_block(gsl_rng *r, const smc_model *model,
+	int n_theta, const double *theta, void *workspace, double *distance){
+	/*Simulate a dataset at each of the n_theta particles of theta, and fill
+	distance, (n_theta), with the mean absolute residual of each to the data*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int n_data = params->n_data;
+	int n_parameters = params->n_predictors + 2;
+	double *sigma = (double*)workspace +
+		(size_t)LIN_REG_MULTI_BLOCK*(2*n_parameters - 1);
+	double *noise = sigma + LIN_REG_MULTI_BLOCK;
+	double *data = noise + LIN_REG_MULTI_BLOCK;
+	double *mean;
+	double y;
+	int i, j;
+
+	lin_reg_multi_block_means(params, n_theta, theta, workspace);
+	for (j = 0; j < n_theta; j++) distance[j] = 0.0;
+	for (i = 0; i < n_data; i++) {
+		mean = data + (size_t)i*n_theta;
+		y = params->data_y[i];
+		for (j = 0; j < n_theta; j++) noise[j] = gsl_ran_gaussian_ziggurat(r, 1.0);
+		for (j = 0; j < n_theta; j++) {
+			distance[j] += fabs(y - mean[j] - sigma[j]*noise[j]);
+		}
+	}
+	for (j = 0; j < n_theta; j++) distance[j] /= n_data;
+}
+
+void lin_reg_multi_simulate_sum_stats_block(gsl_rng *r, const smc_model *model,
+	int n_theta, const double *theta, void *workspace, double *distance){
+	/*Simulate a dataset at each of the n_theta particles of theta, and fill
+	distance, (n_theta X (n_predictors + 2)), with the absolute difference
+	between the fit of each and of the data*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int n_parameters = model->n_parameters;
+	int j, k;
+
+	lin_reg_multi_simulate_block(r, params, n_theta, theta, (double*)workspace,
+		distance);
+	for (j = 0; j < n_theta; j++) {
+		for (k = 0; k < n_parameters; k++) {
+			distance[(size_t)j*n_parameters + k] =
+				fabs(distance[(size_t)j*n_parameters + k] - params->observed_summary[k]);
+		}
+	}
+}
+
+void lin_reg_multi_simulate_summary_block(gsl_rng *r, const smc_model *model,
+	int n_theta, const double *theta, void *workspace, double *summary){
+	/*Simulate a dataset at each of the n_theta particles of theta, and fill
+	summary, (n_theta X (n_predictors + 2)), with the least-squares fit of
+	each*/
+	lin_reg_multi_simulate_block(r, (lin_reg_multi_params*)model->params, n_theta,
+		theta, (double*)workspace, summary);
+}
+
+void lin_reg_multi_repeat(const smc_model *model, const double *theta, int n,
+	void *workspace){
+	/*Copy theta to the first n particles of the workspace's block*/
+	int j;
+	for (j = 0; j < n; j++) {
+		memcpy((double*)workspace + (size_t)j*model->n_parameters, theta,
+			model->n_parameters*sizeof(double));
+	}
+}
+
+void lin_reg_multi_simulate_distance_batch(gsl_rng *r, const smc_model *model,
+	const double *theta, int n_simulations, void *workspace, double *distance){
+	/*Simulate n_simulations datasets at theta, as blocks of copies of theta*/
+	int first, n;
+	lin_reg_multi_repeat(model, theta, (n_simulations < LIN_REG_MULTI_BLOCK) ?
+		n_simulations : LIN_REG_MULTI_BLOCK, workspace);
+	for (first = 0; first < n_simulations; first += LIN_REG_MULTI_BLOCK) {
+		n = (n_simulations - first < LIN_REG_MULTI_BLOCK) ? n_simulations - first :
+			LIN_REG_MULTI_BLOCK;
+		model->simulate_distance_block(r, model, n, (double*)workspace, workspace,
+			distance + (size_t)first*model->n_distances);
+	}
+}
+
+void lin_reg_multi_simulate_distance(gsl_rng *r, const smc_model *model,
+	const double *theta, void *workspace, double *distance){
+	/*Simulate a dataset at theta and compute its distance(s) to the data*/
+	lin_reg_multi_simulate_distance_batch(r, model, theta, 1, workspace, distance);
+}
+
+void lin_reg_multi_simulate_summary_batch(gsl_rng *r, const smc_model *model,
+	const double *theta, int n_simulations, void *workspace, double *summary){
+	/*Simulate n_simulations datasets and fill summary,
+	(n_simulations X (n_predictors + 2)), with the least-squares fit of each*/
+	lin_reg_multi_params *params = (lin_reg_multi_params*)model->params;
+	int first, n;
+	lin_reg_multi_repeat(model, theta, (n_simulations < LIN_REG_MULTI_BLOCK) ?
+		n_simulations : LIN_REG_MULTI_BLOCK, workspace);
+	for (first = 0; first < n_simulations; first += LIN_REG_MULTI_BLOCK) {
+		n = (n_simulations - first < LIN_REG_MULTI_BLOCK) ? n_simulations - first :
+			LIN_REG_MULTI_BLOCK;
+		lin_reg_multi_simulate_block(r, params, n, (double*)workspace,
+			(double*)workspace, summary + (size_t)first*model->n_parameters);
+	}
+}
+
+smc_model lin_reg_multi_model(lin_reg_multi_params *params, int distance_type){
+	/*An smc_model for multiple linear regression with the given data and
+	settings
+
+	Parameters
+	----------------
+	params : The data and settings of the model. lin_reg_multi_fit_data() must
+		have been called
+	distance_type : LIN_REG_MULTI_DISTANCE_ABS_RES or
+		LIN_REG_MULTI_DISTANCE_SUM_STATS
+	*/
+	smc_model model;
+	model.n_parameters = params->n_predictors + 2;
+	model.workspace_size = lin_reg_multi_workspace_length(params)*sizeof(double);
+	model.params = params;
+	model.sample_prior = lin_reg_multi_sample_prior;
+	model.prior_quantile = lin_reg_multi_prior_quantile;
+	model.prior_pdf = lin_reg_multi_prior_pdf;
+	model.perturb = lin_reg_multi_perturb;
+	model.kernel_pdf = lin_reg_multi_kernel_pdf;
+	model.simulate_distance = lin_reg_multi_simulate_distance;
+	model.simulate_distance_batch = lin_reg_multi_simulate_distance_batch;
+	model.block_size = LIN_REG_MULTI_BLOCK;
+	model.n_summaries = model.n_parameters;
+	model.observed_summary = params->observed_summary;
+	model.simulate_summary_batch = lin_reg_multi_simulate_summary_batch;
+	model.simulate_summary_block = lin_reg_multi_simulate_summary_block;
+	if (distance_type == LIN_REG_MULTI_DISTANCE_SUM_STATS) {
+		model.n_distances = model.n_parameters;
+		model.simulate_distance_block = lin_reg_multi_simulate_sum_stats_block;
+	}
+	else{
+		model.n_distances = 1;
+		model.simulate_distance_block = lin_reg_multi_simulate_abs_res_block;
+	}
+	return model;
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+Running many independent ABC SMC problems on a shared pool of threads.
+
+Each smc_job is one complete run of smc_run() with its own model, settings and
+population, for instance the same model fitted to a different observed
+dataset. n_threads worker threads are started once, and each repeatedly claims
+the next job which has not been started, so long and short runs balance across
+the pool without any static split of the jobs.
+
+Jobs must not share mutable state: every job needs its own model parameters
+and population. The engine's verbose output should be off, as runs print
+concurrently.
+*/
+
+#ifndef SMC_BATCH_H
+#define SMC_BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef struct {
+	const smc_model *model;
+	const smc_settings *settings;
+	smc_population *population; // allocated by smc_population_alloc()
+	int status; // the return value of smc_run()
+} smc_job;
+
+typedef struct {
+	smc_job *job;
+	int n_jobs;
+	int next_job;
+	int n_done;
+	int verbose;
+	pthread_mutex_t lock;
+} smc_batch_queue;
+
+int smc_batch_claim(smc_batch_queue *queue){
+	/*Claim the index of the next job to run, or -1 if none remain*/
+	int index;
+	pthread_mutex_lock(&queue->lock);
+	index = (queue->next_job < queue->n_jobs) ? queue->next_job++ : -1;
+	pthread_mutex_unlock(&queue->lock);
+	return index;
+}
+
+void *smc_batch_worker(void *arg){
+	/*Run jobs from the queue until it is empty*/
+	smc_batch_queue *queue = (smc_batch_queue*)arg;
+	smc_job *job;
+	int index;
+	while ((index = smc_batch_claim(queue)) >= 0) {
+		job = &queue->job[index];
+		job->status = smc_run(job->model, job->settings, job->population);
+		if (queue->verbose) {
+			pthread_mutex_lock(&queue->lock);
+			queue->n_done++;
+			printf("Finished %d of %d runs\n", queue->n_done, queue->n_jobs);
+			pthread_mutex_unlock(&queue->lock);
+		}
+	}
+	return NULL;
+}
+
+int smc_default_n_threads(void){
+	/*The number of online processors, or 1 if it cannot be determined*/
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+}
+
+int smc_run_batch(smc_job *job, int n_jobs, int n_threads, int verbose){
+	/*Run every job on a pool of threads
+
+	Parameters
+	----------------
+	job : An array of n_jobs jobs. Each job's status is set on return
+	n_jobs : The number of jobs
+	n_threads : The number of worker threads, or 0 for one per processor. No
+		more threads than jobs are started
+	verbose : If non-zero, print progress as jobs finish
+
+	Returns
+	----------------
+	The number of jobs which failed, or -1 if the threads could not be started
+	*/
+	smc_batch_queue queue;
+	pthread_t *thread;
+	int i, n_started, n_failed = 0;
+
+	if (n_threads <= 0) n_threads = smc_default_n_threads();
+	if (n_threads > n_jobs) n_threads = n_jobs;
+	queue.job = job;
+	queue.n_jobs = n_jobs;
+	queue.next_job = 0;
+	queue.n_done = 0;
+	queue.verbose = verbose;
+	pthread_mutex_init(&queue.lock, NULL);
+	for (i = 0; i < n_jobs; i++) job[i].status = -1;
+
+	thread = malloc(n_threads * sizeof(pthread_t));
+	if (thread == NULL) return -1;
+	for (n_started = 0; n_started < n_threads - 1; n_started++) {
+		if (pthread_create(&thread[n_started], NULL, smc_batch_worker, &queue) != 0) {
+			break;
+		}
+	}
+	/*The calling thread is the last worker, so the batch completes even if no
+	thread could be started*/
+	smc_batch_worker(&queue);
+	for (i = 0; i < n_started; i++) pthread_join(thread[i], NULL);
+	free(thread);
+	pthread_mutex_destroy(&queue.lock);
+
+	for (i = 0; i < n_jobs; i++) {
+		if (job[i].status != 0) n_failed++;
+	}
+	return n_failed;
+}
+
+#endif
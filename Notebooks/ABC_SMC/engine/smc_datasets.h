@@ -0,0 +1,219 @@
+/*
+Reading many observed datasets for batched inference.
+
+A collection of datasets is either
+- a directory, in which every file ending in .csv is one dataset, read in order
+	of file name. Each row of a file is one observation of n_columns
+	comma-separated values, e.g. a `binom_data.csv` for the beta-binomial model,
+	or rows of x,y for linear regression, or
+- a stacked file, in which each row is a dataset label followed by the
+	n_columns values of one observation. Consecutive rows with the same label
+	form a dataset.
+*/
+
+#ifndef SMC_DATASETS_H
+#define SMC_DATASETS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define DATASET_NAME_LENGTH 256
+#define DATASET_LINE_LENGTH 4096
+
+typedef struct {
+	char name[DATASET_NAME_LENGTH];
+	int n_rows;
+	int n_columns;
+	double *values; // (n_rows X n_columns)
+} smc_dataset;
+
+int dataset_append_row(smc_dataset *dataset, const double *row, int *capacity){
+	/*Append a row of n_columns values to a dataset, growing its storage as
+	needed. Returns 0 on success, -1 if allocation failed*/
+	double *values;
+	if (dataset->n_rows == *capacity) {
+		*capacity = (*capacity > 0) ? 2*(*capacity) : 64;
+		values = realloc(dataset->values, (size_t)(*capacity) *
+			dataset->n_columns * sizeof(double));
+		if (values == NULL) return -1;
+		dataset->values = values;
+	}
+	memcpy(dataset->values + (size_t)dataset->n_rows*dataset->n_columns, row,
+		dataset->n_columns * sizeof(double));
+	dataset->n_rows++;
+	return 0;
+}
+
+int parse_dataset_row(char *line, int n_columns, char *label, double *row){
+	/*Split a line into an optional label (when label is not NULL) and
+	n_columns values. Returns 1 if the line holds a row, 0 if it is blank, and
+	-1 if it is malformed*/
+	char *token, *end;
+	int i;
+
+	token = strtok(line, ",\r\n");
+	if (token == NULL) return 0;
+	if (label != NULL) {
+		snprintf(label, DATASET_NAME_LENGTH, "%s", token);
+		token = strtok(NULL, ",\r\n");
+	}
+	for (i = 0; i < n_columns; i++) {
+		if (token == NULL) return -1;
+		row[i] = strtod(token, &end);
+		if (end == token) return -1;
+		token = strtok(NULL, ",\r\n");
+	}
+	return 1;
+}
+
+int compare_names(const void *a, const void *b){
+	/*Order file names alphabetically, for qsort()*/
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+void free_datasets(smc_dataset *datasets, int n_datasets){
+	/*Free datasets read by read_datasets()*/
+	int i;
+	if (datasets == NULL) return;
+	for (i = 0; i < n_datasets; i++) free(datasets[i].values);
+	free(datasets);
+}
+
+smc_dataset *read_datasets(const char *path, int n_columns, int *n_datasets){
+	/*Read a directory or stacked file of datasets
+
+	Parameters
+	----------------
+	path : A directory of one file per dataset, or a stacked file
+	n_columns : The number of values per observation
+	n_datasets : Filled with the number of datasets read
+
+	Returns
+	----------------
+	An array of n_datasets datasets, to be freed by free_datasets(), or NULL if
+	the datasets could not be read
+	*/
+	struct stat path_stat;
+	DIR *directory;
+	struct dirent *entry;
+	FILE *file_pointer;
+	char line[DATASET_LINE_LENGTH];
+	char label[DATASET_NAME_LENGTH];
+	char file_name[2*DATASET_NAME_LENGTH];
+	char **names = NULL, **more_names;
+	double row[DATASET_LINE_LENGTH/2];
+	smc_dataset *datasets = NULL, *more_datasets;
+	int capacity = 0, row_capacity = 0, n_files = 0, i, status, error = 0;
+	size_t length;
+
+	*n_datasets = 0;
+	if (stat(path, &path_stat) != 0) {
+		printf("Cannot open %s\n", path);
+		return NULL;
+	}
+
+	if (S_ISDIR(path_stat.st_mode)) {
+		/*One dataset per .csv file, in order of name*/
+		directory = opendir(path);
+		if (directory == NULL) {printf("Cannot open %s\n", path); return NULL;}
+		while ((entry = readdir(directory)) != NULL) {
+			length = strlen(entry->d_name);
+			if ((length < 5) || (length >= DATASET_NAME_LENGTH) ||
+				(strcmp(entry->d_name + length - 4, ".csv") != 0)) {
+				continue;
+			}
+			more_names = realloc(names, (n_files + 1) * sizeof(char*));
+			if (more_names == NULL) {error = 1; break;}
+			names = more_names;
+			names[n_files] = strdup(entry->d_name);
+			if (names[n_files] == NULL) {error = 1; break;}
+			n_files++;
+		}
+		closedir(directory);
+		if (error) {
+			printf("Error allocating datasets\n");
+			for (i = 0; i < n_files; i++) free(names[i]);
+			free(names);
+			return NULL;
+		}
+		if (n_files == 0) {printf("No .csv files in %s\n", path); return NULL;}
+		qsort(names, n_files, sizeof(char*), compare_names);
+
+		datasets = calloc(n_files, sizeof(smc_dataset));
+		if (datasets == NULL) {printf("Error allocating datasets\n"); error = 1;}
+		for (i = 0; (i < n_files) && !error; i++) {
+			snprintf(datasets[i].name, DATASET_NAME_LENGTH, "%s", names[i]);
+			datasets[i].n_columns = n_columns;
+			snprintf(file_name, sizeof(file_name), "%s/%s", path, names[i]);
+			file_pointer = fopen(file_name, "r");
+			if (file_pointer == NULL) {printf("Cannot open %s\n", file_name); error = 1; break;}
+			row_capacity = 0;
+			while (fgets(line, DATASET_LINE_LENGTH, file_pointer) != NULL) {
+				status = parse_dataset_row(line, n_columns, NULL, row);
+				if ((status < 0) ||
+					((status == 1) && (dataset_append_row(&datasets[i], row,
+						&row_capacity) != 0))) {
+					printf("Error reading %s\n", file_name);
+					error = 1;
+					break;
+				}
+			}
+			fclose(file_pointer);
+		}
+		*n_datasets = n_files;
+		for (i = 0; i < n_files; i++) free(names[i]);
+		free(names);
+	}
+	else{
+		/*A stacked file, split wherever the label changes*/
+		file_pointer = fopen(path, "r");
+		if (file_pointer == NULL) {printf("Cannot open %s\n", path); return NULL;}
+		while (fgets(line, DATASET_LINE_LENGTH, file_pointer) != NULL) {
+			status = parse_dataset_row(line, n_columns, label, row);
+			if (status == 0) continue;
+			if (status < 0) {printf("Error reading %s\n", path); error = 1; break;}
+			if ((*n_datasets == 0) ||
+				(strcmp(label, datasets[*n_datasets - 1].name) != 0)) {
+				if (*n_datasets == capacity) {
+					capacity = (capacity > 0) ? 2*capacity : 16;
+					more_datasets = realloc(datasets, capacity * sizeof(smc_dataset));
+					if (more_datasets == NULL) {
+						printf("Error allocating datasets\n");
+						error = 1;
+						break;
+					}
+					datasets = more_datasets;
+				}
+				memset(&datasets[*n_datasets], 0, sizeof(smc_dataset));
+				snprintf(datasets[*n_datasets].name, DATASET_NAME_LENGTH, "%s", label);
+				datasets[*n_datasets].n_columns = n_columns;
+				(*n_datasets)++;
+				row_capacity = 0;
+			}
+			if (dataset_append_row(&datasets[*n_datasets - 1], row,
+					&row_capacity) != 0) {
+				error = 1;
+				break;
+			}
+		}
+		fclose(file_pointer);
+	}
+
+	for (i = 0; (i < *n_datasets) && !error; i++) {
+		if (datasets[i].n_rows == 0) {
+			printf("Dataset %s is empty\n", datasets[i].name);
+			error = 1;
+		}
+	}
+	if (error || (*n_datasets == 0)) {
+		free_datasets(datasets, *n_datasets);
+		*n_datasets = 0;
+		return NULL;
+	}
+	return datasets;
+}
+
+#endif
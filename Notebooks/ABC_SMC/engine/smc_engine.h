@@ -0,0 +1,2147 @@
+/*
+The approximate Bayesian computation sequential Monte Carlo (ABC SMC) engine
+(Toni et al. 2009) shared by every model in ABC_SMC.
+
+A model is described by an smc_model: its number of parameters and distance
+dimensions, a pointer to its data, and callbacks to sample from the prior,
+evaluate the prior, perturb a particle, evaluate the perturbation kernel, and
+simulate a dataset and compute its distance(s) to the data. The engine owns the
+round loop: drawing/perturbing particles until they are accepted, importance
+weights, the distance threshold for each round, resampling and termination.
+
+Resampling is triggered by the effective sample size (ESS). When the ESS of the
+previous population falls below ess_resample_fraction*n_particles, it is
+systematically resampled before being perturbed, otherwise particles are drawn
+directly from the weighted population.
+
+Unless a schedule is given, each round's threshold is the
+quantile_accept_distance quantile of the distances accepted in the previous
+round, separately for each distance. With target_acceptance_rate set, it instead
+keeps the number of particles accepted per simulation near that rate. If a round
+accepted a fraction alpha of its simulations, the next threshold keeps a
+fraction q = target_acceptance_rate/alpha of its particles (within
+[SMC_MIN_THRESHOLD_QUANTILE, SMC_MAX_THRESHOLD_QUANTILE]), so thresholds fall
+quickly while simulations are cheap to accept and slowly once they are not.
+With several distances the thresholds are set jointly: each is the same
+quantile u of its own dimension, with u chosen so that a fraction q of the
+particles are within all of them, so no single dimension dominates the
+rejections. Models whose distances are on very different scales may instead be
+reduced to one scaled distance (smc_scaling.h).
+
+The run stops after n_rounds rounds, or earlier when either
+- the relative decrease of the (adaptive) distance threshold falls below
+	threshold_tolerance for every distance dimension, or
+- the largest change in a parameter's posterior mean, standard deviation or
+	5%, 50% and 95% quantiles between two rounds, in units of its posterior
+	standard deviation, falls below posterior_tolerance.
+Setting a tolerance to 0 disables that rule.
+
+After each round the weighted particles are summarised (smc_summary.h) per
+parameter: mean, variance, quantile sketch and a fixed-bin histogram on
+[histogram_lower, histogram_upper]. If no histogram range is given, the range of
+the particles of round 0 is used for every round.
+
+Three inference modes are supported (inference_mode):
+- SMC_MODE_REJECTION: one simulation per proposal, accepted if every distance is
+	within its threshold.
+- SMC_MODE_AVERAGED_ACCEPTANCE: n_simulations_per_particle simulations per
+	proposal. The proposal is kept if any of them is accepted, and its weight is
+	multiplied by the fraction accepted, which reduces the variance of the
+	weights when acceptance is noisy.
+- SMC_MODE_SYNTHETIC_LIKELIHOOD: n_simulations_per_particle simulations of the
+	model's summary statistics per proposal, whose mean and covariance define a
+	Gaussian likelihood of the observed summaries (Wood 2010). Every proposal
+	with a non-singular covariance is kept, weighted by this likelihood, so no
+	distance threshold is used. It needs more simulations than summaries.
+Models may provide batched simulators (simulate_distance_batch,
+simulate_summary_batch) to amortise set-up cost over the simulations of a
+particle.
+
+In SMC_MODE_REJECTION, a model may also simulate many particles at once
+(simulate_distance_block), e.g. as one matrix product. Each thread then proposes
+block_size particles ahead, simulates them together, and hands them to the slots
+it fills in the order they were proposed. As every proposal of a round is drawn
+from the same mixture, slots take the same particles as if each had been
+simulated as it was proposed. Proposals left in a thread's block when the round
+ends are discarded, so a round costs up to block_size - 1 more simulations per
+thread, and may overrun its budget by as many.
+
+With n_threads > 1, each round is sampled by a pool of threads which claim
+empty particle slots one at a time with atomic counters, so that a few slots
+needing many proposals do not leave the other threads idle. Thread 0 uses
+the seed of the run and the others derived seeds; which thread fills which slot
+depends on timing, so only single-threaded runs are reproducible. Importance
+weights are computed by the same threads in chunks of SMC_WEIGHT_CHUNK_SIZE
+particles. Each thread starts from its own contiguous range of slots and steals
+from the ranges of other threads once its own is exhausted.
+
+For expensive simulators in SMC_MODE_REJECTION, surrogate_screening discards
+proposals which are unlikely to be accepted before they are simulated. Each
+thread keeps a uniform sample of the proposals it simulated in the previous
+round, surrogate_size in all, with their distances. At the start of a round
+these are labelled accepted or rejected under the new threshold, and a
+proposal theta is simulated with probability
+
+	a(theta) = max(surrogate_min_probability, fraction of the
+		surrogate_neighbours nearest samples which are accepted)
+
+with parameters standardised by their standard deviation in the sample. An
+accepted particle's weight is multiplied by 1/a(theta), so the population
+targets the same posterior as without screening. Round 0 is never screened.
+Every proposal still costs a nearest-neighbour search over the sample, so
+screening only pays off when a simulation costs much more than that.
+
+Each round may be bounded by max_simulations_per_round simulations and
+round_time_limit seconds of wall-clock time. Once either is reached, proposals
+stop and the round falls back on one of (budget_fallback):
+- SMC_FALLBACK_RELAX_THRESHOLD: the round keeps the n_particles proposals with
+	the smallest distances, scaled by their thresholds, and its threshold is
+	relaxed to the largest of them. Every proposal of a round is drawn from the
+	same mixture, so this is a valid population at the relaxed threshold. Each
+	thread keeps its n_particles best proposals of the round, so this costs
+	n_particles*(1 + n_parameters + n_distances) doubles per thread. It applies
+	to SMC_MODE_REJECTION, other modes shrink the population instead.
+- SMC_FALLBACK_SHRINK_POPULATION: the round keeps only the particles accepted so
+	far, at the original threshold.
+Either way the round may hold fewer than n_particles particles (n_accepted).
+Its remaining slots have NAN parameters and zero weight, and the fallback is
+recorded in fallback. If a round accepts nothing, the run stops with
+SMC_STOP_BUDGET_EXHAUSTED. Limits are checked every SMC_BUDGET_CHECK_INTERVAL
+simulations of a thread and before every proposal, so a round may overrun them
+by up to the time of one proposal per thread.
+
+Round 0 draws from the prior by sample_prior, unless prior_sampling selects a
+randomised quasi-Monte Carlo sequence (smc_qmc.h). Proposals of round 0 are then
+successive points of one Sobol or Halton sequence shared by every thread, mapped
+to the prior by the model's prior_quantile. These cover the prior more evenly
+than independent draws, so the first population is spread better for the same
+number of simulations. Only the points used depend on the seed and, with several
+threads, on timing.
+
+A run may instead start from a saved population (initial_theta, initial_weight),
+e.g. the posterior of an earlier run before new observations were appended to
+the data. Round 0 then perturbs that population, resampled by the ESS rule
+above, and is weighted like any later round, w_i = prior(theta_i)/sum_j w_j
+K(theta_j, theta_i), so the run targets the posterior given all of the data.
+When the new data move the posterior only a little, a few rounds at the final
+threshold of the earlier run update it for a fraction of the simulations of a
+run from the prior.
+
+With numa_aware set, threads are pinned to processors (smc_numa.h), and each
+thread first writes its own range of the population, so those pages are placed
+on its node. The mixture of the previous generation, which every thread reads
+at random, is copied once per round to each node in use, by the first thread on
+that node.
+*/
+
+#ifndef SMC_ENGINE_H
+#define SMC_ENGINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_sort_double.h>
+#include <gsl/gsl_statistics.h>
+
+#include "smc_summary.h"
+#include "smc_numa.h"
+#include "smc_qmc.h"
+
+#define SMC_STOP_MAX_ROUNDS 0
+#define SMC_STOP_THRESHOLD_CONVERGED 1
+#define SMC_STOP_POSTERIOR_CONVERGED 2
+#define SMC_STOP_BUDGET_EXHAUSTED 3
+
+#define SMC_MODE_REJECTION 0
+#define SMC_MODE_AVERAGED_ACCEPTANCE 1
+#define SMC_MODE_SYNTHETIC_LIKELIHOOD 2
+
+#define SMC_FALLBACK_NONE 0
+#define SMC_FALLBACK_RELAX_THRESHOLD 1
+#define SMC_FALLBACK_SHRINK_POPULATION 2
+
+#define SMC_WEIGHT_CHUNK_SIZE 64
+#define SMC_MIN_THRESHOLD_QUANTILE 0.05
+#define SMC_MAX_THRESHOLD_QUANTILE 0.95
+#define SMC_BUDGET_CHECK_INTERVAL 64
+
+typedef struct smc_model smc_model;
+typedef struct smc_population smc_population;
+
+struct smc_model {
+	int n_parameters;
+	int n_distances;
+	size_t workspace_size; // bytes of scratch space needed by simulate_distance
+	void *params; // model-specific data and settings
+
+	void (*sample_prior)(gsl_rng *r, const smc_model *model, double *theta);
+	/*Optional, needed for prior_sampling. Map u in (0,1)^n_parameters to theta
+	by the inverse CDF of the prior of each parameter*/
+	void (*prior_quantile)(const smc_model *model, const double *u,
+		double *theta);
+	double (*prior_pdf)(const smc_model *model, const double *theta);
+	void (*perturb)(gsl_rng *r, const smc_model *model, const double *theta_old,
+		double *theta_new);
+	double (*kernel_pdf)(const smc_model *model, const double *theta_old,
+		const double *theta_new);
+	void (*simulate_distance)(gsl_rng *r, const smc_model *model,
+		const double *theta, void *workspace, double *distance);
+
+	/*Optional. Fill distance, (n_simulations X n_distances), with the distances
+	of n_simulations datasets simulated at theta*/
+	void (*simulate_distance_batch)(gsl_rng *r, const smc_model *model,
+		const double *theta, int n_simulations, void *workspace, double *distance);
+
+	/*Optional, used in rejection mode. Fill distance, (n_theta X n_distances),
+	with the distances of one dataset simulated at each row of theta,
+	(n_theta X n_parameters), for n_theta up to block_size*/
+	int block_size;
+	void (*simulate_distance_block)(gsl_rng *r, const smc_model *model,
+		int n_theta, const double *theta, void *workspace, double *distance);
+
+	/*Optional, needed for synthetic likelihood. Fill summary,
+	(n_simulations X n_summaries), with the summary statistics of n_simulations
+	datasets simulated at theta*/
+	int n_summaries;
+	const double *observed_summary; // (n_summaries), summaries of the data
+	void (*simulate_summary_batch)(gsl_rng *r, const smc_model *model,
+		const double *theta, int n_simulations, void *workspace, double *summary);
+
+	/*Optional, used by Mahalanobis distance scaling (smc_scaling.h). Fill
+	summary, (n_theta X n_summaries), with the summary statistics of one dataset
+	simulated at each row of theta, for n_theta up to block_size*/
+	void (*simulate_summary_block)(gsl_rng *r, const smc_model *model,
+		int n_theta, const double *theta, void *workspace, double *summary);
+};
+
+typedef struct {
+	int n_particles;
+	int n_rounds; // maximum number of rounds of SMC
+	unsigned long int seed;
+
+	/*Either a (n_rounds X n_distances) schedule of thresholds, or NULL to adapt
+	the threshold as a quantile of the accepted distances of the previous round,
+	starting from threshold_init*/
+	double *threshold_schedule;
+	double *threshold_init;
+	double quantile_accept_distance;
+	double target_acceptance_rate; // 0 to use quantile_accept_distance
+
+	double ess_resample_fraction;
+	double threshold_tolerance;
+	double posterior_tolerance;
+
+	int sketch_compression;
+	int n_histogram_bins;
+	double *histogram_lower; // (n_parameters), or NULL
+	double *histogram_upper; // (n_parameters), or NULL
+
+	int inference_mode; // one of SMC_MODE_*
+	int n_simulations_per_particle; // unused by SMC_MODE_REJECTION
+	int n_threads; // threads sampling each round
+	int numa_aware; // pin threads and keep their memory on their NUMA node
+	int prior_sampling; // SMC_QMC_NONE, SMC_QMC_SOBOL or SMC_QMC_HALTON, for round 0
+
+	/*Optional. A weighted population, (n_initial X n_parameters), which round 0
+	is proposed from instead of the prior*/
+	const double *initial_theta;
+	const double *initial_weight; // (n_initial), need not be normalised
+	int n_initial;
+
+	long max_simulations_per_round; // 0 for no limit
+	double round_time_limit; // seconds, 0 for no limit
+	int budget_fallback; // one of SMC_FALLBACK_*, used when a limit is reached
+
+	int surrogate_screening; // screen proposals with a nearest-neighbour surrogate
+	int surrogate_size; // simulated proposals of a round kept to screen the next
+	int surrogate_neighbours;
+	double surrogate_min_probability; // in (0, 1]
+
+	/*Optional. Called with round_callback_data once each round's weights and
+	summaries are final, e.g. to write it out (smc_writer.h)*/
+	void (*round_callback)(const smc_population *population, int time_smc,
+		void *data);
+	void *round_callback_data;
+
+	int verbose;
+} smc_settings;
+
+struct smc_population {
+	int n_parameters;
+	int n_distances;
+	int n_rounds;
+	int n_particles;
+	int n_rounds_completed;
+	int stop_reason;
+
+	double ***theta_particle; // (n_parameters X n_rounds X n_particles)
+	double **weight; // (n_rounds X n_particles), normalised
+	double **distance_threshold; // (n_distances X n_rounds)
+	double *ess; // (n_rounds)
+	int *resampled; // (n_rounds), 1 if round t was proposed from a resample
+	long *n_simulations; // (n_rounds)
+	long *n_screened; // (n_rounds), proposals discarded by the surrogate unsimulated
+	int *n_accepted; // (n_rounds), particles held, n_particles unless a limit was reached
+	int *fallback; // (n_rounds), the SMC_FALLBACK_* applied to round t
+	smc_summary *summary; // (n_rounds X n_parameters)
+
+	double *theta_block; // contiguous storage behind theta_particle
+	double *weight_block; // contiguous storage behind weight
+	double *threshold_block; // contiguous storage behind distance_threshold
+};
+
+smc_settings smc_default_settings(void){
+	/*Settings used unless a driver overrides them*/
+	smc_settings settings;
+	settings.n_particles = 1000;
+	settings.n_rounds = 10;
+	settings.seed = 1;
+	settings.threshold_schedule = NULL;
+	settings.threshold_init = NULL;
+	settings.quantile_accept_distance = 0.8;
+	settings.target_acceptance_rate = 0.0;
+	settings.ess_resample_fraction = 0.5;
+	settings.threshold_tolerance = 0.0;
+	settings.posterior_tolerance = 0.0;
+	settings.sketch_compression = 100;
+	settings.n_histogram_bins = 50;
+	settings.histogram_lower = NULL;
+	settings.histogram_upper = NULL;
+	settings.inference_mode = SMC_MODE_REJECTION;
+	settings.n_simulations_per_particle = 1;
+	settings.n_threads = 1;
+	settings.numa_aware = 0;
+	settings.prior_sampling = SMC_QMC_NONE;
+	settings.initial_theta = NULL;
+	settings.initial_weight = NULL;
+	settings.n_initial = 0;
+	settings.max_simulations_per_round = 0;
+	settings.round_time_limit = 0.0;
+	settings.budget_fallback = SMC_FALLBACK_RELAX_THRESHOLD;
+	settings.surrogate_screening = 0;
+	settings.surrogate_size = 2000;
+	settings.surrogate_neighbours = 20;
+	settings.surrogate_min_probability = 0.1;
+	settings.round_callback = NULL;
+	settings.round_callback_data = NULL;
+	settings.verbose = 0;
+	return settings;
+}
+
+smc_population *smc_population_alloc(const smc_model *model,
+	const smc_settings *settings){
+	/*Allocate storage for every particle, weight and threshold of a run
+
+	Returns
+	----------------
+	A pointer to an smc_population, or NULL if allocation failed
+	*/
+	int i, j;
+	int n_parameters = model->n_parameters;
+	int n_distances = model->n_distances;
+	int n_rounds = settings->n_rounds;
+	int n_particles = settings->n_particles;
+	smc_population *population = calloc(1, sizeof(smc_population));
+	if (population == NULL) return NULL;
+
+	population->n_parameters = n_parameters;
+	population->n_distances = n_distances;
+	population->n_rounds = n_rounds;
+	population->n_particles = n_particles;
+
+	population->theta_block = malloc((size_t)n_parameters * n_rounds *
+		n_particles * sizeof(double));
+	population->weight_block = malloc((size_t)n_rounds * n_particles *
+		sizeof(double));
+	population->threshold_block = malloc((size_t)n_distances * n_rounds *
+		sizeof(double));
+	population->theta_particle = malloc(n_parameters * sizeof(double**));
+	population->weight = malloc(n_rounds * sizeof(double*));
+	population->distance_threshold = malloc(n_distances * sizeof(double*));
+	population->ess = calloc(n_rounds, sizeof(double));
+	population->resampled = calloc(n_rounds, sizeof(int));
+	population->n_simulations = calloc(n_rounds, sizeof(long));
+	population->n_screened = calloc(n_rounds, sizeof(long));
+	population->n_accepted = calloc(n_rounds, sizeof(int));
+	population->fallback = calloc(n_rounds, sizeof(int));
+	population->summary = calloc((size_t)n_rounds * n_parameters,
+		sizeof(smc_summary));
+	if ((population->theta_block == NULL) || (population->weight_block == NULL) ||
+		(population->threshold_block == NULL) ||
+		(population->theta_particle == NULL) || (population->weight == NULL) ||
+		(population->distance_threshold == NULL) || (population->ess == NULL) ||
+		(population->resampled == NULL) || (population->n_simulations == NULL) ||
+		(population->n_screened == NULL) || (population->n_accepted == NULL) ||
+		(population->fallback == NULL) ||
+		(population->summary == NULL)) {
+		printf("Error allocating SMC population\n");
+		return NULL;
+	}
+
+	for (i = 0; i < n_parameters; i++) {
+		population->theta_particle[i] = malloc(n_rounds * sizeof(double*));
+		if (population->theta_particle[i] == NULL) return NULL;
+		for (j = 0; j < n_rounds; j++) {
+			population->theta_particle[i][j] = population->theta_block +
+				((size_t)i * n_rounds + j) * n_particles;
+		}
+	}
+	for (j = 0; j < n_rounds; j++) {
+		population->weight[j] = population->weight_block + (size_t)j * n_particles;
+	}
+	for (i = 0; i < n_distances; i++) {
+		population->distance_threshold[i] = population->threshold_block +
+			(size_t)i * n_rounds;
+	}
+	return population;
+}
+
+void smc_population_free(smc_population *population){
+	/*Free an smc_population allocated by smc_population_alloc()*/
+	int i;
+	if (population == NULL) return;
+	if (population->theta_particle != NULL) {
+		for (i = 0; i < population->n_parameters; i++) {
+			free(population->theta_particle[i]);
+		}
+	}
+	free(population->theta_particle);
+	free(population->weight);
+	free(population->distance_threshold);
+	free(population->theta_block);
+	free(population->weight_block);
+	free(population->threshold_block);
+	free(population->ess);
+	free(population->resampled);
+	free(population->n_simulations);
+	free(population->n_screened);
+	free(population->n_accepted);
+	free(population->fallback);
+	if (population->summary != NULL) {
+		for (i = 0; i < population->n_rounds*population->n_parameters; i++) {
+			smc_summary_free(&population->summary[i]);
+		}
+	}
+	free(population->summary);
+	free(population);
+}
+
+double effective_sample_size(const double *weight, int n){
+	/*The effective sample size 1/sum(w^2) of an array of normalised weights*/
+	int i;
+	double sum_sq = 0.0;
+	for (i = 0; i < n; i++) sum_sq += weight[i]*weight[i];
+	return 1.0/sum_sq;
+}
+
+int weighted_choice(gsl_rng *r, const double *cumulative_weight, int n){
+	/*Sample from an array of cumulative weights by bisection
+
+	Parameters
+	----------------
+	r : A GSL random number generator
+	cumulative_weight : An array of length n of non-decreasing partial sums of
+		the weights. They need not sum to 1.
+	n : The number of weights
+
+	Returns
+	----------------
+	An index i, sampled with probability proportional to weight i
+	*/
+	double u = gsl_rng_uniform(r)*cumulative_weight[n-1];
+	int lower = 0;
+	int upper = n - 1;
+	int middle;
+	while (lower < upper) {
+		middle = (lower + upper)/2;
+		if (cumulative_weight[middle] >= u) upper = middle;
+		else lower = middle + 1;
+	}
+	return lower;
+}
+
+int systematic_resample(gsl_rng *r, const double *weight, int n,
+	int *mixture_index, double *mixture_weight){
+	/*Systematically resample n particles with normalised weights, collapsing
+	duplicated particles into a single mixture component
+
+	Parameters
+	----------------
+	r : A GSL random number generator
+	weight : An array of n normalised weights
+	n : The number of particles
+	mixture_index : An array of length n, filled with the indices of the
+		particles which survive resampling
+	mixture_weight : An array of length n, filled with the number of copies of
+		each surviving particle divided by n
+
+	Returns
+	----------------
+	The number of distinct surviving particles
+	*/
+	int i;
+	int n_mixture = 0;
+	int n_copies;
+	double u = gsl_rng_uniform(r)/n;
+	double up_to = 0.0;
+
+	for (i = 0; i < n; i++) {
+		up_to += weight[i];
+		n_copies = 0;
+		while ((u < up_to) && (u < 1.0)) {
+			n_copies++;
+			u += 1.0/n;
+		}
+		if (n_copies > 0) {
+			mixture_index[n_mixture] = i;
+			mixture_weight[n_mixture] = (double)n_copies/n;
+			n_mixture++;
+		}
+	}
+	return n_mixture;
+}
+
+smc_summary *smc_population_summary(smc_population *population, int time_smc,
+	int parameter_index){
+	/*The summary of parameter parameter_index at round time_smc*/
+	return &population->summary[(size_t)time_smc*population->n_parameters +
+		parameter_index];
+}
+
+double smc_posterior_change(smc_population *population, int time_smc,
+	int parameter_index){
+	/*The largest change between rounds time_smc - 1 and time_smc in the mean,
+	standard deviation and 5%, 50% and 95% quantiles of a parameter's posterior,
+	in units of its posterior standard deviation at round time_smc, so that a
+	posterior whose centre has settled but which is still narrowing has not
+	converged*/
+	static const double quantiles[3] = {0.05, 0.5, 0.95};
+	smc_summary *summary = smc_population_summary(population, time_smc,
+		parameter_index);
+	smc_summary *previous = smc_population_summary(population, time_smc - 1,
+		parameter_index);
+	double sd = sqrt(smc_summary_variance(summary)), change, max_change;
+	int q;
+	max_change = fabs(summary->mean - previous->mean);
+	change = fabs(sd - sqrt(smc_summary_variance(previous)));
+	if (change > max_change) max_change = change;
+	for (q = 0; q < 3; q++) {
+		change = fabs(smc_summary_quantile(summary, quantiles[q]) -
+			smc_summary_quantile(previous, quantiles[q]));
+		if (change > max_change) max_change = change;
+	}
+	return (sd > 0.0) ? max_change/sd : max_change;
+}
+
+int smc_summarise_round(const smc_settings *settings,
+	smc_population *population, int time_smc, double *hist_lower,
+	double *hist_upper){
+	/*Summarise the weighted particles of round time_smc
+
+	Parameters
+	----------------
+	settings : Settings of the run
+	population : The population, whose weights for round time_smc are final
+	time_smc : The round to summarise
+	hist_lower, hist_upper : Arrays of length n_parameters with the histogram
+		range of each parameter
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	int i, k;
+	smc_summary *summary;
+	for (k = 0; k < population->n_parameters; k++) {
+		summary = smc_population_summary(population, time_smc, k);
+		if (smc_summary_init(summary, settings->sketch_compression,
+				settings->n_histogram_bins, hist_lower[k], hist_upper[k]) != 0) {
+			return -1;
+		}
+		for (i = 0; i < population->n_accepted[time_smc]; i++) {
+			smc_summary_add(summary, population->theta_particle[k][time_smc][i],
+				population->weight[time_smc][i]);
+		}
+		smc_summary_compress(summary);
+	}
+	return 0;
+}
+
+int smc_accept(const double *distance, const double *threshold, int n_distances){
+	/*1 if every distance is within its threshold, 0 otherwise*/
+	int i;
+	for (i = 0; i < n_distances; i++) {
+		if (distance[i] > threshold[i]) return 0;
+	}
+	return 1;
+}
+
+double smc_joint_thresholds(const double *distance, double *sorted,
+	int n_distances, int stride, int n, double quantile, double *threshold){
+	/*Set each threshold to the same quantile u of its own dimension, with u
+	chosen so that a fraction quantile of the particles are within every
+	threshold
+
+	Parameters
+	----------------
+	distance : (n_distances X stride), the distances of the first n particles
+	sorted : Scratch of the size of distance
+	n_distances : The number of distances
+	stride : The distance between dimensions in distance
+	n : The number of particles
+	quantile : The fraction of particles within the new thresholds
+	threshold : Filled with the new thresholds, (n_distances)
+
+	Returns
+	----------------
+	The quantile u of each dimension
+	*/
+	double lower = 0.0, upper = 1.0, u = 1.0;
+	int i, j, iteration, n_within;
+
+	for (i = 0; i < n_distances; i++) {
+		memcpy(sorted + (size_t)i*stride, distance + (size_t)i*stride,
+			n * sizeof(double));
+		gsl_sort(sorted + (size_t)i*stride, 1, n);
+	}
+	/*The fraction within every threshold increases with u, so bisect*/
+	for (iteration = 0; iteration <= 40; iteration++) {
+		u = (iteration < 40) ? 0.5*(lower + upper) : upper;
+		for (i = 0; i < n_distances; i++) {
+			threshold[i] = gsl_stats_quantile_from_sorted_data(
+				sorted + (size_t)i*stride, 1, n, u);
+		}
+		if (iteration == 40) break;
+		n_within = 0;
+		for (j = 0; j < n; j++) {
+			for (i = 0; i < n_distances; i++) {
+				if (distance[(size_t)i*stride + j] > threshold[i]) break;
+			}
+			n_within += (i == n_distances);
+		}
+		if (n_within < quantile*n) lower = u;
+		else upper = u;
+	}
+	return u;
+}
+
+double synthetic_log_likelihood(const double *summary, int n_simulations,
+	int n_summaries, const double *observed_summary, double *mean, double *cov){
+	/*The Gaussian synthetic log-likelihood (Wood 2010) of the observed summary
+	statistics, up to a constant
+
+	Parameters
+	----------------
+	summary : A (n_simulations X n_summaries) array of simulated summaries
+	n_simulations : The number of simulations, which must exceed n_summaries
+	n_summaries : The number of summary statistics
+	observed_summary : The summary statistics of the data
+	mean : Scratch of length n_summaries
+	cov : Scratch of length n_summaries*n_summaries
+
+	Returns
+	----------------
+	-1/2 (s - mu)^T Sigma^-1 (s - mu) - 1/2 log|Sigma|, with mu and Sigma the
+	sample mean and covariance of the simulated summaries, or -INFINITY if Sigma
+	is singular
+	*/
+	int i, j, k;
+	double sum, log_det = 0.0, quadratic = 0.0;
+
+	for (j = 0; j < n_summaries; j++) {
+		mean[j] = 0.0;
+		for (i = 0; i < n_simulations; i++) mean[j] += summary[i*n_summaries + j];
+		mean[j] /= n_simulations;
+	}
+	for (j = 0; j < n_summaries; j++) {
+		for (k = 0; k <= j; k++) {
+			sum = 0.0;
+			for (i = 0; i < n_simulations; i++) {
+				sum += (summary[i*n_summaries + j] - mean[j])*
+					(summary[i*n_summaries + k] - mean[k]);
+			}
+			cov[j*n_summaries + k] = sum/(n_simulations - 1);
+		}
+	}
+
+	/*Cholesky factorise Sigma = L L^T in the lower triangle of cov*/
+	for (j = 0; j < n_summaries; j++) {
+		for (k = 0; k <= j; k++) {
+			sum = cov[j*n_summaries + k];
+			for (i = 0; i < k; i++) {
+				sum -= cov[j*n_summaries + i]*cov[k*n_summaries + i];
+			}
+			if (k == j) {
+				if (sum <= 0.0) return -INFINITY;
+				cov[j*n_summaries + j] = sqrt(sum);
+				log_det += 2.0*log(cov[j*n_summaries + j]);
+			}
+			else cov[j*n_summaries + k] = sum/cov[k*n_summaries + k];
+		}
+	}
+
+	/*Solve L z = s - mu by forward substitution, reusing mean for z*/
+	for (j = 0; j < n_summaries; j++) {
+		sum = observed_summary[j] - mean[j];
+		for (i = 0; i < j; i++) sum -= cov[j*n_summaries + i]*mean[i];
+		mean[j] = sum/cov[j*n_summaries + j];
+		quadratic += mean[j]*mean[j];
+	}
+	return -0.5*quadratic - 0.5*log_det;
+}
+
+typedef struct {
+	/*The state of one sampler: its random number generator and scratch space*/
+	gsl_rng *r;
+	void *workspace;
+	double *theta; // (n_parameters)
+	double *theta_ancestor; // (n_parameters)
+	double *distance; // (n_simulations_per_particle X n_distances)
+	double *summary; // (n_simulations_per_particle X n_summaries)
+	double *summary_mean; // (n_summaries)
+	double *summary_cov; // (n_summaries X n_summaries)
+
+	long budget_pending; // simulations not yet counted against the round's budget
+
+	/*The pool_capacity best proposals of the round, kept for
+	SMC_FALLBACK_RELAX_THRESHOLD, as a max-heap on pool_key*/
+	int pool_size;
+	int pool_capacity; // 0 if proposals are not kept
+	double *pool_key; // (pool_capacity), the largest distance/threshold ratio
+	double *pool_theta; // (pool_capacity X n_parameters)
+	double *pool_distance; // (pool_capacity X n_distances)
+	double *pool_log_weight; // (pool_capacity), the log screening correction
+
+	/*Proposals simulated together by the model's simulate_distance_block, taken
+	by slots in the order they were proposed*/
+	int block_capacity; // 0 unless proposals are simulated in blocks
+	int block_n; // proposals in the block
+	int block_next; // the next proposal of the block to take
+	double *block_theta; // (block_capacity X n_parameters)
+	double *block_distance; // (block_capacity X n_distances)
+	double *block_log_weight; // (block_capacity), the log screening correction
+
+	/*A uniform sample of the proposals simulated in the round, which trains the
+	surrogate of the next round*/
+	int sample_size;
+	int sample_capacity; // 0 without surrogate screening
+	long sample_seen; // proposals offered to the sample
+	double *sample_theta; // (sample_capacity X n_parameters)
+	double *sample_distance; // (sample_capacity X n_distances)
+	double *neighbour_distance; // (surrogate_neighbours), scratch
+	int *neighbour_accepted; // (surrogate_neighbours), scratch
+	double *standardised_theta; // (n_parameters), scratch
+} smc_worker;
+
+int smc_keeps_proposals(const smc_settings *settings){
+	/*1 if the threshold of a round may be relaxed to its best proposals*/
+	return ((settings->max_simulations_per_round > 0) ||
+		(settings->round_time_limit > 0.0)) &&
+		(settings->budget_fallback == SMC_FALLBACK_RELAX_THRESHOLD) &&
+		(settings->inference_mode == SMC_MODE_REJECTION);
+}
+
+int smc_screens_proposals(const smc_settings *settings){
+	/*1 if proposals are screened by a surrogate before being simulated*/
+	return settings->surrogate_screening &&
+		(settings->inference_mode == SMC_MODE_REJECTION);
+}
+
+int smc_simulates_blocks(const smc_model *model, const smc_settings *settings){
+	/*1 if proposals are simulated in blocks by the model*/
+	return (model->simulate_distance_block != NULL) && (model->block_size > 1) &&
+		(settings->inference_mode == SMC_MODE_REJECTION);
+}
+
+int smc_worker_init(smc_worker *worker, const smc_model *model,
+	const smc_settings *settings, unsigned long int seed){
+	/*Allocate a worker, with its random number generator seeded by seed.
+	Returns 0 on success, -1 otherwise*/
+	int n_simulations = settings->n_simulations_per_particle;
+	int n_summaries = model->n_summaries > 0 ? model->n_summaries : 1;
+	int n_threads = (settings->n_threads > 0) ? settings->n_threads : 1;
+	int n_neighbours = (settings->surrogate_neighbours > 0) ?
+		settings->surrogate_neighbours : 1;
+
+	worker->r = gsl_rng_alloc(gsl_rng_mt19937);
+	if (worker->r != NULL) gsl_rng_set(worker->r, seed);
+	worker->workspace = malloc(model->workspace_size > 0 ? model->workspace_size : 1);
+	worker->theta = malloc(model->n_parameters * sizeof(double));
+	worker->theta_ancestor = malloc(model->n_parameters * sizeof(double));
+	worker->distance = malloc((size_t)n_simulations * model->n_distances *
+		sizeof(double));
+	worker->summary = malloc((size_t)n_simulations * n_summaries * sizeof(double));
+	worker->summary_mean = malloc(n_summaries * sizeof(double));
+	worker->summary_cov = malloc(n_summaries * n_summaries * sizeof(double));
+	worker->budget_pending = 0;
+	worker->pool_size = 0;
+	worker->pool_capacity = smc_keeps_proposals(settings) ?
+		settings->n_particles : 0;
+	worker->pool_key = malloc((worker->pool_capacity + 1) * sizeof(double));
+	worker->pool_theta = malloc(((size_t)worker->pool_capacity + 1) *
+		model->n_parameters * sizeof(double));
+	worker->pool_distance = malloc(((size_t)worker->pool_capacity + 1) *
+		model->n_distances * sizeof(double));
+	worker->pool_log_weight = malloc((worker->pool_capacity + 1) * sizeof(double));
+	worker->block_n = 0;
+	worker->block_next = 0;
+	worker->block_capacity = smc_simulates_blocks(model, settings) ?
+		model->block_size : 0;
+	worker->block_theta = malloc(((size_t)worker->block_capacity + 1) *
+		model->n_parameters * sizeof(double));
+	worker->block_distance = malloc(((size_t)worker->block_capacity + 1) *
+		model->n_distances * sizeof(double));
+	worker->block_log_weight = malloc((worker->block_capacity + 1) *
+		sizeof(double));
+	worker->sample_size = 0;
+	worker->sample_seen = 0;
+	worker->sample_capacity = smc_screens_proposals(settings) ?
+		(settings->surrogate_size + n_threads - 1)/n_threads : 0;
+	worker->sample_theta = malloc(((size_t)worker->sample_capacity + 1) *
+		model->n_parameters * sizeof(double));
+	worker->sample_distance = malloc(((size_t)worker->sample_capacity + 1) *
+		model->n_distances * sizeof(double));
+	worker->neighbour_distance = malloc((n_neighbours + 1) * sizeof(double));
+	worker->neighbour_accepted = malloc((n_neighbours + 1) * sizeof(int));
+	worker->standardised_theta = malloc(model->n_parameters * sizeof(double));
+	if ((worker->r == NULL) || (worker->workspace == NULL) ||
+		(worker->theta == NULL) || (worker->theta_ancestor == NULL) ||
+		(worker->distance == NULL) || (worker->summary == NULL) ||
+		(worker->summary_mean == NULL) || (worker->summary_cov == NULL) ||
+		(worker->pool_key == NULL) || (worker->pool_theta == NULL) ||
+		(worker->pool_distance == NULL) || (worker->pool_log_weight == NULL) ||
+		(worker->block_theta == NULL) || (worker->block_distance == NULL) ||
+		(worker->block_log_weight == NULL) || (worker->sample_theta == NULL) ||
+		(worker->sample_distance == NULL) ||
+		(worker->neighbour_distance == NULL) ||
+		(worker->neighbour_accepted == NULL) ||
+		(worker->standardised_theta == NULL)) {
+		printf("Error allocating SMC worker\n");
+		return -1;
+	}
+	return 0;
+}
+
+void smc_worker_free(smc_worker *worker){
+	/*Free a worker initialised by smc_worker_init()*/
+	if (worker->r != NULL) gsl_rng_free(worker->r);
+	free(worker->workspace);
+	free(worker->theta);
+	free(worker->theta_ancestor);
+	free(worker->distance);
+	free(worker->summary);
+	free(worker->summary_mean);
+	free(worker->summary_cov);
+	free(worker->pool_key);
+	free(worker->pool_theta);
+	free(worker->pool_distance);
+	free(worker->pool_log_weight);
+	free(worker->block_theta);
+	free(worker->block_distance);
+	free(worker->block_log_weight);
+	free(worker->sample_theta);
+	free(worker->sample_distance);
+	free(worker->neighbour_distance);
+	free(worker->neighbour_accepted);
+	free(worker->standardised_theta);
+}
+
+void smc_pool_swap(smc_worker *worker, int a, int b, int n_parameters,
+	int n_distances){
+	/*Swap two entries of a worker's pool of proposals*/
+	double swap;
+	int k;
+	swap = worker->pool_key[a];
+	worker->pool_key[a] = worker->pool_key[b];
+	worker->pool_key[b] = swap;
+	swap = worker->pool_log_weight[a];
+	worker->pool_log_weight[a] = worker->pool_log_weight[b];
+	worker->pool_log_weight[b] = swap;
+	for (k = 0; k < n_parameters; k++) {
+		swap = worker->pool_theta[(size_t)a*n_parameters + k];
+		worker->pool_theta[(size_t)a*n_parameters + k] =
+			worker->pool_theta[(size_t)b*n_parameters + k];
+		worker->pool_theta[(size_t)b*n_parameters + k] = swap;
+	}
+	for (k = 0; k < n_distances; k++) {
+		swap = worker->pool_distance[(size_t)a*n_distances + k];
+		worker->pool_distance[(size_t)a*n_distances + k] =
+			worker->pool_distance[(size_t)b*n_distances + k];
+		worker->pool_distance[(size_t)b*n_distances + k] = swap;
+	}
+}
+
+void smc_pool_add(smc_worker *worker, const double *distance,
+	double log_weight, const double *threshold, int n_parameters,
+	int n_distances){
+	/*Offer the worker's current proposal, with the given distances and log
+	screening correction, to its pool.
+	It is kept if the pool is not full, or if it is closer to the data than the
+	worst proposal in the pool, which it then replaces.*/
+	double key = 0.0, ratio;
+	int i, child, parent;
+
+	for (i = 0; i < n_distances; i++) {
+		if (threshold[i] > 0.0) ratio = distance[i]/threshold[i];
+		else ratio = (distance[i] <= threshold[i]) ? 0.0 : INFINITY;
+		if (isnan(ratio)) ratio = INFINITY;
+		if (ratio > key) key = ratio;
+	}
+
+	if (worker->pool_size < worker->pool_capacity) {
+		i = worker->pool_size++;
+	}
+	else if (key < worker->pool_key[0]) {
+		i = 0;
+	}
+	else return;
+
+	worker->pool_key[i] = key;
+	worker->pool_log_weight[i] = log_weight;
+	memcpy(worker->pool_theta + (size_t)i*n_parameters, worker->theta,
+		n_parameters*sizeof(double));
+	memcpy(worker->pool_distance + (size_t)i*n_distances, distance,
+		n_distances*sizeof(double));
+
+	/*Restore the heap, up from a new entry or down from a replaced root*/
+	while (i > 0) {
+		parent = (i - 1)/2;
+		if (worker->pool_key[parent] >= worker->pool_key[i]) break;
+		smc_pool_swap(worker, i, parent, n_parameters, n_distances);
+		i = parent;
+	}
+	while (1) {
+		child = 2*i + 1;
+		if (child >= worker->pool_size) break;
+		if ((child + 1 < worker->pool_size) &&
+			(worker->pool_key[child + 1] > worker->pool_key[child])) {
+			child++;
+		}
+		if (worker->pool_key[child] <= worker->pool_key[i]) break;
+		smc_pool_swap(worker, i, child, n_parameters, n_distances);
+		i = child;
+	}
+}
+
+typedef struct {
+	/*The limits of a round, shared by every thread*/
+	long max_simulations; // 0 for no limit
+	double deadline; // smc_clock() time the round must end by, 0 for none
+	long n_simulations; // simulations counted so far, over every thread
+	int exhausted; // set once either limit has been reached
+} smc_budget;
+
+double smc_clock(void){
+	/*Monotonic wall-clock time in seconds*/
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1e-9*now.tv_nsec;
+}
+
+int smc_budget_exhausted(smc_budget *budget, smc_worker *worker,
+	long n_simulations){
+	/*Count n_simulations more simulations of worker, adding them to the round's
+	total every SMC_BUDGET_CHECK_INTERVAL simulations. Returns 1 once the
+	round's simulation budget or deadline has been reached*/
+	long total;
+	worker->budget_pending += n_simulations;
+	if (worker->budget_pending >= SMC_BUDGET_CHECK_INTERVAL) {
+		total = __atomic_add_fetch(&budget->n_simulations, worker->budget_pending,
+			__ATOMIC_RELAXED);
+		worker->budget_pending = 0;
+		if ((budget->max_simulations > 0) && (total >= budget->max_simulations)) {
+			__atomic_store_n(&budget->exhausted, 1, __ATOMIC_RELAXED);
+		}
+	}
+	if ((budget->deadline > 0.0) && (smc_clock() >= budget->deadline)) {
+		__atomic_store_n(&budget->exhausted, 1, __ATOMIC_RELAXED);
+	}
+	return __atomic_load_n(&budget->exhausted, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+	/*A nearest-neighbour classifier of whether a proposal will be accepted,
+	trained on the proposals simulated in the previous round*/
+	int n; // training proposals
+	int n_neighbours;
+	double min_probability;
+	double *mean; // (n_parameters)
+	double *scale; // (n_parameters), 1/standard deviation
+	double *theta; // (n X n_parameters), standardised
+	int *accepted; // (n), under the threshold of the round
+} smc_surrogate;
+
+void smc_sample_add(smc_worker *worker, const double *distance,
+	int n_parameters, int n_distances){
+	/*Offer the worker's current proposal, with the given distances, to its
+	sample of the round's simulated proposals (reservoir sampling)*/
+	long i;
+	worker->sample_seen++;
+	if (worker->sample_size < worker->sample_capacity) {
+		i = worker->sample_size++;
+	}
+	else{
+		i = (long)gsl_rng_uniform_int(worker->r, worker->sample_seen);
+		if (i >= worker->sample_capacity) return;
+	}
+	memcpy(worker->sample_theta + (size_t)i*n_parameters, worker->theta,
+		n_parameters*sizeof(double));
+	memcpy(worker->sample_distance + (size_t)i*n_distances, distance,
+		n_distances*sizeof(double));
+}
+
+double smc_surrogate_probability(const smc_surrogate *surrogate,
+	smc_worker *worker, int n_parameters){
+	/*The probability a(theta) of simulating the worker's current proposal: the
+	fraction of its nearest training proposals which were accepted, but at
+	least min_probability*/
+	int n_neighbours = surrogate->n_neighbours;
+	int n_found = 0, n_accepted = 0, i, j, k;
+	double squared, difference, probability;
+	double *z = worker->standardised_theta;
+	const double *x;
+
+	for (k = 0; k < n_parameters; k++) {
+		z[k] = (worker->theta[k] - surrogate->mean[k])*surrogate->scale[k];
+	}
+	for (i = 0; i < surrogate->n; i++) {
+		x = surrogate->theta + (size_t)i*n_parameters;
+		squared = 0.0;
+		for (k = 0; k < n_parameters; k++) {
+			difference = z[k] - x[k];
+			squared += difference*difference;
+		}
+		if ((n_found == n_neighbours) &&
+			(squared >= worker->neighbour_distance[n_found-1])) {
+			continue;
+		}
+		/*Insert into the neighbours found so far, kept in increasing order*/
+		j = (n_found < n_neighbours) ? n_found++ : n_found - 1;
+		while ((j > 0) && (worker->neighbour_distance[j-1] > squared)) {
+			worker->neighbour_distance[j] = worker->neighbour_distance[j-1];
+			worker->neighbour_accepted[j] = worker->neighbour_accepted[j-1];
+			j--;
+		}
+		worker->neighbour_distance[j] = squared;
+		worker->neighbour_accepted[j] = surrogate->accepted[i];
+	}
+	for (j = 0; j < n_found; j++) n_accepted += worker->neighbour_accepted[j];
+	probability = (n_found > 0) ? (double)n_accepted/n_found : 1.0;
+	return (probability > surrogate->min_probability) ? probability :
+		surrogate->min_probability;
+}
+
+typedef struct {
+	/*The weighted particles which new particles are proposed from*/
+	int n;
+	int *index; // (n), index of each component in the previous population
+	double *weight; // (n), normalised
+	double *cumulative; // (n), partial sums of weight
+	double *theta; // (n X n_parameters)
+} smc_mixture;
+
+int smc_propose(const smc_model *model, const smc_mixture *mixture,
+	smc_worker *worker, const smc_surrogate *surrogate, smc_qmc *prior_points,
+	long *n_screened, double *log_weight){
+	/*Propose a particle into worker->theta, from the prior if mixture is NULL.
+	Returns 1 if it is to be simulated, with log_weight set to its log screening
+	correction, or 0 if it is outside the prior's support or screened out*/
+	int n_parameters = model->n_parameters;
+	int k, m;
+	double probability;
+
+	*log_weight = 0.0;
+	if (mixture == NULL) {
+		// Sample from the prior
+		if (prior_points != NULL) {
+			/*theta_ancestor is unused in round 0 and holds the point*/
+			smc_qmc_next(prior_points, worker->theta_ancestor);
+			model->prior_quantile(model, worker->theta_ancestor, worker->theta);
+		}
+		else model->sample_prior(worker->r, model, worker->theta);
+		return 1;
+	}
+
+	/*Sample from the old weights and perturb*/
+	m = weighted_choice(worker->r, mixture->cumulative, mixture->n);
+	for (k = 0; k < n_parameters; k++) {
+		worker->theta_ancestor[k] = mixture->theta[(size_t)m*n_parameters + k];
+	}
+	model->perturb(worker->r, model, worker->theta_ancestor, worker->theta);
+
+	// Check if prior support is 0
+	if (model->prior_pdf(model, worker->theta) <= 0.0) return 0;
+
+	/*Simulate with probability a(theta), correcting the weight by 1/a*/
+	if (surrogate != NULL) {
+		probability = smc_surrogate_probability(surrogate, worker, n_parameters);
+		if (gsl_rng_uniform(worker->r) >= probability) {
+			(*n_screened)++;
+			return 0;
+		}
+		*log_weight = -log(probability);
+	}
+	return 1;
+}
+
+long smc_simulate_block(const smc_model *model, const smc_mixture *mixture,
+	smc_worker *worker, const smc_surrogate *surrogate, smc_qmc *prior_points,
+	long *n_screened){
+	/*Propose a new block of block_capacity particles for the worker and simulate
+	them together. Returns the number of simulations used*/
+	int n_parameters = model->n_parameters;
+	int n = 0;
+	double log_weight;
+
+	while (n < worker->block_capacity) {
+		if (!smc_propose(model, mixture, worker, surrogate, prior_points,
+				n_screened, &log_weight)) {
+			continue;
+		}
+		memcpy(worker->block_theta + (size_t)n*n_parameters, worker->theta,
+			n_parameters*sizeof(double));
+		worker->block_log_weight[n++] = log_weight;
+	}
+	model->simulate_distance_block(worker->r, model, n, worker->block_theta,
+		worker->workspace, worker->block_distance);
+	worker->block_n = n;
+	worker->block_next = 0;
+	return n;
+}
+
+long smc_sample_slot(const smc_model *model, const smc_settings *settings,
+	const smc_mixture *mixture, const double *threshold, smc_worker *worker,
+	smc_budget *budget, const smc_surrogate *surrogate, smc_qmc *prior_points,
+	double *distance, double *log_likelihood, long *n_screened){
+	/*Propose particles until one is accepted, or the round's budget runs out
+
+	Parameters
+	----------------
+	model : The model to perform inference on
+	settings : Settings of the run
+	mixture : The population proposals are perturbed from, or NULL to draw them
+		from the prior
+	threshold : The distance threshold(s) of the round
+	worker : The sampler to use. Its theta is set to the accepted particle
+	budget : The limits of the round, or NULL for none
+	surrogate : The surrogate screening proposals in rejection mode, or NULL
+	prior_points : The sequence round 0 draws from, or NULL to sample the prior
+	distance : Filled with the distance(s) of the accepted particle
+	log_likelihood : Filled with the log of the factor the particle's weight is
+		multiplied by: -log(a(theta)) for rejection (0 unless screened),
+		log(fraction of simulations accepted) for averaged acceptance, the
+		synthetic log-likelihood otherwise. Set to NAN if the budget ran out
+		before a particle was accepted.
+	n_screened : Incremented for every proposal screened out unsimulated
+
+	Returns
+	----------------
+	The number of simulations used
+	*/
+	int n_parameters = model->n_parameters;
+	int n_distances = model->n_distances;
+	int n_simulations = settings->n_simulations_per_particle;
+	int i, j, n_accepted;
+	int accepted = 0;
+	long n_simulations_used = 0, n_simulations_counted = 0;
+	double screening_log_weight = 0.0;
+
+	while (!accepted) {
+		if (budget != NULL) {
+			if (smc_budget_exhausted(budget, worker,
+					n_simulations_used - n_simulations_counted)) {
+				*log_likelihood = NAN;
+				break;
+			}
+			n_simulations_counted = n_simulations_used;
+		}
+		if ((worker->block_capacity == 0) && !smc_propose(model, mixture, worker,
+				surrogate, prior_points, n_screened, &screening_log_weight)) {
+			continue;
+		}
+
+		if (settings->inference_mode == SMC_MODE_SYNTHETIC_LIKELIHOOD) {
+			/*Every proposal is kept, weighted by its synthetic likelihood*/
+			model->simulate_summary_batch(worker->r, model, worker->theta,
+				n_simulations, worker->workspace, worker->summary);
+			n_simulations_used += n_simulations;
+			*log_likelihood = synthetic_log_likelihood(worker->summary, n_simulations,
+				model->n_summaries, model->observed_summary, worker->summary_mean,
+				worker->summary_cov);
+			for (i = 0; i < n_distances; i++) distance[i] = 0.0;
+			accepted = isfinite(*log_likelihood);
+		}
+		else if (settings->inference_mode == SMC_MODE_AVERAGED_ACCEPTANCE) {
+			/*Keep the proposal if any of its simulations is accepted, and weight it
+			by the fraction accepted. Conditional on keeping it, this fraction is an
+			unbiased estimate of P(accept)/P(keep).*/
+			if (model->simulate_distance_batch != NULL) {
+				model->simulate_distance_batch(worker->r, model, worker->theta,
+					n_simulations, worker->workspace, worker->distance);
+			}
+			else{
+				for (j = 0; j < n_simulations; j++) {
+					model->simulate_distance(worker->r, model, worker->theta,
+						worker->workspace, worker->distance + (size_t)j*n_distances);
+				}
+			}
+			n_simulations_used += n_simulations;
+			n_accepted = 0;
+			for (i = 0; i < n_distances; i++) distance[i] = 0.0;
+			for (j = 0; j < n_simulations; j++) {
+				if (smc_accept(worker->distance + (size_t)j*n_distances, threshold,
+						n_distances)) {
+					n_accepted++;
+					for (i = 0; i < n_distances; i++) {
+						distance[i] += worker->distance[(size_t)j*n_distances + i];
+					}
+				}
+			}
+			accepted = (n_accepted > 0);
+			if (accepted) {
+				for (i = 0; i < n_distances; i++) distance[i] /= n_accepted;
+				*log_likelihood = log((double)n_accepted/n_simulations);
+			}
+		}
+		else{
+			if (worker->block_capacity > 0) {
+				/*Take the next proposal of the block, simulating a new block once
+				every proposal of the last has been taken*/
+				if (worker->block_next == worker->block_n) {
+					n_simulations_used += smc_simulate_block(model, mixture, worker,
+						surrogate, prior_points, n_screened);
+				}
+				i = worker->block_next++;
+				memcpy(worker->theta, worker->block_theta + (size_t)i*n_parameters,
+					n_parameters*sizeof(double));
+				memcpy(distance, worker->block_distance + (size_t)i*n_distances,
+					n_distances*sizeof(double));
+				screening_log_weight = worker->block_log_weight[i];
+			}
+			else{
+				model->simulate_distance(worker->r, model, worker->theta,
+					worker->workspace, distance);
+				n_simulations_used++;
+			}
+			*log_likelihood = screening_log_weight;
+			accepted = smc_accept(distance, threshold, n_distances);
+			if (worker->pool_capacity > 0) {
+				smc_pool_add(worker, distance, screening_log_weight, threshold,
+					n_parameters, n_distances);
+			}
+			if (worker->sample_capacity > 0) {
+				smc_sample_add(worker, distance, n_parameters, n_distances);
+			}
+		}
+	}
+	if (budget != NULL) worker->budget_pending += n_simulations_used -
+		n_simulations_counted;
+	return n_simulations_used;
+}
+
+typedef struct smc_round smc_round;
+
+typedef struct {
+	smc_round *round;
+	int index;
+	smc_worker worker;
+	const smc_mixture *mixture; // the copy of the mixture this thread reads
+	double *distance; // (n_distances), the distance of the last accepted particle
+	long n_simulations; // simulations used by this thread in the round
+	long n_screened; // proposals this thread screened out in the round
+	int n_accepted; // slots this thread filled in the round
+	int cpu; // the processor the thread is pinned to, or -1
+	int node; // the thread's NUMA node, numbered from 0 among those used
+	int next_slot; // the next unclaimed slot of the thread's own range
+	int end_slot; // the end of the thread's own range
+	void *(*work)(void*);
+	pthread_t thread;
+	int started;
+} smc_thread;
+
+struct smc_round {
+	/*A round of SMC shared by every thread. Each thread owns a contiguous range
+	of slots, which it claims by atomically advancing its next_slot, and steals
+	from the ranges of other threads once its own is exhausted. A thread writes
+	only to the slots it claimed, so accepted particles are published without
+	locks*/
+	const smc_model *model;
+	const smc_settings *settings;
+	smc_population *population;
+	const smc_mixture *mixture;
+	const double *threshold;
+	int time_smc;
+	int from_prior; // 1 if the round's proposals are drawn from the prior
+	double *distance; // (n_distances X n_particles)
+	double *log_likelihood; // (n_particles), NAN for slots left empty
+	smc_budget *budget; // the limits of the round, or NULL for none
+	const smc_surrogate *surrogate; // screens the round's proposals, or NULL
+	smc_qmc *prior_points; // the sequence round 0 draws from, or NULL
+	smc_thread *thread;
+	int n_threads;
+	int chunk_size;
+	smc_mixture *replica; // (n_nodes) copies of mixture, or NULL
+	int n_nodes;
+};
+
+int smc_claim_range(smc_thread *owner, int chunk_size, int *first){
+	/*Claim the next chunk of slots from the range of owner. Returns the number
+	of slots claimed, starting from *first, or 0 if the range is exhausted*/
+	if (__atomic_load_n(&owner->next_slot, __ATOMIC_RELAXED) >= owner->end_slot) {
+		return 0;
+	}
+	*first = __atomic_fetch_add(&owner->next_slot, chunk_size, __ATOMIC_RELAXED);
+	if (*first >= owner->end_slot) return 0;
+	return (*first + chunk_size <= owner->end_slot) ? chunk_size :
+		owner->end_slot - *first;
+}
+
+int smc_claim_slots(smc_thread *thread, int *first){
+	/*Claim the next chunk of slots for a thread, from its own range first and
+	then from the other threads in turn. Returns the number of slots claimed,
+	starting from *first, or 0 once every slot has been claimed*/
+	smc_round *round = thread->round;
+	int t, n;
+	for (t = 0; t < round->n_threads; t++) {
+		n = smc_claim_range(&round->thread[(thread->index + t) % round->n_threads],
+			round->chunk_size, first);
+		if (n > 0) return n;
+	}
+	return 0;
+}
+
+void *smc_sample_worker(void *arg){
+	/*Fill slots of a round with accepted particles until none are left*/
+	smc_thread *thread = (smc_thread*)arg;
+	smc_round *round = thread->round;
+	smc_population *population = round->population;
+	int n_particles = round->settings->n_particles;
+	int first, n_slots, particle_index, i, k;
+
+	while ((n_slots = smc_claim_slots(thread, &first)) > 0) {
+		for (particle_index = first; particle_index < first + n_slots;
+				particle_index++) {
+			thread->n_simulations += smc_sample_slot(round->model, round->settings,
+				round->from_prior ? NULL : thread->mixture, round->threshold,
+				&thread->worker, round->budget, round->surrogate, round->prior_points,
+				thread->distance, &round->log_likelihood[particle_index],
+				&thread->n_screened);
+			if (isnan(round->log_likelihood[particle_index])) continue;
+			thread->n_accepted++;
+			for (k = 0; k < round->model->n_parameters; k++) {
+				population->theta_particle[k][round->time_smc][particle_index] =
+					thread->worker.theta[k];
+			}
+			for (i = 0; i < round->model->n_distances; i++) {
+				round->distance[(size_t)i*n_particles + particle_index] =
+					thread->distance[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+void *smc_weight_worker(void *arg){
+	/*Set the weight of claimed particles to prior(theta_i)/sum_j w_j
+	K(theta_j, theta_i), where the sum runs over the mixture particles were
+	proposed from*/
+	smc_thread *thread = (smc_thread*)arg;
+	smc_round *round = thread->round;
+	const smc_model *model = round->model;
+	const smc_mixture *mixture = thread->mixture;
+	double *theta = thread->worker.theta;
+	double *weight = round->population->weight[round->time_smc];
+	int n_accepted = round->population->n_accepted[round->time_smc];
+	double kernel_sum;
+	int first, n_slots, i, k, m;
+
+	while ((n_slots = smc_claim_slots(thread, &first)) > 0) {
+		for (i = first; i < first + n_slots; i++) {
+			if (i >= n_accepted) {
+				weight[i] = 0.0;
+				continue;
+			}
+			for (k = 0; k < model->n_parameters; k++) {
+				theta[k] = round->population->theta_particle[k][round->time_smc][i];
+			}
+			kernel_sum = 0.0;
+			for (m = 0; m < mixture->n; m++) {
+				kernel_sum += mixture->weight[m]*model->kernel_pdf(model,
+					mixture->theta + (size_t)m*model->n_parameters, theta);
+			}
+			weight[i] = model->prior_pdf(model, theta)/kernel_sum;
+		}
+	}
+	return NULL;
+}
+
+void *smc_touch_worker(void *arg){
+	/*Write the thread's own range of every round of the population and of the
+	round's scratch, so that its pages are placed on the thread's node*/
+	smc_thread *thread = (smc_thread*)arg;
+	smc_round *round = thread->round;
+	smc_population *population = round->population;
+	int n_particles = round->settings->n_particles;
+	int n_slots = thread->end_slot - thread->next_slot;
+	int t, k, i;
+
+	if (n_slots <= 0) return NULL;
+	for (t = 0; t < population->n_rounds; t++) {
+		for (k = 0; k < population->n_parameters; k++) {
+			memset(population->theta_particle[k][t] + thread->next_slot, 0,
+				n_slots*sizeof(double));
+		}
+		memset(population->weight[t] + thread->next_slot, 0, n_slots*sizeof(double));
+	}
+	for (i = 0; i < round->model->n_distances; i++) {
+		memset(round->distance + (size_t)i*n_particles + thread->next_slot, 0,
+			n_slots*sizeof(double));
+	}
+	memset(round->log_likelihood + thread->next_slot, 0, n_slots*sizeof(double));
+	return NULL;
+}
+
+void *smc_replicate_worker(void *arg){
+	/*Copy the round's mixture into the replica of the thread's node, if the
+	thread is the first on its node, so the copy is local to the node*/
+	smc_thread *thread = (smc_thread*)arg;
+	smc_round *round = thread->round;
+	const smc_mixture *mixture = round->mixture;
+	smc_mixture *replica = &round->replica[thread->node];
+	int t, n_parameters = round->model->n_parameters;
+
+	for (t = 0; t < thread->index; t++) {
+		if (round->thread[t].node == thread->node) return NULL;
+	}
+	replica->n = mixture->n;
+	memcpy(replica->weight, mixture->weight, mixture->n*sizeof(double));
+	memcpy(replica->cumulative, mixture->cumulative, mixture->n*sizeof(double));
+	memcpy(replica->theta, mixture->theta,
+		(size_t)mixture->n*n_parameters*sizeof(double));
+	return NULL;
+}
+
+void *smc_thread_main(void *arg){
+	/*Pin a started thread to its processor, then run its work*/
+	smc_thread *thread = (smc_thread*)arg;
+	if (thread->cpu >= 0) smc_pin_to_cpu(thread->cpu);
+	return thread->work(thread);
+}
+
+void smc_run_threads(smc_round *round, int chunk_size, void *(*work)(void*)){
+	/*Run work on every thread of a round until its slots are exhausted. Thread
+	t owns slots [t N/T, (t+1) N/T). The calling thread does the work of thread
+	0, and also picks up the slots of any thread which could not be started*/
+	smc_thread *thread = round->thread;
+	int n_threads = round->n_threads;
+	int n_particles = round->settings->n_particles;
+	int t;
+
+	round->chunk_size = chunk_size;
+	for (t = 0; t < n_threads; t++) {
+		thread[t].next_slot = (int)((long)n_particles*t/n_threads);
+		thread[t].end_slot = (int)((long)n_particles*(t + 1)/n_threads);
+		thread[t].work = work;
+	}
+	for (t = 1; t < n_threads; t++) {
+		thread[t].started = (pthread_create(&thread[t].thread, NULL,
+			smc_thread_main, &thread[t]) == 0);
+	}
+	work(&thread[0]);
+	for (t = 1; t < n_threads; t++) {
+		if (thread[t].started) pthread_join(thread[t].thread, NULL);
+	}
+}
+
+int smc_place_threads(smc_round *round){
+	/*Assign the threads of a round to processors and NUMA nodes, and pin the
+	calling thread as thread 0. Returns the number of distinct nodes used*/
+	int cpu[SMC_MAX_CPUS], node[SMC_MAX_CPUS];
+	int n_cpus = smc_available_cpus(cpu, SMC_MAX_CPUS);
+	int n_nodes = 0, t, j, node_id;
+
+	for (t = 0; t < round->n_threads; t++) {
+		round->thread[t].cpu = (n_cpus > 0) ? cpu[t % n_cpus] : -1;
+		node_id = (n_cpus > 0) ? smc_cpu_node(round->thread[t].cpu) : 0;
+		for (j = 0; (j < n_nodes) && (node[j] != node_id); j++);
+		if (j == n_nodes) node[n_nodes++] = node_id;
+		round->thread[t].node = j;
+	}
+	if (round->thread[0].cpu >= 0) smc_pin_to_cpu(round->thread[0].cpu);
+	return n_nodes;
+}
+
+int smc_train_surrogate(smc_round *round, smc_surrogate *surrogate){
+	/*Train the surrogate of a round on the samples of simulated proposals kept
+	by its threads in the previous round, labelled under the round's threshold,
+	and empty the samples. Returns 1 if there are enough samples to screen
+	proposals, 0 otherwise*/
+	int n_parameters = round->model->n_parameters;
+	int n_distances = round->model->n_distances;
+	int i, j, k, n = 0;
+	double variance;
+	smc_worker *worker;
+
+	for (j = 0; j < round->n_threads; j++) {
+		worker = &round->thread[j].worker;
+		for (i = 0; i < worker->sample_size; i++) {
+			memcpy(surrogate->theta + (size_t)n*n_parameters,
+				worker->sample_theta + (size_t)i*n_parameters,
+				n_parameters*sizeof(double));
+			surrogate->accepted[n] = smc_accept(
+				worker->sample_distance + (size_t)i*n_distances, round->threshold,
+				n_distances);
+			n++;
+		}
+		worker->sample_size = 0;
+		worker->sample_seen = 0;
+	}
+	surrogate->n = n;
+	if (n < 2*surrogate->n_neighbours) return 0;
+
+	for (k = 0; k < n_parameters; k++) {
+		surrogate->mean[k] = gsl_stats_mean(surrogate->theta + k, n_parameters, n);
+		variance = gsl_stats_variance_m(surrogate->theta + k, n_parameters, n,
+			surrogate->mean[k]);
+		surrogate->scale[k] = (variance > 0.0) ? 1.0/sqrt(variance) : 1.0;
+		for (i = 0; i < n; i++) {
+			surrogate->theta[(size_t)i*n_parameters + k] =
+				(surrogate->theta[(size_t)i*n_parameters + k] - surrogate->mean[k])*
+				surrogate->scale[k];
+		}
+	}
+	return 1;
+}
+
+int smc_shrink_round(smc_round *round){
+	/*Move the particles of the filled slots of a round to its first slots, and
+	set the parameters of the others to NAN. Returns the number of particles*/
+	smc_population *population = round->population;
+	int n_particles = round->settings->n_particles;
+	int t = round->time_smc;
+	int i, k, n = 0;
+
+	for (i = 0; i < n_particles; i++) {
+		if (isnan(round->log_likelihood[i])) continue;
+		if (n < i) {
+			for (k = 0; k < population->n_parameters; k++) {
+				population->theta_particle[k][t][n] = population->theta_particle[k][t][i];
+			}
+			for (k = 0; k < population->n_distances; k++) {
+				round->distance[(size_t)k*n_particles + n] =
+					round->distance[(size_t)k*n_particles + i];
+			}
+			round->log_likelihood[n] = round->log_likelihood[i];
+		}
+		n++;
+	}
+	for (i = n; i < n_particles; i++) {
+		for (k = 0; k < population->n_parameters; k++) {
+			population->theta_particle[k][t][i] = NAN;
+		}
+	}
+	return n;
+}
+
+typedef struct {
+	double key;
+	int thread;
+	int index;
+} smc_pool_entry;
+
+int smc_compare_pool_entries(const void *a, const void *b){
+	/*Order pool entries by increasing key*/
+	double key_a = ((const smc_pool_entry*)a)->key;
+	double key_b = ((const smc_pool_entry*)b)->key;
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+int smc_relax_round(smc_round *round, double *threshold){
+	/*Fill a round with the best proposals kept by its threads, and relax its
+	threshold to the largest distance/threshold ratio among them
+
+	Returns
+	----------------
+	The number of particles, or -1 if the proposals could not be sorted
+	*/
+	smc_population *population = round->population;
+	smc_worker *worker;
+	int n_particles = round->settings->n_particles;
+	int n_parameters = population->n_parameters;
+	int n_distances = population->n_distances;
+	int t = round->time_smc;
+	int n_entries = 0, n, i, j, k;
+	smc_pool_entry *entry;
+
+	for (j = 0; j < round->n_threads; j++) {
+		n_entries += round->thread[j].worker.pool_size;
+	}
+	entry = malloc((n_entries > 0 ? n_entries : 1) * sizeof(smc_pool_entry));
+	if (entry == NULL) return -1;
+	n_entries = 0;
+	for (j = 0; j < round->n_threads; j++) {
+		for (i = 0; i < round->thread[j].worker.pool_size; i++) {
+			entry[n_entries].key = round->thread[j].worker.pool_key[i];
+			entry[n_entries].thread = j;
+			entry[n_entries].index = i;
+			n_entries++;
+		}
+	}
+	qsort(entry, n_entries, sizeof(smc_pool_entry), smc_compare_pool_entries);
+
+	n = (n_entries < n_particles) ? n_entries : n_particles;
+	for (i = 0; i < n; i++) {
+		worker = &round->thread[entry[i].thread].worker;
+		for (k = 0; k < n_parameters; k++) {
+			population->theta_particle[k][t][i] =
+				worker->pool_theta[(size_t)entry[i].index*n_parameters + k];
+		}
+		for (k = 0; k < n_distances; k++) {
+			round->distance[(size_t)k*n_particles + i] =
+				worker->pool_distance[(size_t)entry[i].index*n_distances + k];
+		}
+		round->log_likelihood[i] = worker->pool_log_weight[entry[i].index];
+	}
+	for (i = n; i < n_particles; i++) {
+		for (k = 0; k < n_parameters; k++) population->theta_particle[k][t][i] = NAN;
+	}
+	if ((n > 0) && (entry[n-1].key > 1.0)) {
+		for (k = 0; k < n_distances; k++) threshold[k] *= entry[n-1].key;
+	}
+	free(entry);
+	return n;
+}
+
+const char *smc_settings_error(const smc_model *model,
+	const smc_settings *settings){
+	/*Check settings before a run, and against model unless it is NULL
+
+	Returns
+	----------------
+	NULL if the settings are valid, or a description of the first problem
+	*/
+	if ((settings->n_particles < 1) || (settings->n_rounds < 1)) {
+		return "n_particles and n_rounds must be at least 1";
+	}
+	if ((settings->inference_mode != SMC_MODE_REJECTION) &&
+		(settings->n_simulations_per_particle < 1)) {
+		return "n_simulations_per_particle must be at least 1";
+	}
+	if ((model != NULL) &&
+		(settings->inference_mode == SMC_MODE_SYNTHETIC_LIKELIHOOD) &&
+		((model->simulate_summary_batch == NULL) ||
+		(settings->n_simulations_per_particle <= model->n_summaries))) {
+		return "Synthetic likelihood needs summary statistics, and more simulations "
+			"per particle than summaries";
+	}
+	if (smc_screens_proposals(settings) && ((settings->surrogate_size < 1) ||
+		(settings->surrogate_neighbours < 1) ||
+		!(settings->surrogate_min_probability > 0.0) ||
+		(settings->surrogate_min_probability > 1.0))) {
+		return "Surrogate screening needs a positive sample size and number of "
+			"neighbours, and a minimum probability in (0, 1]";
+	}
+	if ((model != NULL) && (settings->prior_sampling != SMC_QMC_NONE) &&
+		(model->prior_quantile == NULL)) {
+		return "Quasi-Monte Carlo prior sampling needs the model's prior_quantile";
+	}
+	/*Written so that NaN fails too*/
+	if (!((settings->target_acceptance_rate >= 0.0) &&
+		(settings->target_acceptance_rate <= 1.0))) {
+		return "target_acceptance_rate must be in [0, 1]";
+	}
+	if (!((settings->quantile_accept_distance >= 0.0) &&
+		(settings->quantile_accept_distance <= 1.0))) {
+		return "quantile_accept_distance must be in [0, 1]";
+	}
+	if (!((settings->ess_resample_fraction >= 0.0) &&
+		(settings->ess_resample_fraction <= 1.0))) {
+		return "ess_resample_fraction must be in [0, 1]";
+	}
+	if (!(settings->threshold_tolerance >= 0.0) ||
+		!(settings->posterior_tolerance >= 0.0)) {
+		return "threshold_tolerance and posterior_tolerance must be non-negative";
+	}
+	if ((settings->initial_theta != NULL) && ((settings->initial_weight == NULL) ||
+		(settings->n_initial < 1))) {
+		return "An initial population needs its weights and at least one particle";
+	}
+	if ((settings->budget_fallback != SMC_FALLBACK_RELAX_THRESHOLD) &&
+		(settings->budget_fallback != SMC_FALLBACK_SHRINK_POPULATION)) {
+		return "Unknown budget fallback";
+	}
+	return NULL;
+}
+
+int smc_run(const smc_model *model, const smc_settings *settings,
+	smc_population *population){
+	/*Perform ABC SMC
+
+	Parameters
+	----------------
+	model : The model to perform inference on
+	settings : Settings of the run
+	population : Storage allocated by smc_population_alloc() for the same model
+		and settings
+
+	Returns
+	----------------
+	0 on success, -1 otherwise. Fills population with the particles, weights,
+	thresholds and ESS of every completed round.
+	*/
+	int n_parameters = model->n_parameters;
+	int n_distances = model->n_distances;
+	int n_particles = settings->n_particles;
+	int n_threads = (settings->n_threads > 0) ? settings->n_threads : 1;
+	int n_initial = (settings->initial_theta != NULL) ? settings->n_initial : 0;
+	int n_mixture = (n_initial > n_particles) ? n_initial : n_particles;
+	int time_smc, t, i, k, m, n_accepted, n_relaxed;
+	double weight_normalizer, max_change, change, max_log_likelihood, quantile;
+	smc_mixture mixture;
+	smc_round round;
+	smc_budget budget;
+	smc_surrogate surrogate;
+	smc_qmc prior_points;
+	smc_thread *thread = NULL;
+	smc_cpu_mask affinity;
+	int restore_affinity = 0, status = -1;
+	const char *error;
+
+	error = smc_settings_error(model, settings);
+	if (error != NULL) {
+		printf("%s\n", error);
+		return -1;
+	}
+
+	/*Every allocation from here on is released at done, which a failure jumps
+	to*/
+	round.replica = NULL;
+	double *threshold = malloc(n_distances * sizeof(double));
+	double *distance = malloc((size_t)n_distances * n_particles * sizeof(double));
+	double *sorted_distance = malloc((size_t)n_distances * n_particles *
+		sizeof(double));
+	double *next_threshold = malloc(n_distances * sizeof(double));
+	double *log_likelihood = malloc(n_particles * sizeof(double));
+	double *hist_lower = malloc(n_parameters * sizeof(double));
+	double *hist_upper = malloc(n_parameters * sizeof(double));
+	double *initial_weight = malloc((n_initial > 0 ? n_initial : 1) *
+		sizeof(double));
+	mixture.index = malloc(n_mixture * sizeof(int));
+	mixture.weight = malloc(n_mixture * sizeof(double));
+	mixture.cumulative = malloc(n_mixture * sizeof(double));
+	mixture.theta = malloc((size_t)n_parameters * n_mixture * sizeof(double));
+	surrogate.n_neighbours = settings->surrogate_neighbours;
+	surrogate.min_probability = settings->surrogate_min_probability;
+	surrogate.mean = malloc(n_parameters * sizeof(double));
+	surrogate.scale = malloc(n_parameters * sizeof(double));
+	surrogate.theta = malloc(((size_t)settings->surrogate_size + n_threads) *
+		n_parameters * sizeof(double));
+	surrogate.accepted = malloc(((size_t)settings->surrogate_size + n_threads) *
+		sizeof(int));
+	if ((threshold == NULL) || (distance == NULL) || (sorted_distance == NULL) ||
+		(next_threshold == NULL) || (log_likelihood == NULL) ||
+		(hist_lower == NULL) || (hist_upper == NULL) || (initial_weight == NULL) ||
+		(mixture.index == NULL) ||
+		(mixture.weight == NULL) || (mixture.cumulative == NULL) ||
+		(mixture.theta == NULL) || (surrogate.mean == NULL) ||
+		(surrogate.scale == NULL) || (surrogate.theta == NULL) ||
+		(surrogate.accepted == NULL)) {
+		printf("Error allocating SMC workspace\n");
+		goto done;
+	}
+	weight_normalizer = 0.0;
+	for (i = 0; i < n_initial; i++) weight_normalizer += settings->initial_weight[i];
+	for (i = 0; i < n_initial; i++) {
+		initial_weight[i] = settings->initial_weight[i]/weight_normalizer;
+	}
+
+	/*Thread 0 uses the seed of the run, so a single-threaded run is
+	reproducible. Other threads get seeds derived from it.*/
+	thread = calloc(n_threads, sizeof(smc_thread));
+	if (thread == NULL) {printf("Error allocating SMC threads\n"); goto done;}
+	for (t = 0; t < n_threads; t++) {
+		thread[t].round = &round;
+		thread[t].distance = malloc(n_distances * sizeof(double));
+		if ((thread[t].distance == NULL) || (smc_worker_init(&thread[t].worker,
+				model, settings, settings->seed + 1000003UL*t) != 0)) {
+			goto done;
+		}
+	}
+	round.model = model;
+	round.settings = settings;
+	round.population = population;
+	round.mixture = &mixture;
+	round.threshold = threshold;
+	round.distance = distance;
+	round.log_likelihood = log_likelihood;
+	round.budget = ((settings->max_simulations_per_round > 0) ||
+		(settings->round_time_limit > 0.0)) ? &budget : NULL;
+	round.surrogate = NULL;
+	round.prior_points = NULL;
+	if (settings->prior_sampling != SMC_QMC_NONE) {
+		if (smc_qmc_init(&prior_points, settings->prior_sampling, n_parameters,
+				thread[0].worker.r) != 0) {
+			goto done;
+		}
+		round.prior_points = &prior_points;
+	}
+	round.thread = thread;
+	round.n_threads = n_threads;
+	round.n_nodes = 1;
+	for (t = 0; t < n_threads; t++) {
+		thread[t].index = t;
+		thread[t].mixture = &mixture;
+		thread[t].cpu = -1;
+	}
+
+	/*Pin threads, place each thread's share of the population on its node, and
+	give each node its own copy of the mixture*/
+	if (settings->numa_aware) {
+		restore_affinity = (smc_get_affinity(&affinity) == 0);
+		round.n_nodes = smc_place_threads(&round);
+		smc_run_threads(&round, 1, smc_touch_worker);
+		if (round.n_nodes > 1) {
+			round.replica = calloc(round.n_nodes, sizeof(smc_mixture));
+			if (round.replica == NULL) {printf("Error allocating SMC replicas\n"); goto done;}
+			for (i = 0; i < round.n_nodes; i++) {
+				round.replica[i].weight = malloc(n_mixture * sizeof(double));
+				round.replica[i].cumulative = malloc(n_mixture * sizeof(double));
+				round.replica[i].theta = malloc((size_t)n_parameters * n_mixture *
+					sizeof(double));
+				if ((round.replica[i].weight == NULL) ||
+					(round.replica[i].cumulative == NULL) ||
+					(round.replica[i].theta == NULL)) {
+					printf("Error allocating SMC replicas\n");
+					goto done;
+				}
+			}
+			for (t = 0; t < n_threads; t++) {
+				thread[t].mixture = &round.replica[thread[t].node];
+			}
+		}
+		if (settings->verbose) {
+			printf("%d threads on %d NUMA nodes\n", n_threads, round.n_nodes);
+		}
+	}
+
+	if (settings->threshold_schedule == NULL) {
+		for (i = 0; i < n_distances; i++) {
+			threshold[i] = (settings->inference_mode == SMC_MODE_SYNTHETIC_LIKELIHOOD)
+				? NAN : settings->threshold_init[i];
+		}
+	}
+	population->n_rounds_completed = 0;
+	population->stop_reason = SMC_STOP_MAX_ROUNDS;
+
+	/*For every round of SMC*/
+	for (time_smc = 0; time_smc < settings->n_rounds; time_smc++) {
+		if (settings->verbose) printf("Round %d of SMC\n", time_smc);
+
+		if (settings->threshold_schedule != NULL) {
+			for (i = 0; i < n_distances; i++) {
+				threshold[i] = settings->threshold_schedule[time_smc*n_distances + i];
+			}
+		}
+		for (i = 0; i < n_distances; i++) {
+			population->distance_threshold[i][time_smc] = threshold[i];
+		}
+
+		/*Build the mixture which particles are proposed from, resampling the
+		previous population if its ESS is too low*/
+		round.from_prior = (time_smc == 0) && (n_initial == 0);
+		if ((time_smc == 0) && (n_initial > 0)) {
+			if (effective_sample_size(initial_weight, n_initial) <
+					settings->ess_resample_fraction*n_initial) {
+				mixture.n = systematic_resample(thread[0].worker.r, initial_weight,
+					n_initial, mixture.index, mixture.weight);
+				population->resampled[0] = 1;
+			}
+			else{
+				mixture.n = n_initial;
+				for (i = 0; i < mixture.n; i++) {
+					mixture.index[i] = i;
+					mixture.weight[i] = initial_weight[i];
+				}
+			}
+			mixture.cumulative[0] = mixture.weight[0];
+			for (m = 1; m < mixture.n; m++) {
+				mixture.cumulative[m] = mixture.cumulative[m-1] + mixture.weight[m];
+			}
+			for (m = 0; m < mixture.n; m++) {
+				memcpy(mixture.theta + (size_t)m*n_parameters, settings->initial_theta +
+					(size_t)mixture.index[m]*n_parameters, n_parameters*sizeof(double));
+			}
+			if (settings->verbose) {
+				printf("Proposing from an initial population of %d particles\n",
+					mixture.n);
+			}
+		}
+		if (time_smc > 0) {
+			if (population->ess[time_smc-1] <
+					settings->ess_resample_fraction*n_particles) {
+				mixture.n = systematic_resample(thread[0].worker.r,
+					population->weight[time_smc-1],
+					n_particles, mixture.index, mixture.weight);
+				population->resampled[time_smc] = 1;
+				if (settings->verbose) {
+					printf("ESS below %.2f of the population, resampled to %d particles\n",
+						settings->ess_resample_fraction, mixture.n);
+				}
+			}
+			else{
+				mixture.n = population->n_accepted[time_smc-1];
+				for (i = 0; i < mixture.n; i++) {
+					mixture.index[i] = i;
+					mixture.weight[i] = population->weight[time_smc-1][i];
+				}
+			}
+			mixture.cumulative[0] = mixture.weight[0];
+			for (m = 1; m < mixture.n; m++) {
+				mixture.cumulative[m] = mixture.cumulative[m-1] + mixture.weight[m];
+			}
+			for (m = 0; m < mixture.n; m++) {
+				for (k = 0; k < n_parameters; k++) {
+					mixture.theta[(size_t)m*n_parameters + k] =
+						population->theta_particle[k][time_smc-1][mixture.index[m]];
+				}
+			}
+		}
+
+		if (!round.from_prior && (round.replica != NULL)) {
+			smc_run_threads(&round, 1, smc_replicate_worker);
+		}
+
+		/*Draw or perturb a particle and compute distance. The number of
+		proposals a slot needs is heavy-tailed, so threads claim one slot at a
+		time rather than a fixed share of the population.*/
+		round.time_smc = time_smc;
+		budget.max_simulations = settings->max_simulations_per_round;
+		budget.deadline = (settings->round_time_limit > 0.0) ?
+			smc_clock() + settings->round_time_limit : 0.0;
+		budget.n_simulations = 0;
+		budget.exhausted = 0;
+		round.surrogate = NULL;
+		if ((time_smc > 0) && smc_screens_proposals(settings) &&
+			smc_train_surrogate(&round, &surrogate)) {
+			round.surrogate = &surrogate;
+		}
+		for (t = 0; t < n_threads; t++) {
+			thread[t].n_simulations = 0;
+			thread[t].n_screened = 0;
+			thread[t].n_accepted = 0;
+			thread[t].worker.budget_pending = 0;
+			thread[t].worker.pool_size = 0;
+			thread[t].worker.block_n = 0;
+			thread[t].worker.block_next = 0;
+		}
+		smc_run_threads(&round, 1, smc_sample_worker);
+		n_accepted = 0;
+		for (t = 0; t < n_threads; t++) {
+			population->n_simulations[time_smc] += thread[t].n_simulations;
+			population->n_screened[time_smc] += thread[t].n_screened;
+			n_accepted += thread[t].n_accepted;
+		}
+		if (settings->verbose) {
+			printf("Particles sampled.\n");
+			if (round.surrogate != NULL) {
+				printf("%ld proposals screened out by a surrogate of %d simulations\n",
+					population->n_screened[time_smc], surrogate.n);
+			}
+		}
+
+		/*If the round ran out of budget, keep the best proposals at a relaxed
+		threshold, or the particles accepted so far*/
+		population->fallback[time_smc] = SMC_FALLBACK_NONE;
+		if (n_accepted < n_particles) {
+			n_relaxed = -1;
+			if (smc_keeps_proposals(settings)) {
+				n_relaxed = smc_relax_round(&round, threshold);
+			}
+			if (n_relaxed >= 0) {
+				n_accepted = n_relaxed;
+				population->fallback[time_smc] = SMC_FALLBACK_RELAX_THRESHOLD;
+				for (i = 0; i < n_distances; i++) {
+					population->distance_threshold[i][time_smc] = threshold[i];
+				}
+			}
+			else{
+				n_accepted = smc_shrink_round(&round);
+				population->fallback[time_smc] = SMC_FALLBACK_SHRINK_POPULATION;
+			}
+			if (settings->verbose) {
+				printf("Round budget reached after %ld simulations, %s with %d particles\n",
+					population->n_simulations[time_smc],
+					(n_relaxed >= 0) ? "threshold relaxed" : "population shrunk", n_accepted);
+			}
+		}
+		population->n_accepted[time_smc] = n_accepted;
+		if (n_accepted == 0) {
+			population->stop_reason = SMC_STOP_BUDGET_EXHAUSTED;
+			if (settings->verbose) {
+				printf("No particles accepted within the budget of round %d\n",
+					time_smc);
+			}
+			break;
+		}
+
+		/*Compute weights, w_i = L_i prior(theta_i)/sum_j w_j K(theta_j, theta_i),
+		where the sum runs over the mixture particles were proposed from, and L_i
+		is the likelihood factor of particle i (1 for rejection)*/
+		if (!round.from_prior) {
+			smc_run_threads(&round, SMC_WEIGHT_CHUNK_SIZE, smc_weight_worker);
+		}
+		else{
+			for (i = 0; i < n_particles; i++) {
+				population->weight[time_smc][i] = (i < n_accepted) ? 1.0 : 0.0;
+			}
+		}
+		max_log_likelihood = -INFINITY;
+		for (i = 0; i < n_accepted; i++) {
+			if (log_likelihood[i] > max_log_likelihood) {
+				max_log_likelihood = log_likelihood[i];
+			}
+		}
+		for (i = 0; i < n_accepted; i++) {
+			population->weight[time_smc][i] *= exp(log_likelihood[i] -
+				max_log_likelihood);
+		}
+
+		/*Normalise weights*/
+		weight_normalizer = 0.0;
+		for (i = 0; i < n_particles; i++) {
+			weight_normalizer += population->weight[time_smc][i];
+		}
+		for (i = 0; i < n_particles; i++) {
+			population->weight[time_smc][i] /= weight_normalizer;
+		}
+		population->ess[time_smc] = effective_sample_size(
+			population->weight[time_smc], n_particles);
+		population->n_rounds_completed = time_smc + 1;
+		if (settings->verbose) {
+			printf("ESS = %.1f, %ld simulations\n", population->ess[time_smc],
+				population->n_simulations[time_smc]);
+		}
+
+		/*Summarise the round*/
+		if (time_smc == 0) {
+			for (k = 0; k < n_parameters; k++) {
+				if (settings->histogram_lower != NULL) {
+					hist_lower[k] = settings->histogram_lower[k];
+					hist_upper[k] = settings->histogram_upper[k];
+				}
+				else{
+					hist_lower[k] = gsl_stats_min(population->theta_particle[k][0], 1,
+						n_accepted);
+					hist_upper[k] = gsl_stats_max(population->theta_particle[k][0], 1,
+						n_accepted);
+				}
+			}
+		}
+		if (smc_summarise_round(settings, population, time_smc, hist_lower,
+				hist_upper) != 0) {
+			goto done;
+		}
+		if (settings->round_callback != NULL) {
+			settings->round_callback(population, time_smc,
+				settings->round_callback_data);
+		}
+
+		/*Check whether the posterior has stopped changing*/
+		max_change = 0.0;
+		for (k = 0; (time_smc > 0) && (k < n_parameters); k++) {
+			change = smc_posterior_change(population, time_smc, k);
+			if (change > max_change) max_change = change;
+		}
+		if ((time_smc > 0) && (max_change < settings->posterior_tolerance)) {
+			population->stop_reason = SMC_STOP_POSTERIOR_CONVERGED;
+			if (settings->verbose) {
+				printf("Posterior converged after round %d\n", time_smc);
+			}
+			break;
+		}
+
+		/*Update the threshold as a quantile of the accepted distances, and stop if
+		it is no longer decreasing*/
+		if ((settings->threshold_schedule == NULL) &&
+			(settings->inference_mode != SMC_MODE_SYNTHETIC_LIKELIHOOD)) {
+			if (settings->target_acceptance_rate > 0.0) {
+				quantile = settings->target_acceptance_rate*
+					population->n_simulations[time_smc]/n_accepted;
+				if (quantile < SMC_MIN_THRESHOLD_QUANTILE) {
+					quantile = SMC_MIN_THRESHOLD_QUANTILE;
+				}
+				if (quantile > SMC_MAX_THRESHOLD_QUANTILE) {
+					quantile = SMC_MAX_THRESHOLD_QUANTILE;
+				}
+				smc_joint_thresholds(distance, sorted_distance, n_distances,
+					n_particles, n_accepted, quantile, next_threshold);
+			}
+			else{
+				for (i = 0; i < n_distances; i++) {
+					gsl_sort(distance + (size_t)i*n_particles, 1, n_accepted);
+					next_threshold[i] = gsl_stats_quantile_from_sorted_data(
+						distance + (size_t)i*n_particles, 1, n_accepted,
+						settings->quantile_accept_distance);
+				}
+			}
+			max_change = 0.0;
+			for (i = 0; i < n_distances; i++) {
+				change = next_threshold[i];
+				if (threshold[i] > 0.0) {
+					if ((threshold[i] - change)/threshold[i] > max_change) {
+						max_change = (threshold[i] - change)/threshold[i];
+					}
+				}
+				threshold[i] = change;
+			}
+			if ((time_smc > 0) && (max_change < settings->threshold_tolerance)) {
+				population->stop_reason = SMC_STOP_THRESHOLD_CONVERGED;
+				if (settings->verbose) {
+					printf("Threshold converged after round %d\n", time_smc);
+				}
+				break;
+			}
+		}
+	}
+	status = 0;
+
+done:
+	for (t = 0; (thread != NULL) && (t < n_threads); t++) {
+		smc_worker_free(&thread[t].worker);
+		free(thread[t].distance);
+	}
+	free(thread);
+	if (round.replica != NULL) {
+		for (i = 0; i < round.n_nodes; i++) {
+			free(round.replica[i].weight);
+			free(round.replica[i].cumulative);
+			free(round.replica[i].theta);
+		}
+		free(round.replica);
+	}
+	if (restore_affinity) smc_set_affinity(&affinity);
+	free(threshold);
+	free(distance);
+	free(sorted_distance);
+	free(next_threshold);
+	free(log_likelihood);
+	free(hist_lower);
+	free(hist_upper);
+	free(initial_weight);
+	free(mixture.index);
+	free(mixture.weight);
+	free(mixture.cumulative);
+	free(mixture.theta);
+	free(surrogate.mean);
+	free(surrogate.scale);
+	free(surrogate.theta);
+	free(surrogate.accepted);
+	return status;
+}
+
+#endif
@@ -0,0 +1,329 @@
+/*
+Printing and file output shared by the ABC SMC drivers.
+
+A single round of a population may be saved with write_population_round_to_csv()
+and read back with read_population_from_csv(), e.g. to start a later run from
+it (settings.initial_theta, see smc_engine.h). The file has the layout of the
+files of smc_writer.h: a header theta_0,...,theta_{n_parameters-1},weight and
+one row per particle.
+
+Data tables with a header, such as those of Data/, are read by
+read_table_columns(), which keeps only the numeric columns a model uses.
+*/
+
+#ifndef SMC_IO_H
+#define SMC_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SMC_IO_LINE_LENGTH 4096
+
+void print_int_array(int *a, int num_elements){
+	/*Print an array of integers*/
+	int i;
+	for (i = 0; i < num_elements; i++)
+	{
+		printf("%d\n", a[i]);
+	}
+	printf("\n");
+}
+
+void print_double_array(double *a, int num_elements){
+	/*Print an array of doubles*/
+	int i;
+	for (i = 0; i < num_elements; i++)
+	{
+		printf("%.12f\n", a[i]);
+	}
+	printf("\n");
+}
+
+void write_particles_to_csv(smc_population *population, char *outfile_format){
+	/*Write the particles of every completed round to one file per parameter.
+
+	Parameters
+	----------------
+	population : The result of smc_run()
+	outfile_format : A file name, which may contain %d to be replaced by the
+		index of the parameter, e.g. "particle_%d.csv"
+
+	Each row of a file corresponds to a particle and each column corresponds to a
+	round of SMC.
+	*/
+
+	FILE *outfile_pointer;
+
+	int i, j, k;
+	int n_rounds = population->n_rounds_completed;
+	char *outfile_name = (char*)malloc(256 * sizeof(char));
+
+	for (k = 0; k < population->n_parameters; k++) {
+		snprintf(outfile_name, 256, outfile_format, k);
+		outfile_pointer = fopen(outfile_name, "w");
+		for (j = 0; j < population->n_particles; j++) {
+			for (i = 0; i < n_rounds; i++) {
+				if (i < n_rounds - 1) fprintf(outfile_pointer,"%.8f,", population->theta_particle[k][i][j]);
+				else fprintf(outfile_pointer,"%.8f\n", population->theta_particle[k][i][j]);
+			}
+		}
+		fclose(outfile_pointer);
+	}
+	free(outfile_name);
+}
+
+void write_summaries_header(FILE *outfile_pointer, smc_population *population,
+	const char *leading_columns){
+	/*Write the header of a summary csv file, see write_summaries_to_csv().
+	leading_columns, e.g. "dataset,", is written before the standard columns.*/
+	int i, b;
+	smc_summary *summary;
+
+	fprintf(outfile_pointer, "%sround,parameter,ess,n_simulations,n_screened,n_accepted,fallback",
+		leading_columns);
+	for (i = 0; i < population->n_distances; i++) {
+		fprintf(outfile_pointer, ",threshold_%d", i);
+	}
+	fprintf(outfile_pointer, ",mean,variance");
+	for (i = 0; i < SUMMARY_N_QUANTILES; i++) {
+		fprintf(outfile_pointer, ",q%g", summary_quantiles[i]);
+	}
+	fprintf(outfile_pointer, ",hist_lower,hist_upper");
+	summary = smc_population_summary(population, 0, 0);
+	for (b = 0; b < summary->n_bins; b++) fprintf(outfile_pointer, ",bin_%d", b);
+	fprintf(outfile_pointer, "\n");
+}
+
+void write_summaries_rows(FILE *outfile_pointer, smc_population *population,
+	const char *leading_values){
+	/*Write one row per (round, parameter) of a population to a summary csv file,
+	each starting with leading_values, which matches the leading_columns given
+	to write_summaries_header()*/
+	int i, k, b;
+	smc_summary *summary;
+
+	for (i = 0; i < population->n_rounds_completed; i++) {
+		for (k = 0; k < population->n_parameters; k++) {
+			summary = smc_population_summary(population, i, k);
+			fprintf(outfile_pointer, "%s%d,%d,%.8f,%ld,%ld,%d,%d", leading_values, i,
+				k, population->ess[i], population->n_simulations[i],
+				population->n_screened[i], population->n_accepted[i],
+				population->fallback[i]);
+			for (b = 0; b < population->n_distances; b++) {
+				fprintf(outfile_pointer, ",%.8f", population->distance_threshold[b][i]);
+			}
+			fprintf(outfile_pointer, ",%.8f,%.8f", summary->mean,
+				smc_summary_variance(summary));
+			for (b = 0; b < SUMMARY_N_QUANTILES; b++) {
+				fprintf(outfile_pointer, ",%.8f",
+					smc_summary_quantile(summary, summary_quantiles[b]));
+			}
+			fprintf(outfile_pointer, ",%.8f,%.8f", summary->hist_lower,
+				summary->hist_upper);
+			for (b = 0; b < summary->n_bins; b++) {
+				fprintf(outfile_pointer, ",%.8f", summary->histogram[b]);
+			}
+			fprintf(outfile_pointer, "\n");
+		}
+	}
+}
+
+void write_summaries_to_csv(smc_population *population, char *filename){
+	/*Write the summary of every parameter at every completed round to a csv file
+	with a header, one row per (round, parameter).
+
+	Columns are the round, the parameter index, the ESS, the number of
+	simulations, the number of proposals screened out unsimulated, the number
+	of particles held and the fallback applied if the round ran out of budget
+	(see smc_engine.h), the distance threshold(s), the weighted mean and
+	variance, the quantiles in summary_quantiles, the histogram range, and the
+	weight in each histogram bin.
+	*/
+
+	FILE *outfile_pointer;
+
+	outfile_pointer = fopen(filename, "w");
+	write_summaries_header(outfile_pointer, population, "");
+	write_summaries_rows(outfile_pointer, population, "");
+	fclose(outfile_pointer);
+}
+
+int write_population_round_to_csv(smc_population *population, int time_smc,
+	char *filename){
+	/*Write the particles held at round time_smc and their weights to a csv file.
+	Returns 0 on success, -1 if the file could not be written*/
+	FILE *outfile_pointer;
+	int i, k;
+
+	outfile_pointer = fopen(filename, "w");
+	if (outfile_pointer == NULL) {printf("Cannot write %s\n", filename); return -1;}
+	for (k = 0; k < population->n_parameters; k++) {
+		fprintf(outfile_pointer, "theta_%d,", k);
+	}
+	fprintf(outfile_pointer, "weight\n");
+	for (i = 0; i < population->n_accepted[time_smc]; i++) {
+		for (k = 0; k < population->n_parameters; k++) {
+			fprintf(outfile_pointer, "%.8f,", population->theta_particle[k][time_smc][i]);
+		}
+		fprintf(outfile_pointer, "%.8e\n", population->weight[time_smc][i]);
+	}
+	return (fclose(outfile_pointer) == 0) ? 0 : -1;
+}
+
+int read_population_from_csv(char *filename, int n_parameters, int *n_particles,
+	double **theta, double **weight){
+	/*Read a population written by write_population_round_to_csv() or by an
+	smc_writer
+
+	Parameters
+	----------------
+	filename : The csv file to read
+	n_parameters : The number of parameters of each particle
+	n_particles : Filled with the number of particles read
+	theta : Filled with the particles, (n_particles X n_parameters), to be freed
+		by the caller
+	weight : Filled with the weights, (n_particles), to be freed by the caller
+
+	Returns
+	----------------
+	0 on success, -1 if the file could not be read
+	*/
+	FILE *infile_pointer;
+	char line[SMC_IO_LINE_LENGTH];
+	char *token, *end;
+	double *grown;
+	int capacity = 0, k, status = 0;
+
+	*n_particles = 0;
+	*theta = NULL;
+	*weight = NULL;
+	infile_pointer = fopen(filename, "r");
+	if (infile_pointer == NULL) {printf("Cannot open %s\n", filename); return -1;}
+	if (fgets(line, sizeof(line), infile_pointer) == NULL) status = -1;
+	while ((status == 0) && (fgets(line, sizeof(line), infile_pointer) != NULL)) {
+		token = strtok(line, ",\r\n");
+		if (token == NULL) continue;
+		if (*n_particles == capacity) {
+			capacity = (capacity > 0) ? 2*capacity : 1024;
+			grown = realloc(*theta, (size_t)capacity * n_parameters * sizeof(double));
+			if (grown == NULL) {status = -1; break;}
+			*theta = grown;
+			grown = realloc(*weight, capacity * sizeof(double));
+			if (grown == NULL) {status = -1; break;}
+			*weight = grown;
+		}
+		for (k = 0; k <= n_parameters; k++) {
+			if (token == NULL) {status = -1; break;}
+			if (k < n_parameters) {
+				(*theta)[(size_t)(*n_particles)*n_parameters + k] = strtod(token, &end);
+			}
+			else (*weight)[*n_particles] = strtod(token, &end);
+			if (end == token) {status = -1; break;}
+			token = strtok(NULL, ",\r\n");
+		}
+		(*n_particles)++;
+	}
+	fclose(infile_pointer);
+	if ((status != 0) || (*n_particles == 0)) {
+		printf("Error reading population from %s\n", filename);
+		free(*theta);
+		free(*weight);
+		*theta = NULL;
+		*weight = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int read_table_columns(char *filename, char delimiter, int n_columns,
+	const int *columns, int *n_rows, double **table){
+	/*Read some columns of a delimited table with a header line
+
+	Parameters
+	----------------
+	filename : The file to read
+	delimiter : The character separating fields, e.g. ',' or '\t'
+	n_columns : The number of columns to read
+	columns : (n_columns), the index of each column to read, counted from 0 over
+		the fields of a row
+	n_rows : Filled with the number of rows read
+	table : Filled with the columns read, (n_rows X n_columns), in the order of
+		columns, to be freed by the caller
+
+	Returns
+	----------------
+	0 on success, -1 if the file could not be read or a field is not a number
+	*/
+	FILE *infile_pointer;
+	char line[SMC_IO_LINE_LENGTH];
+	char *field, *end;
+	double *grown;
+	int capacity = 0, index, k, status = 0;
+
+	*n_rows = 0;
+	*table = NULL;
+	infile_pointer = fopen(filename, "r");
+	if (infile_pointer == NULL) {printf("Cannot open %s\n", filename); return -1;}
+	if (fgets(line, sizeof(line), infile_pointer) == NULL) status = -1;
+	while ((status == 0) && (fgets(line, sizeof(line), infile_pointer) != NULL)) {
+		if ((line[0] == '\n') || (line[0] == '\r')) continue;
+		if (*n_rows == capacity) {
+			capacity = (capacity > 0) ? 2*capacity : 1024;
+			grown = realloc(*table, (size_t)capacity * n_columns * sizeof(double));
+			if (grown == NULL) {status = -1; break;}
+			*table = grown;
+		}
+		for (k = 0; (k < n_columns) && (status == 0); k++) {
+			/*Find the start of field columns[k]*/
+			field = line;
+			for (index = 0; (index < columns[k]) && (field != NULL); index++) {
+				field = strchr(field, delimiter);
+				if (field != NULL) field++;
+			}
+			if (field == NULL) {status = -1; break;}
+			(*table)[(size_t)(*n_rows)*n_columns + k] = strtod(field, &end);
+			if (end == field) status = -1;
+		}
+		(*n_rows)++;
+	}
+	fclose(infile_pointer);
+	if ((status != 0) || (*n_rows == 0)) {
+		printf("Error reading table from %s\n", filename);
+		free(*table);
+		*table = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void write_double_array_to_csv(double *arr, int N_ELEMENTS, char *filename){
+	/*Write a double array of length N_ELEMENTS to file*/
+
+	FILE *outfile_pointer;
+	int i;
+
+	outfile_pointer = fopen(filename, "w");
+	for (i = 0; i < N_ELEMENTS; i++) {
+		fprintf(outfile_pointer,"%.8f\n", arr[i]);
+	}
+	fclose(outfile_pointer);
+}
+
+void write_2d_double_array_to_csv(double **arr, int N_ROWS, int N_COLS, char *filename){
+	/*Write a 2D double array of dimensions (N_ROWS X N_COLS) to file*/
+
+	FILE *outfile_pointer;
+	int i, j;
+
+	outfile_pointer = fopen(filename, "w");
+	for (i = 0; i < N_ROWS; i++) {
+		for (j = 0; j < N_COLS; j++) {
+			if (j < N_COLS-1) fprintf(outfile_pointer,"%.8f,", arr[i][j]);
+			else fprintf(outfile_pointer,"%.8f\n", arr[i][j]);
+		}
+	}
+	fclose(outfile_pointer);
+}
+
+#endif
@@ -0,0 +1,481 @@
+/*
+ABC SMC model choice (Toni et al. 2009, section 3): several competing models fit
+by one population whose particles carry a model index as well as parameters.
+
+The models are ordinary smc_models, e.g. linear regression with Gaussian,
+Student-t or heteroscedastic noise (lin_reg.h). They must share the same data
+and distance, so that a single threshold applies to all of them, but may have
+different numbers of parameters.
+
+Round 0 samples the model from model_prior and its parameters from that model's
+prior. In later rounds a model m* is drawn from the model probabilities of the
+previous round and moved with the model-jump kernel, which keeps it with
+probability stay_probability and otherwise moves to one of the other models
+uniformly. The parameters are then drawn from the previous particles of the new
+model m, with their weights, and perturbed with the kernel of m. Models without
+particles in the previous round cannot be proposed again. An accepted particle
+has weight
+
+	w = model_prior(m) prior_m(theta) / (S1 S2)
+	S1 = sum_m' P(m') KM(m | m')
+	S2 = sum_{j: m_j = m} w_j K_m(theta_j, theta) / P(m)
+
+where P are the model probabilities of the previous round. Weights are
+normalised over every model, and the marginal posterior probability of a model
+is the sum of the weights of its particles. A proposal costs one simulation of
+one model, so the models share the simulation budget, which is spent mostly on
+the models that fit.
+
+The threshold follows threshold_schedule, or adapts as a quantile of the
+accepted distances starting from threshold_init, as in smc_run(). The run stops
+after n_rounds rounds, when the threshold stops decreasing by more than
+threshold_tolerance, or when no model probability changes by more than
+posterior_tolerance between rounds. Sampling is single-threaded, and only the
+rejection inference mode is supported. Rounds cannot be bounded by
+max_simulations_per_round or round_time_limit, which must be 0.
+*/
+
+#ifndef SMC_MODEL_CHOICE_H
+#define SMC_MODEL_CHOICE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_sort_double.h>
+#include <gsl/gsl_statistics.h>
+
+typedef struct {
+	int n_models;
+	const smc_model *models; // (n_models)
+	const double *model_prior; // (n_models), need not be normalised
+	double stay_probability; // of the model-jump kernel
+} smc_model_choice;
+
+typedef struct {
+	int n_models;
+	int n_parameters; // the most parameters of any model
+	int n_distances;
+	int n_rounds;
+	int n_particles;
+	int n_rounds_completed;
+	int stop_reason;
+
+	int *model_index; // (n_rounds X n_particles)
+	double *theta; // (n_rounds X n_particles X n_parameters), padded with NAN
+	double *weight; // (n_rounds X n_particles), normalised over every model
+	double *model_probability; // (n_rounds X n_models)
+	double *distance_threshold; // (n_rounds X n_distances)
+	double *ess; // (n_rounds)
+	long *n_simulations; // (n_rounds)
+} smc_choice_population;
+
+void smc_choice_population_free(smc_choice_population *population){
+	/*Free an smc_choice_population allocated by smc_choice_population_alloc()*/
+	if (population == NULL) return;
+	free(population->model_index);
+	free(population->theta);
+	free(population->weight);
+	free(population->model_probability);
+	free(population->distance_threshold);
+	free(population->ess);
+	free(population->n_simulations);
+	free(population);
+}
+
+smc_choice_population *smc_choice_population_alloc(
+	const smc_model_choice *choice, const smc_settings *settings){
+	/*Allocate storage for every particle, weight and model probability of a
+	model choice run
+
+	Returns
+	----------------
+	A pointer to an smc_choice_population, or NULL if allocation failed
+	*/
+	int m;
+	size_t n_slots = (size_t)settings->n_rounds * settings->n_particles;
+	smc_choice_population *population = calloc(1,
+		sizeof(smc_choice_population));
+	if (population == NULL) return NULL;
+
+	population->n_models = choice->n_models;
+	population->n_distances = choice->models[0].n_distances;
+	population->n_rounds = settings->n_rounds;
+	population->n_particles = settings->n_particles;
+	for (m = 0; m < choice->n_models; m++) {
+		if (choice->models[m].n_parameters > population->n_parameters) {
+			population->n_parameters = choice->models[m].n_parameters;
+		}
+	}
+
+	population->model_index = malloc(n_slots * sizeof(int));
+	population->theta = malloc(n_slots * population->n_parameters *
+		sizeof(double));
+	population->weight = malloc(n_slots * sizeof(double));
+	population->model_probability = calloc((size_t)settings->n_rounds *
+		choice->n_models, sizeof(double));
+	population->distance_threshold = malloc((size_t)settings->n_rounds *
+		population->n_distances * sizeof(double));
+	population->ess = calloc(settings->n_rounds, sizeof(double));
+	population->n_simulations = calloc(settings->n_rounds, sizeof(long));
+	if ((population->model_index == NULL) || (population->theta == NULL) ||
+		(population->weight == NULL) || (population->model_probability == NULL) ||
+		(population->distance_threshold == NULL) || (population->ess == NULL) ||
+		(population->n_simulations == NULL)) {
+		printf("Error allocating SMC model choice population\n");
+		smc_choice_population_free(population);
+		return NULL;
+	}
+	return population;
+}
+
+double smc_model_jump_pdf(const smc_model_choice *choice, int model_old,
+	int model_new){
+	/*The probability of the model-jump kernel moving from model_old to
+	model_new*/
+	if (choice->n_models == 1) return 1.0;
+	if (model_old == model_new) return choice->stay_probability;
+	return (1.0 - choice->stay_probability)/(choice->n_models - 1);
+}
+
+int smc_model_jump(gsl_rng *r, const smc_model_choice *choice, int model_old){
+	/*Sample a model from the model-jump kernel*/
+	int model_new;
+	if ((choice->n_models == 1) ||
+		(gsl_rng_uniform(r) < choice->stay_probability)) {
+		return model_old;
+	}
+	model_new = (int)gsl_rng_uniform_int(r, choice->n_models - 1);
+	return (model_new >= model_old) ? model_new + 1 : model_new;
+}
+
+int smc_run_model_choice(const smc_model_choice *choice,
+	const smc_settings *settings, smc_choice_population *population){
+	/*Perform ABC SMC model choice
+
+	Parameters
+	----------------
+	choice : The competing models, their prior and the model-jump kernel
+	settings : Settings of the run. The inference mode must be
+		SMC_MODE_REJECTION, with no round budget
+	population : Storage allocated by smc_choice_population_alloc() for the same
+		models and settings
+
+	Returns
+	----------------
+	0 on success, -1 otherwise. Fills population with the particles, weights,
+	model probabilities, thresholds and ESS of every completed round.
+	*/
+	int n_models = choice->n_models;
+	int n_parameters = population->n_parameters;
+	int n_distances = population->n_distances;
+	int n_particles = settings->n_particles;
+	int time_smc, i, j, k, m, m_old, accepted, status = -1;
+	double *threshold = NULL, *distance = NULL, *prior_cumulative = NULL;
+	double *model_cumulative = NULL, *cumulative = NULL;
+	int *offset = NULL, *next = NULL, *order = NULL;
+	double weight_normalizer, max_change, change, kernel_sum, jump_sum;
+	const smc_model *model;
+	smc_model sizes;
+	smc_worker worker;
+	const char *error = smc_settings_error(NULL, settings);
+
+	if (error != NULL) {
+		printf("%s\n", error);
+		return -1;
+	}
+	if (settings->inference_mode != SMC_MODE_REJECTION) {
+		printf("Model choice supports only the rejection inference mode\n");
+		return -1;
+	}
+	if ((settings->max_simulations_per_round > 0) ||
+		(settings->round_time_limit > 0.0)) {
+		printf("Model choice does not support a round budget\n");
+		return -1;
+	}
+	sizes = choice->models[0];
+	for (m = 0; m < n_models; m++) {
+		if (choice->models[m].n_distances != n_distances) {
+			printf("Every model must have the same number of distances\n");
+			return -1;
+		}
+		if (choice->models[m].workspace_size > sizes.workspace_size) {
+			sizes.workspace_size = choice->models[m].workspace_size;
+		}
+	}
+	sizes.n_parameters = n_parameters;
+
+	memset(&worker, 0, sizeof(smc_worker));
+	threshold = malloc(n_distances * sizeof(double));
+	distance = malloc((size_t)n_distances * n_particles * sizeof(double));
+	prior_cumulative = malloc(n_models * sizeof(double));
+	model_cumulative = malloc(n_models * sizeof(double));
+	offset = malloc((n_models + 1) * sizeof(int));
+	next = malloc(n_models * sizeof(int));
+	order = malloc(n_particles * sizeof(int));
+	cumulative = malloc(n_particles * sizeof(double));
+	if ((threshold == NULL) || (distance == NULL) || (prior_cumulative == NULL) ||
+		(model_cumulative == NULL) || (offset == NULL) || (next == NULL) ||
+		(order == NULL) ||
+		(cumulative == NULL) ||
+		(smc_worker_init(&worker, &sizes, settings, settings->seed) != 0)) {
+		printf("Error allocating SMC workspace\n");
+		goto done;
+	}
+
+	prior_cumulative[0] = choice->model_prior[0];
+	for (m = 1; m < n_models; m++) {
+		prior_cumulative[m] = prior_cumulative[m-1] + choice->model_prior[m];
+	}
+	if (settings->threshold_schedule == NULL) {
+		for (i = 0; i < n_distances; i++) threshold[i] = settings->threshold_init[i];
+	}
+	population->n_rounds_completed = 0;
+	population->stop_reason = SMC_STOP_MAX_ROUNDS;
+
+	/*For every round of SMC*/
+	for (time_smc = 0; time_smc < settings->n_rounds; time_smc++) {
+		int *model_index = population->model_index + (size_t)time_smc*n_particles;
+		double *theta = population->theta +
+			(size_t)time_smc*n_particles*n_parameters;
+		double *weight = population->weight + (size_t)time_smc*n_particles;
+		double *probability = population->model_probability +
+			(size_t)time_smc*n_models;
+		const int *model_index_old = NULL;
+		const double *theta_old = NULL, *weight_old = NULL, *probability_old = NULL;
+		if (time_smc > 0) {
+			model_index_old = model_index - n_particles;
+			theta_old = theta - (size_t)n_particles*n_parameters;
+			weight_old = weight - n_particles;
+			probability_old = probability - n_models;
+		}
+
+		if (settings->verbose) printf("Round %d of SMC\n", time_smc);
+		if (settings->threshold_schedule != NULL) {
+			for (i = 0; i < n_distances; i++) {
+				threshold[i] = settings->threshold_schedule[time_smc*n_distances + i];
+			}
+		}
+		for (i = 0; i < n_distances; i++) {
+			population->distance_threshold[(size_t)time_smc*n_distances + i] =
+				threshold[i];
+		}
+
+		/*Group the previous particles by model, with partial sums of their
+		weights within each model*/
+		if (time_smc > 0) {
+			for (m = 0; m <= n_models; m++) offset[m] = 0;
+			for (j = 0; j < n_particles; j++) offset[model_index_old[j] + 1]++;
+			for (m = 0; m < n_models; m++) offset[m+1] += offset[m];
+			for (m = 0; m < n_models; m++) next[m] = offset[m];
+			for (j = 0; j < n_particles; j++) order[next[model_index_old[j]]++] = j;
+			for (m = 0; m < n_models; m++) {
+				for (j = offset[m]; j < offset[m+1]; j++) {
+					cumulative[j] = weight_old[order[j]] +
+						((j > offset[m]) ? cumulative[j-1] : 0.0);
+				}
+				model_cumulative[m] = probability_old[m] +
+					((m > 0) ? model_cumulative[m-1] : 0.0);
+			}
+		}
+
+		/*Propose (model, particle) pairs until one is accepted*/
+		for (i = 0; i < n_particles; i++) {
+			accepted = 0;
+			while (!accepted) {
+				if (time_smc == 0) {
+					m = weighted_choice(worker.r, prior_cumulative, n_models);
+					model = &choice->models[m];
+					model->sample_prior(worker.r, model, worker.theta);
+				}
+				else{
+					m = smc_model_jump(worker.r, choice,
+						weighted_choice(worker.r, model_cumulative, n_models));
+					if (offset[m+1] == offset[m]) continue;
+					model = &choice->models[m];
+					j = order[offset[m] + weighted_choice(worker.r, cumulative + offset[m],
+						offset[m+1] - offset[m])];
+					model->perturb(worker.r, model, theta_old + (size_t)j*n_parameters,
+						worker.theta);
+					if (model->prior_pdf(model, worker.theta) <= 0.0) continue;
+				}
+				model->simulate_distance(worker.r, model, worker.theta,
+					worker.workspace, worker.distance);
+				population->n_simulations[time_smc]++;
+				accepted = smc_accept(worker.distance, threshold, n_distances);
+			}
+			model_index[i] = m;
+			for (k = 0; k < n_parameters; k++) {
+				theta[(size_t)i*n_parameters + k] = (k < model->n_parameters) ?
+					worker.theta[k] : NAN;
+			}
+			for (k = 0; k < n_distances; k++) {
+				distance[(size_t)k*n_particles + i] = worker.distance[k];
+			}
+		}
+		if (settings->verbose) printf("Particles sampled.\n");
+
+		/*Compute weights, w_i = model_prior(m_i) prior(theta_i)/(S1 S2), see
+		above*/
+		for (i = 0; i < n_particles; i++) {
+			m = model_index[i];
+			model = &choice->models[m];
+			if (time_smc == 0) {
+				weight[i] = 1.0;
+				continue;
+			}
+			jump_sum = 0.0;
+			for (m_old = 0; m_old < n_models; m_old++) {
+				jump_sum += probability_old[m_old]*smc_model_jump_pdf(choice, m_old, m);
+			}
+			kernel_sum = 0.0;
+			for (j = offset[m]; j < offset[m+1]; j++) {
+				kernel_sum += weight_old[order[j]]*model->kernel_pdf(model,
+					theta_old + (size_t)order[j]*n_parameters,
+					theta + (size_t)i*n_parameters);
+			}
+			kernel_sum /= probability_old[m];
+			weight[i] = choice->model_prior[m]*model->prior_pdf(model,
+				theta + (size_t)i*n_parameters)/(jump_sum*kernel_sum);
+		}
+
+		/*Normalise weights, and sum them by model*/
+		weight_normalizer = 0.0;
+		for (i = 0; i < n_particles; i++) weight_normalizer += weight[i];
+		for (m = 0; m < n_models; m++) probability[m] = 0.0;
+		for (i = 0; i < n_particles; i++) {
+			weight[i] /= weight_normalizer;
+			probability[model_index[i]] += weight[i];
+		}
+		population->ess[time_smc] = effective_sample_size(weight, n_particles);
+		population->n_rounds_completed = time_smc + 1;
+		if (settings->verbose) {
+			printf("ESS = %.1f, %ld simulations\n", population->ess[time_smc],
+				population->n_simulations[time_smc]);
+			for (m = 0; m < n_models; m++) {
+				printf("P(model %d) = %.4f\n", m, probability[m]);
+			}
+		}
+
+		/*Check whether the model probabilities have stopped changing*/
+		max_change = 0.0;
+		for (m = 0; (time_smc > 0) && (m < n_models); m++) {
+			change = fabs(probability[m] - probability_old[m]);
+			if (change > max_change) max_change = change;
+		}
+		if ((time_smc > 0) && (max_change < settings->posterior_tolerance)) {
+			population->stop_reason = SMC_STOP_POSTERIOR_CONVERGED;
+			if (settings->verbose) {
+				printf("Model probabilities converged after round %d\n", time_smc);
+			}
+			break;
+		}
+
+		/*Update the threshold as a quantile of the accepted distances, and stop if
+		it is no longer decreasing*/
+		if (settings->threshold_schedule == NULL) {
+			max_change = 0.0;
+			for (i = 0; i < n_distances; i++) {
+				gsl_sort(distance + (size_t)i*n_particles, 1, n_particles);
+				change = gsl_stats_quantile_from_sorted_data(
+					distance + (size_t)i*n_particles, 1, n_particles,
+					settings->quantile_accept_distance);
+				if (threshold[i] > 0.0) {
+					if ((threshold[i] - change)/threshold[i] > max_change) {
+						max_change = (threshold[i] - change)/threshold[i];
+					}
+				}
+				threshold[i] = change;
+			}
+			if ((time_smc > 0) && (max_change < settings->threshold_tolerance)) {
+				population->stop_reason = SMC_STOP_THRESHOLD_CONVERGED;
+				if (settings->verbose) {
+					printf("Threshold converged after round %d\n", time_smc);
+				}
+				break;
+			}
+		}
+	}
+	status = 0;
+
+done:
+	smc_worker_free(&worker);
+	free(threshold);
+	free(distance);
+	free(prior_cumulative);
+	free(model_cumulative);
+	free(offset);
+	free(next);
+	free(order);
+	free(cumulative);
+	return status;
+}
+
+void write_model_probabilities_to_csv(smc_choice_population *population,
+	char *outfile_name){
+	/*Write the thresholds, ESS, number of simulations and marginal posterior
+	probability of every model at every completed round, one row per round*/
+	int t, i, m;
+	FILE *outfile_pointer = fopen(outfile_name, "w");
+	if (outfile_pointer == NULL) {printf("Error opening %s\n", outfile_name); return;}
+
+	fprintf(outfile_pointer, "round,ess,n_simulations");
+	for (i = 0; i < population->n_distances; i++) {
+		fprintf(outfile_pointer, ",threshold_%d", i);
+	}
+	for (m = 0; m < population->n_models; m++) {
+		fprintf(outfile_pointer, ",p_model_%d", m);
+	}
+	fprintf(outfile_pointer, "\n");
+	for (t = 0; t < population->n_rounds_completed; t++) {
+		fprintf(outfile_pointer, "%d,%.4f,%ld", t, population->ess[t],
+			population->n_simulations[t]);
+		for (i = 0; i < population->n_distances; i++) {
+			fprintf(outfile_pointer, ",%.8f",
+				population->distance_threshold[(size_t)t*population->n_distances + i]);
+		}
+		for (m = 0; m < population->n_models; m++) {
+			fprintf(outfile_pointer, ",%.8f",
+				population->model_probability[(size_t)t*population->n_models + m]);
+		}
+		fprintf(outfile_pointer, "\n");
+	}
+	fclose(outfile_pointer);
+}
+
+void write_model_choice_particles_to_csv(smc_choice_population *population,
+	char *outfile_name){
+	/*Write the model, weight and parameters of every particle of the last
+	completed round. Parameters a model does not have are left empty.*/
+	int i, k;
+	size_t t = population->n_rounds_completed - 1;
+	size_t slot;
+	FILE *outfile_pointer = fopen(outfile_name, "w");
+	if (outfile_pointer == NULL) {printf("Error opening %s\n", outfile_name); return;}
+
+	fprintf(outfile_pointer, "model,weight");
+	for (k = 0; k < population->n_parameters; k++) {
+		fprintf(outfile_pointer, ",theta_%d", k);
+	}
+	fprintf(outfile_pointer, "\n");
+	for (i = 0; i < population->n_particles; i++) {
+		slot = t*population->n_particles + i;
+		fprintf(outfile_pointer, "%d,%.8e", population->model_index[slot],
+			population->weight[slot]);
+		for (k = 0; k < population->n_parameters; k++) {
+			if (isnan(population->theta[slot*population->n_parameters + k])) {
+				fprintf(outfile_pointer, ",");
+			}
+			else{
+				fprintf(outfile_pointer, ",%.8f",
+					population->theta[slot*population->n_parameters + k]);
+			}
+		}
+		fprintf(outfile_pointer, "\n");
+	}
+	fclose(outfile_pointer);
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*
+Thread placement for the ABC SMC engine on machines with several NUMA nodes.
+
+Threads are pinned to the processors the process may run on, in order, and the
+NUMA node of each processor is read from /sys/devices/system/cpu. Linux places
+a page on the node of the thread which first writes it, so memory a pinned
+thread writes first stays local to it.
+
+Affinity is set through the sched_setaffinity system call directly, which
+needs no feature test macros in the including file. On other systems, or if
+the calls fail, threads are left unpinned and every processor is reported to
+be on node 0.
+*/
+
+#ifndef SMC_NUMA_H
+#define SMC_NUMA_H
+
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define SMC_MAX_CPUS 1024
+#define SMC_CPU_MASK_WORDS (SMC_MAX_CPUS/(8*sizeof(unsigned long)))
+#define SMC_CPU_MASK_BITS (8*sizeof(unsigned long))
+
+typedef struct {
+	unsigned long bits[SMC_CPU_MASK_WORDS];
+} smc_cpu_mask;
+
+int smc_get_affinity(smc_cpu_mask *mask){
+	/*Get the processors the calling thread may run on. Returns 0 on success*/
+#ifdef __linux__
+	memset(mask, 0, sizeof(smc_cpu_mask));
+	return (syscall(SYS_sched_getaffinity, 0, sizeof(smc_cpu_mask), mask) > 0) ?
+		0 : -1;
+#else
+	return -1;
+#endif
+}
+
+int smc_set_affinity(const smc_cpu_mask *mask){
+	/*Restrict the calling thread to the processors in mask. Returns 0 on
+	success*/
+#ifdef __linux__
+	return (syscall(SYS_sched_setaffinity, 0, sizeof(smc_cpu_mask), mask) == 0) ?
+		0 : -1;
+#else
+	return -1;
+#endif
+}
+
+int smc_pin_to_cpu(int cpu){
+	/*Pin the calling thread to one processor. Returns 0 on success*/
+	smc_cpu_mask mask;
+	if ((cpu < 0) || (cpu >= SMC_MAX_CPUS)) return -1;
+	memset(&mask, 0, sizeof(smc_cpu_mask));
+	mask.bits[cpu/SMC_CPU_MASK_BITS] = 1UL << (cpu % SMC_CPU_MASK_BITS);
+	return smc_set_affinity(&mask);
+}
+
+int smc_available_cpus(int *cpu, int max_cpus){
+	/*Fill cpu with the processors the calling thread may run on, in increasing
+	order. Returns their number, or 0 if it cannot be determined*/
+	smc_cpu_mask mask;
+	int i, n = 0;
+	if (smc_get_affinity(&mask) != 0) return 0;
+	for (i = 0; (i < SMC_MAX_CPUS) && (n < max_cpus); i++) {
+		if (mask.bits[i/SMC_CPU_MASK_BITS] & (1UL << (i % SMC_CPU_MASK_BITS))) {
+			cpu[n++] = i;
+		}
+	}
+	return n;
+}
+
+int smc_cpu_node(int cpu){
+	/*The NUMA node of a processor, or 0 if it is not known*/
+	char path[64];
+	DIR *directory;
+	struct dirent *entry;
+	int node = 0;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	directory = opendir(path);
+	if (directory == NULL) return 0;
+	while ((entry = readdir(directory)) != NULL) {
+		if (sscanf(entry->d_name, "node%d", &node) == 1) break;
+		node = 0;
+	}
+	closedir(directory);
+	return node;
+}
+
+#endif
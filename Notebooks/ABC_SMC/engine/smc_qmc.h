@@ -0,0 +1,176 @@
+/*
+Randomised quasi-Monte Carlo points for drawing the first population of ABC SMC
+from the prior.
+
+Two low-discrepancy sequences in [0,1)^d are available:
+SMC_QMC_SOBOL - Sobol points, with the direction numbers of Joe and Kuo (2008),
+	randomised by a random linear scrambling (Matousek 1998) and a random digital
+	shift, for up to SMC_QMC_SOBOL_MAX_DIMENSIONS dimensions
+SMC_QMC_HALTON - Halton points in prime bases, randomised by a random shift
+	modulo 1, for up to SMC_QMC_HALTON_MAX_DIMENSIONS dimensions
+
+Point i is computed directly from i, so threads may claim points from a shared
+counter in any order. A model maps a point to a draw from its prior by the
+inverse CDF of each parameter (smc_model.prior_quantile).
+*/
+
+#ifndef SMC_QMC_H
+#define SMC_QMC_H
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+
+#define SMC_QMC_NONE 0
+#define SMC_QMC_SOBOL 1
+#define SMC_QMC_HALTON 2
+
+#define SMC_QMC_SOBOL_MAX_DIMENSIONS 13
+#define SMC_QMC_HALTON_MAX_DIMENSIONS 32
+#define SMC_QMC_BITS 32
+
+/*Degree s, coefficients a and initial direction numbers m of the primitive
+polynomials of dimensions 2 to 13 (Joe and Kuo 2008). Dimension 1 has every
+m equal to 1.*/
+static const int sobol_degree[SMC_QMC_SOBOL_MAX_DIMENSIONS - 1] = {
+	1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 5, 5};
+static const int sobol_coefficients[SMC_QMC_SOBOL_MAX_DIMENSIONS - 1] = {
+	0, 1, 1, 2, 1, 4, 2, 4, 7, 11, 13, 14};
+static const unsigned int sobol_initial[SMC_QMC_SOBOL_MAX_DIMENSIONS - 1][5] = {
+	{1}, {1, 3}, {1, 3, 1}, {1, 1, 1}, {1, 1, 3, 3}, {1, 3, 5, 13},
+	{1, 1, 5, 5, 17}, {1, 1, 5, 5, 5}, {1, 1, 7, 11, 19}, {1, 1, 5, 1, 1},
+	{1, 1, 1, 3, 11}, {1, 3, 5, 5, 31}};
+
+static const int halton_base[SMC_QMC_HALTON_MAX_DIMENSIONS] = {
+	2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71,
+	73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131};
+
+typedef struct {
+	int type; // one of SMC_QMC_*
+	int n_dimensions;
+	unsigned int direction[SMC_QMC_SOBOL_MAX_DIMENSIONS][SMC_QMC_BITS]; // scrambled
+	unsigned int digital_shift[SMC_QMC_SOBOL_MAX_DIMENSIONS];
+	double shift[SMC_QMC_HALTON_MAX_DIMENSIONS];
+	unsigned long next; // the next point to be claimed
+} smc_qmc;
+
+unsigned int smc_qmc_random_bits(gsl_rng *r){
+	/*32 random bits*/
+	return (unsigned int)(gsl_rng_uniform(r)*4294967296.0);
+}
+
+unsigned int smc_qmc_parity(unsigned int x){
+	/*1 if an odd number of bits of x are set*/
+	x ^= x >> 16;
+	x ^= x >> 8;
+	x ^= x >> 4;
+	x ^= x >> 2;
+	x ^= x >> 1;
+	return x & 1u;
+}
+
+int smc_qmc_init(smc_qmc *qmc, int type, int n_dimensions, gsl_rng *r){
+	/*Set up a randomised sequence
+
+	Parameters
+	----------------
+	qmc : The sequence to set up
+	type : SMC_QMC_SOBOL or SMC_QMC_HALTON
+	n_dimensions : The dimension of each point
+	r : A GSL random number generator, which draws the randomisation
+
+	Returns
+	----------------
+	0 on success, -1 if the type or number of dimensions is not supported
+	*/
+	unsigned int v[SMC_QMC_BITS], row;
+	int d, k, j, s, a;
+
+	memset(qmc, 0, sizeof(smc_qmc));
+	qmc->type = type;
+	qmc->n_dimensions = n_dimensions;
+	if ((type == SMC_QMC_SOBOL) && (n_dimensions >= 1) &&
+		(n_dimensions <= SMC_QMC_SOBOL_MAX_DIMENSIONS)) {
+		for (d = 0; d < n_dimensions; d++) {
+			/*Direction numbers v_k = m_k 2^(31-k), from the recurrence past the
+			initial ones*/
+			if (d == 0) {
+				for (k = 0; k < SMC_QMC_BITS; k++) v[k] = 1u << (SMC_QMC_BITS - 1 - k);
+			}
+			else{
+				s = sobol_degree[d-1];
+				a = sobol_coefficients[d-1];
+				for (k = 0; k < s; k++) {
+					v[k] = sobol_initial[d-1][k] << (SMC_QMC_BITS - 1 - k);
+				}
+				for (k = s; k < SMC_QMC_BITS; k++) {
+					v[k] = v[k-s] ^ (v[k-s] >> s);
+					for (j = 1; j < s; j++) {
+						if ((a >> (s - 1 - j)) & 1) v[k] ^= v[k-j];
+					}
+				}
+			}
+			/*Scramble by a random lower-triangular matrix with unit diagonal:
+			output digit j depends on input digits 1 to j*/
+			for (k = 0; k < SMC_QMC_BITS; k++) qmc->direction[d][k] = 0;
+			for (j = 0; j < SMC_QMC_BITS; j++) {
+				row = smc_qmc_random_bits(r) & ~((1u << (SMC_QMC_BITS - 1 - j)) - 1u);
+				row |= 1u << (SMC_QMC_BITS - 1 - j);
+				if (j == SMC_QMC_BITS - 1) row |= 1u;
+				for (k = 0; k < SMC_QMC_BITS; k++) {
+					qmc->direction[d][k] |= smc_qmc_parity(row & v[k]) <<
+						(SMC_QMC_BITS - 1 - j);
+				}
+			}
+			qmc->digital_shift[d] = smc_qmc_random_bits(r);
+		}
+		return 0;
+	}
+	if ((type == SMC_QMC_HALTON) && (n_dimensions >= 1) &&
+		(n_dimensions <= SMC_QMC_HALTON_MAX_DIMENSIONS)) {
+		for (d = 0; d < n_dimensions; d++) qmc->shift[d] = gsl_rng_uniform(r);
+		return 0;
+	}
+	printf("Quasi-Monte Carlo type %d does not support %d dimensions\n", type,
+		n_dimensions);
+	return -1;
+}
+
+void smc_qmc_point(const smc_qmc *qmc, unsigned long index, double *u){
+	/*Fill u, (n_dimensions), with point index of the sequence, in (0,1)*/
+	unsigned int x, i32 = (unsigned int)index;
+	unsigned long n;
+	double inverse, digit_scale;
+	int d, k;
+
+	for (d = 0; d < qmc->n_dimensions; d++) {
+		if (qmc->type == SMC_QMC_SOBOL) {
+			x = qmc->digital_shift[d];
+			for (k = 0; (k < SMC_QMC_BITS) && (i32 >> k); k++) {
+				if ((i32 >> k) & 1u) x ^= qmc->direction[d][k];
+			}
+			u[d] = (x + 0.5)/4294967296.0;
+		}
+		else{
+			/*Radical inverse of index in the base of dimension d*/
+			inverse = 0.0;
+			digit_scale = 1.0/halton_base[d];
+			for (n = index; n > 0; n /= halton_base[d]) {
+				inverse += (n % halton_base[d])*digit_scale;
+				digit_scale /= halton_base[d];
+			}
+			u[d] = inverse + qmc->shift[d];
+			if (u[d] >= 1.0) u[d] -= 1.0;
+		}
+	}
+}
+
+void smc_qmc_next(smc_qmc *qmc, double *u){
+	/*Claim the next point of the sequence, which may be shared by threads, and
+	fill u with it*/
+	smc_qmc_point(qmc, __atomic_fetch_add(&qmc->next, 1UL, __ATOMIC_RELAXED), u);
+}
+
+#endif
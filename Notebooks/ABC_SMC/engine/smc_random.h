@@ -0,0 +1,165 @@
+/*
+Batched binomial variates for simulators which draw many counts with the same
+success probability.
+
+smc_binomial_init() computes the constants of Binomial(n, p) once, after which
+smc_binomial_fill() draws a whole array of variates. Uniforms are drawn from the
+GSL generator a block of SMC_RANDOM_BLOCK variates at a time, and each block is
+transformed in two passes:
+- a branch-free pass over the block, which the compiler can vectorise, proposes
+	a candidate for every variate and applies the quick acceptance test, which
+	accepts most candidates without evaluating a logarithm
+- a scalar pass finishes the few candidates left, by the exact acceptance test
+	and, if rejected, further proposals.
+For n p >= SMC_BINOMIAL_BTRS_MIN_MEAN, proposals follow the transformed
+rejection method with squeeze, BTRS (Hormann 1993), whose cost does not grow
+with n. Smaller means are drawn by inversion, which then needs few steps.
+*/
+
+#ifndef SMC_RANDOM_H
+#define SMC_RANDOM_H
+
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+
+#define SMC_RANDOM_BLOCK 64
+#define SMC_BINOMIAL_BTRS_MIN_MEAN 10.0
+
+typedef struct {
+	unsigned int n;
+	double p; // min(p, 1 - p), the variate is reflected if p > 1/2
+	int reflect;
+	int btrs; // 1 for BTRS, 0 for inversion
+
+	/*BTRS*/
+	double spq, a, b, c, v_r, alpha, log_r, m, h;
+
+	/*Inversion*/
+	double q_n, s, ns;
+} smc_binomial;
+
+void smc_binomial_init(smc_binomial *binomial, double p, unsigned int n){
+	/*Compute the constants for drawing Binomial(n, p), with p in [0, 1]*/
+	double q;
+	binomial->n = n;
+	binomial->reflect = (p > 0.5);
+	binomial->p = binomial->reflect ? 1.0 - p : p;
+	if (binomial->p < 0.0) binomial->p = 0.0;
+	q = 1.0 - binomial->p;
+	binomial->btrs = (n*binomial->p >= SMC_BINOMIAL_BTRS_MIN_MEAN);
+
+	if (binomial->btrs) {
+		binomial->spq = sqrt(n*binomial->p*q);
+		binomial->b = 1.15 + 2.53*binomial->spq;
+		binomial->a = -0.0873 + 0.0248*binomial->b + 0.01*binomial->p;
+		binomial->c = n*binomial->p + 0.5;
+		binomial->v_r = 0.92 - 4.2/binomial->b;
+		binomial->alpha = (2.83 + 5.1/binomial->b)*binomial->spq;
+		binomial->log_r = log(binomial->p/q);
+		binomial->m = floor((n + 1)*binomial->p);
+		binomial->h = lgamma(binomial->m + 1.0) + lgamma(n - binomial->m + 1.0);
+	}
+	else{
+		binomial->q_n = pow(q, n);
+		binomial->s = (q > 0.0) ? binomial->p/q : 0.0;
+		binomial->ns = (n + 1)*binomial->s;
+	}
+}
+
+int smc_binomial_accept(const smc_binomial *binomial, double u, double v,
+	double k){
+	/*The exact BTRS acceptance test of candidate k, from the uniforms u - 1/2
+	and v which proposed it*/
+	double us = 0.5 - fabs(u);
+	double bound;
+	if ((k < 0.0) || (k > binomial->n)) return 0;
+	v = log(v*binomial->alpha/(binomial->a/(us*us) + binomial->b));
+	bound = binomial->h - lgamma(k + 1.0) - lgamma(binomial->n - k + 1.0) +
+		(k - binomial->m)*binomial->log_r;
+	return (v <= bound);
+}
+
+unsigned int smc_binomial_finish(gsl_rng *r, const smc_binomial *binomial,
+	double u, double v){
+	/*Draw one variate, starting from the proposal of the uniforms u and v*/
+	double us, k, x;
+	if (binomial->btrs) {
+		while (1) {
+			u -= 0.5;
+			us = 0.5 - fabs(u);
+			k = floor((2.0*binomial->a/us + binomial->b)*u + binomial->c);
+			if (((us >= 0.07) && (v <= binomial->v_r) && (k >= 0.0) &&
+					(k <= binomial->n)) || smc_binomial_accept(binomial, u, v, k)) {
+				return (unsigned int)k;
+			}
+			u = gsl_rng_uniform(r);
+			v = gsl_rng_uniform(r);
+		}
+	}
+	/*Inversion, u falls past the cumulative probability of each count*/
+	while (1) {
+		x = binomial->q_n;
+		for (k = 0.0; (u > x) && (k < binomial->n); ) {
+			u -= x;
+			k += 1.0;
+			x *= binomial->ns/k - binomial->s;
+		}
+		if (u <= x) return (unsigned int)k;
+		u = gsl_rng_uniform(r);
+	}
+}
+
+void smc_binomial_fill(gsl_rng *r, const smc_binomial *binomial, int n_variates,
+	unsigned int *variate){
+	/*Fill variate, (n_variates), with independent Binomial(n, p) variates*/
+	double u[SMC_RANDOM_BLOCK], v[SMC_RANDOM_BLOCK], k[SMC_RANDOM_BLOCK];
+	int accepted[SMC_RANDOM_BLOCK];
+	double us;
+	int first, n, i;
+
+	if (binomial->p <= 0.0) {
+		for (i = 0; i < n_variates; i++) {
+			variate[i] = binomial->reflect ? binomial->n : 0;
+		}
+		return;
+	}
+	for (first = 0; first < n_variates; first += SMC_RANDOM_BLOCK) {
+		n = (n_variates - first < SMC_RANDOM_BLOCK) ? n_variates - first :
+			SMC_RANDOM_BLOCK;
+		if (binomial->btrs) {
+			for (i = 0; i < n; i++) {
+				u[i] = gsl_rng_uniform(r);
+				v[i] = gsl_rng_uniform(r);
+			}
+			for (i = 0; i < n; i++) {
+				us = 0.5 - fabs(u[i] - 0.5);
+				k[i] = floor((2.0*binomial->a/us + binomial->b)*(u[i] - 0.5) +
+					binomial->c);
+				accepted[i] = (us >= 0.07) & (v[i] <= binomial->v_r) & (k[i] >= 0.0) &
+					(k[i] <= binomial->n);
+			}
+		}
+		else{
+			for (i = 0; i < n; i++) {
+				u[i] = gsl_rng_uniform(r);
+				v[i] = 0.0;
+				accepted[i] = 0;
+			}
+		}
+		for (i = 0; i < n; i++) {
+			variate[first + i] = accepted[i] ? (unsigned int)k[i] :
+				smc_binomial_finish(r, binomial, u[i], v[i]);
+			if (binomial->reflect) variate[first + i] = binomial->n - variate[first + i];
+		}
+	}
+}
+
+unsigned int smc_binomial_draw(gsl_rng *r, const smc_binomial *binomial){
+	/*Draw one Binomial(n, p) variate*/
+	unsigned int variate;
+	smc_binomial_fill(r, binomial, 1, &variate);
+	return variate;
+}
+
+#endif
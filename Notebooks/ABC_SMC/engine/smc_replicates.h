@@ -0,0 +1,226 @@
+/*
+Independent replicate runs of ABC SMC, to measure the Monte Carlo error of a
+posterior.
+
+smc_run_replicates() runs n_replicates copies of one run, identical but for
+their seeds (seed, seed + 1, ...), as jobs on a shared pool of threads
+(smc_batch.h). The replicates share the model, and so its data and any
+statistics precomputed from it, which the engine only reads. Each replicate is
+sampled by settings->n_threads threads, so with one thread per replicate each is
+reproducible from its seed, and replicate 0 is the run the settings alone
+would give.
+
+Once every replicate has finished, the final round of each is pooled into one
+population of n_replicates*n_particles particles, each replicate's weights
+divided by n_replicates. For every parameter, write_replicates_to_csv() reports
+the posterior mean, standard deviation and quantiles of the pooled population,
+together with their mean and standard deviation across replicates. The latter is
+the Monte Carlo error of a single run, and divided by sqrt(n_replicates) that of
+the pooled population.
+*/
+
+#ifndef SMC_REPLICATES_H
+#define SMC_REPLICATES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef struct {
+	int n_replicates;
+	smc_settings *settings; // (n_replicates), the settings of each replicate
+	smc_job *job; // (n_replicates), holding the population of each replicate
+	smc_population *pooled; // the final rounds of every replicate, as round 0
+} smc_replicates;
+
+void smc_replicates_free(smc_replicates *replicates){
+	/*Free the populations of replicates run by smc_run_replicates()*/
+	int r;
+	if (replicates->job != NULL) {
+		for (r = 0; r < replicates->n_replicates; r++) {
+			if (replicates->job[r].population != NULL) {
+				smc_population_free(replicates->job[r].population);
+			}
+		}
+	}
+	if (replicates->pooled != NULL) smc_population_free(replicates->pooled);
+	free(replicates->job);
+	free(replicates->settings);
+	replicates->job = NULL;
+	replicates->settings = NULL;
+	replicates->pooled = NULL;
+}
+
+int smc_pool_replicates(smc_replicates *replicates, const smc_model *model){
+	/*Pool the final round of every replicate into replicates->pooled. Returns 0
+	on success, -1 otherwise*/
+	int n_replicates = replicates->n_replicates;
+	int n_particles = replicates->settings[0].n_particles;
+	int n_parameters = model->n_parameters;
+	int n_distances = model->n_distances;
+	int r, i, k, t, n = 0;
+	smc_settings settings = replicates->settings[0];
+	smc_population *population, *pooled;
+	double *hist_lower = malloc(n_parameters * sizeof(double));
+	double *hist_upper = malloc(n_parameters * sizeof(double));
+
+	settings.n_rounds = 1;
+	settings.n_particles = n_replicates*n_particles;
+	pooled = replicates->pooled = smc_population_alloc(model, &settings);
+	if ((pooled == NULL) || (hist_lower == NULL) || (hist_upper == NULL)) {
+		printf("Error allocating pooled population\n");
+		return -1;
+	}
+
+	for (i = 0; i < n_distances; i++) pooled->distance_threshold[i][0] = 0.0;
+	for (r = 0; r < n_replicates; r++) {
+		population = replicates->job[r].population;
+		t = population->n_rounds_completed - 1;
+		for (i = 0; i < population->n_accepted[t]; i++) {
+			for (k = 0; k < n_parameters; k++) {
+				pooled->theta_particle[k][0][n] = population->theta_particle[k][t][i];
+			}
+			pooled->weight[0][n++] = population->weight[t][i]/n_replicates;
+		}
+		/*The pooled threshold is the loosest of the replicates*/
+		for (i = 0; i < n_distances; i++) {
+			if (population->distance_threshold[i][t] > pooled->distance_threshold[i][0]) {
+				pooled->distance_threshold[i][0] = population->distance_threshold[i][t];
+			}
+		}
+		pooled->n_simulations[0] += population->n_simulations[t];
+		pooled->n_screened[0] += population->n_screened[t];
+		if (population->fallback[t] != SMC_FALLBACK_NONE) {
+			pooled->fallback[0] = population->fallback[t];
+		}
+	}
+	for (i = n; i < n_replicates*n_particles; i++) {
+		for (k = 0; k < n_parameters; k++) pooled->theta_particle[k][0][i] = NAN;
+		pooled->weight[0][i] = 0.0;
+	}
+	pooled->n_accepted[0] = n;
+	pooled->ess[0] = effective_sample_size(pooled->weight[0], n);
+	pooled->n_rounds_completed = 1;
+	pooled->stop_reason = SMC_STOP_MAX_ROUNDS;
+
+	/*Histograms share the range of replicate 0*/
+	population = replicates->job[0].population;
+	for (k = 0; k < n_parameters; k++) {
+		hist_lower[k] = smc_population_summary(population,
+			population->n_rounds_completed - 1, k)->hist_lower;
+		hist_upper[k] = smc_population_summary(population,
+			population->n_rounds_completed - 1, k)->hist_upper;
+	}
+	i = smc_summarise_round(&settings, pooled, 0, hist_lower, hist_upper);
+	free(hist_lower);
+	free(hist_upper);
+	return i;
+}
+
+int smc_run_replicates(smc_replicates *replicates, const smc_model *model,
+	const smc_settings *settings, int n_replicates, int n_threads, int verbose){
+	/*Run independent replicates of ABC SMC, and pool their final rounds
+
+	Parameters
+	----------------
+	replicates : Filled with the replicates, to be freed by
+		smc_replicates_free()
+	model : The model to perform inference on, shared by every replicate
+	settings : Settings of replicate 0. Replicate r uses seed settings->seed + r.
+		Only replicate 0 keeps the round_callback, and the engine's verbose
+		output is off, as replicates run concurrently
+	n_replicates : The number of replicates
+	n_threads : The number of threads running replicates at once, or 0 for one
+		per processor
+	verbose : If non-zero, print progress as replicates finish
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	int r;
+
+	replicates->n_replicates = n_replicates;
+	replicates->pooled = NULL;
+	replicates->settings = malloc(n_replicates * sizeof(smc_settings));
+	replicates->job = calloc(n_replicates, sizeof(smc_job));
+	if ((n_replicates < 1) || (replicates->settings == NULL) ||
+		(replicates->job == NULL)) {
+		printf("Error allocating replicates\n");
+		return -1;
+	}
+	for (r = 0; r < n_replicates; r++) {
+		replicates->settings[r] = *settings;
+		replicates->settings[r].seed = settings->seed + r;
+		replicates->settings[r].verbose = 0;
+		if (r > 0) {
+			replicates->settings[r].round_callback = NULL;
+			replicates->settings[r].round_callback_data = NULL;
+		}
+		replicates->job[r].model = model;
+		replicates->job[r].settings = &replicates->settings[r];
+		replicates->job[r].population = smc_population_alloc(model,
+			&replicates->settings[r]);
+		if (replicates->job[r].population == NULL) {
+			printf("Error allocating replicates\n");
+			return -1;
+		}
+	}
+
+	r = smc_run_batch(replicates->job, n_replicates, n_threads, verbose);
+	if (r != 0) {
+		printf("%d replicates failed\n", r);
+		return -1;
+	}
+	return smc_pool_replicates(replicates, model);
+}
+
+double smc_replicate_statistic(smc_population *population, int parameter_index,
+	int statistic){
+	/*Statistic of the final round's posterior of a parameter: 0 the mean, 1
+	the standard deviation, and 2 + i quantile summary_quantiles[i]*/
+	smc_summary *summary = smc_population_summary(population,
+		population->n_rounds_completed - 1, parameter_index);
+	if (statistic == 0) return summary->mean;
+	if (statistic == 1) return sqrt(smc_summary_variance(summary));
+	return smc_summary_quantile(summary, summary_quantiles[statistic - 2]);
+}
+
+void write_replicates_to_csv(smc_replicates *replicates, char *filename){
+	/*Write the posterior statistics of every parameter to a csv file with a
+	header, one row per (parameter, statistic).
+
+	Columns are the parameter index, the statistic (mean, sd or a quantile
+	q<level>), its value for the pooled population, and its mean and standard
+	deviation across replicates.
+	*/
+	FILE *outfile_pointer;
+	int n_replicates = replicates->n_replicates;
+	int k, s, r;
+	double value, mean, m2, delta;
+
+	outfile_pointer = fopen(filename, "w");
+	fprintf(outfile_pointer, "parameter,statistic,pooled,replicate_mean,replicate_sd\n");
+	for (k = 0; k < replicates->pooled->n_parameters; k++) {
+		for (s = 0; s < 2 + SUMMARY_N_QUANTILES; s++) {
+			if (s == 0) fprintf(outfile_pointer, "%d,mean", k);
+			else if (s == 1) fprintf(outfile_pointer, "%d,sd", k);
+			else fprintf(outfile_pointer, "%d,q%g", k, summary_quantiles[s - 2]);
+
+			mean = 0.0;
+			m2 = 0.0;
+			for (r = 0; r < n_replicates; r++) {
+				value = smc_replicate_statistic(replicates->job[r].population, k, s);
+				delta = value - mean;
+				mean += delta/(r + 1);
+				m2 += delta*(value - mean);
+			}
+			fprintf(outfile_pointer, ",%.8f,%.8f,%.8f\n",
+				smc_replicate_statistic(replicates->pooled, k, s), mean,
+				(n_replicates > 1) ? sqrt(m2/(n_replicates - 1)) : 0.0);
+		}
+	}
+	fclose(outfile_pointer);
+}
+
+#endif
@@ -0,0 +1,362 @@
+/*
+Scaled vector distances for models with several distance dimensions.
+
+A model with n_distances > 1 is normally accepted when each distance is within
+its own threshold, so the dimension on the largest scale (e.g. the intercept of
+linear regression) decides most rejections. smc_scaled_model() wraps such a
+model into one with a single distance,
+
+	|W d|,
+
+where W is fitted to pilot simulations from the prior:
+SMC_SCALING_MAD - d is the inner model's distance vector, and W is diagonal,
+	with W_kk = 1/MAD(d_k), the median absolute deviation of dimension k
+	(Prangle 2017)
+SMC_SCALING_MAHALANOBIS - d = s - s_obs is the signed difference between the
+	inner model's simulated and observed summaries, and W = L^-1, where L L^T is
+	the covariance Sigma of s, so |W d|^2 = d^T Sigma^-1 d. Distances such as
+	|s_k - s_obs,k| have lost their signs, so that a difference which breaks the
+	correlation of correlated summaries would look as close as one which follows
+	it; this scaling therefore needs simulate_summary_batch (and
+	simulate_summary_block for blocks of particles)
+
+Batches of simulations (simulate_distance_batch), and blocks of particles
+simulated together (simulate_distance_block), are scaled in blocks of
+SMC_SCALING_BLOCK, one dimension at a time across the block, so that the
+compiler can vectorise the block over its simulations. A joint threshold then
+applies to every dimension at once; settings.target_acceptance_rate adapts it
+to keep the cost per particle steady (smc_engine.h).
+*/
+
+#ifndef SMC_SCALING_H
+#define SMC_SCALING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_sort_double.h>
+#include <gsl/gsl_statistics.h>
+
+#define SMC_SCALING_NONE 0
+#define SMC_SCALING_MAD 1
+#define SMC_SCALING_MAHALANOBIS 2
+
+#define SMC_SCALING_BLOCK 64
+
+typedef struct {
+	const smc_model *inner;
+	int scaling; // one of SMC_SCALING_*
+	int n_dimensions; // of d, inner->n_distances or inner->n_summaries
+	double *weight; // (n_dimensions X n_dimensions), W, lower triangular
+	size_t inner_workspace_size; // bytes of the workspace used by inner, aligned
+} smc_scaled_distance;
+
+void smc_scale_distances(const smc_scaled_distance *scaled, const double *raw,
+	int n, double *out){
+	/*Fill out, (n), with |W d| for each of the n rows d of raw,
+	(n X n_dimensions)*/
+	int n_dimensions = scaled->n_dimensions;
+	const double *w = scaled->weight;
+	double z[SMC_SCALING_BLOCK];
+	int i, j, k;
+
+	for (i = 0; i < n; i++) out[i] = 0.0;
+	for (j = 0; j < n_dimensions; j++) {
+		/*Component j of W d, for every row at once*/
+		for (i = 0; i < n; i++) z[i] = 0.0;
+		for (k = 0; k <= j; k++) {
+			if (w[j*n_dimensions + k] == 0.0) continue;
+			for (i = 0; i < n; i++) {
+				z[i] += w[j*n_dimensions + k]*raw[i*n_dimensions + k];
+			}
+		}
+		for (i = 0; i < n; i++) out[i] += z[i]*z[i];
+	}
+	for (i = 0; i < n; i++) out[i] = sqrt(out[i]);
+}
+
+/*The scaled model forwards everything but its distances to the inner model*/
+
+void smc_scaled_sample_prior(gsl_rng *r, const smc_model *model, double *theta){
+	const smc_model *inner = ((smc_scaled_distance*)model->params)->inner;
+	inner->sample_prior(r, inner, theta);
+}
+
+void smc_scaled_prior_quantile(const smc_model *model, const double *u,
+	double *theta){
+	const smc_model *inner = ((smc_scaled_distance*)model->params)->inner;
+	inner->prior_quantile(inner, u, theta);
+}
+
+double smc_scaled_prior_pdf(const smc_model *model, const double *theta){
+	const smc_model *inner = ((smc_scaled_distance*)model->params)->inner;
+	return inner->prior_pdf(inner, theta);
+}
+
+void smc_scaled_perturb(gsl_rng *r, const smc_model *model,
+	const double *theta_old, double *theta_new){
+	const smc_model *inner = ((smc_scaled_distance*)model->params)->inner;
+	inner->perturb(r, inner, theta_old, theta_new);
+}
+
+double smc_scaled_kernel_pdf(const smc_model *model, const double *theta_old,
+	const double *theta_new){
+	const smc_model *inner = ((smc_scaled_distance*)model->params)->inner;
+	return inner->kernel_pdf(inner, theta_old, theta_new);
+}
+
+void smc_scaled_simulate_summary_batch(gsl_rng *r, const smc_model *model,
+	const double *theta, int n_simulations, void *workspace, double *summary){
+	const smc_model *inner = ((smc_scaled_distance*)model->params)->inner;
+	inner->simulate_summary_batch(r, inner, theta, n_simulations, workspace,
+		summary);
+}
+
+void smc_scaled_simulate_summary_block(gsl_rng *r, const smc_model *model,
+	int n_theta, const double *theta, void *workspace, double *summary){
+	const smc_model *inner = ((smc_scaled_distance*)model->params)->inner;
+	inner->simulate_summary_block(r, inner, n_theta, theta, workspace, summary);
+}
+
+void smc_scaled_residuals(const smc_scaled_distance *scaled, int n, double *raw){
+	/*Subtract the observed summaries from each of the n rows of raw,
+	(n X n_summaries)*/
+	const double *observed = scaled->inner->observed_summary;
+	int n_summaries = scaled->n_dimensions;
+	int i, k;
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < n_summaries; k++) raw[i*n_summaries + k] -= observed[k];
+	}
+}
+
+void smc_scaled_simulate_distance_batch(gsl_rng *r, const smc_model *model,
+	const double *theta, int n_simulations, void *workspace, double *distance){
+	/*Simulate the inner model in blocks, and scale each block*/
+	smc_scaled_distance *scaled = (smc_scaled_distance*)model->params;
+	const smc_model *inner = scaled->inner;
+	double *raw = (double*)((char*)workspace + scaled->inner_workspace_size);
+	int first, n, j;
+
+	for (first = 0; first < n_simulations; first += SMC_SCALING_BLOCK) {
+		n = (n_simulations - first < SMC_SCALING_BLOCK) ? n_simulations - first :
+			SMC_SCALING_BLOCK;
+		if (scaled->scaling == SMC_SCALING_MAHALANOBIS) {
+			inner->simulate_summary_batch(r, inner, theta, n, workspace, raw);
+			smc_scaled_residuals(scaled, n, raw);
+		}
+		else if (inner->simulate_distance_batch != NULL) {
+			inner->simulate_distance_batch(r, inner, theta, n, workspace, raw);
+		}
+		else{
+			for (j = 0; j < n; j++) {
+				inner->simulate_distance(r, inner, theta, workspace,
+					raw + (size_t)j*inner->n_distances);
+			}
+		}
+		smc_scale_distances(scaled, raw, n, distance + first);
+	}
+}
+
+void smc_scaled_simulate_distance_block(gsl_rng *r, const smc_model *model,
+	int n_theta, const double *theta, void *workspace, double *distance){
+	/*Simulate the inner model's blocks of particles in pieces of
+	SMC_SCALING_BLOCK, and scale each piece*/
+	smc_scaled_distance *scaled = (smc_scaled_distance*)model->params;
+	const smc_model *inner = scaled->inner;
+	double *raw = (double*)((char*)workspace + scaled->inner_workspace_size);
+	int first, n;
+
+	for (first = 0; first < n_theta; first += SMC_SCALING_BLOCK) {
+		n = (n_theta - first < SMC_SCALING_BLOCK) ? n_theta - first :
+			SMC_SCALING_BLOCK;
+		if (scaled->scaling == SMC_SCALING_MAHALANOBIS) {
+			inner->simulate_summary_block(r, inner, n,
+				theta + (size_t)first*inner->n_parameters, workspace, raw);
+			smc_scaled_residuals(scaled, n, raw);
+		}
+		else{
+			inner->simulate_distance_block(r, inner, n,
+				theta + (size_t)first*inner->n_parameters, workspace, raw);
+		}
+		smc_scale_distances(scaled, raw, n, distance + first);
+	}
+}
+
+void smc_scaled_simulate_distance(gsl_rng *r, const smc_model *model,
+	const double *theta, void *workspace, double *distance){
+	smc_scaled_simulate_distance_batch(r, model, theta, 1, workspace, distance);
+}
+
+int smc_scaled_distance_init(smc_scaled_distance *scaled, const smc_model *inner,
+	int scaling, int n_pilot, unsigned long int seed){
+	/*Fit the scaling of a model's distances to pilot simulations
+
+	Parameters
+	----------------
+	scaled : The scaling to fit, freed by smc_scaled_distance_free()
+	inner : The model whose distances are scaled
+	scaling : SMC_SCALING_MAD or SMC_SCALING_MAHALANOBIS
+	n_pilot : The number of pilot simulations, each at a draw from the prior
+	seed : Seed of the pilot simulations
+
+	Returns
+	----------------
+	0 on success, -1 if the scaling could not be fitted, e.g. if a dimension has
+	no spread in the pilot simulations, in which case nothing is left to free
+	*/
+	int n_dimensions = (scaling == SMC_SCALING_MAHALANOBIS) ? inner->n_summaries :
+		inner->n_distances;
+	int i, j, k, status = -1;
+	double median, sum;
+	gsl_rng *r = gsl_rng_alloc(gsl_rng_mt19937);
+	void *workspace = malloc(inner->workspace_size > 0 ? inner->workspace_size : 1);
+	double *theta = malloc(inner->n_parameters * sizeof(double));
+	double *pilot = malloc((size_t)n_pilot * n_dimensions * sizeof(double));
+	double *column = malloc(n_pilot * sizeof(double));
+	double *cov = malloc(n_dimensions * n_dimensions * sizeof(double));
+
+	scaled->inner = inner;
+	scaled->scaling = scaling;
+	scaled->n_dimensions = n_dimensions;
+	scaled->inner_workspace_size = (inner->workspace_size + 15)/16*16;
+	scaled->weight = calloc(n_dimensions * n_dimensions, sizeof(double));
+	if ((scaling == SMC_SCALING_MAHALANOBIS) && ((n_dimensions < 1) ||
+		(inner->observed_summary == NULL) ||
+		(inner->simulate_summary_batch == NULL))) {
+		printf("Mahalanobis distance scaling needs the model's summary statistics\n");
+		goto done;
+	}
+	if (((scaling != SMC_SCALING_MAD) && (scaling != SMC_SCALING_MAHALANOBIS)) ||
+		(n_pilot < 2*n_dimensions)) {
+		printf("Distance scaling needs a known scaling and at least %d pilot simulations\n",
+			2*n_dimensions);
+		goto done;
+	}
+	if ((r == NULL) || (workspace == NULL) || (theta == NULL) || (pilot == NULL) ||
+		(column == NULL) || (cov == NULL) || (scaled->weight == NULL)) {
+		printf("Error allocating pilot simulations\n");
+		goto done;
+	}
+	status = 0;
+
+	/*The covariance of the summaries is that of their differences to the
+	observed summaries, so the pilot simulations keep the summaries as they are*/
+	gsl_rng_set(r, seed);
+	for (i = 0; i < n_pilot; i++) {
+		inner->sample_prior(r, inner, theta);
+		if (scaling == SMC_SCALING_MAHALANOBIS) {
+			inner->simulate_summary_batch(r, inner, theta, 1, workspace,
+				pilot + (size_t)i*n_dimensions);
+		}
+		else{
+			inner->simulate_distance(r, inner, theta, workspace,
+				pilot + (size_t)i*n_dimensions);
+		}
+	}
+
+	if (scaling == SMC_SCALING_MAD) {
+		for (k = 0; (k < n_dimensions) && (status == 0); k++) {
+			for (i = 0; i < n_pilot; i++) {
+				column[i] = pilot[(size_t)i*n_dimensions + k];
+			}
+			gsl_sort(column, 1, n_pilot);
+			median = gsl_stats_median_from_sorted_data(column, 1, n_pilot);
+			for (i = 0; i < n_pilot; i++) column[i] = fabs(column[i] - median);
+			gsl_sort(column, 1, n_pilot);
+			sum = gsl_stats_median_from_sorted_data(column, 1, n_pilot);
+			if (!(sum > 0.0)) status = -1;
+			else scaled->weight[k*n_dimensions + k] = 1.0/sum;
+		}
+	}
+	else{
+		/*Cholesky factorise the covariance Sigma = L L^T, then invert L by
+		forward substitution*/
+		for (j = 0; j < n_dimensions; j++) {
+			for (k = 0; k <= j; k++) {
+				cov[j*n_dimensions + k] = gsl_stats_covariance(pilot + j, n_dimensions,
+					pilot + k, n_dimensions, n_pilot);
+			}
+		}
+		for (j = 0; (j < n_dimensions) && (status == 0); j++) {
+			for (k = 0; k <= j; k++) {
+				sum = cov[j*n_dimensions + k];
+				for (i = 0; i < k; i++) {
+					sum -= cov[j*n_dimensions + i]*cov[k*n_dimensions + i];
+				}
+				if (k < j) cov[j*n_dimensions + k] = sum/cov[k*n_dimensions + k];
+				else if (sum > 0.0) cov[j*n_dimensions + j] = sqrt(sum);
+				else status = -1;
+			}
+		}
+		for (j = 0; (j < n_dimensions) && (status == 0); j++) {
+			scaled->weight[j*n_dimensions + j] = 1.0/cov[j*n_dimensions + j];
+			for (k = 0; k < j; k++) {
+				sum = 0.0;
+				for (i = k; i < j; i++) {
+					sum += cov[j*n_dimensions + i]*scaled->weight[i*n_dimensions + k];
+				}
+				scaled->weight[j*n_dimensions + k] = -sum/cov[j*n_dimensions + j];
+			}
+		}
+	}
+	if (status != 0) {
+		printf("Pilot simulations have no spread, cannot scale them\n");
+	}
+
+done:
+	if (status != 0) {
+		free(scaled->weight);
+		scaled->weight = NULL;
+	}
+	if (r != NULL) gsl_rng_free(r);
+	free(workspace);
+	free(theta);
+	free(pilot);
+	free(column);
+	free(cov);
+	return status;
+}
+
+void smc_scaled_distance_free(smc_scaled_distance *scaled){
+	/*Free a scaling fitted by smc_scaled_distance_init()*/
+	free(scaled->weight);
+}
+
+smc_model smc_scaled_model(smc_scaled_distance *scaled){
+	/*A model with the parameters of scaled->inner and its single scaled
+	distance. scaled must outlive the model*/
+	const smc_model *inner = scaled->inner;
+	int mahalanobis = (scaled->scaling == SMC_SCALING_MAHALANOBIS);
+	smc_model model;
+
+	model.n_parameters = inner->n_parameters;
+	model.n_distances = 1;
+	model.workspace_size = scaled->inner_workspace_size +
+		(size_t)SMC_SCALING_BLOCK * scaled->n_dimensions * sizeof(double);
+	model.params = scaled;
+	model.sample_prior = smc_scaled_sample_prior;
+	model.prior_quantile = (inner->prior_quantile != NULL) ?
+		smc_scaled_prior_quantile : NULL;
+	model.prior_pdf = smc_scaled_prior_pdf;
+	model.perturb = smc_scaled_perturb;
+	model.kernel_pdf = smc_scaled_kernel_pdf;
+	model.simulate_distance = smc_scaled_simulate_distance;
+	model.simulate_distance_batch = smc_scaled_simulate_distance_batch;
+	model.block_size = inner->block_size;
+	model.simulate_distance_block =
+		((mahalanobis && (inner->simulate_summary_block != NULL)) ||
+		(!mahalanobis && (inner->simulate_distance_block != NULL))) ?
+		smc_scaled_simulate_distance_block : NULL;
+	model.n_summaries = inner->n_summaries;
+	model.observed_summary = inner->observed_summary;
+	model.simulate_summary_batch = (inner->simulate_summary_batch != NULL) ?
+		smc_scaled_simulate_summary_batch : NULL;
+	model.simulate_summary_block = (inner->simulate_summary_block != NULL) ?
+		smc_scaled_simulate_summary_block : NULL;
+	return model;
+}
+
+#endif
@@ -0,0 +1,486 @@
+/*
+A long-running ABC SMC job server on a local Unix socket.
+
+Launching a process per inference recompiles, rereads data and starts threads
+for every run. An smc_server instead holds datasets whose models were built
+once when it started (smc_server_dataset), and a pool of worker threads which
+stay alive between jobs. Each connection carries one request line, handled by
+the next free worker:
+
+	run model=<model> data=<dataset> [<setting>=<value> ...]
+		Run smc_run() on a preloaded dataset. Settings not given take the
+		server's defaults: n_particles, n_rounds, seed, threshold_init (one value
+		per distance, comma-separated, or one for all), quantile_accept_distance,
+		target_acceptance_rate, ess_resample_fraction, threshold_tolerance,
+		posterior_tolerance, mode (rejection, averaged or synthetic_likelihood),
+		n_simulations_per_particle, n_threads, max_simulations_per_round,
+		round_time_limit, budget_fallback (relax or shrink), surrogate_screening
+		and prior_sampling (random, sobol or halton).
+	datasets
+		List the preloaded datasets.
+	shutdown
+		Stop accepting connections, finish the queued jobs and exit.
+
+A run replies `accepted <job>`, then streams one line per completed round,
+
+	round <t> ess <ess> n_simulations <n> n_accepted <n> threshold <e_0,...>
+		mean <mean_0,...>
+
+and ends with `result stop_reason <reason> n_rounds <n>`, the summary csv of the
+run (see write_summaries_to_csv()) and `end`. Failures reply `error <message>`.
+
+Jobs run with n_threads = 1 unless a request asks for more, so a job uses only
+its worker; datasets and their models are shared read-only between jobs. Include
+after smc_engine.h, smc_io.h, smc_datasets.h and smc_batch.h.
+*/
+
+#ifndef SMC_SERVER_H
+#define SMC_SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SMC_SERVER_NAME_LENGTH 32
+#define SMC_SERVER_REQUEST_LENGTH 4096
+#define SMC_SERVER_QUEUE_LENGTH 64
+#define SMC_SERVER_MAX_TOKENS 64
+
+typedef struct {
+	char model_name[SMC_SERVER_NAME_LENGTH]; // e.g. "beta_binomial"
+	char name[DATASET_NAME_LENGTH]; // the data reference of requests
+	int n_data;
+	smc_model model; // built once, read by every job on this dataset
+	double *threshold_init; // (n_distances), the default of requests
+	double *histogram_lower; // (n_parameters), or NULL
+	double *histogram_upper; // (n_parameters), or NULL
+} smc_server_dataset;
+
+typedef struct {
+	smc_server_dataset *dataset;
+	int n_datasets;
+	smc_settings defaults; // settings of a run before those of its request
+
+	char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+	int listen_fd;
+	int queue[SMC_SERVER_QUEUE_LENGTH]; // connections waiting for a worker
+	int queue_head;
+	int queue_size;
+	int stopping;
+	long n_jobs; // runs accepted so far, numbering the jobs
+	int n_workers;
+	pthread_t *worker;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+} smc_server;
+
+int smc_server_parse_long(const char *value, long *x){
+	/*Parse a whole value as an integer. Returns 0 on success, -1 otherwise*/
+	char *end;
+	*x = strtol(value, &end, 10);
+	return ((end != value) && (*end == '\0')) ? 0 : -1;
+}
+
+int smc_server_parse_double(const char *value, double *x){
+	/*Parse a whole value as a double. Returns 0 on success, -1 otherwise*/
+	char *end;
+	*x = strtod(value, &end);
+	return ((end != value) && (*end == '\0')) ? 0 : -1;
+}
+
+int smc_server_parse_doubles(const char *value, double *x, int n){
+	/*Parse n comma-separated doubles, or one double copied n times. Returns 0 on
+	success, -1 otherwise*/
+	const char *start = value;
+	char *end = NULL;
+	int i;
+	for (i = 0; i < n; i++) {
+		x[i] = strtod(start, &end);
+		if (end == start) return -1;
+		if (*end != ',') break;
+		start = end + 1;
+	}
+	if (*end != '\0') return -1;
+	if (i == 0) {
+		for (i = 1; i < n; i++) x[i] = x[0];
+		return 0;
+	}
+	return (i == n - 1) ? 0 : -1;
+}
+
+int smc_server_parse_setting(smc_settings *settings, double *threshold_init,
+	int n_distances, const char *key, const char *value){
+	/*Apply one setting of a run request. Returns 0 on success, -1 if the key is
+	unknown or its value invalid*/
+	long integer;
+
+	if (strcmp(key, "threshold_init") == 0) {
+		return smc_server_parse_doubles(value, threshold_init, n_distances);
+	}
+	if (strcmp(key, "mode") == 0) {
+		if (strcmp(value, "rejection") == 0) {
+			settings->inference_mode = SMC_MODE_REJECTION;
+		}
+		else if (strcmp(value, "averaged") == 0) {
+			settings->inference_mode = SMC_MODE_AVERAGED_ACCEPTANCE;
+		}
+		else if (strcmp(value, "synthetic_likelihood") == 0) {
+			settings->inference_mode = SMC_MODE_SYNTHETIC_LIKELIHOOD;
+		}
+		else return -1;
+		return 0;
+	}
+	if (strcmp(key, "budget_fallback") == 0) {
+		if (strcmp(value, "relax") == 0) {
+			settings->budget_fallback = SMC_FALLBACK_RELAX_THRESHOLD;
+		}
+		else if (strcmp(value, "shrink") == 0) {
+			settings->budget_fallback = SMC_FALLBACK_SHRINK_POPULATION;
+		}
+		else return -1;
+		return 0;
+	}
+	if (strcmp(key, "prior_sampling") == 0) {
+		if (strcmp(value, "random") == 0) settings->prior_sampling = SMC_QMC_NONE;
+		else if (strcmp(value, "sobol") == 0) settings->prior_sampling = SMC_QMC_SOBOL;
+		else if (strcmp(value, "halton") == 0) {
+			settings->prior_sampling = SMC_QMC_HALTON;
+		}
+		else return -1;
+		return 0;
+	}
+
+	if (strcmp(key, "quantile_accept_distance") == 0) {
+		return smc_server_parse_double(value, &settings->quantile_accept_distance);
+	}
+	if (strcmp(key, "target_acceptance_rate") == 0) {
+		return smc_server_parse_double(value, &settings->target_acceptance_rate);
+	}
+	if (strcmp(key, "ess_resample_fraction") == 0) {
+		return smc_server_parse_double(value, &settings->ess_resample_fraction);
+	}
+	if (strcmp(key, "threshold_tolerance") == 0) {
+		return smc_server_parse_double(value, &settings->threshold_tolerance);
+	}
+	if (strcmp(key, "posterior_tolerance") == 0) {
+		return smc_server_parse_double(value, &settings->posterior_tolerance);
+	}
+	if (strcmp(key, "round_time_limit") == 0) {
+		return smc_server_parse_double(value, &settings->round_time_limit);
+	}
+
+	if (smc_server_parse_long(value, &integer) != 0) return -1;
+	if (strcmp(key, "n_particles") == 0) settings->n_particles = (int)integer;
+	else if (strcmp(key, "n_rounds") == 0) settings->n_rounds = (int)integer;
+	else if (strcmp(key, "seed") == 0) settings->seed = (unsigned long int)integer;
+	else if (strcmp(key, "n_simulations_per_particle") == 0) {
+		settings->n_simulations_per_particle = (int)integer;
+	}
+	else if (strcmp(key, "n_threads") == 0) settings->n_threads = (int)integer;
+	else if (strcmp(key, "max_simulations_per_round") == 0) {
+		settings->max_simulations_per_round = integer;
+	}
+	else if (strcmp(key, "surrogate_screening") == 0) {
+		settings->surrogate_screening = (int)integer;
+	}
+	else return -1;
+	return 0;
+}
+
+void smc_server_round(const smc_population *population, int time_smc,
+	void *arg){
+	/*Stream the progress of a completed round to the client, an smc_settings
+	round_callback*/
+	FILE *out = (FILE*)arg;
+	smc_population *p = (smc_population*)population;
+	int i, k;
+
+	fprintf(out, "round %d ess %.8f n_simulations %ld n_accepted %d threshold ",
+		time_smc, p->ess[time_smc], p->n_simulations[time_smc],
+		p->n_accepted[time_smc]);
+	for (i = 0; i < p->n_distances; i++) {
+		fprintf(out, (i > 0) ? ",%.8f" : "%.8f", p->distance_threshold[i][time_smc]);
+	}
+	fprintf(out, " mean ");
+	for (k = 0; k < p->n_parameters; k++) {
+		fprintf(out, (k > 0) ? ",%.8f" : "%.8f",
+			smc_population_summary(p, time_smc, k)->mean);
+	}
+	fprintf(out, "\n");
+	fflush(out);
+}
+
+smc_server_dataset *smc_server_find(smc_server *server, const char *model_name,
+	const char *name){
+	/*The preloaded dataset of a model with the given name, or NULL*/
+	int i;
+	for (i = 0; i < server->n_datasets; i++) {
+		if ((strcmp(server->dataset[i].model_name, model_name) == 0) &&
+			(strcmp(server->dataset[i].name, name) == 0)) {
+			return &server->dataset[i];
+		}
+	}
+	return NULL;
+}
+
+void smc_server_run(smc_server *server, char *request, FILE *out){
+	/*Run the job of a request, whose leading "run" has been removed*/
+	char *token[SMC_SERVER_MAX_TOKENS];
+	char *save, *value;
+	const char *model_name = NULL, *name = NULL;
+	smc_server_dataset *dataset;
+	smc_settings settings = server->defaults;
+	smc_population *population;
+	const char *error;
+	double *threshold_init;
+	long job;
+	int n_tokens = 0, i;
+
+	for (token[0] = strtok_r(request, " \t\r\n", &save); token[n_tokens] != NULL;
+			token[n_tokens] = strtok_r(NULL, " \t\r\n", &save)) {
+		if (strncmp(token[n_tokens], "model=", 6) == 0) {
+			model_name = token[n_tokens] + 6;
+		}
+		else if (strncmp(token[n_tokens], "data=", 5) == 0) {
+			name = token[n_tokens] + 5;
+		}
+		else if (++n_tokens == SMC_SERVER_MAX_TOKENS) {
+			fprintf(out, "error too many settings\n");
+			return;
+		}
+	}
+	if ((model_name == NULL) || (name == NULL)) {
+		fprintf(out, "error run needs model= and data=\n");
+		return;
+	}
+	dataset = smc_server_find(server, model_name, name);
+	if (dataset == NULL) {
+		fprintf(out, "error no dataset %s for model %s\n", name, model_name);
+		return;
+	}
+
+	threshold_init = malloc(dataset->model.n_distances * sizeof(double));
+	if (threshold_init == NULL) {fprintf(out, "error out of memory\n"); return;}
+	memcpy(threshold_init, dataset->threshold_init,
+		dataset->model.n_distances * sizeof(double));
+	for (i = 0; i < n_tokens; i++) {
+		value = strchr(token[i], '=');
+		if (value != NULL) *value++ = '\0';
+		if ((value == NULL) || (smc_server_parse_setting(&settings, threshold_init,
+				dataset->model.n_distances, token[i], value) != 0)) {
+			fprintf(out, "error invalid setting %s\n", token[i]);
+			free(threshold_init);
+			return;
+		}
+	}
+	if ((settings.n_particles < 1) || (settings.n_rounds < 1)) {
+		fprintf(out, "error n_particles and n_rounds must be positive\n");
+		free(threshold_init);
+		return;
+	}
+	settings.threshold_init = threshold_init;
+	settings.histogram_lower = dataset->histogram_lower;
+	settings.histogram_upper = dataset->histogram_upper;
+	settings.round_callback = smc_server_round;
+	settings.round_callback_data = out;
+	settings.verbose = 0;
+
+	error = smc_settings_error(&dataset->model, &settings);
+	if (error != NULL) {
+		fprintf(out, "error %s\n", error);
+		free(threshold_init);
+		return;
+	}
+	population = smc_population_alloc(&dataset->model, &settings);
+	if (population == NULL) {
+		fprintf(out, "error out of memory\n");
+		free(threshold_init);
+		return;
+	}
+	pthread_mutex_lock(&server->lock);
+	job = server->n_jobs++;
+	pthread_mutex_unlock(&server->lock);
+	fprintf(out, "accepted %ld\n", job);
+	fflush(out);
+
+	if (smc_run(&dataset->model, &settings, population) != 0) {
+		fprintf(out, "error ABC SMC failed\n");
+	}
+	else{
+		fprintf(out, "result stop_reason %d n_rounds %d\n", population->stop_reason,
+			population->n_rounds_completed);
+		write_summaries_header(out, population, "");
+		write_summaries_rows(out, population, "");
+		fprintf(out, "end\n");
+	}
+	smc_population_free(population);
+	free(threshold_init);
+}
+
+void smc_server_stop(smc_server *server){
+	/*Stop accepting connections. Only async-signal-safe calls are made, so this
+	may be called from a signal handler*/
+	__atomic_store_n(&server->stopping, 1, __ATOMIC_RELAXED);
+	shutdown(server->listen_fd, SHUT_RDWR);
+}
+
+void smc_server_handle(smc_server *server, int fd){
+	/*Read one request from a connection, answer it and close the connection*/
+	char request[SMC_SERVER_REQUEST_LENGTH];
+	FILE *in = fdopen(fd, "r");
+	FILE *out = fdopen(dup(fd), "w");
+	int i;
+
+	if ((in == NULL) || (out == NULL)) {
+		if (in != NULL) fclose(in);
+		else close(fd);
+		if (out != NULL) fclose(out);
+		return;
+	}
+	if (fgets(request, sizeof(request), in) == NULL) request[0] = '\0';
+
+	if (strncmp(request, "run", 3) == 0) smc_server_run(server, request + 3, out);
+	else if (strncmp(request, "datasets", 8) == 0) {
+		for (i = 0; i < server->n_datasets; i++) {
+			fprintf(out, "dataset %s %s %d\n", server->dataset[i].model_name,
+				server->dataset[i].name, server->dataset[i].n_data);
+		}
+		fprintf(out, "end\n");
+	}
+	else if (strncmp(request, "shutdown", 8) == 0) {
+		smc_server_stop(server);
+		fprintf(out, "ok\n");
+	}
+	else fprintf(out, "error unknown request\n");
+	fclose(out);
+	fclose(in);
+}
+
+void *smc_server_worker(void *arg){
+	/*Handle queued connections until the server stops and the queue is empty*/
+	smc_server *server = (smc_server*)arg;
+	int fd;
+
+	while (1) {
+		pthread_mutex_lock(&server->lock);
+		while ((server->queue_size == 0) &&
+			!__atomic_load_n(&server->stopping, __ATOMIC_RELAXED)) {
+			pthread_cond_wait(&server->changed, &server->lock);
+		}
+		if (server->queue_size == 0) {
+			pthread_mutex_unlock(&server->lock);
+			return NULL;
+		}
+		fd = server->queue[server->queue_head];
+		server->queue_head = (server->queue_head + 1) % SMC_SERVER_QUEUE_LENGTH;
+		server->queue_size--;
+		pthread_mutex_unlock(&server->lock);
+		smc_server_handle(server, fd);
+	}
+}
+
+int smc_server_start(smc_server *server, const char *socket_path,
+	int n_workers){
+	/*Listen on socket_path and start the worker threads
+
+	Parameters
+	----------------
+	server : A server whose datasets and defaults are set
+	socket_path : The path of the Unix socket, replaced if it exists
+	n_workers : The number of jobs run at once, or 0 for one per processor
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	struct sockaddr_un address;
+	int i;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		printf("Socket path %s is too long\n", socket_path);
+		return -1;
+	}
+	memcpy(server->socket_path, socket_path, strlen(socket_path) + 1);
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, socket_path, strlen(socket_path) + 1);
+	unlink(socket_path);
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((server->listen_fd < 0) ||
+		(bind(server->listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0) ||
+		(listen(server->listen_fd, SMC_SERVER_QUEUE_LENGTH) != 0)) {
+		printf("Cannot listen on %s\n", socket_path);
+		return -1;
+	}
+	/*A client which disconnects early must not kill the server*/
+	signal(SIGPIPE, SIG_IGN);
+
+	server->queue_head = 0;
+	server->queue_size = 0;
+	server->stopping = 0;
+	server->n_jobs = 0;
+	server->n_workers = (n_workers > 0) ? n_workers : smc_default_n_threads();
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->changed, NULL);
+	server->worker = malloc(server->n_workers * sizeof(pthread_t));
+	if (server->worker == NULL) {printf("Error allocating server\n"); return -1;}
+	for (i = 0; i < server->n_workers; i++) {
+		if (pthread_create(&server->worker[i], NULL, smc_server_worker,
+				server) != 0) {
+			printf("Error starting server threads\n");
+			server->n_workers = i;
+			return (i > 0) ? 0 : -1;
+		}
+	}
+	return 0;
+}
+
+int smc_server_serve(smc_server *server){
+	/*Accept connections until smc_server_stop() is called, then finish the
+	queued jobs, join the workers and remove the socket. Returns 0 on a clean
+	stop, -1 if accepting failed*/
+	int fd, status = 0;
+
+	while (!__atomic_load_n(&server->stopping, __ATOMIC_RELAXED)) {
+		fd = accept(server->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			if (!__atomic_load_n(&server->stopping, __ATOMIC_RELAXED)) status = -1;
+			break;
+		}
+		pthread_mutex_lock(&server->lock);
+		if (server->queue_size == SMC_SERVER_QUEUE_LENGTH) {
+			pthread_mutex_unlock(&server->lock);
+			if (write(fd, "error server busy\n", 18) < 0) {}
+			close(fd);
+			continue;
+		}
+		server->queue[(server->queue_head + server->queue_size) %
+			SMC_SERVER_QUEUE_LENGTH] = fd;
+		server->queue_size++;
+		pthread_cond_signal(&server->changed);
+		pthread_mutex_unlock(&server->lock);
+	}
+
+	pthread_mutex_lock(&server->lock);
+	__atomic_store_n(&server->stopping, 1, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&server->changed);
+	pthread_mutex_unlock(&server->lock);
+	for (fd = 0; fd < server->n_workers; fd++) {
+		pthread_join(server->worker[fd], NULL);
+	}
+	free(server->worker);
+	pthread_mutex_destroy(&server->lock);
+	pthread_cond_destroy(&server->changed);
+	close(server->listen_fd);
+	unlink(server->socket_path);
+	return status;
+}
+
+#endif
@@ -0,0 +1,271 @@
+/*
+Streaming, weighted summaries of a population of particles.
+
+For each round of SMC and each parameter, the engine keeps an smc_summary of the
+weighted particles:
+- the weighted mean and variance (West 1979), combined with Chan et al.'s
+	pairwise update when two summaries are merged,
+- a weighted quantile sketch, a merging t-digest (Dunning & Ertl 2019) whose
+	centroids are sized by the k1 scale function, so that quantiles in the tails
+	are more accurate than in the bulk,
+- a histogram with fixed bins on [hist_lower, hist_upper]. Values outside the
+	range are counted in the first or last bin, and every value is counted in the
+	first bin if the range is empty (hist_upper <= hist_lower).
+
+Every part of a summary can be updated one particle at a time and merged with
+another summary of the same parameter, so summaries can be accumulated in pieces
+(for instance by several threads) without keeping the particles.
+*/
+
+#ifndef SMC_SUMMARY_H
+#define SMC_SUMMARY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SUMMARY_N_QUANTILES 7
+const double summary_quantiles[SUMMARY_N_QUANTILES] = {0.025, 0.05, 0.25, 0.5,
+	0.75, 0.95, 0.975};
+
+typedef struct {
+	double mean;
+	double weight;
+} smc_centroid;
+
+typedef struct {
+	double total_weight;
+	double mean;
+	double m2; // weighted sum of squared deviations from the mean
+	double min;
+	double max;
+
+	/*Quantile sketch*/
+	int compression;
+	int n_centroids;
+	int n_buffered;
+	int buffer_size;
+	smc_centroid *centroid; // capacity 2*compression + buffer_size
+	smc_centroid *buffer; // capacity buffer_size
+
+	/*Histogram*/
+	int n_bins;
+	double hist_lower;
+	double hist_upper;
+	double *histogram;
+} smc_summary;
+
+int smc_summary_init(smc_summary *summary, int compression, int n_bins,
+	double hist_lower, double hist_upper){
+	/*Initialise an empty summary
+
+	Parameters
+	----------------
+	summary : The summary to initialise
+	compression : The t-digest compression. The sketch keeps at most about
+		compression/2 centroids
+	n_bins : The number of histogram bins
+	hist_lower, hist_upper : The range of the histogram
+
+	Returns
+	----------------
+	0 on success, -1 if allocation failed
+	*/
+	summary->total_weight = 0.0;
+	summary->mean = 0.0;
+	summary->m2 = 0.0;
+	summary->min = INFINITY;
+	summary->max = -INFINITY;
+
+	summary->compression = compression;
+	summary->n_centroids = 0;
+	summary->n_buffered = 0;
+	summary->buffer_size = 5*compression;
+	summary->centroid = malloc((2*compression + summary->buffer_size) *
+		sizeof(smc_centroid));
+	summary->buffer = malloc(summary->buffer_size * sizeof(smc_centroid));
+
+	summary->n_bins = n_bins;
+	summary->hist_lower = hist_lower;
+	summary->hist_upper = hist_upper;
+	summary->histogram = calloc(n_bins > 0 ? n_bins : 1, sizeof(double));
+
+	if ((summary->centroid == NULL) || (summary->buffer == NULL) ||
+		(summary->histogram == NULL)) {
+		printf("Error allocating summary\n");
+		return -1;
+	}
+	return 0;
+}
+
+void smc_summary_free(smc_summary *summary){
+	/*Free the storage of a summary initialised by smc_summary_init()*/
+	free(summary->centroid);
+	free(summary->buffer);
+	free(summary->histogram);
+	summary->centroid = NULL;
+	summary->buffer = NULL;
+	summary->histogram = NULL;
+}
+
+int compare_centroids(const void *a, const void *b){
+	/*Order centroids by their mean, for qsort()*/
+	double mean_a = ((const smc_centroid*)a)->mean;
+	double mean_b = ((const smc_centroid*)b)->mean;
+	return (mean_a > mean_b) - (mean_a < mean_b);
+}
+
+double tdigest_scale(double q, int compression){
+	/*The k1 scale function of a t-digest, delta/(2 pi) asin(2q - 1). q is
+	clamped to [0, 1], which rounding in the running sums of weights can leave*/
+	if (q < 0.0) q = 0.0;
+	if (q > 1.0) q = 1.0;
+	return compression/(2.0*M_PI)*asin(2.0*q - 1.0);
+}
+
+void smc_summary_compress(smc_summary *summary){
+	/*Merge buffered points into the centroids of the quantile sketch
+
+	Centroids and buffered points are sorted together, and neighbours are merged
+	while the merged centroid spans at most one unit of the scale function.
+	*/
+	int i;
+	int n = summary->n_centroids;
+	double total_weight = 0.0;
+	double weight_so_far = 0.0;
+	double k_lower, q_upper;
+	smc_centroid *all = summary->centroid;
+	smc_centroid current;
+
+	if (summary->n_buffered == 0) return;
+	memcpy(all + n, summary->buffer, summary->n_buffered * sizeof(smc_centroid));
+	n += summary->n_buffered;
+	summary->n_buffered = 0;
+	qsort(all, n, sizeof(smc_centroid), compare_centroids);
+
+	for (i = 0; i < n; i++) total_weight += all[i].weight;
+	if (total_weight <= 0.0) {
+		summary->n_centroids = 0;
+		return;
+	}
+
+	summary->n_centroids = 0;
+	current = all[0];
+	k_lower = tdigest_scale(0.0, summary->compression);
+	for (i = 1; i < n; i++) {
+		q_upper = (weight_so_far + current.weight + all[i].weight)/total_weight;
+		if (tdigest_scale(q_upper, summary->compression) - k_lower <= 1.0) {
+			current.mean += (all[i].mean - current.mean)*all[i].weight/
+				(current.weight + all[i].weight);
+			current.weight += all[i].weight;
+		}
+		else{
+			weight_so_far += current.weight;
+			all[summary->n_centroids++] = current;
+			k_lower = tdigest_scale(weight_so_far/total_weight, summary->compression);
+			current = all[i];
+		}
+	}
+	all[summary->n_centroids++] = current;
+}
+
+void smc_summary_add(smc_summary *summary, double x, double weight){
+	/*Add a particle with value x and weight to a summary*/
+	double delta;
+	int bin;
+
+	if (weight <= 0.0) return;
+
+	summary->total_weight += weight;
+	delta = x - summary->mean;
+	summary->mean += delta*weight/summary->total_weight;
+	summary->m2 += weight*delta*(x - summary->mean);
+	if (x < summary->min) summary->min = x;
+	if (x > summary->max) summary->max = x;
+
+	summary->buffer[summary->n_buffered].mean = x;
+	summary->buffer[summary->n_buffered].weight = weight;
+	summary->n_buffered++;
+	if (summary->n_buffered == summary->buffer_size) smc_summary_compress(summary);
+
+	if (summary->n_bins > 0) {
+		bin = 0;
+		if (summary->hist_upper > summary->hist_lower) {
+			if (x >= summary->hist_upper) bin = summary->n_bins - 1;
+			else if (x > summary->hist_lower) {
+				bin = (int)floor((x - summary->hist_lower)/
+					(summary->hist_upper - summary->hist_lower)*summary->n_bins);
+			}
+		}
+		if (bin >= summary->n_bins) bin = summary->n_bins - 1;
+		summary->histogram[bin] += weight;
+	}
+}
+
+void smc_summary_merge(smc_summary *summary, smc_summary *other){
+	/*Merge the summary other into summary. Both must have been initialised with
+	the same histogram bins.*/
+	int i;
+	double delta, total_weight;
+
+	if (other->total_weight <= 0.0) return;
+
+	total_weight = summary->total_weight + other->total_weight;
+	delta = other->mean - summary->mean;
+	summary->m2 += other->m2 +
+		delta*delta*summary->total_weight*other->total_weight/total_weight;
+	summary->mean += delta*other->total_weight/total_weight;
+	summary->total_weight = total_weight;
+	if (other->min < summary->min) summary->min = other->min;
+	if (other->max > summary->max) summary->max = other->max;
+
+	smc_summary_compress(other);
+	for (i = 0; i < other->n_centroids; i++) {
+		summary->buffer[summary->n_buffered++] = other->centroid[i];
+		if (summary->n_buffered == summary->buffer_size) smc_summary_compress(summary);
+	}
+
+	for (i = 0; i < summary->n_bins; i++) {
+		summary->histogram[i] += other->histogram[i];
+	}
+}
+
+double smc_summary_variance(smc_summary *summary){
+	/*The weighted variance of the particles in a summary*/
+	if (summary->total_weight <= 0.0) return 0.0;
+	return summary->m2/summary->total_weight;
+}
+
+double smc_summary_quantile(smc_summary *summary, double q){
+	/*Estimate the weighted quantile q of the particles in a summary, by linear
+	interpolation between the centres of the centroids of the sketch*/
+	int i;
+	double target, centre, next_centre, weight_so_far;
+	smc_centroid *c;
+
+	smc_summary_compress(summary);
+	if (summary->n_centroids == 0) return NAN;
+	c = summary->centroid;
+	if (summary->n_centroids == 1) return c[0].mean;
+
+	target = q*summary->total_weight;
+	centre = c[0].weight/2.0;
+	if (target <= centre) {
+		return summary->min + (c[0].mean - summary->min)*target/centre;
+	}
+	weight_so_far = c[0].weight;
+	for (i = 0; i < summary->n_centroids - 1; i++) {
+		next_centre = weight_so_far + c[i+1].weight/2.0;
+		if (target <= next_centre) {
+			return c[i].mean + (c[i+1].mean - c[i].mean)*(target - centre)/
+				(next_centre - centre);
+		}
+		weight_so_far += c[i+1].weight;
+		centre = next_centre;
+	}
+	return c[i].mean + (summary->max - c[i].mean)*(target - centre)/
+		(summary->total_weight - centre);
+}
+
+#endif
@@ -0,0 +1,242 @@
+/*
+Writing each generation of particles while the next one is being sampled.
+
+An smc_writer owns a background thread and two round buffers. It is attached
+to a run through settings.round_callback (see smc_writer_attach()). When a round
+of SMC completes, the engine's thread copies the particles and weights of that
+round into a free buffer and returns straight away. The writer thread then
+serialises the buffer to its own file, one per round, while the engine samples
+the next round. The engine only waits if both buffers are still being written.
+
+Each file has a header, theta_0,...,theta_{n_parameters-1},weight, and one row
+per particle. If the engine is compiled with SMC_WRITER_ZLIB defined (and linked
+with -lz), files are optionally gzip-compressed.
+*/
+
+#ifndef SMC_WRITER_H
+#define SMC_WRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef SMC_WRITER_ZLIB
+#include <zlib.h>
+#endif
+
+#define SMC_WRITER_FORMAT_LENGTH 256
+
+typedef struct {
+	int time_smc; // the round held, or -1 if the buffer is free
+	double *theta; // (n_parameters X n_particles)
+	double *weight; // (n_particles)
+} smc_round_buffer;
+
+typedef struct {
+	char filename_format[SMC_WRITER_FORMAT_LENGTH];
+	int compress;
+	int n_parameters;
+	int n_particles;
+
+	smc_round_buffer buffer[2];
+	int next_fill; // the buffer the next round is copied into
+	int next_write; // the buffer the writer thread writes next
+	int finished; // set once no more rounds will arrive
+	int error; // set if a file could not be written
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_t thread;
+} smc_writer;
+
+int smc_write_round_buffer(smc_writer *writer, smc_round_buffer *buffer){
+	/*Serialise one round to its file. Returns 0 on success, -1 otherwise*/
+	char filename[SMC_WRITER_FORMAT_LENGTH + 32];
+	char line[64];
+	int i, k, length;
+	FILE *outfile_pointer = NULL;
+#ifdef SMC_WRITER_ZLIB
+	gzFile gz_pointer = NULL;
+#endif
+
+	snprintf(filename, sizeof(filename), writer->filename_format,
+		buffer->time_smc);
+#ifdef SMC_WRITER_ZLIB
+	if (writer->compress) {
+		strncat(filename, ".gz", sizeof(filename) - strlen(filename) - 1);
+		gz_pointer = gzopen(filename, "wb");
+		if (gz_pointer == NULL) return -1;
+	}
+	else
+#endif
+	{
+		outfile_pointer = fopen(filename, "w");
+		if (outfile_pointer == NULL) return -1;
+	}
+
+	for (k = 0; k <= writer->n_parameters; k++) {
+		if (k < writer->n_parameters) {
+			length = snprintf(line, sizeof(line), "theta_%d,", k);
+		}
+		else length = snprintf(line, sizeof(line), "weight\n");
+#ifdef SMC_WRITER_ZLIB
+		if (gz_pointer != NULL) gzwrite(gz_pointer, line, length);
+		else
+#endif
+		fwrite(line, 1, length, outfile_pointer);
+	}
+	for (i = 0; i < writer->n_particles; i++) {
+		for (k = 0; k <= writer->n_parameters; k++) {
+			if (k < writer->n_parameters) {
+				length = snprintf(line, sizeof(line), "%.8f,",
+					buffer->theta[(size_t)k*writer->n_particles + i]);
+			}
+			else{
+				length = snprintf(line, sizeof(line), "%.8e\n", buffer->weight[i]);
+			}
+#ifdef SMC_WRITER_ZLIB
+			if (gz_pointer != NULL) gzwrite(gz_pointer, line, length);
+			else
+#endif
+			fwrite(line, 1, length, outfile_pointer);
+		}
+	}
+
+#ifdef SMC_WRITER_ZLIB
+	if (gz_pointer != NULL) return (gzclose(gz_pointer) == Z_OK) ? 0 : -1;
+#endif
+	return (fclose(outfile_pointer) == 0) ? 0 : -1;
+}
+
+void *smc_writer_main(void *arg){
+	/*Write buffers in the order they were filled until the run is finished*/
+	smc_writer *writer = (smc_writer*)arg;
+	smc_round_buffer *buffer;
+	int status;
+
+	pthread_mutex_lock(&writer->lock);
+	while (1) {
+		buffer = &writer->buffer[writer->next_write];
+		while ((buffer->time_smc < 0) && !writer->finished) {
+			pthread_cond_wait(&writer->changed, &writer->lock);
+		}
+		if (buffer->time_smc < 0) break;
+		pthread_mutex_unlock(&writer->lock);
+
+		status = smc_write_round_buffer(writer, buffer);
+
+		pthread_mutex_lock(&writer->lock);
+		if (status != 0) writer->error = 1;
+		buffer->time_smc = -1;
+		writer->next_write = 1 - writer->next_write;
+		pthread_cond_broadcast(&writer->changed);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return NULL;
+}
+
+int smc_writer_start(smc_writer *writer, const char *filename_format,
+	int n_parameters, int n_particles, int compress){
+	/*Start a writer thread
+
+	Parameters
+	----------------
+	writer : The writer to start
+	filename_format : A file name containing %d, replaced by the round, e.g.
+		"generation_%d.csv"
+	n_parameters, n_particles : The dimensions of the run
+	compress : If non-zero and SMC_WRITER_ZLIB is defined, write gzip files,
+		with ".gz" appended to the file name
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	int b;
+	snprintf(writer->filename_format, SMC_WRITER_FORMAT_LENGTH, "%s",
+		filename_format);
+	writer->compress = compress;
+	writer->n_parameters = n_parameters;
+	writer->n_particles = n_particles;
+	writer->next_fill = 0;
+	writer->next_write = 0;
+	writer->finished = 0;
+	writer->error = 0;
+	for (b = 0; b < 2; b++) {
+		writer->buffer[b].time_smc = -1;
+		writer->buffer[b].theta = malloc((size_t)n_parameters * n_particles *
+			sizeof(double));
+		writer->buffer[b].weight = malloc(n_particles * sizeof(double));
+		if ((writer->buffer[b].theta == NULL) ||
+			(writer->buffer[b].weight == NULL)) {
+			printf("Error allocating writer buffers\n");
+			return -1;
+		}
+	}
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->changed, NULL);
+	if (pthread_create(&writer->thread, NULL, smc_writer_main, writer) != 0) {
+		printf("Error starting writer thread\n");
+		return -1;
+	}
+	return 0;
+}
+
+void smc_writer_round(const smc_population *population, int time_smc,
+	void *arg){
+	/*Hand a completed round to the writer, an smc_settings round_callback.
+	Waits only if both buffers are still being written.*/
+	smc_writer *writer = (smc_writer*)arg;
+	smc_round_buffer *buffer;
+	int k;
+
+	pthread_mutex_lock(&writer->lock);
+	buffer = &writer->buffer[writer->next_fill];
+	while (buffer->time_smc >= 0) {
+		pthread_cond_wait(&writer->changed, &writer->lock);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	/*The writer thread does not touch a free buffer*/
+	for (k = 0; k < writer->n_parameters; k++) {
+		memcpy(buffer->theta + (size_t)k*writer->n_particles,
+			population->theta_particle[k][time_smc],
+			writer->n_particles*sizeof(double));
+	}
+	memcpy(buffer->weight, population->weight[time_smc],
+		writer->n_particles*sizeof(double));
+
+	pthread_mutex_lock(&writer->lock);
+	buffer->time_smc = time_smc;
+	writer->next_fill = 1 - writer->next_fill;
+	pthread_cond_broadcast(&writer->changed);
+	pthread_mutex_unlock(&writer->lock);
+}
+
+void smc_writer_attach(smc_writer *writer, smc_settings *settings){
+	/*Have a run hand each completed round to writer*/
+	settings->round_callback = smc_writer_round;
+	settings->round_callback_data = writer;
+}
+
+int smc_writer_finish(smc_writer *writer){
+	/*Wait for every handed-over round to be written, stop the writer thread and
+	free its buffers. Returns 0 if every file was written, -1 otherwise*/
+	int b;
+	pthread_mutex_lock(&writer->lock);
+	writer->finished = 1;
+	pthread_cond_broadcast(&writer->changed);
+	pthread_mutex_unlock(&writer->lock);
+	pthread_join(writer->thread, NULL);
+
+	pthread_mutex_destroy(&writer->lock);
+	pthread_cond_destroy(&writer->changed);
+	for (b = 0; b < 2; b++) {
+		free(writer->buffer[b].theta);
+		free(writer->buffer[b].weight);
+	}
+	if (writer->error) printf("Error writing generations to file\n");
+	return writer->error ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+set -e
+for module in kmeans logistic gmm gp rbf hmm mvn; do
+	gcc -Wall -O3 -shared -fPIC -pthread -I/home/juvid/gsl-2.5/include \
+		$(python3-config --includes) \
+		-I$(python3 -c "import numpy; print(numpy.get_include())") \
+		${module}_module.c -L/home/juvid/gsl/lib -lgsl -lgslcblas -lm \
+		-o ${module}$(python3-config --extension-suffix)
+done
@@ -0,0 +1,536 @@
+/*
+Expectation maximisation for a Gaussian mixture model, as in
+expectation_maximization_GMM.ipynb, on datasets of tens of millions of points.
+
+Each iteration makes one pass over the data. The E-step computes the
+responsibility r_ik of each component k for each point x_i from
+
+	log(pi_k N(x_i | mu_k, Sigma_k)) = log_norm_k - |L_k^-1 (x_i - mu_k)|^2/2,
+
+where L_k is the Cholesky factor of Sigma_k, factorised once per iteration with
+log_norm_k, and normalises them by log-sum-exp, so that points far from every
+component do not underflow to 0/0 as the densities of the notebook do. The same
+pass accumulates the sufficient statistics of the M-step,
+
+	N_k = sum_i r_ik, S_k = sum_i r_ik d_ik, T_k = sum_i r_ik d_ik d_ik^T,
+
+with d_ik = x_i - mu_k taken about the current mean of each component, so that
+the covariance T_k/N_k - (S_k/N_k)(S_k/N_k)^T does not lose its precision to
+cancellation as the notebook's E[x x^T] - mu mu^T does when the data are far from
+the origin. The M-step then costs O(n_components n_features^2), independent of
+the number of points.
+
+Points are taken GMM_BLOCK at a time and stored by feature, (n_features X
+GMM_BLOCK), so that the triangular solves, the log-sum-exp and the statistics are
+each loops over the points of the block which the compiler vectorises. The pass is
+split into n_threads contiguous ranges of points, each accumulating its own
+statistics, which are merged once the pass is over, so that the cost of an
+iteration is one read of the data.
+
+The data are read through a gmm_data. gmm_data_map() maps a binary file of
+float64 rows into memory, which the operating system pages in from disk as the
+pass reaches it, so datasets need not fit in memory.
+
+Iterations stop once the mean log-likelihood per point increases by less than
+tolerance, or after max_iterations. reg_covar is added to the diagonal of every
+covariance, which keeps components which collapse onto few points invertible.
+*/
+
+#ifndef GMM_H
+#define GMM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "native_parallel.h"
+
+#define GMM_BLOCK 64
+
+typedef struct {
+	const double *x; // (n_data X n_features)
+	long n_data;
+	int n_features;
+	void *map; // the mapping made by gmm_data_map(), NULL otherwise
+	size_t map_size;
+} gmm_data;
+
+typedef struct {
+	int n_components;
+	int n_features;
+	double *weight; // (n_components), the mixing weights pi_k
+	double *mean; // (n_components X n_features)
+	double *covariance; // (n_components X n_features X n_features)
+} gmm_params;
+
+typedef struct {
+	int max_iterations;
+	double tolerance; // on the change of the mean log-likelihood per point
+	double reg_covar; // added to the diagonal of each covariance
+	int n_threads; // 0 for one per processor
+	int verbose;
+} gmm_settings;
+
+typedef struct {
+	double *log_likelihood; // (max_iterations), the mean log-likelihood per
+		// point before each M-step
+	int n_iterations;
+	int converged;
+} gmm_result;
+
+typedef struct gmm_state gmm_state;
+
+typedef struct {
+	gmm_state *state;
+	long first; // the range of points of the thread
+	long last;
+	double *n; // (n_components), the thread's N_k
+	double *s; // (n_components X n_features), the thread's S_k
+	double *t; // (n_components X n_features X n_features), the thread's T_k,
+		// lower triangle
+	double *diff; // (n_components X n_features X GMM_BLOCK), d_ik of the block
+	double *solve; // (n_features X GMM_BLOCK), scratch
+	double *log_p; // (n_components X GMM_BLOCK), then r_ik
+	double log_likelihood; // the thread's part of the log-likelihood
+	double *r_out; // if not NULL, (n_data X n_components), r_ik is written to it
+	pthread_t thread;
+	int started;
+} gmm_thread;
+
+struct gmm_state {
+	const gmm_data *data;
+	const gmm_params *params;
+	double *cholesky; // (n_components X n_features X n_features), lower
+	double *log_norm; // (n_components), log(pi_k) - log((2 pi)^(D/2) |Sigma_k|^(1/2))
+	int n_threads;
+	gmm_thread *thread;
+};
+
+gmm_settings gmm_default_settings(void){
+	gmm_settings settings;
+	settings.max_iterations = 100;
+	settings.tolerance = 1e-6;
+	settings.reg_covar = 1e-6;
+	settings.n_threads = 0;
+	settings.verbose = 0;
+	return settings;
+}
+
+int gmm_data_map(const char *filename, int n_features, gmm_data *data){
+	/*Map a binary file of native float64 rows of n_features values read-only
+	into data.
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	struct stat status;
+	size_t row_size = (size_t)n_features*sizeof(double);
+	int fd;
+
+	memset(data, 0, sizeof(gmm_data));
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("Error opening %s\n", filename);
+		return -1;
+	}
+	if ((fstat(fd, &status) != 0) || (status.st_size == 0) ||
+		((size_t)status.st_size % row_size != 0)) {
+		printf("%s does not hold rows of %d float64 values\n", filename, n_features);
+		close(fd);
+		return -1;
+	}
+	data->map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data->map == MAP_FAILED) {
+		printf("Error mapping %s\n", filename);
+		data->map = NULL;
+		return -1;
+	}
+	madvise(data->map, status.st_size, MADV_SEQUENTIAL);
+	data->map_size = status.st_size;
+	data->x = (const double*)data->map;
+	data->n_data = (long)(status.st_size/row_size);
+	data->n_features = n_features;
+	return 0;
+}
+
+void gmm_data_unmap(gmm_data *data){
+	/*Unmap data mapped by gmm_data_map()*/
+	if (data->map != NULL) munmap(data->map, data->map_size);
+	data->map = NULL;
+}
+
+int gmm_factorise(gmm_state *state){
+	/*Cache the Cholesky factor and log normalisation of every component.
+	Returns 0 on success, -1 if a covariance is not positive definite*/
+	const gmm_params *params = state->params;
+	int n_features = params->n_features;
+	const double *covariance;
+	double *cholesky, sum, log_det;
+	int k, i, j, l;
+
+	for (k = 0; k < params->n_components; k++) {
+		covariance = params->covariance + (size_t)k*n_features*n_features;
+		cholesky = state->cholesky + (size_t)k*n_features*n_features;
+		log_det = 0.0;
+		for (i = 0; i < n_features; i++) {
+			for (j = 0; j <= i; j++) {
+				sum = covariance[i*n_features + j];
+				for (l = 0; l < j; l++) sum -= cholesky[i*n_features + l]*cholesky[j*n_features + l];
+				if (i == j) {
+					if (!(sum > 0.0)) {
+						printf("The covariance of component %d is not positive definite\n", k);
+						return -1;
+					}
+					cholesky[i*n_features + i] = sqrt(sum);
+					log_det += log(cholesky[i*n_features + i]);
+				}
+				else cholesky[i*n_features + j] = sum/cholesky[j*n_features + j];
+			}
+			for (j = i + 1; j < n_features; j++) cholesky[i*n_features + j] = 0.0;
+		}
+		state->log_norm[k] = log(params->weight[k]) -
+			0.5*n_features*log(2.0*M_PI) - log_det;
+	}
+	return 0;
+}
+
+void gmm_block(gmm_thread *thread, long start, int n){
+	/*The E-step of points [start, start + n), leaving r_ik in thread->log_p and
+	adding the block's log-likelihood and statistics to those of the thread*/
+	gmm_state *state = thread->state;
+	const gmm_params *params = state->params;
+	int n_components = params->n_components;
+	int n_features = params->n_features;
+	const double *x = state->data->x + start*n_features;
+	const double *cholesky, *mean;
+	double *diff, *log_p, *row, *u_j, *u_l;
+	double maximum[GMM_BLOCK], total[GMM_BLOCK];
+	double l_jl, inverse, sum, r_d;
+	int k, i, j, l;
+
+	/*log(pi_k N(x_i | mu_k, Sigma_k)) by forward substitution L u = d*/
+	for (k = 0; k < n_components; k++) {
+		mean = params->mean + (size_t)k*n_features;
+		cholesky = state->cholesky + (size_t)k*n_features*n_features;
+		diff = thread->diff + (size_t)k*n_features*GMM_BLOCK;
+		log_p = thread->log_p + (size_t)k*GMM_BLOCK;
+		for (j = 0; j < n_features; j++) {
+			row = diff + (size_t)j*GMM_BLOCK;
+			for (i = 0; i < n; i++) row[i] = x[(size_t)i*n_features + j] - mean[j];
+		}
+		for (i = 0; i < n; i++) log_p[i] = 0.0;
+		for (j = 0; j < n_features; j++) {
+			u_j = thread->solve + (size_t)j*GMM_BLOCK;
+			row = diff + (size_t)j*GMM_BLOCK;
+			for (i = 0; i < n; i++) u_j[i] = row[i];
+			for (l = 0; l < j; l++) {
+				l_jl = cholesky[j*n_features + l];
+				u_l = thread->solve + (size_t)l*GMM_BLOCK;
+				for (i = 0; i < n; i++) u_j[i] -= l_jl*u_l[i];
+			}
+			inverse = 1.0/cholesky[j*n_features + j];
+			for (i = 0; i < n; i++) {
+				u_j[i] *= inverse;
+				log_p[i] += u_j[i]*u_j[i];
+			}
+		}
+		for (i = 0; i < n; i++) log_p[i] = state->log_norm[k] - 0.5*log_p[i];
+	}
+
+	/*Log-sum-exp over the components, then the responsibilities*/
+	for (i = 0; i < n; i++) maximum[i] = thread->log_p[i];
+	for (k = 1; k < n_components; k++) {
+		log_p = thread->log_p + (size_t)k*GMM_BLOCK;
+		for (i = 0; i < n; i++) maximum[i] = (log_p[i] > maximum[i]) ? log_p[i] : maximum[i];
+	}
+	for (i = 0; i < n; i++) total[i] = 0.0;
+	for (k = 0; k < n_components; k++) {
+		log_p = thread->log_p + (size_t)k*GMM_BLOCK;
+		for (i = 0; i < n; i++) {
+			log_p[i] = exp(log_p[i] - maximum[i]);
+			total[i] += log_p[i];
+		}
+	}
+	for (i = 0; i < n; i++) {
+		thread->log_likelihood += maximum[i] + log(total[i]);
+		total[i] = 1.0/total[i];
+	}
+	for (k = 0; k < n_components; k++) {
+		log_p = thread->log_p + (size_t)k*GMM_BLOCK;
+		for (i = 0; i < n; i++) log_p[i] *= total[i];
+	}
+
+	if (thread->r_out != NULL) {
+		for (k = 0; k < n_components; k++) {
+			for (i = 0; i < n; i++) {
+				thread->r_out[(start + i)*n_components + k] = thread->log_p[(size_t)k*GMM_BLOCK + i];
+			}
+		}
+		return;
+	}
+
+	/*The statistics, about the current means*/
+	for (k = 0; k < n_components; k++) {
+		log_p = thread->log_p + (size_t)k*GMM_BLOCK;
+		diff = thread->diff + (size_t)k*n_features*GMM_BLOCK;
+		sum = 0.0;
+		for (i = 0; i < n; i++) sum += log_p[i];
+		thread->n[k] += sum;
+		for (j = 0; j < n_features; j++) {
+			row = diff + (size_t)j*GMM_BLOCK;
+			u_j = thread->solve + (size_t)j*GMM_BLOCK;
+			sum = 0.0;
+			for (i = 0; i < n; i++) {
+				u_j[i] = log_p[i]*row[i];
+				sum += u_j[i];
+			}
+			thread->s[(size_t)k*n_features + j] += sum;
+			for (l = 0; l <= j; l++) {
+				u_l = diff + (size_t)l*GMM_BLOCK;
+				r_d = 0.0;
+				for (i = 0; i < n; i++) r_d += u_j[i]*u_l[i];
+				thread->t[((size_t)k*n_features + j)*n_features + l] += r_d;
+			}
+		}
+	}
+}
+
+void *gmm_worker(void *arg){
+	/*The E-step and statistics of the points of the thread*/
+	gmm_thread *thread = (gmm_thread*)arg;
+	const gmm_params *params = thread->state->params;
+	int n_components = params->n_components;
+	int n_features = params->n_features;
+	long start;
+	int n;
+
+	thread->log_likelihood = 0.0;
+	memset(thread->n, 0, n_components*sizeof(double));
+	memset(thread->s, 0, (size_t)n_components*n_features*sizeof(double));
+	memset(thread->t, 0, (size_t)n_components*n_features*n_features*sizeof(double));
+	for (start = thread->first; start < thread->last; start += GMM_BLOCK) {
+		n = (thread->last - start < GMM_BLOCK) ? (int)(thread->last - start) : GMM_BLOCK;
+		gmm_block(thread, start, n);
+	}
+	return NULL;
+}
+
+void gmm_run_threads(gmm_state *state){
+	/*Make a pass over the data. The calling thread does the work of thread 0,
+	and of any thread which could not be started*/
+	int t;
+	for (t = 1; t < state->n_threads; t++) {
+		state->thread[t].started = (pthread_create(&state->thread[t].thread, NULL,
+			gmm_worker, &state->thread[t]) == 0);
+	}
+	gmm_worker(&state->thread[0]);
+	for (t = 1; t < state->n_threads; t++) {
+		if (state->thread[t].started) pthread_join(state->thread[t].thread, NULL);
+		else gmm_worker(&state->thread[t]);
+	}
+}
+
+void gmm_state_free(gmm_state *state){
+	int t;
+	if (state->thread != NULL) {
+		for (t = 0; t < state->n_threads; t++) {
+			free(state->thread[t].n);
+			free(state->thread[t].s);
+			free(state->thread[t].t);
+			free(state->thread[t].diff);
+			free(state->thread[t].solve);
+			free(state->thread[t].log_p);
+		}
+	}
+	free(state->thread);
+	free(state->cholesky);
+	free(state->log_norm);
+}
+
+int gmm_state_alloc(gmm_state *state, const gmm_data *data,
+	const gmm_params *params, int n_threads){
+	/*Allocate the factors and the threads' accumulators, splitting the points
+	between n_threads threads (0 for one per processor).
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	size_t n_k = params->n_components, n_f = params->n_features;
+	int t;
+
+	memset(state, 0, sizeof(gmm_state));
+	state->data = data;
+	state->params = params;
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+	if (n_threads > data->n_data) n_threads = (int)data->n_data;
+	state->n_threads = n_threads;
+	state->cholesky = malloc(n_k*n_f*n_f*sizeof(double));
+	state->log_norm = malloc(n_k*sizeof(double));
+	state->thread = calloc(n_threads, sizeof(gmm_thread));
+	if ((state->cholesky == NULL) || (state->log_norm == NULL) ||
+		(state->thread == NULL)) {
+		gmm_state_free(state);
+		return -1;
+	}
+	for (t = 0; t < n_threads; t++) {
+		state->thread[t].state = state;
+		state->thread[t].first = data->n_data*t/n_threads;
+		state->thread[t].last = data->n_data*(t + 1)/n_threads;
+		state->thread[t].n = malloc(n_k*sizeof(double));
+		state->thread[t].s = malloc(n_k*n_f*sizeof(double));
+		state->thread[t].t = malloc(n_k*n_f*n_f*sizeof(double));
+		state->thread[t].diff = malloc(n_k*n_f*GMM_BLOCK*sizeof(double));
+		state->thread[t].solve = malloc(n_f*GMM_BLOCK*sizeof(double));
+		state->thread[t].log_p = malloc(n_k*GMM_BLOCK*sizeof(double));
+		if ((state->thread[t].n == NULL) || (state->thread[t].s == NULL) ||
+			(state->thread[t].t == NULL) || (state->thread[t].diff == NULL) ||
+			(state->thread[t].solve == NULL) || (state->thread[t].log_p == NULL)) {
+			gmm_state_free(state);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void gmm_maximise(gmm_state *state, gmm_params *params, double reg_covar){
+	/*The M-step, from the statistics of every thread. Components without
+	responsibility keep their mean and covariance*/
+	int n_components = params->n_components;
+	int n_features = params->n_features;
+	double n_k, shift_j, *mean, *covariance, *t_k;
+	double *shift = state->thread[0].solve; // scratch of n_features
+	int k, t, j, l;
+
+	/*Merge into the statistics of thread 0*/
+	for (t = 1; t < state->n_threads; t++) {
+		for (k = 0; k < n_components; k++) state->thread[0].n[k] += state->thread[t].n[k];
+		for (j = 0; j < n_components*n_features; j++) state->thread[0].s[j] += state->thread[t].s[j];
+		for (j = 0; j < n_components*n_features*n_features; j++) {
+			state->thread[0].t[j] += state->thread[t].t[j];
+		}
+	}
+	for (k = 0; k < n_components; k++) {
+		n_k = state->thread[0].n[k];
+		params->weight[k] = n_k/state->data->n_data;
+		if (!(n_k > 0.0)) continue;
+		mean = params->mean + (size_t)k*n_features;
+		covariance = params->covariance + (size_t)k*n_features*n_features;
+		t_k = state->thread[0].t + (size_t)k*n_features*n_features;
+		for (j = 0; j < n_features; j++) shift[j] = state->thread[0].s[(size_t)k*n_features + j]/n_k;
+		for (j = 0; j < n_features; j++) {
+			shift_j = shift[j];
+			for (l = 0; l <= j; l++) {
+				covariance[j*n_features + l] = t_k[j*n_features + l]/n_k - shift_j*shift[l];
+				covariance[l*n_features + j] = covariance[j*n_features + l];
+			}
+			covariance[j*n_features + j] += reg_covar;
+		}
+		for (j = 0; j < n_features; j++) mean[j] += shift[j];
+	}
+}
+
+int gmm_fit(const gmm_data *data, gmm_params *params,
+	const gmm_settings *settings, gmm_result *result){
+	/*Fit a Gaussian mixture model by expectation maximisation
+
+	Parameters
+	----------------
+	data : The points
+	params : The initial weights, means and covariances, overwritten by those
+		fitted
+	settings : The stopping rule, covariance regularisation and threads
+	result : Filled with the log-likelihood of every iteration, to be freed by
+		gmm_result_free()
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	gmm_state state;
+	double log_likelihood, previous = -INFINITY;
+	int iteration, t;
+
+	result->n_iterations = 0;
+	result->converged = 0;
+	result->log_likelihood = malloc(((settings->max_iterations > 0) ?
+		settings->max_iterations : 1)*sizeof(double));
+	if ((data->n_data < 1) || (params->n_components < 1) ||
+		(data->n_features != params->n_features)) {
+		printf("The mixture does not match the data\n");
+		return -1;
+	}
+	if ((result->log_likelihood == NULL) ||
+		(gmm_state_alloc(&state, data, params, settings->n_threads) != 0)) {
+		printf("Error allocating EM\n");
+		return -1;
+	}
+
+	for (iteration = 0; iteration < settings->max_iterations; iteration++) {
+		if (gmm_factorise(&state) != 0) {
+			gmm_state_free(&state);
+			return -1;
+		}
+		gmm_run_threads(&state);
+		log_likelihood = 0.0;
+		for (t = 0; t < state.n_threads; t++) log_likelihood += state.thread[t].log_likelihood;
+		log_likelihood /= data->n_data;
+		result->log_likelihood[iteration] = log_likelihood;
+		result->n_iterations = iteration + 1;
+		if (settings->verbose && (iteration % 10 == 0)) printf("%d %f\n", iteration, log_likelihood);
+
+		gmm_maximise(&state, params, settings->reg_covar);
+		if (log_likelihood - previous < settings->tolerance) {
+			result->converged = 1;
+			break;
+		}
+		previous = log_likelihood;
+	}
+	gmm_state_free(&state);
+	return 0;
+}
+
+void gmm_result_free(gmm_result *result){
+	/*Free a result filled by gmm_fit()*/
+	free(result->log_likelihood);
+	result->log_likelihood = NULL;
+}
+
+int gmm_responsibilities(const gmm_data *data, const gmm_params *params,
+	int n_threads, double *r, double *log_likelihood){
+	/*Fill r, (n_data X n_components), with the responsibility of every
+	component for every point, and set log_likelihood to their mean
+	log-likelihood, as compute_expected_sufficient_statistic()
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	gmm_state state;
+	int t;
+	if ((data->n_data < 1) || (data->n_features != params->n_features) ||
+		(gmm_state_alloc(&state, data, params, n_threads) != 0)) {
+		return -1;
+	}
+	if (gmm_factorise(&state) != 0) {
+		gmm_state_free(&state);
+		return -1;
+	}
+	for (t = 0; t < state.n_threads; t++) state.thread[t].r_out = r;
+	gmm_run_threads(&state);
+	*log_likelihood = 0.0;
+	for (t = 0; t < state.n_threads; t++) *log_likelihood += state.thread[t].log_likelihood;
+	*log_likelihood /= data->n_data;
+	gmm_state_free(&state);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,360 @@
+/*
+A Python extension module, gmm, which runs the expectation maximisation of gmm.h
+in-process, in place of compute_expected_sufficient_statistic() and the EM loop of
+expectation_maximization_GMM.ipynb.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('native')
+	import gmm
+	result = gmm.fit(d, means=[[-1, 1], [1, -1]], max_iterations=50)
+	result['means'] # (n_components X n_features)
+	rik = gmm.responsibilities(d, result['weights'], result['means'],
+		result['covariances'])
+
+X is read directly from the NumPy buffer passed in when it is a C-contiguous
+float64 array, which includes an np.memmap of a file; anything else is
+converted once. fit_file() maps a binary file of float64 rows into memory
+instead, for datasets larger than memory. The GIL is released while EM runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "gmm.h"
+
+int parse_params(PyObject *weights_object, PyObject *means_object,
+	PyObject *covariances_object, int n_features, PyArrayObject **arrays,
+	gmm_params *params){
+	/*Copy the weights (uniform if None), means, (n_components X n_features),
+	and covariances (identities if None) of a mixture into three new arrays,
+	returned in arrays, which params points to.
+
+	Returns
+	----------------
+	0 on success, -1 with a Python exception set otherwise
+	*/
+	npy_intp shape[3];
+	PyArrayObject *given;
+	int k, j;
+
+	arrays[0] = arrays[1] = arrays[2] = NULL;
+	given = (PyArrayObject*)PyArray_FROMANY(means_object, NPY_DOUBLE, 2, 2,
+		NPY_ARRAY_IN_ARRAY);
+	if (given == NULL) return -1;
+	if ((PyArray_DIM(given, 1) != n_features) || (PyArray_DIM(given, 0) < 1)) {
+		PyErr_Format(PyExc_ValueError,
+			"means must have shape (n_components, %d)", n_features);
+		Py_DECREF(given);
+		return -1;
+	}
+	arrays[1] = (PyArrayObject*)PyArray_NewCopy(given, NPY_CORDER);
+	Py_DECREF(given);
+	if (arrays[1] == NULL) return -1;
+	params->n_components = (int)PyArray_DIM(arrays[1], 0);
+	params->n_features = n_features;
+
+	shape[0] = params->n_components;
+	shape[1] = n_features;
+	shape[2] = n_features;
+	if ((weights_object == NULL) || (weights_object == Py_None)) {
+		arrays[0] = (PyArrayObject*)PyArray_SimpleNew(1, shape, NPY_DOUBLE);
+		if (arrays[0] == NULL) goto fail;
+		for (k = 0; k < params->n_components; k++) {
+			((double*)PyArray_DATA(arrays[0]))[k] = 1.0/params->n_components;
+		}
+	}
+	else{
+		given = (PyArrayObject*)PyArray_FROMANY(weights_object, NPY_DOUBLE, 1, 1,
+			NPY_ARRAY_IN_ARRAY);
+		if (given == NULL) goto fail;
+		if (PyArray_DIM(given, 0) != params->n_components) {
+			PyErr_SetString(PyExc_ValueError, "weights must have one weight per mean");
+			Py_DECREF(given);
+			goto fail;
+		}
+		arrays[0] = (PyArrayObject*)PyArray_NewCopy(given, NPY_CORDER);
+		Py_DECREF(given);
+		if (arrays[0] == NULL) goto fail;
+	}
+	if ((covariances_object == NULL) || (covariances_object == Py_None)) {
+		arrays[2] = (PyArrayObject*)PyArray_ZEROS(3, shape, NPY_DOUBLE, 0);
+		if (arrays[2] == NULL) goto fail;
+		for (k = 0; k < params->n_components; k++) {
+			for (j = 0; j < n_features; j++) {
+				((double*)PyArray_DATA(arrays[2]))[((size_t)k*n_features + j)*n_features + j] = 1.0;
+			}
+		}
+	}
+	else{
+		given = (PyArrayObject*)PyArray_FROMANY(covariances_object, NPY_DOUBLE, 3, 3,
+			NPY_ARRAY_IN_ARRAY);
+		if (given == NULL) goto fail;
+		if ((PyArray_DIM(given, 0) != params->n_components) ||
+			(PyArray_DIM(given, 1) != n_features) || (PyArray_DIM(given, 2) != n_features)) {
+			PyErr_Format(PyExc_ValueError,
+				"covariances must have shape (%d, %d, %d)", params->n_components,
+				n_features, n_features);
+			Py_DECREF(given);
+			goto fail;
+		}
+		arrays[2] = (PyArrayObject*)PyArray_NewCopy(given, NPY_CORDER);
+		Py_DECREF(given);
+		if (arrays[2] == NULL) goto fail;
+	}
+	params->weight = (double*)PyArray_DATA(arrays[0]);
+	params->mean = (double*)PyArray_DATA(arrays[1]);
+	params->covariance = (double*)PyArray_DATA(arrays[2]);
+	return 0;
+
+fail:
+	Py_XDECREF(arrays[0]);
+	Py_XDECREF(arrays[1]);
+	Py_XDECREF(arrays[2]);
+	return -1;
+}
+
+PyObject *run_fit(const gmm_data *data, PyObject *weights_object,
+	PyObject *means_object, PyObject *covariances_object,
+	const gmm_settings *settings){
+	/*Run EM with the GIL released, returning a dict of the mixture fitted*/
+	PyArrayObject *arrays[3];
+	PyObject *dict, *item = NULL;
+	gmm_params params;
+	gmm_result result;
+	npy_intp n_iterations;
+	int status;
+
+	if (parse_params(weights_object, means_object, covariances_object,
+			data->n_features, arrays, &params) != 0) {
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = gmm_fit(data, &params, settings, &result);
+	Py_END_ALLOW_THREADS
+
+	if (status != 0) {
+		gmm_result_free(&result);
+		Py_DECREF(arrays[0]);
+		Py_DECREF(arrays[1]);
+		Py_DECREF(arrays[2]);
+		PyErr_SetString(PyExc_RuntimeError,
+			"EM failed, a covariance is not positive definite");
+		return NULL;
+	}
+	dict = PyDict_New();
+	if (dict == NULL) goto fail;
+	if ((PyDict_SetItemString(dict, "weights", (PyObject*)arrays[0]) != 0) ||
+		(PyDict_SetItemString(dict, "means", (PyObject*)arrays[1]) != 0) ||
+		(PyDict_SetItemString(dict, "covariances", (PyObject*)arrays[2]) != 0)) {
+		goto fail;
+	}
+
+	n_iterations = result.n_iterations;
+	item = PyArray_SimpleNew(1, &n_iterations, NPY_DOUBLE);
+	if (item == NULL) goto fail;
+	memcpy(PyArray_DATA((PyArrayObject*)item), result.log_likelihood,
+		n_iterations*sizeof(double));
+	if (PyDict_SetItemString(dict, "log_likelihood", item) != 0) goto fail;
+	Py_DECREF(item);
+
+	item = PyLong_FromLong(result.n_iterations);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "n_iterations", item) != 0)) goto fail;
+	Py_DECREF(item);
+
+	item = PyBool_FromLong(result.converged);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "converged", item) != 0)) goto fail;
+	Py_DECREF(item);
+
+	gmm_result_free(&result);
+	Py_DECREF(arrays[0]);
+	Py_DECREF(arrays[1]);
+	Py_DECREF(arrays[2]);
+	return dict;
+
+fail:
+	gmm_result_free(&result);
+	Py_XDECREF(item);
+	Py_XDECREF(dict);
+	Py_DECREF(arrays[0]);
+	Py_DECREF(arrays[1]);
+	Py_DECREF(arrays[2]);
+	return NULL;
+}
+
+int parse_points(PyObject *x_object, PyArrayObject **x, gmm_data *data){
+	/*Point data at X, (n_data X n_features), converting it if needed. The array
+	is returned in x, for the caller to release.
+
+	Returns
+	----------------
+	0 on success, -1 with a Python exception set otherwise
+	*/
+	*x = (PyArrayObject*)PyArray_FROMANY(x_object, NPY_DOUBLE, 2, 2,
+		NPY_ARRAY_IN_ARRAY);
+	if (*x == NULL) return -1;
+	if ((PyArray_DIM(*x, 0) < 1) || (PyArray_DIM(*x, 1) < 1)) {
+		PyErr_SetString(PyExc_ValueError, "X must have at least one row and column");
+		Py_DECREF(*x);
+		return -1;
+	}
+	memset(data, 0, sizeof(gmm_data));
+	data->x = (const double*)PyArray_DATA(*x);
+	data->n_data = (long)PyArray_DIM(*x, 0);
+	data->n_features = (int)PyArray_DIM(*x, 1);
+	return 0;
+}
+
+PyObject *gmm_py_fit(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*EM on an array, see the module docstring*/
+	static char *keywords[] = {"X", "means", "covariances", "weights",
+		"max_iterations", "tolerance", "reg_covar", "n_threads", "verbose", NULL};
+	PyObject *x_object, *means_object, *covariances_object = NULL;
+	PyObject *weights_object = NULL, *result;
+	PyArrayObject *x;
+	gmm_settings settings = gmm_default_settings();
+	gmm_data data;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OOiddip", keywords,
+			&x_object, &means_object, &covariances_object, &weights_object,
+			&settings.max_iterations, &settings.tolerance, &settings.reg_covar,
+			&settings.n_threads, &settings.verbose)) {
+		return NULL;
+	}
+	if ((settings.max_iterations < 1) || (settings.n_threads < 0)) {
+		PyErr_SetString(PyExc_ValueError,
+			"max_iterations must be positive and n_threads not negative");
+		return NULL;
+	}
+	if (parse_points(x_object, &x, &data) != 0) return NULL;
+	result = run_fit(&data, weights_object, means_object, covariances_object,
+		&settings);
+	Py_DECREF(x);
+	return result;
+}
+
+PyObject *gmm_py_fit_file(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*EM on a mapped binary file, see the module docstring*/
+	static char *keywords[] = {"filename", "n_features", "means", "covariances",
+		"weights", "max_iterations", "tolerance", "reg_covar", "n_threads",
+		"verbose", NULL};
+	PyObject *means_object, *covariances_object = NULL;
+	PyObject *weights_object = NULL, *result;
+	const char *filename;
+	int n_features;
+	gmm_settings settings = gmm_default_settings();
+	gmm_data data;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "siO|OOiddip", keywords,
+			&filename, &n_features, &means_object, &covariances_object,
+			&weights_object, &settings.max_iterations, &settings.tolerance,
+			&settings.reg_covar, &settings.n_threads, &settings.verbose)) {
+		return NULL;
+	}
+	if ((settings.max_iterations < 1) || (settings.n_threads < 0) ||
+		(n_features < 1)) {
+		PyErr_SetString(PyExc_ValueError,
+			"max_iterations and n_features must be positive and n_threads not negative");
+		return NULL;
+	}
+	if (gmm_data_map(filename, n_features, &data) != 0) {
+		PyErr_Format(PyExc_OSError, "Could not map %s as rows of %d float64 values",
+			filename, n_features);
+		return NULL;
+	}
+	result = run_fit(&data, weights_object, means_object, covariances_object,
+		&settings);
+	gmm_data_unmap(&data);
+	return result;
+}
+
+PyObject *gmm_py_responsibilities(PyObject *self, PyObject *args,
+	PyObject *kwargs){
+	/*The responsibilities of a mixture, see the module docstring*/
+	static char *keywords[] = {"X", "weights", "means", "covariances",
+		"n_threads", NULL};
+	PyObject *x_object, *weights_object, *means_object, *covariances_object;
+	PyObject *r;
+	PyArrayObject *x, *arrays[3];
+	gmm_data data;
+	gmm_params params;
+	npy_intp shape[2];
+	double log_likelihood;
+	int n_threads = 0, status;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|i", keywords,
+			&x_object, &weights_object, &means_object, &covariances_object,
+			&n_threads)) {
+		return NULL;
+	}
+	if (parse_points(x_object, &x, &data) != 0) return NULL;
+	if (parse_params(weights_object, means_object, covariances_object,
+			data.n_features, arrays, &params) != 0) {
+		Py_DECREF(x);
+		return NULL;
+	}
+	shape[0] = data.n_data;
+	shape[1] = params.n_components;
+	r = PyArray_SimpleNew(2, shape, NPY_DOUBLE);
+	if (r != NULL) {
+		Py_BEGIN_ALLOW_THREADS
+		status = gmm_responsibilities(&data, &params, n_threads,
+			(double*)PyArray_DATA((PyArrayObject*)r), &log_likelihood);
+		Py_END_ALLOW_THREADS
+		if (status != 0) {
+			Py_CLEAR(r);
+			PyErr_SetString(PyExc_RuntimeError,
+				"A covariance is not positive definite");
+		}
+	}
+	Py_DECREF(x);
+	Py_DECREF(arrays[0]);
+	Py_DECREF(arrays[1]);
+	Py_DECREF(arrays[2]);
+	return r;
+}
+
+PyMethodDef gmm_methods[] = {
+	{"fit", (PyCFunction)(void(*)(void))gmm_py_fit,
+		METH_VARARGS | METH_KEYWORDS,
+		"fit(X, means, covariances=None, weights=None, max_iterations=100,\n"
+		"    tolerance=1e-6, reg_covar=1e-6, n_threads=0, verbose=False)\n\n"
+		"Fit a Gaussian mixture to the rows of X (data X features) by EM, from\n"
+		"the initial means (components X features), covariances (components X\n"
+		"features X features, identities if None) and weights (uniform if\n"
+		"None). Iterations stop once the mean log-likelihood per point rises by\n"
+		"less than tolerance (a negative tolerance runs every iteration, as the\n"
+		"notebook), or after max_iterations. reg_covar is added to the diagonal\n"
+		"of each covariance. Each pass over X is split between n_threads\n"
+		"threads (0 for one per processor). Returns a dict of weights, means,\n"
+		"covariances, log_likelihood (iterations), the mean log-likelihood per\n"
+		"point before each M-step, n_iterations and converged."},
+	{"fit_file", (PyCFunction)(void(*)(void))gmm_py_fit_file,
+		METH_VARARGS | METH_KEYWORDS,
+		"fit_file(filename, n_features, means, covariances=None, weights=None,\n"
+		"    max_iterations=100, tolerance=1e-6, reg_covar=1e-6, n_threads=0,\n"
+		"    verbose=False)\n\n"
+		"As fit(), on a binary file of native float64 rows of n_features\n"
+		"values, e.g. written by X.astype(np.float64).tofile(filename), which is\n"
+		"mapped into memory rather than read, so it may be larger than memory."},
+	{"responsibilities", (PyCFunction)(void(*)(void))gmm_py_responsibilities,
+		METH_VARARGS | METH_KEYWORDS,
+		"responsibilities(X, weights, means, covariances, n_threads=0)\n\n"
+		"The responsibility of every component for every row of X, (data X\n"
+		"components), as compute_expected_sufficient_statistic()."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef gmm_module = {
+	PyModuleDef_HEAD_INIT, "gmm",
+	"Multithreaded expectation maximisation for Gaussian mixtures, run in-process",
+	-1, gmm_methods
+};
+
+PyMODINIT_FUNC PyInit_gmm(void){
+	import_array();
+	return PyModule_Create(&gmm_module);
+}
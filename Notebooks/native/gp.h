@@ -0,0 +1,791 @@
+/*
+Gaussian process regression, as in gaussian_processes.ipynb, for 10^4 to 10^5
+points.
+
+The covariance is the squared exponential of cov_matrix_function(),
+
+	k(x1, x2) = exp(-|x1 - x2|^2/length),
+
+of inputs of dim dimensions. Observations carry noise of variance noise_var, and
+jitter is added to the diagonal, which keeps the covariance of dense grids, whose
+smallest eigenvalues vanish, positive definite.
+
+A gp_model caches the Cholesky factor L of K + (noise_var + jitter) I of its
+inputs, and alpha = K^-1 y, once by gp_fit(), so that
+- gp_sample() draws any number of functions at the inputs, L z for standard
+	normal z, as sample_from_gp(), at O(n^2) per draw
+- gp_predict() gives the posterior predictive mean k_*.alpha and variance
+	k(x_*, x_*) + noise_var - |L^-1 k_*|^2 of new points at O(n^2) per point,
+	where the notebook inverts K again for every point
+- gp_add_points() appends points, extending L by one row each,
+	l = L^-1 k_new and sqrt(k(x_new, x_new) + noise_var + jitter - l.l), at
+	O(n^2) per point rather than the O(n^3) of factorising again.
+
+Kernel matrices are assembled GP_TILE X GP_TILE tiles at a time, each row of a
+tile as a loop over the columns which the compiler vectorises, with the tiles
+split between threads. The factorisation is blocked: each diagonal tile is
+factorised, then the panel below it solved, its rows split between the threads,
+and the trailing matrix updated a tile at a time, the tiles taken in turn by the
+threads. The trailing update and the solves of predictions go through
+gp_multiply_subtract(), which accumulates four rows at a time so that each row
+it reads of the other operand serves all four. Predictions and draws take
+GP_TILE points at a time, solving for all of them in one pass over L.
+
+For more points than a dense factor allows, a gp_sparse approximates the process
+by its values at n_inducing inducing points Z (the deterministic training
+conditional, Seeger et al. 2003). With L_m the Cholesky factor of K_mm and
+V = L_m^-1 K_mn, only the (n_inducing X n_inducing) factor L_A of
+A = I + V V^T/noise_var and beta = L_A^-1 V y/noise_var are kept, which
+gp_sparse_fit() accumulates over the data in chunks, each thread into its own
+A and V y, at O(n n_inducing^2). Predictions cost O(n_inducing^2) per point:
+with v = L_m^-1 k_m* and c = L_A^-1 v, the mean is c.beta and the variance
+k(x_*, x_*) - v.v + c.c + noise_var. gp_sparse_add_points() adds each point by a
+rank-one update of L_A, for A + v v^T/noise_var.
+*/
+
+#ifndef GP_H
+#define GP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "native_parallel.h"
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#define GP_TILE 64
+
+typedef struct {
+	int dim;
+	double length;
+	double noise_var;
+	double jitter;
+	int n_threads;
+	long n; // the number of points
+	long capacity; // the points allocated for
+	double *x; // (capacity X dim)
+	double *y; // (capacity), NULL to sample from the prior only
+	double *cholesky; // (capacity X capacity), lower triangle of the first n rows
+	double *alpha; // (capacity), K^-1 y
+} gp_model;
+
+typedef struct {
+	int dim;
+	double length;
+	double noise_var;
+	double jitter;
+	int n_threads;
+	int n_inducing;
+	long n; // the number of points
+	double *z; // (n_inducing X dim), the inducing points
+	double *cholesky_m; // (n_inducing X n_inducing), L_m
+	double *cholesky_a; // (n_inducing X n_inducing), L_A
+	double *v_y; // (n_inducing), V y
+	double *beta; // (n_inducing)
+} gp_sparse;
+
+double gp_kernel(const double *x1, const double *x2, int dim, double length){
+	/*The squared exponential covariance of two inputs*/
+	double squared = 0.0, difference;
+	int f;
+	for (f = 0; f < dim; f++) {
+		difference = x1[f] - x2[f];
+		squared += difference*difference;
+	}
+	return exp(-squared/length);
+}
+
+void gp_kernel_tile(const double *x1, long n1, const double *x2, long n2, int dim,
+	double length, double *out, long ld){
+	/*out[i*ld + j] = k(x1_i, x2_j) for at most GP_TILE inputs x2*/
+	double squared[GP_TILE], x_f, difference;
+	long i, j;
+	int f;
+	for (i = 0; i < n1; i++) {
+		for (j = 0; j < n2; j++) squared[j] = 0.0;
+		for (f = 0; f < dim; f++) {
+			x_f = x1[i*dim + f];
+			for (j = 0; j < n2; j++) {
+				difference = x_f - x2[j*dim + f];
+				squared[j] += difference*difference;
+			}
+		}
+		for (j = 0; j < n2; j++) out[i*ld + j] = exp(-squared[j]/length);
+	}
+}
+
+typedef struct {
+	const double *x1;
+	long n1;
+	const double *x2;
+	long n2;
+	int dim;
+	double length;
+	double *out;
+	long ld;
+	int lower; // only the tiles on or below the diagonal, for x1 = x2
+} gp_kernel_context;
+
+void gp_kernel_worker(void *arg, int thread, int n_threads){
+	/*The tiles of the thread, taken in turn*/
+	gp_kernel_context *context = (gp_kernel_context*)arg;
+	long n_row_tiles = (context->n1 + GP_TILE - 1)/GP_TILE;
+	long n_column_tiles = (context->n2 + GP_TILE - 1)/GP_TILE;
+	long tile, i0, j0, n_i, n_j;
+	for (tile = thread; tile < n_row_tiles*n_column_tiles; tile += n_threads) {
+		i0 = (tile/n_column_tiles)*GP_TILE;
+		j0 = (tile % n_column_tiles)*GP_TILE;
+		if (context->lower && (j0 > i0)) continue;
+		n_i = (context->n1 - i0 < GP_TILE) ? context->n1 - i0 : GP_TILE;
+		n_j = (context->n2 - j0 < GP_TILE) ? context->n2 - j0 : GP_TILE;
+		gp_kernel_tile(context->x1 + i0*context->dim, n_i,
+			context->x2 + j0*context->dim, n_j, context->dim, context->length,
+			context->out + i0*context->ld + j0, context->ld);
+	}
+}
+
+void gp_kernel_matrix(const double *x1, long n1, const double *x2, long n2,
+	int dim, double length, double *out, long ld, int n_threads){
+	/*Fill out, (n1 X n2) with rows ld apart, with k(x1_i, x2_j). If x1 is x2,
+	only the tiles on or below the diagonal are filled*/
+	gp_kernel_context context = {x1, n1, x2, n2, dim, length, out, ld,
+		(x1 == x2) && (n1 == n2)};
+	native_parallel(gp_kernel_worker, &context, n_threads);
+}
+
+typedef struct {
+	double *a;
+	long n;
+	long ld;
+	long k0; // the diagonal tile being eliminated
+	long n_k;
+} gp_cholesky_context;
+
+void gp_panel_worker(void *arg, int thread, int n_threads){
+	/*Solve the rows of the panel below the diagonal tile*/
+	gp_cholesky_context *context = (gp_cholesky_context*)arg;
+	double *a = context->a, *row, sum;
+	long ld = context->ld, k0 = context->k0, i, c, p;
+	for (i = k0 + context->n_k + thread; i < context->n; i += n_threads) {
+		row = a + i*ld;
+		for (c = k0; c < k0 + context->n_k; c++) {
+			sum = row[c];
+			for (p = k0; p < c; p++) sum -= row[p]*a[c*ld + p];
+			row[c] = sum/a[c*ld + c];
+		}
+	}
+}
+
+void gp_multiply_subtract(long n_i, long n_j, int n_p, const double *a, long lda,
+	const double *b, long ldb, double *c, long ldc){
+	/*C -= A B, for A (n_i X n_j), B (n_j X n_p) and C (n_i X n_p), with rows lda,
+	ldb and ldc apart and n_p <= GP_TILE. Four rows of C are accumulated at a
+	time, so that each row of B is read once for the four*/
+	double acc[4][GP_TILE], a_0, a_1, a_2, a_3;
+	const double *b_j;
+	long i, j;
+	int r, n_r, p;
+	for (i = 0; i < n_i; i += 4) {
+		n_r = (n_i - i < 4) ? (int)(n_i - i) : 4;
+		for (r = 0; r < 4; r++) {
+			for (p = 0; p < n_p; p++) acc[r][p] = 0.0;
+		}
+		for (j = 0; j < n_j; j++) {
+			b_j = b + j*ldb;
+			a_0 = a[i*lda + j];
+			a_1 = (n_r > 1) ? a[(i + 1)*lda + j] : 0.0;
+			a_2 = (n_r > 2) ? a[(i + 2)*lda + j] : 0.0;
+			a_3 = (n_r > 3) ? a[(i + 3)*lda + j] : 0.0;
+			for (p = 0; p < n_p; p++) {
+				acc[0][p] += a_0*b_j[p];
+				acc[1][p] += a_1*b_j[p];
+				acc[2][p] += a_2*b_j[p];
+				acc[3][p] += a_3*b_j[p];
+			}
+		}
+		for (r = 0; r < n_r; r++) {
+			for (p = 0; p < n_p; p++) c[(i + r)*ldc + p] -= acc[r][p];
+		}
+	}
+}
+
+void gp_trailing_worker(void *arg, int thread, int n_threads){
+	/*Update the trailing matrix by the panel, a tile on or below the diagonal
+	at a time, the tiles taken in turn*/
+	gp_cholesky_context *context = (gp_cholesky_context*)arg;
+	double *a = context->a, panel_t[GP_TILE*GP_TILE];
+	long ld = context->ld, k0 = context->k0, k1 = k0 + context->n_k;
+	long i0, j0, n_i, n_j, j, tile = 0;
+	int p;
+	for (i0 = k1; i0 < context->n; i0 += GP_TILE) {
+		for (j0 = k1; j0 <= i0; j0 += GP_TILE, tile++) {
+			if (tile % n_threads != thread) continue;
+			n_i = (context->n - i0 < GP_TILE) ? context->n - i0 : GP_TILE;
+			n_j = (context->n - j0 < GP_TILE) ? context->n - j0 : GP_TILE;
+			/*The panel rows of the tile's columns, by column of the panel*/
+			for (j = 0; j < n_j; j++) {
+				for (p = 0; p < context->n_k; p++) {
+					panel_t[p*GP_TILE + j] = a[(j0 + j)*ld + k0 + p];
+				}
+			}
+			gp_multiply_subtract(n_i, context->n_k, (int)n_j, a + i0*ld + k0, ld,
+				panel_t, GP_TILE, a + i0*ld + j0, ld);
+		}
+	}
+}
+
+int gp_cholesky(double *a, long n, long ld, int n_threads){
+	/*Factorise the symmetric positive definite matrix whose lower triangle is
+	in a, (n X n) with rows ld apart, in place into its lower Cholesky factor.
+	Returns 0 on success, -1 if a is not positive definite*/
+	gp_cholesky_context context = {a, n, ld, 0, 0};
+	double sum;
+	long k0, i, c, p;
+	for (k0 = 0; k0 < n; k0 += GP_TILE) {
+		context.k0 = k0;
+		context.n_k = (n - k0 < GP_TILE) ? n - k0 : GP_TILE;
+		for (i = k0; i < k0 + context.n_k; i++) {
+			for (c = k0; c <= i; c++) {
+				sum = a[i*ld + c];
+				for (p = k0; p < c; p++) sum -= a[i*ld + p]*a[c*ld + p];
+				if (c < i) a[i*ld + c] = sum/a[c*ld + c];
+				else if (sum > 0.0) a[i*ld + i] = sqrt(sum);
+				else return -1;
+			}
+		}
+		if (k0 + context.n_k < n) {
+			native_parallel(gp_panel_worker, &context, n_threads);
+			native_parallel(gp_trailing_worker, &context, n_threads);
+		}
+	}
+	return 0;
+}
+
+void gp_solve_lower(const double *l, long n, long ld, double *b){
+	/*Solve L x = b in place*/
+	double sum;
+	long i, j;
+	for (i = 0; i < n; i++) {
+		sum = b[i];
+		for (j = 0; j < i; j++) sum -= l[i*ld + j]*b[j];
+		b[i] = sum/l[i*ld + i];
+	}
+}
+
+void gp_solve_upper(const double *l, long n, long ld, double *b){
+	/*Solve L^T x = b in place*/
+	long i, j;
+	for (i = n - 1; i >= 0; i--) {
+		b[i] /= l[i*ld + i];
+		for (j = 0; j < i; j++) b[j] -= l[i*ld + j]*b[i];
+	}
+}
+
+void gp_solve_lower_columns(const double *l, long n, long ld, double *b,
+	int n_columns){
+	/*Solve L X = B in place, for B, (n X n_columns) with rows GP_TILE apart, a
+	tile of rows at a time: the rows solved before are subtracted a tile at a
+	time, then the diagonal tile is solved*/
+	double l_ij, inverse, *row_i, *row_j;
+	long i0, j0, n_i, i, j;
+	int p;
+	for (i0 = 0; i0 < n; i0 += GP_TILE) {
+		n_i = (n - i0 < GP_TILE) ? n - i0 : GP_TILE;
+		for (j0 = 0; j0 < i0; j0 += GP_TILE) {
+			gp_multiply_subtract(n_i, GP_TILE, n_columns, l + i0*ld + j0, ld,
+				b + j0*GP_TILE, GP_TILE, b + i0*GP_TILE, GP_TILE);
+		}
+		for (i = i0; i < i0 + n_i; i++) {
+			row_i = b + i*GP_TILE;
+			for (j = i0; j < i; j++) {
+				l_ij = l[i*ld + j];
+				row_j = b + j*GP_TILE;
+				for (p = 0; p < n_columns; p++) row_i[p] -= l_ij*row_j[p];
+			}
+			inverse = 1.0/l[i*ld + i];
+			for (p = 0; p < n_columns; p++) row_i[p] *= inverse;
+		}
+	}
+}
+
+void gp_free(gp_model *gp){
+	free(gp->x);
+	free(gp->y);
+	free(gp->cholesky);
+	free(gp->alpha);
+	memset(gp, 0, sizeof(gp_model));
+}
+
+int gp_reserve(gp_model *gp, long capacity){
+	/*Grow the arrays of gp to hold capacity points, keeping the first n.
+	Returns 0 on success, -1 otherwise*/
+	double *x, *y = NULL, *cholesky, *alpha;
+	long i;
+	if (capacity <= gp->capacity) return 0;
+	x = realloc(gp->x, (size_t)capacity*gp->dim*sizeof(double));
+	if (x != NULL) gp->x = x;
+	if (gp->y != NULL) {
+		y = realloc(gp->y, capacity*sizeof(double));
+		if (y != NULL) gp->y = y;
+	}
+	alpha = realloc(gp->alpha, capacity*sizeof(double));
+	if (alpha != NULL) gp->alpha = alpha;
+	cholesky = malloc((size_t)capacity*capacity*sizeof(double));
+	if ((x == NULL) || ((gp->y != NULL) && (y == NULL)) || (alpha == NULL) ||
+		(cholesky == NULL)) {
+		free(cholesky);
+		return -1;
+	}
+	for (i = 0; i < gp->n; i++) {
+		memcpy(cholesky + i*capacity, gp->cholesky + i*gp->capacity,
+			(i + 1)*sizeof(double));
+	}
+	free(gp->cholesky);
+	gp->cholesky = cholesky;
+	gp->capacity = capacity;
+	return 0;
+}
+
+void gp_update_alpha(gp_model *gp){
+	/*alpha = K^-1 y, from the factor*/
+	if (gp->y == NULL) return;
+	memcpy(gp->alpha, gp->y, gp->n*sizeof(double));
+	gp_solve_lower(gp->cholesky, gp->n, gp->capacity, gp->alpha);
+	gp_solve_upper(gp->cholesky, gp->n, gp->capacity, gp->alpha);
+}
+
+int gp_fit(gp_model *gp, int dim, double length, double noise_var,
+	double jitter, int n_threads, long n, const double *x, const double *y){
+	/*Factorise the covariance of n inputs
+
+	Parameters
+	----------------
+	gp : Filled with the factor, to be freed by gp_free()
+	dim : The dimension of the inputs
+	length : The length scale of the kernel
+	noise_var : The variance of the noise of the observations
+	jitter : Added to the diagonal with noise_var
+	n_threads : The threads used by every operation on gp, 0 for one per
+		processor
+	n, x : The inputs, (n X dim)
+	y : The observations, (n), or NULL for a prior to sample from
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	long i;
+	memset(gp, 0, sizeof(gp_model));
+	gp->dim = dim;
+	gp->length = length;
+	gp->noise_var = noise_var;
+	gp->jitter = jitter;
+	gp->n_threads = (n_threads > 0) ? n_threads : native_default_n_threads();
+	if (y != NULL) {
+		gp->y = malloc(sizeof(double));
+		if (gp->y == NULL) return -1;
+	}
+	if ((n < 1) || (gp_reserve(gp, n) != 0)) {
+		printf("Error allocating the GP\n");
+		gp_free(gp);
+		return -1;
+	}
+	gp->n = n;
+	memcpy(gp->x, x, (size_t)n*dim*sizeof(double));
+	if (y != NULL) memcpy(gp->y, y, n*sizeof(double));
+
+	gp_kernel_matrix(gp->x, n, gp->x, n, dim, length, gp->cholesky, gp->capacity,
+		gp->n_threads);
+	for (i = 0; i < n; i++) gp->cholesky[i*gp->capacity + i] += noise_var + jitter;
+	if (gp_cholesky(gp->cholesky, n, gp->capacity, gp->n_threads) != 0) {
+		printf("The covariance is not positive definite, increase the jitter\n");
+		gp_free(gp);
+		return -1;
+	}
+	gp_update_alpha(gp);
+	return 0;
+}
+
+int gp_add_points(gp_model *gp, long n_new, const double *x, const double *y){
+	/*Add n_new inputs x, (n_new X dim), with observations y (ignored for a
+	prior), extending the factor by a row for each.
+	Returns 0 on success, -1 otherwise*/
+	double *row, squared;
+	long p, i;
+	if (gp->n + n_new > gp->capacity) {
+		if (gp_reserve(gp, (2*gp->capacity > gp->n + n_new) ? 2*gp->capacity :
+				gp->n + n_new) != 0) {
+			printf("Error allocating the GP\n");
+			return -1;
+		}
+	}
+	for (p = 0; p < n_new; p++) {
+		memcpy(gp->x + gp->n*gp->dim, x + p*gp->dim, gp->dim*sizeof(double));
+		row = gp->cholesky + gp->n*gp->capacity;
+		for (i = 0; i < gp->n; i++) {
+			row[i] = gp_kernel(gp->x + i*gp->dim, x + p*gp->dim, gp->dim, gp->length);
+		}
+		gp_solve_lower(gp->cholesky, gp->n, gp->capacity, row);
+		squared = 1.0 + gp->noise_var + gp->jitter;
+		for (i = 0; i < gp->n; i++) squared -= row[i]*row[i];
+		if (!(squared > 0.0)) {
+			printf("The covariance is not positive definite, increase the jitter\n");
+			return -1;
+		}
+		row[gp->n] = sqrt(squared);
+		if (gp->y != NULL) gp->y[gp->n] = y[p];
+		gp->n++;
+	}
+	gp_update_alpha(gp);
+	return 0;
+}
+
+typedef struct {
+	const gp_model *gp;
+	const gp_sparse *sparse;
+	long m;
+	const double *x; // (m X dim), the points to predict
+	double *mean; // (m)
+	double *variance; // (m)
+	double *scratch; // (n_threads X n X GP_TILE), or n_inducing for sparse
+} gp_predict_context;
+
+void gp_predict_worker(void *arg, int thread, int n_threads){
+	/*The predictions of the thread's tiles of points*/
+	gp_predict_context *context = (gp_predict_context*)arg;
+	const gp_model *gp = context->gp;
+	long n = gp->n, i, p0;
+	double *k_star = context->scratch + (size_t)thread*n*GP_TILE;
+	int n_p, p;
+
+	for (p0 = (long)thread*GP_TILE; p0 < context->m; p0 += (long)n_threads*GP_TILE) {
+		n_p = (context->m - p0 < GP_TILE) ? (int)(context->m - p0) : GP_TILE;
+		gp_kernel_tile(gp->x, n, context->x + p0*gp->dim, n_p, gp->dim, gp->length,
+			k_star, GP_TILE);
+		for (p = 0; p < n_p; p++) context->mean[p0 + p] = 0.0;
+		if (gp->y != NULL) {
+			for (i = 0; i < n; i++) {
+				for (p = 0; p < n_p; p++) context->mean[p0 + p] += k_star[i*GP_TILE + p]*gp->alpha[i];
+			}
+		}
+		gp_solve_lower_columns(gp->cholesky, n, gp->capacity, k_star, n_p);
+		for (p = 0; p < n_p; p++) context->variance[p0 + p] = 1.0 + gp->noise_var;
+		for (i = 0; i < n; i++) {
+			for (p = 0; p < n_p; p++) context->variance[p0 + p] -= k_star[i*GP_TILE + p]*k_star[i*GP_TILE + p];
+		}
+	}
+}
+
+int gp_predict(const gp_model *gp, long m, const double *x, double *mean,
+	double *variance){
+	/*The posterior predictive mean and variance of the observation of each of
+	m inputs x, (m X dim), as in the notebook. A prior without observations has
+	mean 0. Returns 0 on success, -1 otherwise*/
+	int n_threads = gp->n_threads;
+	gp_predict_context context = {gp, NULL, m, x, mean, variance, NULL};
+	if (n_threads > (m + GP_TILE - 1)/GP_TILE) n_threads = (int)((m + GP_TILE - 1)/GP_TILE);
+	if (n_threads < 1) return 0;
+	context.scratch = malloc((size_t)n_threads*gp->n*GP_TILE*sizeof(double));
+	if (context.scratch == NULL) {
+		printf("Error allocating the predictions\n");
+		return -1;
+	}
+	native_parallel(gp_predict_worker, &context, n_threads);
+	free(context.scratch);
+	return 0;
+}
+
+typedef struct {
+	const gp_model *gp;
+	int n_draws;
+	const double *z; // (n X n_draws), standard normals
+	double *out; // (n_draws X n)
+} gp_sample_context;
+
+void gp_sample_worker(void *arg, int thread, int n_threads){
+	/*Rows of L z, taken in turn*/
+	gp_sample_context *context = (gp_sample_context*)arg;
+	const gp_model *gp = context->gp;
+	int n_draws = context->n_draws, d;
+	double draw[GP_TILE], l_ij;
+	const double *z_j;
+	long i, j;
+	int d0, n_d;
+	for (i = thread; i < gp->n; i += n_threads) {
+		for (d0 = 0; d0 < n_draws; d0 += GP_TILE) {
+			n_d = (n_draws - d0 < GP_TILE) ? n_draws - d0 : GP_TILE;
+			for (d = 0; d < n_d; d++) draw[d] = 0.0;
+			for (j = 0; j <= i; j++) {
+				l_ij = gp->cholesky[i*gp->capacity + j];
+				z_j = context->z + j*n_draws + d0;
+				for (d = 0; d < n_d; d++) draw[d] += l_ij*z_j[d];
+			}
+			for (d = 0; d < n_d; d++) context->out[(size_t)(d0 + d)*gp->n + i] = draw[d];
+		}
+	}
+}
+
+int gp_sample(const gp_model *gp, gsl_rng *r, int n_draws, double *out){
+	/*Fill out, (n_draws X n), with draws at the inputs from N(0, K + (noise_var
+	+ jitter) I), as sample_from_gp(). Returns 0 on success, -1 otherwise*/
+	gp_sample_context context = {gp, n_draws, NULL, out};
+	double *z;
+	size_t k;
+	z = malloc((size_t)gp->n*n_draws*sizeof(double));
+	if (z == NULL) {
+		printf("Error allocating the draws\n");
+		return -1;
+	}
+	for (k = 0; k < (size_t)gp->n*n_draws; k++) z[k] = gsl_ran_gaussian_ziggurat(r, 1.0);
+	context.z = z;
+	native_parallel(gp_sample_worker, &context, gp->n_threads);
+	free(z);
+	return 0;
+}
+
+void gp_sparse_free(gp_sparse *sparse){
+	free(sparse->z);
+	free(sparse->cholesky_m);
+	free(sparse->cholesky_a);
+	free(sparse->v_y);
+	free(sparse->beta);
+	memset(sparse, 0, sizeof(gp_sparse));
+}
+
+typedef struct {
+	const gp_sparse *sparse;
+	long n;
+	const double *x;
+	const double *y;
+	double *a; // (n_threads X n_inducing X n_inducing), each thread's V V^T
+	double *v_y; // (n_threads X n_inducing), each thread's V y
+	double *scratch; // (n_threads X n_inducing X GP_TILE)
+} gp_sparse_fit_context;
+
+void gp_sparse_fit_worker(void *arg, int thread, int n_threads){
+	/*Accumulate V V^T and V y over the thread's range of points*/
+	gp_sparse_fit_context *context = (gp_sparse_fit_context*)arg;
+	const gp_sparse *sparse = context->sparse;
+	int m = sparse->n_inducing, n_p, p;
+	double *a = context->a + (size_t)thread*m*m;
+	double *v_y = context->v_y + (size_t)thread*m;
+	double *v = context->scratch + (size_t)thread*m*GP_TILE;
+	long first = context->n*thread/n_threads;
+	long last = context->n*(thread + 1)/n_threads;
+	double sum, *v_i, *v_j;
+	long p0;
+	int i, j;
+
+	memset(a, 0, (size_t)m*m*sizeof(double));
+	memset(v_y, 0, m*sizeof(double));
+	for (p0 = first; p0 < last; p0 += GP_TILE) {
+		n_p = (last - p0 < GP_TILE) ? (int)(last - p0) : GP_TILE;
+		gp_kernel_tile(sparse->z, m, context->x + p0*sparse->dim, n_p, sparse->dim,
+			sparse->length, v, GP_TILE);
+		gp_solve_lower_columns(sparse->cholesky_m, m, m, v, n_p);
+		for (i = 0; i < m; i++) {
+			v_i = v + (size_t)i*GP_TILE;
+			sum = 0.0;
+			for (p = 0; p < n_p; p++) sum += v_i[p]*context->y[p0 + p];
+			v_y[i] += sum;
+			for (j = 0; j <= i; j++) {
+				v_j = v + (size_t)j*GP_TILE;
+				sum = 0.0;
+				for (p = 0; p < n_p; p++) sum += v_i[p]*v_j[p];
+				a[(size_t)i*m + j] += sum;
+			}
+		}
+	}
+}
+
+void gp_sparse_update_beta(gp_sparse *sparse){
+	/*beta = L_A^-1 V y/noise_var*/
+	int i;
+	for (i = 0; i < sparse->n_inducing; i++) sparse->beta[i] = sparse->v_y[i]/sparse->noise_var;
+	gp_solve_lower(sparse->cholesky_a, sparse->n_inducing, sparse->n_inducing, sparse->beta);
+}
+
+int gp_sparse_fit(gp_sparse *sparse, int dim, double length, double noise_var,
+	double jitter, int n_threads, int n_inducing, const double *z, long n,
+	const double *x, const double *y){
+	/*Fit the inducing point approximation to n observations
+
+	Parameters
+	----------------
+	sparse : Filled with the factors, to be freed by gp_sparse_free()
+	dim, length, noise_var, jitter, n_threads : As gp_fit(), noise_var > 0
+	n_inducing, z : The inducing points, (n_inducing X dim)
+	n, x, y : The inputs, (n X dim), and observations, (n)
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	gp_sparse_fit_context context;
+	size_t m = n_inducing;
+	int i, t, status = 0;
+
+	memset(sparse, 0, sizeof(gp_sparse));
+	if (!(noise_var > 0.0) || (n_inducing < 1)) {
+		printf("The inducing point approximation needs noise and inducing points\n");
+		return -1;
+	}
+	sparse->dim = dim;
+	sparse->length = length;
+	sparse->noise_var = noise_var;
+	sparse->jitter = jitter;
+	sparse->n_threads = (n_threads > 0) ? n_threads : native_default_n_threads();
+	sparse->n_inducing = n_inducing;
+	sparse->n = n;
+	sparse->z = malloc(m*dim*sizeof(double));
+	sparse->cholesky_m = malloc(m*m*sizeof(double));
+	sparse->cholesky_a = malloc(m*m*sizeof(double));
+	sparse->v_y = calloc(m, sizeof(double));
+	sparse->beta = malloc(m*sizeof(double));
+	n_threads = sparse->n_threads;
+	if (n_threads > (n + GP_TILE - 1)/GP_TILE) n_threads = (int)((n + GP_TILE - 1)/GP_TILE);
+	if (n_threads < 1) n_threads = 1;
+	context.sparse = sparse;
+	context.n = n;
+	context.x = x;
+	context.y = y;
+	context.a = malloc(n_threads*m*m*sizeof(double));
+	context.v_y = malloc(n_threads*m*sizeof(double));
+	context.scratch = malloc(n_threads*m*GP_TILE*sizeof(double));
+	if ((sparse->z == NULL) || (sparse->cholesky_m == NULL) ||
+		(sparse->cholesky_a == NULL) || (sparse->v_y == NULL) ||
+		(sparse->beta == NULL) || (context.a == NULL) || (context.v_y == NULL) ||
+		(context.scratch == NULL)) {
+		printf("Error allocating the GP\n");
+		status = -1;
+	}
+
+	if (status == 0) {
+		memcpy(sparse->z, z, m*dim*sizeof(double));
+		gp_kernel_matrix(sparse->z, m, sparse->z, m, dim, length, sparse->cholesky_m,
+			m, sparse->n_threads);
+		for (i = 0; i < n_inducing; i++) sparse->cholesky_m[i*m + i] += jitter;
+		if (gp_cholesky(sparse->cholesky_m, m, m, sparse->n_threads) != 0) {
+			printf("The covariance of the inducing points is not positive definite, "
+				"increase the jitter\n");
+			status = -1;
+		}
+	}
+	if (status == 0) {
+		if (n > 0) native_parallel(gp_sparse_fit_worker, &context, n_threads);
+		memset(sparse->cholesky_a, 0, m*m*sizeof(double));
+		for (t = 0; (t < n_threads) && (n > 0); t++) {
+			for (i = 0; i < (int)(m*m); i++) sparse->cholesky_a[i] += context.a[t*m*m + i];
+			for (i = 0; i < n_inducing; i++) sparse->v_y[i] += context.v_y[t*m + i];
+		}
+		for (i = 0; i < (int)(m*m); i++) sparse->cholesky_a[i] /= noise_var;
+		for (i = 0; i < n_inducing; i++) sparse->cholesky_a[i*m + i] += 1.0;
+		if (gp_cholesky(sparse->cholesky_a, m, m, sparse->n_threads) != 0) status = -1;
+		else gp_sparse_update_beta(sparse);
+	}
+
+	free(context.a);
+	free(context.v_y);
+	free(context.scratch);
+	if (status != 0) gp_sparse_free(sparse);
+	return status;
+}
+
+void gp_cholesky_update(double *l, int n, double *x){
+	/*Replace L, (n X n) lower, by the factor of L L^T + x x^T, overwriting x*/
+	double r, c, s, l_kk;
+	int k, i;
+	for (k = 0; k < n; k++) {
+		l_kk = l[(size_t)k*n + k];
+		r = hypot(l_kk, x[k]);
+		c = r/l_kk;
+		s = x[k]/l_kk;
+		l[(size_t)k*n + k] = r;
+		for (i = k + 1; i < n; i++) {
+			l[(size_t)i*n + k] = (l[(size_t)i*n + k] + s*x[i])/c;
+			x[i] = c*x[i] - s*l[(size_t)i*n + k];
+		}
+	}
+}
+
+int gp_sparse_add_points(gp_sparse *sparse, long n_new, const double *x,
+	const double *y){
+	/*Add n_new observations y at inputs x, (n_new X dim), each by a rank-one
+	update of L_A. Returns 0 on success, -1 otherwise*/
+	int m = sparse->n_inducing, i;
+	double *v = malloc(m*sizeof(double));
+	double scale = 1.0/sqrt(sparse->noise_var);
+	long p;
+	if (v == NULL) {
+		printf("Error allocating the update\n");
+		return -1;
+	}
+	for (p = 0; p < n_new; p++) {
+		for (i = 0; i < m; i++) {
+			v[i] = gp_kernel(sparse->z + (size_t)i*sparse->dim, x + p*sparse->dim,
+				sparse->dim, sparse->length);
+		}
+		gp_solve_lower(sparse->cholesky_m, m, m, v);
+		for (i = 0; i < m; i++) {
+			sparse->v_y[i] += v[i]*y[p];
+			v[i] *= scale;
+		}
+		gp_cholesky_update(sparse->cholesky_a, m, v);
+	}
+	sparse->n += n_new;
+	gp_sparse_update_beta(sparse);
+	free(v);
+	return 0;
+}
+
+void gp_sparse_predict_worker(void *arg, int thread, int n_threads){
+	/*The predictions of the thread's tiles of points*/
+	gp_predict_context *context = (gp_predict_context*)arg;
+	const gp_sparse *sparse = context->sparse;
+	int m = sparse->n_inducing, n_p, p, i;
+	double *v = context->scratch + (size_t)thread*m*GP_TILE;
+	long p0;
+
+	for (p0 = (long)thread*GP_TILE; p0 < context->m; p0 += (long)n_threads*GP_TILE) {
+		n_p = (context->m - p0 < GP_TILE) ? (int)(context->m - p0) : GP_TILE;
+		gp_kernel_tile(sparse->z, m, context->x + p0*sparse->dim, n_p, sparse->dim,
+			sparse->length, v, GP_TILE);
+		gp_solve_lower_columns(sparse->cholesky_m, m, m, v, n_p);
+		for (p = 0; p < n_p; p++) context->variance[p0 + p] = 1.0 + sparse->noise_var;
+		for (i = 0; i < m; i++) {
+			for (p = 0; p < n_p; p++) context->variance[p0 + p] -= v[(size_t)i*GP_TILE + p]*v[(size_t)i*GP_TILE + p];
+		}
+		gp_solve_lower_columns(sparse->cholesky_a, m, m, v, n_p);
+		for (p = 0; p < n_p; p++) context->mean[p0 + p] = 0.0;
+		for (i = 0; i < m; i++) {
+			for (p = 0; p < n_p; p++) {
+				context->mean[p0 + p] += v[(size_t)i*GP_TILE + p]*sparse->beta[i];
+				context->variance[p0 + p] += v[(size_t)i*GP_TILE + p]*v[(size_t)i*GP_TILE + p];
+			}
+		}
+	}
+}
+
+int gp_sparse_predict(const gp_sparse *sparse, long m, const double *x,
+	double *mean, double *variance){
+	/*As gp_predict(), under the inducing point approximation*/
+	int n_threads = sparse->n_threads;
+	gp_predict_context context = {NULL, sparse, m, x, mean, variance, NULL};
+	if (n_threads > (m + GP_TILE - 1)/GP_TILE) n_threads = (int)((m + GP_TILE - 1)/GP_TILE);
+	if (n_threads < 1) return 0;
+	context.scratch = malloc((size_t)n_threads*sparse->n_inducing*GP_TILE*sizeof(double));
+	if (context.scratch == NULL) {
+		printf("Error allocating the predictions\n");
+		return -1;
+	}
+	native_parallel(gp_sparse_predict_worker, &context, n_threads);
+	free(context.scratch);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,436 @@
+/*
+A Python extension module, gp, which runs the Gaussian process regression of gp.h
+in-process, in place of cov_matrix_function(), sample_from_gp() and the
+prediction loop of gaussian_processes.ipynb.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('native')
+	import gp
+	prior = gp.fit(x, length=l, jitter=1e-8)
+	draws = gp.sample(prior, ndraws, seed=1) # (ndraws X D)
+	model = gp.fit(data_x, data_y, length=l, noise_var=var_noise)
+	means, variances = gp.predict(model, x)
+	gp.add_points(model, new_x, new_y)
+
+Inputs are arrays of shape (n) or (n X dim). fit() and sparse_fit() return a
+handle holding the factorised covariance, which every later call reuses, and is
+freed with the handle. sparse_fit() approximates the process by its values at
+inducing points z, for more points than a dense factor allows. The GIL is
+released while the engine runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "gp.h"
+
+#define MODEL_CAPSULE_NAME "gp.model"
+#define SPARSE_CAPSULE_NAME "gp.sparse"
+
+void model_capsule_destructor(PyObject *capsule){
+	/*Free the gp_model owned by a capsule*/
+	gp_model *gp = (gp_model*)PyCapsule_GetPointer(capsule, MODEL_CAPSULE_NAME);
+	gp_free(gp);
+	free(gp);
+}
+
+void sparse_capsule_destructor(PyObject *capsule){
+	/*Free the gp_sparse owned by a capsule*/
+	gp_sparse *sparse = (gp_sparse*)PyCapsule_GetPointer(capsule,
+		SPARSE_CAPSULE_NAME);
+	gp_sparse_free(sparse);
+	free(sparse);
+}
+
+PyArrayObject *parse_inputs(PyObject *object, int dim, const char *name){
+	/*Inputs of shape (n) or (n X dim) as a C-contiguous float64 array. dim 0
+	accepts any dimension.
+
+	Returns
+	----------------
+	The array, or NULL with a Python exception set
+	*/
+	PyArrayObject *array = (PyArrayObject*)PyArray_FROMANY(object, NPY_DOUBLE, 1,
+		2, NPY_ARRAY_IN_ARRAY);
+	int array_dim;
+	if (array == NULL) return NULL;
+	array_dim = (PyArray_NDIM(array) == 2) ? (int)PyArray_DIM(array, 1) : 1;
+	if ((PyArray_DIM(array, 0) < 1) || (array_dim < 1) ||
+		((dim > 0) && (array_dim != dim))) {
+		if (dim > 0) PyErr_Format(PyExc_ValueError, "%s must have shape (n, %d)", name, dim);
+		else PyErr_Format(PyExc_ValueError, "%s must not be empty", name);
+		Py_DECREF(array);
+		return NULL;
+	}
+	return array;
+}
+
+int input_dim(PyArrayObject *array){
+	return (PyArray_NDIM(array) == 2) ? (int)PyArray_DIM(array, 1) : 1;
+}
+
+PyArrayObject *parse_observations(PyObject *object, npy_intp n){
+	/*n observations as a C-contiguous float64 array, or NULL with a Python
+	exception set*/
+	PyArrayObject *array = (PyArrayObject*)PyArray_FROMANY(object, NPY_DOUBLE, 1,
+		1, NPY_ARRAY_IN_ARRAY);
+	if (array == NULL) return NULL;
+	if (PyArray_DIM(array, 0) != n) {
+		PyErr_SetString(PyExc_ValueError, "y must have one observation per input");
+		Py_DECREF(array);
+		return NULL;
+	}
+	return array;
+}
+
+PyObject *gp_py_kernel_matrix(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*The kernel between two sets of inputs, see the module docstring*/
+	static char *keywords[] = {"x1", "x2", "length", "n_threads", NULL};
+	PyObject *x1_object, *x2_object, *out;
+	PyArrayObject *x1, *x2;
+	double length;
+	int n_threads = 0;
+	npy_intp shape[2];
+	long i, j;
+	double *k;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOd|i", keywords,
+			&x1_object, &x2_object, &length, &n_threads)) {
+		return NULL;
+	}
+	x1 = parse_inputs(x1_object, 0, "x1");
+	if (x1 == NULL) return NULL;
+	x2 = parse_inputs(x2_object, input_dim(x1), "x2");
+	if (x2 == NULL) {Py_DECREF(x1); return NULL;}
+	shape[0] = PyArray_DIM(x1, 0);
+	shape[1] = PyArray_DIM(x2, 0);
+	out = PyArray_SimpleNew(2, shape, NPY_DOUBLE);
+	if (out != NULL) {
+		k = (double*)PyArray_DATA((PyArrayObject*)out);
+		Py_BEGIN_ALLOW_THREADS
+		/*Only the lower tiles are filled when x1 is x2, so mirror them*/
+		gp_kernel_matrix((double*)PyArray_DATA(x1), shape[0],
+			(double*)PyArray_DATA(x2), shape[1], input_dim(x1), length, k, shape[1],
+			n_threads);
+		if (PyArray_DATA(x1) == PyArray_DATA(x2)) {
+			for (i = 0; i < shape[0]; i++) {
+				for (j = i + 1; j < shape[1]; j++) k[i*shape[1] + j] = k[j*shape[1] + i];
+			}
+		}
+		Py_END_ALLOW_THREADS
+	}
+	Py_DECREF(x1);
+	Py_DECREF(x2);
+	return out;
+}
+
+PyObject *gp_py_fit(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Factorise a dense GP, see the module docstring*/
+	static char *keywords[] = {"x", "y", "length", "noise_var", "jitter",
+		"n_threads", NULL};
+	PyObject *x_object, *y_object = Py_None, *capsule;
+	PyArrayObject *x, *y = NULL;
+	double length = 1.0, noise_var = 0.0, jitter = 1e-8;
+	int n_threads = 0, status;
+	gp_model *gp;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Odddi", keywords,
+			&x_object, &y_object, &length, &noise_var, &jitter, &n_threads)) {
+		return NULL;
+	}
+	if (!(length > 0.0) || (noise_var < 0.0) || (jitter < 0.0)) {
+		PyErr_SetString(PyExc_ValueError,
+			"length must be positive, noise_var and jitter not negative");
+		return NULL;
+	}
+	x = parse_inputs(x_object, 0, "x");
+	if (x == NULL) return NULL;
+	if (y_object != Py_None) {
+		y = parse_observations(y_object, PyArray_DIM(x, 0));
+		if (y == NULL) {Py_DECREF(x); return NULL;}
+	}
+	gp = malloc(sizeof(gp_model));
+	if (gp == NULL) {
+		Py_DECREF(x);
+		Py_XDECREF(y);
+		return PyErr_NoMemory();
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = gp_fit(gp, input_dim(x), length, noise_var, jitter, n_threads,
+		(long)PyArray_DIM(x, 0), (double*)PyArray_DATA(x),
+		(y == NULL) ? NULL : (double*)PyArray_DATA(y));
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x);
+	Py_XDECREF(y);
+	if (status != 0) {
+		free(gp);
+		PyErr_SetString(PyExc_RuntimeError,
+			"The covariance could not be factorised, increase the jitter");
+		return NULL;
+	}
+	capsule = PyCapsule_New(gp, MODEL_CAPSULE_NAME, model_capsule_destructor);
+	if (capsule == NULL) {
+		gp_free(gp);
+		free(gp);
+	}
+	return capsule;
+}
+
+PyObject *gp_py_sparse_fit(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Fit the inducing point approximation, see the module docstring*/
+	static char *keywords[] = {"x", "y", "z", "length", "noise_var", "jitter",
+		"n_threads", NULL};
+	PyObject *x_object, *y_object, *z_object, *capsule;
+	PyArrayObject *x, *y, *z;
+	double length = 1.0, noise_var = 0.01, jitter = 1e-8;
+	int n_threads = 0, status;
+	gp_sparse *sparse;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|dddi", keywords,
+			&x_object, &y_object, &z_object, &length, &noise_var, &jitter,
+			&n_threads)) {
+		return NULL;
+	}
+	if (!(length > 0.0) || !(noise_var > 0.0) || (jitter < 0.0)) {
+		PyErr_SetString(PyExc_ValueError,
+			"length and noise_var must be positive, jitter not negative");
+		return NULL;
+	}
+	x = parse_inputs(x_object, 0, "x");
+	if (x == NULL) return NULL;
+	y = parse_observations(y_object, PyArray_DIM(x, 0));
+	z = (y == NULL) ? NULL : parse_inputs(z_object, input_dim(x), "z");
+	sparse = (z == NULL) ? NULL : malloc(sizeof(gp_sparse));
+	if (sparse == NULL) {
+		if (z != NULL) PyErr_NoMemory();
+		Py_DECREF(x);
+		Py_XDECREF(y);
+		Py_XDECREF(z);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = gp_sparse_fit(sparse, input_dim(x), length, noise_var, jitter,
+		n_threads, (int)PyArray_DIM(z, 0), (double*)PyArray_DATA(z),
+		(long)PyArray_DIM(x, 0), (double*)PyArray_DATA(x), (double*)PyArray_DATA(y));
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x);
+	Py_DECREF(y);
+	Py_DECREF(z);
+	if (status != 0) {
+		free(sparse);
+		PyErr_SetString(PyExc_RuntimeError,
+			"The covariance could not be factorised, increase the jitter");
+		return NULL;
+	}
+	capsule = PyCapsule_New(sparse, SPARSE_CAPSULE_NAME, sparse_capsule_destructor);
+	if (capsule == NULL) {
+		gp_sparse_free(sparse);
+		free(sparse);
+	}
+	return capsule;
+}
+
+int parse_handle(PyObject *handle, gp_model **gp, gp_sparse **sparse){
+	/*The model held by a handle from fit() or sparse_fit(). Returns 0 on
+	success, -1 with a Python exception set otherwise*/
+	*gp = NULL;
+	*sparse = NULL;
+	if (PyCapsule_IsValid(handle, MODEL_CAPSULE_NAME)) {
+		*gp = (gp_model*)PyCapsule_GetPointer(handle, MODEL_CAPSULE_NAME);
+	}
+	else if (PyCapsule_IsValid(handle, SPARSE_CAPSULE_NAME)) {
+		*sparse = (gp_sparse*)PyCapsule_GetPointer(handle, SPARSE_CAPSULE_NAME);
+	}
+	else{
+		PyErr_SetString(PyExc_TypeError, "Expected a handle from fit() or sparse_fit()");
+		return -1;
+	}
+	return 0;
+}
+
+PyObject *gp_py_predict(PyObject *self, PyObject *args){
+	/*The posterior predictive distribution, see the module docstring*/
+	PyObject *handle, *x_object, *mean, *variance;
+	PyArrayObject *x;
+	gp_model *gp;
+	gp_sparse *sparse;
+	npy_intp m;
+	int status;
+
+	if (!PyArg_ParseTuple(args, "OO", &handle, &x_object)) return NULL;
+	if (parse_handle(handle, &gp, &sparse) != 0) return NULL;
+	x = parse_inputs(x_object, (gp != NULL) ? gp->dim : sparse->dim, "x");
+	if (x == NULL) return NULL;
+	m = PyArray_DIM(x, 0);
+	mean = PyArray_SimpleNew(1, &m, NPY_DOUBLE);
+	variance = PyArray_SimpleNew(1, &m, NPY_DOUBLE);
+	if ((mean == NULL) || (variance == NULL)) {
+		Py_DECREF(x);
+		Py_XDECREF(mean);
+		Py_XDECREF(variance);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	if (gp != NULL) {
+		status = gp_predict(gp, (long)m, (double*)PyArray_DATA(x),
+			(double*)PyArray_DATA((PyArrayObject*)mean),
+			(double*)PyArray_DATA((PyArrayObject*)variance));
+	}
+	else{
+		status = gp_sparse_predict(sparse, (long)m, (double*)PyArray_DATA(x),
+			(double*)PyArray_DATA((PyArrayObject*)mean),
+			(double*)PyArray_DATA((PyArrayObject*)variance));
+	}
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x);
+	if (status != 0) {
+		Py_DECREF(mean);
+		Py_DECREF(variance);
+		return PyErr_NoMemory();
+	}
+	return Py_BuildValue("NN", mean, variance);
+}
+
+PyObject *gp_py_add_points(PyObject *self, PyObject *args){
+	/*Add observations to a model, see the module docstring*/
+	PyObject *handle, *x_object, *y_object = Py_None;
+	PyArrayObject *x, *y = NULL;
+	gp_model *gp;
+	gp_sparse *sparse;
+	int status;
+
+	if (!PyArg_ParseTuple(args, "OO|O", &handle, &x_object, &y_object)) return NULL;
+	if (parse_handle(handle, &gp, &sparse) != 0) return NULL;
+	if (((gp == NULL) || (gp->y != NULL)) && (y_object == Py_None)) {
+		PyErr_SetString(PyExc_ValueError, "y is needed for a model with observations");
+		return NULL;
+	}
+	x = parse_inputs(x_object, (gp != NULL) ? gp->dim : sparse->dim, "x");
+	if (x == NULL) return NULL;
+	if (y_object != Py_None) {
+		y = parse_observations(y_object, PyArray_DIM(x, 0));
+		if (y == NULL) {Py_DECREF(x); return NULL;}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	if (gp != NULL) {
+		status = gp_add_points(gp, (long)PyArray_DIM(x, 0), (double*)PyArray_DATA(x),
+			(y == NULL) ? NULL : (double*)PyArray_DATA(y));
+	}
+	else{
+		status = gp_sparse_add_points(sparse, (long)PyArray_DIM(x, 0),
+			(double*)PyArray_DATA(x), (double*)PyArray_DATA(y));
+	}
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x);
+	Py_XDECREF(y);
+	if (status != 0) {
+		PyErr_SetString(PyExc_RuntimeError,
+			"The points could not be added, increase the jitter");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+PyObject *gp_py_sample(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Draws from a dense GP at its inputs, see the module docstring*/
+	static char *keywords[] = {"handle", "n_draws", "seed", NULL};
+	PyObject *handle, *out;
+	gp_model *gp;
+	gp_sparse *sparse;
+	unsigned long int seed = 1;
+	int n_draws = 1, status;
+	npy_intp shape[2];
+	gsl_rng *r;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ik", keywords,
+			&handle, &n_draws, &seed)) {
+		return NULL;
+	}
+	if (parse_handle(handle, &gp, &sparse) != 0) return NULL;
+	if ((gp == NULL) || (n_draws < 1)) {
+		PyErr_SetString(PyExc_ValueError,
+			"sample() needs a handle from fit() and n_draws >= 1");
+		return NULL;
+	}
+	shape[0] = n_draws;
+	shape[1] = gp->n;
+	out = PyArray_SimpleNew(2, shape, NPY_DOUBLE);
+	if (out == NULL) return NULL;
+	r = gsl_rng_alloc(gsl_rng_mt19937);
+	if (r == NULL) {Py_DECREF(out); return PyErr_NoMemory();}
+	gsl_rng_set(r, seed);
+
+	Py_BEGIN_ALLOW_THREADS
+	status = gp_sample(gp, r, n_draws, (double*)PyArray_DATA((PyArrayObject*)out));
+	Py_END_ALLOW_THREADS
+
+	gsl_rng_free(r);
+	if (status != 0) {
+		Py_DECREF(out);
+		return PyErr_NoMemory();
+	}
+	return out;
+}
+
+PyMethodDef gp_methods[] = {
+	{"kernel_matrix", (PyCFunction)(void(*)(void))gp_py_kernel_matrix,
+		METH_VARARGS | METH_KEYWORDS,
+		"kernel_matrix(x1, x2, length, n_threads=0)\n\n"
+		"The squared exponential covariance exp(-|x1_i - x2_j|^2/length) of\n"
+		"cov_matrix_function(), between inputs of shape (n1) or (n1 X dim) and\n"
+		"(n2) or (n2 X dim), as an (n1 X n2) array."},
+	{"fit", (PyCFunction)(void(*)(void))gp_py_fit,
+		METH_VARARGS | METH_KEYWORDS,
+		"fit(x, y=None, length=1.0, noise_var=0.0, jitter=1e-8, n_threads=0)\n\n"
+		"Factorise the covariance K + (noise_var + jitter) I of inputs x, with\n"
+		"observations y (None for a prior to sample from), and return a handle\n"
+		"for sample(), predict() and add_points(). jitter keeps the covariance\n"
+		"of a dense grid positive definite. Every operation on the handle uses\n"
+		"n_threads threads (0 for one per processor)."},
+	{"sparse_fit", (PyCFunction)(void(*)(void))gp_py_sparse_fit,
+		METH_VARARGS | METH_KEYWORDS,
+		"sparse_fit(x, y, z, length=1.0, noise_var=0.01, jitter=1e-8,\n"
+		"    n_threads=0)\n\n"
+		"As fit(), approximating the process by its values at the inducing\n"
+		"points z (deterministic training conditional), at a cost linear in\n"
+		"the number of inputs. noise_var must be positive. The handle supports\n"
+		"predict() and add_points()."},
+	{"predict", (PyCFunction)(void(*)(void))gp_py_predict, METH_VARARGS,
+		"predict(handle, x)\n\n"
+		"The posterior predictive means and variances of observations at the\n"
+		"inputs x, as arrays of shape (n), the variances including noise_var as\n"
+		"in the notebook."},
+	{"add_points", (PyCFunction)(void(*)(void))gp_py_add_points, METH_VARARGS,
+		"add_points(handle, x, y=None)\n\n"
+		"Add inputs x with observations y (None for a prior) to a model,\n"
+		"updating its factor at O(n^2) per point for fit(), or O(inducing^2)\n"
+		"for sparse_fit(), rather than factorising again."},
+	{"sample", (PyCFunction)(void(*)(void))gp_py_sample,
+		METH_VARARGS | METH_KEYWORDS,
+		"sample(handle, n_draws=1, seed=1)\n\n"
+		"Draws from N(0, K + (noise_var + jitter) I) at the inputs of a handle\n"
+		"from fit(), as an (n_draws X n) array, as sample_from_gp()."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef gp_module = {
+	PyModuleDef_HEAD_INIT, "gp",
+	"Gaussian process regression with cached factorisations, run in-process",
+	-1, gp_methods
+};
+
+PyMODINIT_FUNC PyInit_gp(void){
+	import_array();
+	return PyModule_Create(&gp_module);
+}
@@ -0,0 +1,505 @@
+/*
+Inference and Baum-Welch training of hidden Markov models with discrete
+observations, as the occasionally dishonest casino of hidden_markov_models.ipynb,
+on many sequences of millions of observations.
+
+A model has n_states hidden states z and n_symbols symbols x, with
+
+	p(z_1 = i) = initial_i, p(z_(t+1) = j | z_t = i) = transition_ij,
+	p(x_t = s | z_t = j) = emission_js,
+
+so that transition is the notebook's transition_matrix_trans transposed, and
+emission its local_evidence transposed. initial is the distribution of z_1, to
+which the notebook applies the transition once more; for its stationary
+initial_state_distn the two are the same. The engine keeps the evidence psi_s, the
+probabilities of symbol s from every state, stored by symbol, (n_symbols X
+n_states), so that the evidence of each observation is one contiguous row.
+
+hmm_posteriors() runs the forward filter of the notebook,
+
+	alpha_(t+1) = psi_(x_(t+1)) * (transition^T alpha_t)/Z_(t+1),
+
+normalising each step by Z_(t+1) so that long sequences neither underflow nor
+need logs, then the backward pass with the same scaling, to give the posteriors
+p(z_t | x_(1:T)) and the log-likelihood sum_t log(Z_t). The filtered alpha are
+stored in the output and replaced by the posteriors as the backward pass reaches
+them. hmm_viterbi() finds the most probable path by max-sum in log space, storing
+one back pointer per state and observation. Each step of either is a loop over
+the previous states whose body is a loop over the next states, along a row of
+the transition matrix, which the compiler vectorises.
+
+Sequences are stored end to end in one array of symbols, with the offset of each
+one, and are taken in turn by the threads. hmm_fit() runs Baum-Welch: each thread
+accumulates the expected counts of the initial states, transitions and emissions
+of its sequences during the backward pass, without storing the pairwise
+posteriors, and the counts are merged once the pass is over to re-estimate the
+parameters. The transition counts are accumulated as sum_t alpha_t(i)
+psi_j beta_(t+1)(j)/Z_(t+1) and multiplied by transition_ij once per iteration.
+*/
+
+#ifndef HMM_H
+#define HMM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "native_parallel.h"
+
+typedef struct {
+	int n_states;
+	int n_symbols;
+	double *initial; // (n_states)
+	double *transition; // (n_states X n_states), from the row's state
+	double *emission; // (n_states X n_symbols)
+} hmm_params;
+
+typedef struct {
+	const int *x; // (offsets[n_sequences]), the symbols of every sequence
+	long n_sequences;
+	const long *offsets; // (n_sequences + 1), sequence k is x[offsets[k]:offsets[k + 1]]
+} hmm_data;
+
+typedef struct {
+	int max_iterations;
+	double tolerance; // on the change of the mean log-likelihood per observation
+	int n_threads; // 0 for one per processor
+	int verbose;
+} hmm_settings;
+
+typedef struct {
+	double *log_likelihood; // (max_iterations), the mean log-likelihood per
+		// observation before each re-estimation
+	int n_iterations;
+	int converged;
+} hmm_result;
+
+hmm_settings hmm_default_settings(void){
+	hmm_settings settings;
+	settings.max_iterations = 100;
+	settings.tolerance = 1e-6;
+	settings.n_threads = 0;
+	settings.verbose = 0;
+	return settings;
+}
+
+int hmm_check(const hmm_params *params, const hmm_data *data){
+	/*Returns 0 if every symbol of data is one of the model's and every sequence
+	is non-empty, -1 otherwise*/
+	long k, t;
+	if ((params->n_states < 1) || (params->n_symbols < 1) || (data->n_sequences < 1)) {
+		printf("The model and data must not be empty\n");
+		return -1;
+	}
+	for (k = 0; k < data->n_sequences; k++) {
+		if (data->offsets[k + 1] <= data->offsets[k]) {
+			printf("Sequence %ld is empty\n", k);
+			return -1;
+		}
+	}
+	for (t = 0; t < data->offsets[data->n_sequences]; t++) {
+		if ((data->x[t] < 0) || (data->x[t] >= params->n_symbols)) {
+			printf("Symbol %d of observation %ld is not in [0, %d)\n", data->x[t], t,
+				params->n_symbols);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+long hmm_longest(const hmm_data *data){
+	long k, longest = 0;
+	for (k = 0; k < data->n_sequences; k++) {
+		if (data->offsets[k + 1] - data->offsets[k] > longest) {
+			longest = data->offsets[k + 1] - data->offsets[k];
+		}
+	}
+	return longest;
+}
+
+typedef struct {
+	const hmm_params *params;
+	const hmm_data *data;
+	double *evidence; // (n_symbols X n_states), psi, or log(psi) for hmm_viterbi()
+	double *log_transition; // (n_states X n_states), for hmm_viterbi()
+	double *posterior; // (n_observations X n_states), NULL for hmm_fit()
+	int *path; // (n_observations), for hmm_viterbi()
+	double *log_likelihood; // (n_sequences), or the log-probability of each path
+	double *counts; // for hmm_fit(), the counts of each thread, hmm_counts_size()
+		// apart
+	long longest;
+	int failed;
+} hmm_context;
+
+size_t hmm_counts_size(int n_states, int n_symbols){
+	/*The initial, transition and emission counts, (n_states), (n_states X
+	n_states) and (n_symbols X n_states)*/
+	return (size_t)n_states*(1 + n_states + n_symbols);
+}
+
+void hmm_set_evidence(const hmm_params *params, double *evidence){
+	/*psi, (n_symbols X n_states), the emission matrix stored by symbol*/
+	int j, s;
+	for (s = 0; s < params->n_symbols; s++) {
+		for (j = 0; j < params->n_states; j++) {
+			evidence[s*params->n_states + j] = params->emission[j*params->n_symbols + s];
+		}
+	}
+}
+
+int hmm_forward_backward(const hmm_context *context, long k, double *alpha,
+	double *scale, double *beta, double *scratch, double *counts){
+	/*The posteriors of sequence k.
+
+	Parameters
+	----------------
+	alpha : (T X n_states), replaced by the posteriors
+	scale : (T), the normalisers Z_t
+	beta, scratch : (n_states)
+	counts : If not NULL, the sequence's expected counts are added to it
+
+	Returns
+	----------------
+	0 on success, -1 if the sequence has probability 0, setting the
+	log-likelihood of sequence k
+	*/
+	const hmm_params *params = context->params;
+	const int *x = context->data->x + context->data->offsets[k];
+	long T = context->data->offsets[k + 1] - context->data->offsets[k], t;
+	int n = params->n_states, i, j;
+	const double *psi, *a_i;
+	double *alpha_t, z, a, sum, log_likelihood = 0.0;
+
+	/*Forward, the filter of the notebook*/
+	for (t = 0; t < T; t++) {
+		alpha_t = alpha + t*n;
+		psi = context->evidence + (size_t)x[t]*n;
+		if (t == 0) {
+			for (j = 0; j < n; j++) alpha_t[j] = params->initial[j];
+		}
+		else{
+			for (j = 0; j < n; j++) alpha_t[j] = 0.0;
+			for (i = 0; i < n; i++) {
+				a = alpha_t[i - n];
+				a_i = params->transition + (size_t)i*n;
+				for (j = 0; j < n; j++) alpha_t[j] += a*a_i[j];
+			}
+		}
+		z = 0.0;
+		for (j = 0; j < n; j++) {
+			alpha_t[j] *= psi[j];
+			z += alpha_t[j];
+		}
+		if (!(z > 0.0)) {
+			context->log_likelihood[k] = -INFINITY;
+			return -1;
+		}
+		a = 1.0/z;
+		for (j = 0; j < n; j++) alpha_t[j] *= a;
+		scale[t] = z;
+		log_likelihood += log(z);
+	}
+	context->log_likelihood[k] = log_likelihood;
+
+	/*Backward, beta_t(i) = sum_j transition_ij psi_j beta_(t+1)(j)/Z_(t+1) with
+	scratch = psi beta_(t+1)/Z_(t+1), and the posteriors alpha_t beta_t*/
+	for (j = 0; j < n; j++) beta[j] = 1.0;
+	for (t = T - 1; t >= 0; t--) {
+		alpha_t = alpha + t*n;
+		if (t < T - 1) {
+			psi = context->evidence + (size_t)x[t + 1]*n;
+			a = 1.0/scale[t + 1];
+			for (j = 0; j < n; j++) scratch[j] = psi[j]*beta[j]*a;
+			if (counts != NULL) {
+				for (i = 0; i < n; i++) {
+					a = alpha_t[i];
+					for (j = 0; j < n; j++) counts[n + i*n + j] += a*scratch[j];
+				}
+			}
+			for (i = 0; i < n; i++) {
+				a_i = params->transition + (size_t)i*n;
+				sum = 0.0;
+				for (j = 0; j < n; j++) sum += a_i[j]*scratch[j];
+				beta[i] = sum;
+			}
+			for (j = 0; j < n; j++) alpha_t[j] *= beta[j];
+		}
+		if (counts != NULL) {
+			for (j = 0; j < n; j++) counts[n + n*n + x[t]*n + j] += alpha_t[j];
+		}
+	}
+	if (counts != NULL) {
+		for (j = 0; j < n; j++) counts[j] += alpha[j];
+	}
+	return 0;
+}
+
+void hmm_forward_backward_worker(void *arg, int thread, int n_threads){
+	/*The posteriors, or the counts, of the thread's sequences, taken in turn*/
+	hmm_context *context = (hmm_context*)arg;
+	const hmm_data *data = context->data;
+	int n = context->params->n_states;
+	double *buffer, *alpha, *scale, *counts = NULL;
+	long k;
+	buffer = malloc(((size_t)context->longest*
+		((context->posterior == NULL) ? n + 1 : 1) + 2*n)*sizeof(double));
+	if (buffer == NULL) {
+		printf("Error allocating the forward-backward\n");
+		context->failed = 1;
+		return;
+	}
+	scale = buffer + 2*n;
+	alpha = scale + context->longest;
+	if (context->counts != NULL) {
+		counts = context->counts + thread*hmm_counts_size(n, context->params->n_symbols);
+	}
+	for (k = thread; k < data->n_sequences; k += n_threads) {
+		if (context->posterior != NULL) alpha = context->posterior + data->offsets[k]*n;
+		if (hmm_forward_backward(context, k, alpha, scale, buffer, buffer + n,
+				counts) != 0) {
+			context->failed = 1;
+		}
+	}
+	free(buffer);
+}
+
+int hmm_n_threads(const hmm_data *data, int n_threads){
+	/*At most one thread per sequence*/
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+	if (n_threads > data->n_sequences) n_threads = (int)data->n_sequences;
+	return n_threads;
+}
+
+int hmm_posteriors(const hmm_params *params, const hmm_data *data, int n_threads,
+	double *posterior, double *log_likelihood){
+	/*The posteriors p(z_t | x) of every observation by forward-backward.
+
+	Parameters
+	----------------
+	posterior : (n_observations X n_states)
+	log_likelihood : (n_sequences), the log-likelihood of each sequence, -inf
+		for one with probability 0
+
+	Returns
+	----------------
+	0 on success, -1 if the data do not match the model or a sequence has
+	probability 0
+	*/
+	hmm_context context = {params, data, NULL, NULL, posterior, NULL,
+		log_likelihood, NULL, 0, 0};
+	if (hmm_check(params, data) != 0) return -1;
+	context.longest = hmm_longest(data);
+	context.evidence = malloc((size_t)params->n_symbols*params->n_states*sizeof(double));
+	if (context.evidence == NULL) {
+		printf("Error allocating the evidence\n");
+		return -1;
+	}
+	hmm_set_evidence(params, context.evidence);
+	native_parallel(hmm_forward_backward_worker, &context, hmm_n_threads(data, n_threads));
+	free(context.evidence);
+	return context.failed ? -1 : 0;
+}
+
+void hmm_viterbi_worker(void *arg, int thread, int n_threads){
+	/*The most probable paths of the thread's sequences, taken in turn, by
+	max-sum over log-probabilities with back pointers*/
+	hmm_context *context = (hmm_context*)arg;
+	const hmm_data *data = context->data;
+	int n = context->params->n_states, i, j, *back, *back_t, *path;
+	double *buffer, *delta, *next, *swap, d, v, best;
+	const double *log_psi, *row;
+	const int *x;
+	long k, t, T;
+	buffer = malloc(2*n*sizeof(double));
+	back = malloc((size_t)context->longest*n*sizeof(int));
+	if ((buffer == NULL) || (back == NULL)) {
+		printf("Error allocating the back pointers\n");
+		context->failed = 1;
+		free(buffer);
+		free(back);
+		return;
+	}
+	for (k = thread; k < data->n_sequences; k += n_threads) {
+		x = data->x + data->offsets[k];
+		path = context->path + data->offsets[k];
+		T = data->offsets[k + 1] - data->offsets[k];
+		delta = buffer;
+		next = buffer + n;
+		log_psi = context->evidence + (size_t)x[0]*n;
+		for (j = 0; j < n; j++) delta[j] = log(context->params->initial[j]) + log_psi[j];
+		for (t = 1; t < T; t++) {
+			back_t = back + t*n;
+			for (j = 0; j < n; j++) {
+				next[j] = -INFINITY;
+				back_t[j] = 0;
+			}
+			for (i = 0; i < n; i++) {
+				d = delta[i];
+				row = context->log_transition + (size_t)i*n;
+				for (j = 0; j < n; j++) {
+					v = d + row[j];
+					back_t[j] = (v > next[j]) ? i : back_t[j];
+					next[j] = (v > next[j]) ? v : next[j];
+				}
+			}
+			log_psi = context->evidence + (size_t)x[t]*n;
+			for (j = 0; j < n; j++) next[j] += log_psi[j];
+			swap = delta;
+			delta = next;
+			next = swap;
+		}
+		best = delta[0];
+		path[T - 1] = 0;
+		for (j = 1; j < n; j++) {
+			if (delta[j] > best) {
+				best = delta[j];
+				path[T - 1] = j;
+			}
+		}
+		context->log_likelihood[k] = best;
+		for (t = T - 1; t > 0; t--) path[t - 1] = back[t*n + path[t]];
+	}
+	free(buffer);
+	free(back);
+}
+
+int hmm_viterbi(const hmm_params *params, const hmm_data *data, int n_threads,
+	int *path, double *log_probability){
+	/*The most probable sequence of hidden states of every sequence.
+
+	Parameters
+	----------------
+	path : (n_observations), the states
+	log_probability : (n_sequences), the log joint probability of each sequence
+		and its path
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	hmm_context context = {params, data, NULL, NULL, NULL, path, log_probability,
+		NULL, 0, 0};
+	int n = params->n_states, i;
+	if (hmm_check(params, data) != 0) return -1;
+	context.longest = hmm_longest(data);
+	context.evidence = malloc((size_t)params->n_symbols*n*sizeof(double));
+	context.log_transition = malloc((size_t)n*n*sizeof(double));
+	if ((context.evidence == NULL) || (context.log_transition == NULL)) {
+		printf("Error allocating the log-probabilities\n");
+		free(context.evidence);
+		free(context.log_transition);
+		return -1;
+	}
+	hmm_set_evidence(params, context.evidence);
+	for (i = 0; i < params->n_symbols*n; i++) context.evidence[i] = log(context.evidence[i]);
+	for (i = 0; i < n*n; i++) context.log_transition[i] = log(params->transition[i]);
+	native_parallel(hmm_viterbi_worker, &context, hmm_n_threads(data, n_threads));
+	free(context.evidence);
+	free(context.log_transition);
+	return context.failed ? -1 : 0;
+}
+
+void hmm_maximise(hmm_params *params, const double *counts){
+	/*Re-estimate the parameters from the merged expected counts. A state with
+	no expected transitions or emissions keeps its row*/
+	int n = params->n_states, m = params->n_symbols, i, j, s;
+	double total = 0.0, *row;
+	for (i = 0; i < n; i++) total += counts[i];
+	for (i = 0; i < n; i++) params->initial[i] = counts[i]/total;
+	for (i = 0; i < n; i++) {
+		row = params->transition + i*n;
+		total = 0.0;
+		for (j = 0; j < n; j++) total += row[j]*counts[n + i*n + j];
+		if (!(total > 0.0)) continue;
+		for (j = 0; j < n; j++) row[j] *= counts[n + i*n + j]/total;
+	}
+	for (j = 0; j < n; j++) {
+		row = params->emission + j*m;
+		total = 0.0;
+		for (s = 0; s < m; s++) total += counts[n + n*n + s*n + j];
+		if (!(total > 0.0)) continue;
+		for (s = 0; s < m; s++) row[s] = counts[n + n*n + s*n + j]/total;
+	}
+}
+
+int hmm_fit(const hmm_data *data, hmm_params *params,
+	const hmm_settings *settings, hmm_result *result){
+	/*Fit a hidden Markov model by Baum-Welch
+
+	Parameters
+	----------------
+	data : The sequences
+	params : The initial parameters, overwritten by those fitted
+	settings : The stopping rule and threads
+	result : Filled with the log-likelihood of every iteration, to be freed by
+		hmm_result_free()
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	hmm_context context = {params, data, NULL, NULL, NULL, NULL, NULL, NULL, 0, 0};
+	size_t size = hmm_counts_size(params->n_states, params->n_symbols), a;
+	double log_likelihood, previous = -INFINITY;
+	long k, n_observations = data->offsets[data->n_sequences];
+	int n_threads = hmm_n_threads(data, settings->n_threads), iteration, t;
+
+	result->n_iterations = 0;
+	result->converged = 0;
+	result->log_likelihood = malloc(((settings->max_iterations > 0) ?
+		settings->max_iterations : 1)*sizeof(double));
+	if (hmm_check(params, data) != 0) return -1;
+	context.longest = hmm_longest(data);
+	context.evidence = malloc((size_t)params->n_symbols*params->n_states*sizeof(double));
+	context.log_likelihood = malloc(data->n_sequences*sizeof(double));
+	context.counts = malloc(n_threads*size*sizeof(double));
+	if ((result->log_likelihood == NULL) || (context.evidence == NULL) ||
+		(context.log_likelihood == NULL) || (context.counts == NULL)) {
+		printf("Error allocating Baum-Welch\n");
+		free(context.evidence);
+		free(context.log_likelihood);
+		free(context.counts);
+		return -1;
+	}
+
+	for (iteration = 0; iteration < settings->max_iterations; iteration++) {
+		hmm_set_evidence(params, context.evidence);
+		memset(context.counts, 0, n_threads*size*sizeof(double));
+		native_parallel(hmm_forward_backward_worker, &context, n_threads);
+		if (context.failed) {
+			printf("A sequence has probability 0 under the parameters\n");
+			break;
+		}
+		for (t = 1; t < n_threads; t++) {
+			for (a = 0; a < size; a++) context.counts[a] += context.counts[t*size + a];
+		}
+		log_likelihood = 0.0;
+		for (k = 0; k < data->n_sequences; k++) log_likelihood += context.log_likelihood[k];
+		log_likelihood /= n_observations;
+		result->log_likelihood[iteration] = log_likelihood;
+		result->n_iterations = iteration + 1;
+		if (settings->verbose && (iteration % 10 == 0)) printf("%d %f\n", iteration, log_likelihood);
+
+		hmm_maximise(params, context.counts);
+		if (log_likelihood - previous < settings->tolerance) {
+			result->converged = 1;
+			break;
+		}
+		previous = log_likelihood;
+	}
+	free(context.evidence);
+	free(context.log_likelihood);
+	free(context.counts);
+	return context.failed ? -1 : 0;
+}
+
+void hmm_result_free(hmm_result *result){
+	/*Free a result filled by hmm_fit()*/
+	free(result->log_likelihood);
+	result->log_likelihood = NULL;
+}
+
+#endif
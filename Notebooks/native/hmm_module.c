@@ -0,0 +1,335 @@
+/*
+A Python extension module, hmm, which runs the hidden Markov model inference of
+hmm.h in-process, in place of the forward filter loop of
+hidden_markov_models.ipynb.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('native')
+	import hmm
+	x = die_outcomes - 1 # symbols from 0
+	posterior, log_likelihood = hmm.posteriors(x, initial_state_distn,
+		transition_matrix_trans.T, local_evidence.T)
+	path, log_probability = hmm.viterbi(x, initial_state_distn,
+		transition_matrix_trans.T, local_evidence.T)
+	fitted = hmm.fit(x, initial, transition, emission, lengths=lengths)
+
+Observations are integer symbols in [0, n_symbols). Many independent sequences
+are passed end to end in x, with their lengths, and are split between the
+threads. The GIL is released while the engine runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "hmm.h"
+
+typedef struct {
+	PyArrayObject *x;
+	PyArrayObject *initial;
+	PyArrayObject *transition;
+	PyArrayObject *emission;
+	long *offsets;
+} hmm_arrays;
+
+void free_arrays(hmm_arrays *arrays){
+	Py_XDECREF(arrays->x);
+	Py_XDECREF(arrays->initial);
+	Py_XDECREF(arrays->transition);
+	Py_XDECREF(arrays->emission);
+	free(arrays->offsets);
+}
+
+int parse_model(PyObject *x_object, PyObject *lengths_object,
+	PyObject *initial_object, PyObject *transition_object,
+	PyObject *emission_object, int copy, hmm_arrays *arrays, hmm_params *params,
+	hmm_data *data){
+	/*The sequences and the model as C-contiguous arrays, copies of the
+	parameters if copy is set.
+
+	Returns
+	----------------
+	0 on success, -1 with a Python exception set otherwise
+	*/
+	int flags = NPY_ARRAY_IN_ARRAY | (copy ? NPY_ARRAY_ENSURECOPY : 0);
+	PyArrayObject *lengths;
+	npy_intp n_observations, k, t;
+	long n_sequences;
+	const int *x;
+
+	memset(arrays, 0, sizeof(hmm_arrays));
+	arrays->x = (PyArrayObject*)PyArray_FROMANY(x_object, NPY_INT, 1, 1,
+		NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+	arrays->initial = (arrays->x == NULL) ? NULL :
+		(PyArrayObject*)PyArray_FROMANY(initial_object, NPY_DOUBLE, 1, 1, flags);
+	arrays->transition = (arrays->initial == NULL) ? NULL :
+		(PyArrayObject*)PyArray_FROMANY(transition_object, NPY_DOUBLE, 2, 2, flags);
+	arrays->emission = (arrays->transition == NULL) ? NULL :
+		(PyArrayObject*)PyArray_FROMANY(emission_object, NPY_DOUBLE, 2, 2, flags);
+	if (arrays->emission == NULL) {
+		free_arrays(arrays);
+		return -1;
+	}
+	params->n_states = (int)PyArray_DIM(arrays->initial, 0);
+	params->n_symbols = (int)PyArray_DIM(arrays->emission, 1);
+	params->initial = (double*)PyArray_DATA(arrays->initial);
+	params->transition = (double*)PyArray_DATA(arrays->transition);
+	params->emission = (double*)PyArray_DATA(arrays->emission);
+	if ((params->n_states < 1) || (params->n_symbols < 1) ||
+		(PyArray_DIM(arrays->transition, 0) != params->n_states) ||
+		(PyArray_DIM(arrays->transition, 1) != params->n_states) ||
+		(PyArray_DIM(arrays->emission, 0) != params->n_states)) {
+		PyErr_SetString(PyExc_ValueError, "initial, transition and emission must "
+			"have shapes (n_states), (n_states, n_states) and (n_states, n_symbols)");
+		free_arrays(arrays);
+		return -1;
+	}
+
+	n_observations = PyArray_DIM(arrays->x, 0);
+	x = (int*)PyArray_DATA(arrays->x);
+	for (t = 0; t < n_observations; t++) {
+		if ((x[t] < 0) || (x[t] >= params->n_symbols)) {
+			PyErr_Format(PyExc_ValueError, "x must hold symbols in [0, %d)",
+				params->n_symbols);
+			free_arrays(arrays);
+			return -1;
+		}
+	}
+	if (lengths_object == Py_None) {
+		n_sequences = 1;
+		arrays->offsets = malloc(2*sizeof(long));
+		if (arrays->offsets != NULL) {
+			arrays->offsets[0] = 0;
+			arrays->offsets[1] = (long)n_observations;
+		}
+	}
+	else{
+		lengths = (PyArrayObject*)PyArray_FROMANY(lengths_object, NPY_LONG, 1, 1,
+			NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+		if (lengths == NULL) {
+			free_arrays(arrays);
+			return -1;
+		}
+		n_sequences = (long)PyArray_DIM(lengths, 0);
+		arrays->offsets = malloc((n_sequences + 1)*sizeof(long));
+		if (arrays->offsets != NULL) {
+			arrays->offsets[0] = 0;
+			for (k = 0; k < n_sequences; k++) {
+				arrays->offsets[k + 1] = arrays->offsets[k] + ((long*)PyArray_DATA(lengths))[k];
+				if (arrays->offsets[k + 1] <= arrays->offsets[k]) n_sequences = -1;
+				if (n_sequences < 0) break;
+			}
+		}
+		Py_DECREF(lengths);
+	}
+	if (arrays->offsets == NULL) {
+		free_arrays(arrays);
+		PyErr_NoMemory();
+		return -1;
+	}
+	if ((n_sequences < 1) || (arrays->offsets[n_sequences] != n_observations)) {
+		PyErr_SetString(PyExc_ValueError,
+			"lengths must be positive and sum to the length of x");
+		free_arrays(arrays);
+		return -1;
+	}
+	data->x = x;
+	data->n_sequences = n_sequences;
+	data->offsets = arrays->offsets;
+	return 0;
+}
+
+PyObject *hmm_py_posteriors(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Forward-backward, see the module docstring*/
+	static char *keywords[] = {"x", "initial", "transition", "emission", "lengths",
+		"n_threads", NULL};
+	PyObject *x_object, *initial_object, *transition_object, *emission_object;
+	PyObject *lengths_object = Py_None, *posterior, *log_likelihood;
+	hmm_arrays arrays;
+	hmm_params params;
+	hmm_data data;
+	npy_intp shape[2];
+	int n_threads = 0, status;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|Oi", keywords,
+			&x_object, &initial_object, &transition_object, &emission_object,
+			&lengths_object, &n_threads)) {
+		return NULL;
+	}
+	if (parse_model(x_object, lengths_object, initial_object, transition_object,
+			emission_object, 0, &arrays, &params, &data) != 0) {
+		return NULL;
+	}
+	shape[0] = data.offsets[data.n_sequences];
+	shape[1] = params.n_states;
+	posterior = PyArray_SimpleNew(2, shape, NPY_DOUBLE);
+	shape[0] = data.n_sequences;
+	log_likelihood = PyArray_SimpleNew(1, shape, NPY_DOUBLE);
+	if ((posterior == NULL) || (log_likelihood == NULL)) {
+		free_arrays(&arrays);
+		Py_XDECREF(posterior);
+		Py_XDECREF(log_likelihood);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = hmm_posteriors(&params, &data, n_threads,
+		(double*)PyArray_DATA((PyArrayObject*)posterior),
+		(double*)PyArray_DATA((PyArrayObject*)log_likelihood));
+	Py_END_ALLOW_THREADS
+
+	free_arrays(&arrays);
+	if (status != 0) {
+		Py_DECREF(posterior);
+		Py_DECREF(log_likelihood);
+		PyErr_SetString(PyExc_RuntimeError,
+			"A sequence has probability 0 under the parameters");
+		return NULL;
+	}
+	return Py_BuildValue("NN", posterior, log_likelihood);
+}
+
+PyObject *hmm_py_viterbi(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*The most probable paths, see the module docstring*/
+	static char *keywords[] = {"x", "initial", "transition", "emission", "lengths",
+		"n_threads", NULL};
+	PyObject *x_object, *initial_object, *transition_object, *emission_object;
+	PyObject *lengths_object = Py_None, *path, *log_probability;
+	hmm_arrays arrays;
+	hmm_params params;
+	hmm_data data;
+	npy_intp n;
+	int n_threads = 0, status;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|Oi", keywords,
+			&x_object, &initial_object, &transition_object, &emission_object,
+			&lengths_object, &n_threads)) {
+		return NULL;
+	}
+	if (parse_model(x_object, lengths_object, initial_object, transition_object,
+			emission_object, 0, &arrays, &params, &data) != 0) {
+		return NULL;
+	}
+	n = data.offsets[data.n_sequences];
+	path = PyArray_SimpleNew(1, &n, NPY_INT);
+	n = data.n_sequences;
+	log_probability = PyArray_SimpleNew(1, &n, NPY_DOUBLE);
+	if ((path == NULL) || (log_probability == NULL)) {
+		free_arrays(&arrays);
+		Py_XDECREF(path);
+		Py_XDECREF(log_probability);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = hmm_viterbi(&params, &data, n_threads,
+		(int*)PyArray_DATA((PyArrayObject*)path),
+		(double*)PyArray_DATA((PyArrayObject*)log_probability));
+	Py_END_ALLOW_THREADS
+
+	free_arrays(&arrays);
+	if (status != 0) {
+		Py_DECREF(path);
+		Py_DECREF(log_probability);
+		return PyErr_NoMemory();
+	}
+	return Py_BuildValue("NN", path, log_probability);
+}
+
+PyObject *hmm_py_fit(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Baum-Welch, see the module docstring*/
+	static char *keywords[] = {"x", "initial", "transition", "emission", "lengths",
+		"max_iterations", "tolerance", "n_threads", "verbose", NULL};
+	PyObject *x_object, *initial_object, *transition_object, *emission_object;
+	PyObject *lengths_object = Py_None, *log_likelihood, *out;
+	hmm_arrays arrays;
+	hmm_params params;
+	hmm_data data;
+	hmm_settings settings = hmm_default_settings();
+	hmm_result result;
+	npy_intp n;
+	int status;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|Oidip", keywords,
+			&x_object, &initial_object, &transition_object, &emission_object,
+			&lengths_object, &settings.max_iterations, &settings.tolerance,
+			&settings.n_threads, &settings.verbose)) {
+		return NULL;
+	}
+	if (settings.max_iterations < 1) {
+		PyErr_SetString(PyExc_ValueError, "max_iterations must be positive");
+		return NULL;
+	}
+	if (parse_model(x_object, lengths_object, initial_object, transition_object,
+			emission_object, 1, &arrays, &params, &data) != 0) {
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = hmm_fit(&data, &params, &settings, &result);
+	Py_END_ALLOW_THREADS
+
+	if (status != 0) {
+		hmm_result_free(&result);
+		free_arrays(&arrays);
+		PyErr_SetString(PyExc_RuntimeError,
+			"A sequence has probability 0 under the parameters");
+		return NULL;
+	}
+	n = result.n_iterations;
+	log_likelihood = PyArray_SimpleNew(1, &n, NPY_DOUBLE);
+	if (log_likelihood == NULL) {
+		hmm_result_free(&result);
+		free_arrays(&arrays);
+		return NULL;
+	}
+	memcpy(PyArray_DATA((PyArrayObject*)log_likelihood), result.log_likelihood,
+		n*sizeof(double));
+	out = Py_BuildValue("{s:O,s:O,s:O,s:N,s:i,s:O}",
+		"initial", arrays.initial, "transition", arrays.transition,
+		"emission", arrays.emission, "log_likelihood", log_likelihood,
+		"n_iterations", result.n_iterations,
+		"converged", result.converged ? Py_True : Py_False);
+	hmm_result_free(&result);
+	free_arrays(&arrays);
+	return out;
+}
+
+PyMethodDef hmm_methods[] = {
+	{"posteriors", (PyCFunction)(void(*)(void))hmm_py_posteriors,
+		METH_VARARGS | METH_KEYWORDS,
+		"posteriors(x, initial, transition, emission, lengths=None, n_threads=0)\n\n"
+		"The posteriors p(z_t | x) of the hidden states of the symbols x, by\n"
+		"scaled forward-backward, as an (n X n_states) array, and the\n"
+		"log-likelihood of each sequence. transition[i, j] is\n"
+		"p(z_(t+1) = j | z_t = i) and emission[j, s] is p(x_t = s | z_t = j).\n"
+		"lengths splits x into independent sequences (None for one), which\n"
+		"n_threads threads (0 for one per processor) take in turn."},
+	{"viterbi", (PyCFunction)(void(*)(void))hmm_py_viterbi,
+		METH_VARARGS | METH_KEYWORDS,
+		"viterbi(x, initial, transition, emission, lengths=None, n_threads=0)\n\n"
+		"The most probable hidden states of the symbols x, as an int array of\n"
+		"length n, and the log joint probability of each sequence and its path."},
+	{"fit", (PyCFunction)(void(*)(void))hmm_py_fit,
+		METH_VARARGS | METH_KEYWORDS,
+		"fit(x, initial, transition, emission, lengths=None, max_iterations=100,\n"
+		"    tolerance=1e-6, n_threads=0, verbose=False)\n\n"
+		"Baum-Welch from the given parameters, until the mean log-likelihood per\n"
+		"observation increases by less than tolerance. Returns a dict of the\n"
+		"fitted initial, transition and emission, the log_likelihood of each\n"
+		"iteration, n_iterations and converged."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef hmm_module = {
+	PyModuleDef_HEAD_INIT, "hmm",
+	"Hidden Markov model inference and Baum-Welch, run in-process",
+	-1, hmm_methods
+};
+
+PyMODINIT_FUNC PyInit_hmm(void){
+	import_array();
+	return PyModule_Create(&hmm_module);
+}
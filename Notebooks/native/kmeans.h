@@ -0,0 +1,556 @@
+/*
+K-means clustering of an (n_data X n_features) design matrix, as in
+data_science_classics.ipynb, for datasets of millions of points.
+
+Centroids are seeded either by k-means++ (Arthur and Vassilvitskii 2007), each
+new centroid a point drawn with probability proportional to its squared distance
+to the closest centroid so far, or by the Forgy method of the notebook, n_clusters
+distinct points drawn uniformly.
+
+Lloyd iterations then alternate assigning every point to its closest centroid and
+moving each centroid to the mean of its points, until no point changes cluster
+or max_iterations is reached. Most distances are skipped by Hamerly's bounds
+(Hamerly 2010): each point keeps an upper bound on the distance to its own
+centroid and a lower bound on the distance to any other. Bounds are loosened by
+how far centroids moved, and a point is only compared with every centroid when
+its upper bound exceeds both its lower bound and half the distance from its
+centroid to the nearest other one. The sum and count of each cluster are
+updated by the points which changed cluster, so points whose bounds hold are not
+read at all.
+
+Every pass over the data is split into n_threads contiguous ranges of points,
+each accumulating into its own sums and counts, which are merged once the pass
+is over. The squared distances from a point to every centroid are computed
+against the centroids stored by feature, (n_features X n_clusters), in a loop
+over clusters which the compiler vectorises.
+*/
+
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "native_parallel.h"
+
+#include <gsl/gsl_rng.h>
+
+#define KMEANS_SEED_PLUSPLUS 0
+#define KMEANS_SEED_FORGY 1
+
+typedef struct {
+	int n_clusters;
+	int max_iterations;
+	int seeding; // KMEANS_SEED_PLUSPLUS or KMEANS_SEED_FORGY
+	int n_threads; // 0 for one per processor
+	unsigned long int seed;
+} kmeans_settings;
+
+typedef struct {
+	double *centroid; // (n_clusters X n_features)
+	int *label; // (n_data), the cluster of each point
+	double inertia; // total squared distance of the points to their centroids
+	int n_iterations;
+	long n_distances; // point to centroid distances computed, over every pass
+} kmeans_result;
+
+typedef struct kmeans_state kmeans_state;
+
+typedef struct {
+	kmeans_state *state;
+	long first; // the range of points of the thread
+	long last;
+	double *sum; // (n_clusters X n_features), change of each cluster's sum
+	long *count; // (n_clusters), change of each cluster's count
+	double *distance; // (n_clusters), scratch
+	double partial; // the thread's part of a sum over points
+	long n_changed; // points which changed cluster in the pass
+	long n_distances;
+	void *(*work)(void*);
+	pthread_t thread;
+	int started;
+} kmeans_thread;
+
+struct kmeans_state {
+	const double *x; // (n_data X n_features)
+	long n_data;
+	int n_features;
+	int n_clusters;
+	double *centroid; // (n_clusters X n_features)
+	double *centroid_t; // (n_features X n_clusters), the centroids by feature
+	double *sum; // (n_clusters X n_features)
+	long *count; // (n_clusters)
+	double *half_separation; // (n_clusters), half the distance to the nearest centroid
+	double *shift; // (n_clusters), how far each centroid moved in the last update
+	double max_shift; // the largest shift, of centroid max_shift_cluster
+	double second_shift; // the largest shift of the other centroids
+	int max_shift_cluster;
+	int *label; // (n_data)
+	double *upper; // (n_data), bound on the distance to the point's centroid
+	double *lower; // (n_data), bound on the distance to any other centroid
+	double *min_distance; // (n_data), squared distance to the closest seed
+	int n_threads;
+	kmeans_thread *thread;
+};
+
+double kmeans_squared_distance(const double *a, const double *b, int n_features){
+	/*The squared distance between two points*/
+	double squared = 0.0, difference;
+	int f;
+	for (f = 0; f < n_features; f++) {
+		difference = a[f] - b[f];
+		squared += difference*difference;
+	}
+	return squared;
+}
+
+void kmeans_distances(const double *x, const double *centroid_t, int n_features,
+	int n_clusters, double *distance){
+	/*Fill distance, (n_clusters), with the squared distance from x to every
+	centroid, given by feature in centroid_t, (n_features X n_clusters)*/
+	const double *row;
+	double x_f, difference;
+	int f, j;
+	for (j = 0; j < n_clusters; j++) distance[j] = 0.0;
+	for (f = 0; f < n_features; f++) {
+		x_f = x[f];
+		row = centroid_t + (size_t)f*n_clusters;
+		for (j = 0; j < n_clusters; j++) {
+			difference = x_f - row[j];
+			distance[j] += difference*difference;
+		}
+	}
+}
+
+int kmeans_closest(const double *distance, int n_clusters, double *closest,
+	double *second){
+	/*The index of the smallest of n_clusters squared distances, setting closest
+	to it and second to the next smallest (INFINITY if there is none)*/
+	int j, best = 0;
+	*closest = distance[0];
+	*second = INFINITY;
+	for (j = 1; j < n_clusters; j++) {
+		if (distance[j] < *closest) {
+			*second = *closest;
+			*closest = distance[j];
+			best = j;
+		}
+		else if (distance[j] < *second) *second = distance[j];
+	}
+	return best;
+}
+
+void *kmeans_thread_main(void *arg){
+	kmeans_thread *thread = (kmeans_thread*)arg;
+	return thread->work(thread);
+}
+
+void kmeans_run_threads(kmeans_state *state, void *(*work)(void*)){
+	/*Run work on the range of points of every thread. The calling thread does
+	the work of thread 0, and of any thread which could not be started*/
+	int t;
+	for (t = 0; t < state->n_threads; t++) {
+		state->thread[t].work = work;
+		state->thread[t].partial = 0.0;
+		state->thread[t].n_changed = 0;
+	}
+	for (t = 1; t < state->n_threads; t++) {
+		state->thread[t].started = (pthread_create(&state->thread[t].thread, NULL,
+			kmeans_thread_main, &state->thread[t]) == 0);
+	}
+	work(&state->thread[0]);
+	for (t = 1; t < state->n_threads; t++) {
+		if (state->thread[t].started) pthread_join(state->thread[t].thread, NULL);
+		else work(&state->thread[t]);
+	}
+}
+
+void *kmeans_seed_worker(void *arg){
+	/*Lower the squared distance of each point to its closest seed by the
+	newest seed, the last centroid set, and sum them*/
+	kmeans_thread *thread = (kmeans_thread*)arg;
+	kmeans_state *state = thread->state;
+	const double *seed = state->centroid + (size_t)state->n_features*
+		(state->n_clusters - 1);
+	double squared;
+	long i;
+	for (i = thread->first; i < thread->last; i++) {
+		squared = kmeans_squared_distance(state->x + (size_t)i*state->n_features,
+			seed, state->n_features);
+		if (squared < state->min_distance[i]) state->min_distance[i] = squared;
+		thread->partial += state->min_distance[i];
+	}
+	thread->n_distances += thread->last - thread->first;
+	return NULL;
+}
+
+void *kmeans_assign_worker(void *arg){
+	/*Assign every point of the thread to its closest centroid, setting its
+	bounds, and add it to the sums and counts of the thread*/
+	kmeans_thread *thread = (kmeans_thread*)arg;
+	kmeans_state *state = thread->state;
+	int n_features = state->n_features;
+	int n_clusters = state->n_clusters;
+	double closest, second;
+	const double *x;
+	long i;
+	int j, f;
+
+	memset(thread->sum, 0, (size_t)n_clusters*n_features*sizeof(double));
+	memset(thread->count, 0, n_clusters*sizeof(long));
+	for (i = thread->first; i < thread->last; i++) {
+		x = state->x + (size_t)i*n_features;
+		kmeans_distances(x, state->centroid_t, n_features, n_clusters,
+			thread->distance);
+		j = kmeans_closest(thread->distance, n_clusters, &closest, &second);
+		state->label[i] = j;
+		state->upper[i] = sqrt(closest);
+		state->lower[i] = sqrt(second);
+		for (f = 0; f < n_features; f++) thread->sum[(size_t)j*n_features + f] += x[f];
+		thread->count[j]++;
+	}
+	thread->n_distances += (thread->last - thread->first)*n_clusters;
+	return NULL;
+}
+
+void *kmeans_update_worker(void *arg){
+	/*Reassign the points of the thread after the centroids moved, skipping
+	every point whose bounds show its centroid is still the closest, and
+	accumulate the changes of the sums and counts*/
+	kmeans_thread *thread = (kmeans_thread*)arg;
+	kmeans_state *state = thread->state;
+	int n_features = state->n_features;
+	int n_clusters = state->n_clusters;
+	double upper, lower, bound, closest, second;
+	const double *x;
+	long i;
+	int a, j, f;
+
+	memset(thread->sum, 0, (size_t)n_clusters*n_features*sizeof(double));
+	memset(thread->count, 0, n_clusters*sizeof(long));
+	for (i = thread->first; i < thread->last; i++) {
+		a = state->label[i];
+		upper = state->upper[i] + state->shift[a];
+		lower = state->lower[i] - ((a == state->max_shift_cluster) ?
+			state->second_shift : state->max_shift);
+		bound = (state->half_separation[a] > lower) ? state->half_separation[a] :
+			lower;
+		if (upper > bound) {
+			/*Tighten the upper bound, then compare with every centroid*/
+			x = state->x + (size_t)i*n_features;
+			upper = sqrt(kmeans_squared_distance(x,
+				state->centroid + (size_t)a*n_features, n_features));
+			thread->n_distances++;
+			if (upper > bound) {
+				kmeans_distances(x, state->centroid_t, n_features, n_clusters,
+					thread->distance);
+				thread->n_distances += n_clusters;
+				j = kmeans_closest(thread->distance, n_clusters, &closest, &second);
+				upper = sqrt(closest);
+				lower = sqrt(second);
+				if (j != a) {
+					state->label[i] = j;
+					for (f = 0; f < n_features; f++) {
+						thread->sum[(size_t)a*n_features + f] -= x[f];
+						thread->sum[(size_t)j*n_features + f] += x[f];
+					}
+					thread->count[a]--;
+					thread->count[j]++;
+					thread->n_changed++;
+				}
+			}
+		}
+		state->upper[i] = upper;
+		state->lower[i] = lower;
+	}
+	return NULL;
+}
+
+void *kmeans_inertia_worker(void *arg){
+	/*Sum the squared distances of the points of the thread to their centroid*/
+	kmeans_thread *thread = (kmeans_thread*)arg;
+	kmeans_state *state = thread->state;
+	long i;
+	for (i = thread->first; i < thread->last; i++) {
+		thread->partial += kmeans_squared_distance(
+			state->x + (size_t)i*state->n_features,
+			state->centroid + (size_t)state->label[i]*state->n_features,
+			state->n_features);
+	}
+	return NULL;
+}
+
+void kmeans_transpose_centroids(kmeans_state *state){
+	/*Copy the centroids into their layout by feature*/
+	int j, f;
+	for (j = 0; j < state->n_clusters; j++) {
+		for (f = 0; f < state->n_features; f++) {
+			state->centroid_t[(size_t)f*state->n_clusters + j] =
+				state->centroid[(size_t)j*state->n_features + f];
+		}
+	}
+}
+
+int kmeans_seed(kmeans_state *state, const kmeans_settings *settings,
+	gsl_rng *r){
+	/*Choose the initial centroids. Returns 0 on success, -1 otherwise*/
+	int n_clusters = settings->n_clusters;
+	int j, k, t, duplicate;
+	long i, *chosen;
+	double total, target;
+
+	if (settings->seeding == KMEANS_SEED_FORGY) {
+		/*Distinct points, drawn uniformly*/
+		chosen = malloc(n_clusters * sizeof(long));
+		if (chosen == NULL) return -1;
+		for (j = 0; j < n_clusters; j++) {
+			do {
+				chosen[j] = (long)gsl_rng_uniform_int(r, state->n_data);
+				duplicate = 0;
+				for (k = 0; k < j; k++) duplicate |= (chosen[k] == chosen[j]);
+			} while (duplicate);
+			memcpy(state->centroid + (size_t)j*state->n_features,
+				state->x + (size_t)chosen[j]*state->n_features,
+				state->n_features*sizeof(double));
+		}
+		free(chosen);
+		kmeans_transpose_centroids(state);
+		return 0;
+	}
+
+	/*k-means++. n_clusters counts the seeds chosen so far, for the workers*/
+	state->min_distance = malloc(state->n_data * sizeof(double));
+	if (state->min_distance == NULL) return -1;
+	for (i = 0; i < state->n_data; i++) state->min_distance[i] = INFINITY;
+	i = (long)gsl_rng_uniform_int(r, state->n_data);
+	for (j = 0; j < n_clusters; j++) {
+		state->n_clusters = j + 1;
+		memcpy(state->centroid + (size_t)j*state->n_features,
+			state->x + (size_t)i*state->n_features, state->n_features*sizeof(double));
+		if (j == n_clusters - 1) break;
+		kmeans_run_threads(state, kmeans_seed_worker);
+
+		/*Draw the next seed in proportion to min_distance: find the thread whose
+		range holds it, then the point within that range*/
+		total = 0.0;
+		for (t = 0; t < state->n_threads; t++) total += state->thread[t].partial;
+		if (!(total > 0.0)) {
+			i = (long)gsl_rng_uniform_int(r, state->n_data);
+			continue;
+		}
+		target = gsl_rng_uniform(r)*total;
+		for (t = 0; t < state->n_threads - 1; t++) {
+			if (target < state->thread[t].partial) break;
+			target -= state->thread[t].partial;
+		}
+		for (i = state->thread[t].first; i < state->thread[t].last - 1; i++) {
+			if (target < state->min_distance[i]) break;
+			target -= state->min_distance[i];
+		}
+	}
+	state->n_clusters = n_clusters;
+	free(state->min_distance);
+	state->min_distance = NULL;
+	kmeans_transpose_centroids(state);
+	return 0;
+}
+
+void kmeans_update_centroids(kmeans_state *state){
+	/*Move each centroid to the mean of its points, leaving centroids of empty
+	clusters in place, and record how far each moved and the half distance to
+	its nearest neighbour*/
+	int n_features = state->n_features;
+	int n_clusters = state->n_clusters;
+	double mean, shift, separation;
+	int j, k, f;
+
+	state->max_shift = 0.0;
+	state->second_shift = 0.0;
+	state->max_shift_cluster = 0;
+	for (j = 0; j < n_clusters; j++) {
+		shift = 0.0;
+		if (state->count[j] > 0) {
+			for (f = 0; f < n_features; f++) {
+				mean = state->sum[(size_t)j*n_features + f]/state->count[j];
+				shift += (mean - state->centroid[(size_t)j*n_features + f])*
+					(mean - state->centroid[(size_t)j*n_features + f]);
+				state->centroid[(size_t)j*n_features + f] = mean;
+				state->centroid_t[(size_t)f*n_clusters + j] = mean;
+			}
+		}
+		state->shift[j] = sqrt(shift);
+		if (state->shift[j] > state->max_shift) {
+			state->second_shift = state->max_shift;
+			state->max_shift = state->shift[j];
+			state->max_shift_cluster = j;
+		}
+		else if (state->shift[j] > state->second_shift) {
+			state->second_shift = state->shift[j];
+		}
+	}
+	for (j = 0; j < n_clusters; j++) state->half_separation[j] = INFINITY;
+	for (j = 0; j < n_clusters; j++) {
+		for (k = j + 1; k < n_clusters; k++) {
+			separation = 0.5*sqrt(kmeans_squared_distance(
+				state->centroid + (size_t)j*n_features,
+				state->centroid + (size_t)k*n_features, n_features));
+			if (separation < state->half_separation[j]) state->half_separation[j] = separation;
+			if (separation < state->half_separation[k]) state->half_separation[k] = separation;
+		}
+	}
+}
+
+void kmeans_merge(kmeans_state *state){
+	/*Add the sums and counts of every thread to those of the clusters*/
+	int t;
+	size_t k;
+	for (t = 0; t < state->n_threads; t++) {
+		for (k = 0; k < (size_t)state->n_clusters*state->n_features; k++) {
+			state->sum[k] += state->thread[t].sum[k];
+		}
+		for (k = 0; k < (size_t)state->n_clusters; k++) {
+			state->count[k] += state->thread[t].count[k];
+		}
+	}
+}
+
+void kmeans_result_free(kmeans_result *result){
+	/*Free a result filled by kmeans_fit()*/
+	free(result->centroid);
+	free(result->label);
+	result->centroid = NULL;
+	result->label = NULL;
+}
+
+int kmeans_fit(const double *x, long n_data, int n_features,
+	const kmeans_settings *settings, kmeans_result *result){
+	/*Cluster the rows of a design matrix by k-means
+
+	Parameters
+	----------------
+	x : The design matrix, (n_data X n_features)
+	n_data : The number of points
+	n_features : The number of features of each point
+	settings : The number of clusters, seeding, iterations, threads and seed
+	result : Filled with the centroids and the cluster of each point, to be
+		freed by kmeans_result_free()
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	kmeans_state state;
+	int n_clusters = settings->n_clusters;
+	int n_threads = (settings->n_threads > 0) ? settings->n_threads :
+		native_default_n_threads();
+	int t, status = 0, iteration;
+	long n_changed = 1;
+	gsl_rng *r;
+
+	result->centroid = NULL;
+	result->label = NULL;
+	result->inertia = 0.0;
+	result->n_iterations = 0;
+	result->n_distances = 0;
+	if ((n_clusters < 1) || (n_data < n_clusters) || (n_features < 1)) {
+		printf("k-means needs at least as many points as clusters\n");
+		return -1;
+	}
+	if (n_threads > n_data) n_threads = (int)n_data;
+
+	memset(&state, 0, sizeof(state));
+	state.x = x;
+	state.n_data = n_data;
+	state.n_features = n_features;
+	state.n_clusters = n_clusters;
+	state.n_threads = n_threads;
+	state.centroid = malloc((size_t)n_clusters*n_features*sizeof(double));
+	state.centroid_t = malloc((size_t)n_clusters*n_features*sizeof(double));
+	state.sum = malloc((size_t)n_clusters*n_features*sizeof(double));
+	state.count = malloc(n_clusters*sizeof(long));
+	state.half_separation = malloc(n_clusters*sizeof(double));
+	state.shift = malloc(n_clusters*sizeof(double));
+	state.label = malloc(n_data*sizeof(int));
+	state.upper = malloc(n_data*sizeof(double));
+	state.lower = malloc(n_data*sizeof(double));
+	state.thread = calloc(n_threads, sizeof(kmeans_thread));
+	r = gsl_rng_alloc(gsl_rng_mt19937);
+	if ((state.centroid == NULL) || (state.centroid_t == NULL) ||
+		(state.sum == NULL) || (state.count == NULL) ||
+		(state.half_separation == NULL) || (state.shift == NULL) ||
+		(state.label == NULL) || (state.upper == NULL) || (state.lower == NULL) ||
+		(state.thread == NULL) || (r == NULL)) {
+		status = -1;
+	}
+	for (t = 0; (t < n_threads) && (status == 0); t++) {
+		state.thread[t].state = &state;
+		state.thread[t].first = n_data*t/n_threads;
+		state.thread[t].last = n_data*(t + 1)/n_threads;
+		state.thread[t].sum = malloc((size_t)n_clusters*n_features*sizeof(double));
+		state.thread[t].count = malloc(n_clusters*sizeof(long));
+		state.thread[t].distance = malloc(n_clusters*sizeof(double));
+		if ((state.thread[t].sum == NULL) || (state.thread[t].count == NULL) ||
+			(state.thread[t].distance == NULL)) {
+			status = -1;
+		}
+	}
+	if (status != 0) printf("Error allocating k-means\n");
+
+	if (status == 0) {
+		gsl_rng_set(r, settings->seed);
+		status = kmeans_seed(&state, settings, r);
+	}
+	if (status == 0) {
+		kmeans_run_threads(&state, kmeans_assign_worker);
+		memset(state.sum, 0, (size_t)n_clusters*n_features*sizeof(double));
+		memset(state.count, 0, n_clusters*sizeof(long));
+		kmeans_merge(&state);
+		for (iteration = 1; iteration <= settings->max_iterations; iteration++) {
+			kmeans_update_centroids(&state);
+			kmeans_run_threads(&state, kmeans_update_worker);
+			kmeans_merge(&state);
+			n_changed = 0;
+			for (t = 0; t < n_threads; t++) n_changed += state.thread[t].n_changed;
+			result->n_iterations = iteration;
+			if (n_changed == 0) break;
+		}
+		/*The centroids of the final assignment*/
+		if (n_changed > 0) kmeans_update_centroids(&state);
+		kmeans_run_threads(&state, kmeans_inertia_worker);
+		for (t = 0; t < n_threads; t++) {
+			result->inertia += state.thread[t].partial;
+			result->n_distances += state.thread[t].n_distances;
+		}
+		result->centroid = state.centroid;
+		result->label = state.label;
+		state.centroid = NULL;
+		state.label = NULL;
+	}
+
+	if (r != NULL) gsl_rng_free(r);
+	if (state.thread != NULL) {
+		for (t = 0; t < n_threads; t++) {
+			free(state.thread[t].sum);
+			free(state.thread[t].count);
+			free(state.thread[t].distance);
+		}
+	}
+	free(state.thread);
+	free(state.centroid);
+	free(state.centroid_t);
+	free(state.sum);
+	free(state.count);
+	free(state.half_separation);
+	free(state.shift);
+	free(state.label);
+	free(state.upper);
+	free(state.lower);
+	free(state.min_distance);
+	return status;
+}
+
+#endif
@@ -0,0 +1,158 @@
+/*
+A Python extension module, kmeans, which runs the k-means of kmeans.h
+in-process, in place of the Python loops of data_science_classics.ipynb.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('native')
+	import kmeans
+	result = kmeans.fit(X, n_clusters=3, seed=1)
+	result['centroids'] # (n_clusters X n_features)
+	result['labels'] # (n_data)
+
+X is read directly from the NumPy buffer passed in when it is a C-contiguous
+float64 array; anything else is converted once. The GIL is released while the
+clustering runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "kmeans.h"
+
+PyObject *kmeans_result_to_dict(const kmeans_result *result, long n_data,
+	int n_clusters, int n_features){
+	/*Copy a k-means result into a dict of NumPy arrays*/
+	npy_intp shape[2];
+	PyObject *dict, *item = NULL;
+
+	dict = PyDict_New();
+	if (dict == NULL) return NULL;
+
+	shape[0] = n_clusters;
+	shape[1] = n_features;
+	item = PyArray_SimpleNew(2, shape, NPY_DOUBLE);
+	if (item == NULL) goto fail;
+	memcpy(PyArray_DATA((PyArrayObject*)item), result->centroid,
+		(size_t)n_clusters*n_features*sizeof(double));
+	if (PyDict_SetItemString(dict, "centroids", item) != 0) goto fail;
+	Py_DECREF(item);
+
+	shape[0] = n_data;
+	item = PyArray_SimpleNew(1, shape, NPY_INT);
+	if (item == NULL) goto fail;
+	memcpy(PyArray_DATA((PyArrayObject*)item), result->label, n_data*sizeof(int));
+	if (PyDict_SetItemString(dict, "labels", item) != 0) goto fail;
+	Py_DECREF(item);
+
+	item = PyFloat_FromDouble(result->inertia);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "inertia", item) != 0)) goto fail;
+	Py_DECREF(item);
+
+	item = PyLong_FromLong(result->n_iterations);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "n_iterations", item) != 0)) goto fail;
+	Py_DECREF(item);
+
+	item = PyLong_FromLong(result->n_distances);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "n_distances", item) != 0)) goto fail;
+	Py_DECREF(item);
+	return dict;
+
+fail:
+	Py_XDECREF(item);
+	Py_DECREF(dict);
+	return NULL;
+}
+
+PyObject *kmeans_py_fit(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Cluster the rows of X, see the module docstring*/
+	static char *keywords[] = {"X", "n_clusters", "max_iterations", "init",
+		"n_threads", "seed", NULL};
+	PyObject *x_object, *dict;
+	PyArrayObject *x;
+	const char *init = "k-means++";
+	kmeans_settings settings;
+	kmeans_result result;
+	long n_data;
+	int n_features, status;
+
+	settings.n_clusters = 8;
+	settings.max_iterations = 300;
+	settings.n_threads = 0;
+	settings.seed = 1;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iisik", keywords,
+			&x_object, &settings.n_clusters, &settings.max_iterations, &init,
+			&settings.n_threads, &settings.seed)) {
+		return NULL;
+	}
+	if (strcmp(init, "k-means++") == 0) settings.seeding = KMEANS_SEED_PLUSPLUS;
+	else if (strcmp(init, "forgy") == 0) settings.seeding = KMEANS_SEED_FORGY;
+	else{
+		PyErr_SetString(PyExc_ValueError, "init must be 'k-means++' or 'forgy'");
+		return NULL;
+	}
+	if ((settings.max_iterations < 0) || (settings.n_threads < 0)) {
+		PyErr_SetString(PyExc_ValueError,
+			"max_iterations and n_threads must not be negative");
+		return NULL;
+	}
+
+	x = (PyArrayObject*)PyArray_FROMANY(x_object, NPY_DOUBLE, 2, 2,
+		NPY_ARRAY_IN_ARRAY);
+	if (x == NULL) return NULL;
+	n_data = (long)PyArray_DIM(x, 0);
+	n_features = (int)PyArray_DIM(x, 1);
+	if ((settings.n_clusters < 1) || (n_data < settings.n_clusters) ||
+		(n_features < 1)) {
+		PyErr_SetString(PyExc_ValueError,
+			"X needs at least n_clusters rows and one column, n_clusters >= 1");
+		Py_DECREF(x);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = kmeans_fit((double*)PyArray_DATA(x), n_data, n_features, &settings,
+		&result);
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x);
+	if (status != 0) {
+		kmeans_result_free(&result);
+		PyErr_SetString(PyExc_RuntimeError, "k-means failed");
+		return NULL;
+	}
+	dict = kmeans_result_to_dict(&result, n_data, settings.n_clusters, n_features);
+	kmeans_result_free(&result);
+	return dict;
+}
+
+PyMethodDef kmeans_methods[] = {
+	{"fit", (PyCFunction)(void(*)(void))kmeans_py_fit,
+		METH_VARARGS | METH_KEYWORDS,
+		"fit(X, n_clusters=8, max_iterations=300, init='k-means++', n_threads=0,\n"
+		"    seed=1)\n\n"
+		"Cluster the rows of X, (data X features), by k-means. init is\n"
+		"'k-means++' or 'forgy' (n_clusters distinct rows, as in the notebook).\n"
+		"Iterations stop once no point changes cluster, or after\n"
+		"max_iterations. Each pass over X is split between n_threads threads\n"
+		"(0 for one per processor); only the rounding of sums depends on it.\n"
+		"Returns a dict of centroids (n_clusters X features), labels (data),\n"
+		"the inertia (the summed squared distances of the points to their\n"
+		"centroids), n_iterations and n_distances, the point to centroid\n"
+		"distances computed, which Hamerly's bounds keep far below\n"
+		"n_iterations X data X n_clusters."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef kmeans_module = {
+	PyModuleDef_HEAD_INIT, "kmeans",
+	"Multithreaded k-means clustering, run in-process",
+	-1, kmeans_methods
+};
+
+PyMODINIT_FUNC PyInit_kmeans(void){
+	import_array();
+	return PyModule_Create(&kmeans_module);
+}
@@ -0,0 +1,573 @@
+/*
+Logistic regression, as in data_science_classics.ipynb, trained natively on
+datasets which need not fit in memory.
+
+The weights w minimise the cost of LR_cost_function(),
+
+	F(w) = -sum_i [y_i log(mu_i) + (1 - y_i) log(1 - mu_i)]/n_data + reg w.w/n_data,
+
+with mu_i = 1/(1 + exp(-w.x_i)), whose gradient is
+
+	(sum_i (mu_i - y_i) x_i + 2 reg w)/n_data.
+
+(grad_LR_cost_function() adds reg w_i rather than 2 reg w_i, half the derivative
+of the penalty; gradient descent on it minimises F with reg halved.) The cost of
+each point is evaluated as log(1 + exp(-|z|)) + max(z, 0) - y z, for z = w.x, which
+is finite for any w, unlike the logarithms of mu and 1 - mu.
+
+The sigmoid, cost and gradient are computed together by one pass over the data,
+logistic_pass(), which reads each row once. Rows are taken LOGISTIC_BLOCK at a
+time: the dot products of the block, then the sigmoid and cost of every row, then
+the gradient, each as a loop the compiler can vectorise. A pass over many rows
+is split between the threads of a logistic_pool, each adding into its own
+gradient, which are summed once the pass is over. The threads are started once
+per fit and wait for each pass, so that passes over small mini-batches are not
+dominated by starting threads; passes over fewer than LOGISTIC_BLOCK rows per
+thread are made by the calling thread alone.
+
+Two methods are provided:
+- LOGISTIC_LBFGS, limited-memory BFGS (Nocedal 1980) with a backtracking line
+	search, making a full pass over the data for every evaluation of F
+- LOGISTIC_SGD, mini-batch stochastic gradient descent with a constant learning
+	rate. Each epoch visits every batch of batch_size consecutive rows once, in a
+	random order, so that each batch is read sequentially from memory or disk.
+Both stop once F changes by less than tolerance (relative) between iterations,
+the rule of the notebook's loop (with tolerance 1e-4), or after max_iterations
+iterations or epochs. SGD compares the mean cost of its mini-batches over
+consecutive epochs.
+
+The data are read through a logistic_data, which gives the rows of the features
+and the labels with a stride. logistic_data_map() maps a binary file of float64
+rows, the features of each point followed by its label, into memory, so that the
+operating system pages it in from disk as passes reach it, and training is not
+limited by memory.
+*/
+
+#ifndef LOGISTIC_H
+#define LOGISTIC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "native_parallel.h"
+
+#include <gsl/gsl_rng.h>
+
+#define LOGISTIC_BLOCK 64
+
+#define LOGISTIC_LBFGS 0
+#define LOGISTIC_SGD 1
+
+#define LOGISTIC_ARMIJO 1e-4
+#define LOGISTIC_MAX_BACKTRACKS 50
+
+typedef struct {
+	const double *x; // the features of row i start at x + i*x_stride
+	long x_stride;
+	const double *y; // the label of row i, 0 or 1, is y[i*y_stride]
+	long y_stride;
+	long n_data;
+	int n_features;
+	void *map; // the mapping made by logistic_data_map(), NULL otherwise
+	size_t map_size;
+} logistic_data;
+
+typedef struct {
+	int method; // LOGISTIC_LBFGS or LOGISTIC_SGD
+	double reg; // L2 penalty, as in LR_cost_function()
+	int max_iterations; // iterations of L-BFGS, or epochs of SGD
+	double tolerance; // stop once F changes by less than this, relative
+	int n_threads; // 0 for one per processor
+	int memory; // L-BFGS, the number of correction pairs kept
+	double learning_rate; // SGD
+	long batch_size; // SGD
+	unsigned long int seed; // SGD, for the order of the batches
+	int verbose;
+} logistic_settings;
+
+typedef struct {
+	double cost; // F at the weights returned
+	int n_iterations;
+	double n_passes; // rows read, in passes over the data
+	int converged;
+} logistic_result;
+
+typedef struct logistic_pool logistic_pool;
+
+typedef struct {
+	logistic_pool *pool;
+	int index;
+	double *grad; // (n_features), the thread's part of the gradient
+	double cost; // the thread's part of the cost
+	long seen; // the last pass the thread made
+	pthread_t thread;
+	int started;
+} logistic_thread;
+
+struct logistic_pool {
+	const logistic_data *data;
+	const double *w; // the weights of the current pass
+	long first; // the rows of the current pass
+	long last;
+	long generation; // counts passes, threads wait for it to change
+	int n_pending; // started threads yet to finish the pass
+	int stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	int n_threads;
+	logistic_thread *thread;
+	double rows_read;
+};
+
+logistic_settings logistic_default_settings(void){
+	/*L-BFGS, without penalty, to a relative change of 1e-6*/
+	logistic_settings settings;
+	settings.method = LOGISTIC_LBFGS;
+	settings.reg = 0.0;
+	settings.max_iterations = 1000;
+	settings.tolerance = 1e-6;
+	settings.n_threads = 0;
+	settings.memory = 10;
+	settings.learning_rate = 0.1;
+	settings.batch_size = 256;
+	settings.seed = 1;
+	settings.verbose = 0;
+	return settings;
+}
+
+int logistic_data_map(const char *filename, int n_features, logistic_data *data){
+	/*Map a binary file of native float64 rows, each the n_features features of a
+	point followed by its label, read-only into data.
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	struct stat status;
+	size_t row_size = (size_t)(n_features + 1)*sizeof(double);
+	int fd;
+
+	memset(data, 0, sizeof(logistic_data));
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("Error opening %s\n", filename);
+		return -1;
+	}
+	if ((fstat(fd, &status) != 0) || (status.st_size == 0) ||
+		((size_t)status.st_size % row_size != 0)) {
+		printf("%s does not hold rows of %d float64 values\n", filename,
+			n_features + 1);
+		close(fd);
+		return -1;
+	}
+	data->map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data->map == MAP_FAILED) {
+		printf("Error mapping %s\n", filename);
+		data->map = NULL;
+		return -1;
+	}
+	madvise(data->map, status.st_size, MADV_SEQUENTIAL);
+	data->map_size = status.st_size;
+	data->n_data = (long)(status.st_size/row_size);
+	data->n_features = n_features;
+	data->x = (const double*)data->map;
+	data->x_stride = n_features + 1;
+	data->y = (const double*)data->map + n_features;
+	data->y_stride = n_features + 1;
+	return 0;
+}
+
+void logistic_data_unmap(logistic_data *data){
+	/*Unmap data mapped by logistic_data_map()*/
+	if (data->map != NULL) munmap(data->map, data->map_size);
+	data->map = NULL;
+}
+
+double logistic_pass(const logistic_data *data, const double *w, long first,
+	long last, double *grad){
+	/*Add sum_i (mu_i - y_i) x_i over rows [first, last) to grad, (n_features),
+	and return the sum of their costs*/
+	double z[LOGISTIC_BLOCK], residual[LOGISTIC_BLOCK];
+	int n_features = data->n_features;
+	const double *row;
+	double dot, e, label, cost = 0.0;
+	long start;
+	int n, i, f;
+
+	for (start = first; start < last; start += LOGISTIC_BLOCK) {
+		n = (last - start < LOGISTIC_BLOCK) ? (int)(last - start) : LOGISTIC_BLOCK;
+		for (i = 0; i < n; i++) {
+			row = data->x + (start + i)*data->x_stride;
+			dot = 0.0;
+			for (f = 0; f < n_features; f++) dot += row[f]*w[f];
+			z[i] = dot;
+		}
+		for (i = 0; i < n; i++) {
+			label = data->y[(start + i)*data->y_stride];
+			e = exp(-fabs(z[i]));
+			cost += log1p(e) + ((z[i] > 0.0) ? z[i] : 0.0) - label*z[i];
+			residual[i] = ((z[i] >= 0.0) ? 1.0 : e)/(1.0 + e) - label;
+		}
+		for (i = 0; i < n; i++) {
+			row = data->x + (start + i)*data->x_stride;
+			for (f = 0; f < n_features; f++) grad[f] += residual[i]*row[f];
+		}
+	}
+	return cost;
+}
+
+void logistic_thread_pass(logistic_thread *thread){
+	/*The thread's share of the rows of the current pass*/
+	logistic_pool *pool = thread->pool;
+	long n = pool->last - pool->first;
+	long first = pool->first + n*thread->index/pool->n_threads;
+	long last = pool->first + n*(thread->index + 1)/pool->n_threads;
+	memset(thread->grad, 0, pool->data->n_features*sizeof(double));
+	thread->cost = logistic_pass(pool->data, pool->w, first, last, thread->grad);
+}
+
+void *logistic_thread_main(void *arg){
+	/*Make each pass of the pool until it stops*/
+	logistic_thread *thread = (logistic_thread*)arg;
+	logistic_pool *pool = thread->pool;
+	while (1) {
+		pthread_mutex_lock(&pool->mutex);
+		while ((pool->generation == thread->seen) && !pool->stop) {
+			pthread_cond_wait(&pool->start_cond, &pool->mutex);
+		}
+		thread->seen = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+		if (pool->stop) break;
+
+		logistic_thread_pass(thread);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->n_pending == 0) pthread_cond_signal(&pool->done_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return NULL;
+}
+
+int logistic_pool_start(logistic_pool *pool, const logistic_data *data,
+	int n_threads){
+	/*Start the threads which make the passes over data. The calling thread
+	makes the share of thread 0, and of any thread which could not be started.
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	int t;
+	memset(pool, 0, sizeof(logistic_pool));
+	pool->data = data;
+	pool->n_threads = (n_threads > 0) ? n_threads : 1;
+	pool->thread = calloc(pool->n_threads, sizeof(logistic_thread));
+	if (pool->thread == NULL) return -1;
+	for (t = 0; t < pool->n_threads; t++) {
+		pool->thread[t].pool = pool;
+		pool->thread[t].index = t;
+		pool->thread[t].grad = malloc(data->n_features*sizeof(double));
+		if (pool->thread[t].grad == NULL) {
+			while (t-- > 0) free(pool->thread[t].grad);
+			free(pool->thread);
+			return -1;
+		}
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	for (t = 1; t < pool->n_threads; t++) {
+		pool->thread[t].started = (pthread_create(&pool->thread[t].thread, NULL,
+			logistic_thread_main, &pool->thread[t]) == 0);
+	}
+	return 0;
+}
+
+void logistic_pool_stop(logistic_pool *pool){
+	/*Stop the threads of the pool and free it*/
+	int t;
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (t = 1; t < pool->n_threads; t++) {
+		if (pool->thread[t].started) pthread_join(pool->thread[t].thread, NULL);
+	}
+	for (t = 0; t < pool->n_threads; t++) free(pool->thread[t].grad);
+	free(pool->thread);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->start_cond);
+	pthread_cond_destroy(&pool->done_cond);
+}
+
+double logistic_pool_pass(logistic_pool *pool, const double *w, long first,
+	long last, double *grad){
+	/*Set grad, (n_features), to sum_i (mu_i - y_i) x_i over rows [first, last)
+	and return the sum of their costs, splitting the rows between the threads*/
+	int n_features = pool->data->n_features;
+	double cost = 0.0;
+	int t, f, n_started = 0;
+
+	pool->rows_read += last - first;
+	memset(grad, 0, n_features*sizeof(double));
+	if ((pool->n_threads == 1) || (last - first < (long)LOGISTIC_BLOCK*pool->n_threads)) {
+		return logistic_pass(pool->data, w, first, last, grad);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->w = w;
+	pool->first = first;
+	pool->last = last;
+	for (t = 1; t < pool->n_threads; t++) n_started += pool->thread[t].started;
+	pool->n_pending = n_started;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	logistic_thread_pass(&pool->thread[0]);
+	for (t = 1; t < pool->n_threads; t++) {
+		if (!pool->thread[t].started) logistic_thread_pass(&pool->thread[t]);
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->n_pending > 0) pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (t = 0; t < pool->n_threads; t++) {
+		cost += pool->thread[t].cost;
+		for (f = 0; f < n_features; f++) grad[f] += pool->thread[t].grad[f];
+	}
+	return cost;
+}
+
+double logistic_cost(logistic_pool *pool, const double *w, double reg,
+	double *grad){
+	/*F(w) over every row, setting grad, (n_features), to its gradient*/
+	const logistic_data *data = pool->data;
+	double n = (double)data->n_data, penalty = 0.0, cost;
+	int f;
+	cost = logistic_pool_pass(pool, w, 0, data->n_data, grad);
+	for (f = 0; f < data->n_features; f++) {
+		penalty += w[f]*w[f];
+		grad[f] = (grad[f] + 2.0*reg*w[f])/n;
+	}
+	return (cost + reg*penalty)/n;
+}
+
+int logistic_converged(double cost, double cost_new, double tolerance){
+	/*Whether the cost changed by less than tolerance, as np.isclose()*/
+	return (fabs(cost - cost_new) <= 1e-8 + tolerance*fabs(cost_new));
+}
+
+double logistic_dot(const double *a, const double *b, int n){
+	double dot = 0.0;
+	int i;
+	for (i = 0; i < n; i++) dot += a[i]*b[i];
+	return dot;
+}
+
+int logistic_lbfgs(logistic_pool *pool, const logistic_settings *settings,
+	double *w, logistic_result *result){
+	/*Minimise F from w by L-BFGS, see logistic_fit()*/
+	int n_features = pool->data->n_features;
+	int memory = (settings->memory > 0) ? settings->memory : 1;
+	double *s, *y, *rho, *alpha, *grad, *grad_new, *direction, *w_new;
+	double cost, cost_new, slope, step, beta, gamma, sy;
+	int iteration, n_pairs = 0, newest = -1, k, j, f, backtrack;
+
+	s = malloc((size_t)memory*n_features*sizeof(double));
+	y = malloc((size_t)memory*n_features*sizeof(double));
+	rho = malloc(memory*sizeof(double));
+	alpha = malloc(memory*sizeof(double));
+	grad = malloc(n_features*sizeof(double));
+	grad_new = malloc(n_features*sizeof(double));
+	direction = malloc(n_features*sizeof(double));
+	w_new = malloc(n_features*sizeof(double));
+	if ((s == NULL) || (y == NULL) || (rho == NULL) || (alpha == NULL) ||
+		(grad == NULL) || (grad_new == NULL) || (direction == NULL) ||
+		(w_new == NULL)) {
+		printf("Error allocating L-BFGS\n");
+		free(s); free(y); free(rho); free(alpha);
+		free(grad); free(grad_new); free(direction); free(w_new);
+		return -1;
+	}
+
+	cost = logistic_cost(pool, w, settings->reg, grad);
+	for (iteration = 1; iteration <= settings->max_iterations; iteration++) {
+		/*The two-loop recursion, direction = -H grad*/
+		for (f = 0; f < n_features; f++) direction[f] = -grad[f];
+		for (j = 0; j < n_pairs; j++) {
+			k = (newest - j + memory) % memory;
+			alpha[k] = rho[k]*logistic_dot(s + (size_t)k*n_features, direction, n_features);
+			for (f = 0; f < n_features; f++) direction[f] -= alpha[k]*y[(size_t)k*n_features + f];
+		}
+		if (n_pairs > 0) {
+			gamma = 1.0/(rho[newest]*logistic_dot(y + (size_t)newest*n_features,
+				y + (size_t)newest*n_features, n_features));
+			for (f = 0; f < n_features; f++) direction[f] *= gamma;
+		}
+		for (j = n_pairs - 1; j >= 0; j--) {
+			k = (newest - j + memory) % memory;
+			beta = rho[k]*logistic_dot(y + (size_t)k*n_features, direction, n_features);
+			for (f = 0; f < n_features; f++) direction[f] += (alpha[k] - beta)*s[(size_t)k*n_features + f];
+		}
+		slope = logistic_dot(grad, direction, n_features);
+		if (!(slope < 0.0)) {
+			/*Not a descent direction, forget the curvature*/
+			n_pairs = 0;
+			for (f = 0; f < n_features; f++) direction[f] = -grad[f];
+			slope = -logistic_dot(grad, grad, n_features);
+			if (slope == 0.0) {result->converged = 1; break;}
+		}
+
+		/*Backtrack until the cost decreases enough. The first step, without
+		curvature, moves by at most one unit*/
+		step = (n_pairs > 0) ? 1.0 : fmin(1.0, 1.0/sqrt(-slope));
+		for (backtrack = 0; backtrack < LOGISTIC_MAX_BACKTRACKS; backtrack++) {
+			for (f = 0; f < n_features; f++) w_new[f] = w[f] + step*direction[f];
+			cost_new = logistic_cost(pool, w_new, settings->reg, grad_new);
+			if (cost_new <= cost + LOGISTIC_ARMIJO*step*slope) break;
+			step *= 0.5;
+		}
+		if (backtrack == LOGISTIC_MAX_BACKTRACKS) break;
+
+		/*Keep the correction pair if it carries positive curvature*/
+		k = (newest + 1) % memory;
+		for (f = 0; f < n_features; f++) {
+			s[(size_t)k*n_features + f] = w_new[f] - w[f];
+			y[(size_t)k*n_features + f] = grad_new[f] - grad[f];
+		}
+		sy = logistic_dot(s + (size_t)k*n_features, y + (size_t)k*n_features, n_features);
+		if (sy > 1e-12*logistic_dot(y + (size_t)k*n_features, y + (size_t)k*n_features, n_features)) {
+			rho[k] = 1.0/sy;
+			newest = k;
+			if (n_pairs < memory) n_pairs++;
+		}
+
+		memcpy(w, w_new, n_features*sizeof(double));
+		memcpy(grad, grad_new, n_features*sizeof(double));
+		result->n_iterations = iteration;
+		if (settings->verbose && (iteration % 100 == 0)) printf("%d %f\n", iteration, cost_new);
+		if (logistic_converged(cost, cost_new, settings->tolerance)) {
+			cost = cost_new;
+			result->converged = 1;
+			break;
+		}
+		cost = cost_new;
+	}
+	result->cost = cost;
+
+	free(s); free(y); free(rho); free(alpha);
+	free(grad); free(grad_new); free(direction); free(w_new);
+	return 0;
+}
+
+int logistic_sgd(logistic_pool *pool, const logistic_settings *settings,
+	double *w, logistic_result *result){
+	/*Minimise F from w by mini-batch SGD, see logistic_fit()*/
+	const logistic_data *data = pool->data;
+	int n_features = data->n_features;
+	long batch_size = (settings->batch_size > 0) ? settings->batch_size : 1;
+	long n_batches = (data->n_data + batch_size - 1)/batch_size;
+	double epoch_cost, previous_cost = INFINITY, penalty, n_batch, *grad;
+	long *order, b, k, first, last;
+	int epoch, f;
+	gsl_rng *r;
+
+	order = malloc(n_batches*sizeof(long));
+	grad = malloc(n_features*sizeof(double));
+	r = gsl_rng_alloc(gsl_rng_mt19937);
+	if ((order == NULL) || (grad == NULL) || (r == NULL)) {
+		printf("Error allocating SGD\n");
+		free(order); free(grad);
+		if (r != NULL) gsl_rng_free(r);
+		return -1;
+	}
+	gsl_rng_set(r, settings->seed);
+	for (b = 0; b < n_batches; b++) order[b] = b;
+
+	for (epoch = 1; epoch <= settings->max_iterations; epoch++) {
+		/*Shuffle the order of the batches*/
+		for (b = n_batches - 1; b > 0; b--) {
+			k = (long)gsl_rng_uniform_int(r, b + 1);
+			first = order[b]; order[b] = order[k]; order[k] = first;
+		}
+		epoch_cost = 0.0;
+		for (b = 0; b < n_batches; b++) {
+			first = order[b]*batch_size;
+			last = (first + batch_size < data->n_data) ? first + batch_size : data->n_data;
+			n_batch = (double)(last - first);
+			epoch_cost += logistic_pool_pass(pool, w, first, last, grad);
+			penalty = logistic_dot(w, w, n_features);
+			epoch_cost += settings->reg*penalty*n_batch/data->n_data;
+			for (f = 0; f < n_features; f++) {
+				w[f] -= settings->learning_rate*(grad[f]/n_batch +
+					2.0*settings->reg*w[f]/data->n_data);
+			}
+		}
+		epoch_cost /= data->n_data;
+		result->n_iterations = epoch;
+		if (settings->verbose && (epoch % 100 == 0)) printf("%d %f\n", epoch, epoch_cost);
+		if (logistic_converged(previous_cost, epoch_cost, settings->tolerance)) {
+			result->converged = 1;
+			break;
+		}
+		previous_cost = epoch_cost;
+	}
+	result->cost = logistic_cost(pool, w, settings->reg, grad);
+
+	free(order);
+	free(grad);
+	gsl_rng_free(r);
+	return 0;
+}
+
+int logistic_fit(const logistic_data *data, const logistic_settings *settings,
+	double *w, logistic_result *result){
+	/*Train logistic regression
+
+	Parameters
+	----------------
+	data : The features and labels
+	settings : The method, penalty, stopping rule and threads
+	w : (n_features), the initial weights, overwritten by the weights found
+	result : Filled with the final cost and the work done
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	logistic_pool pool;
+	int n_threads = settings->n_threads;
+	int status;
+
+	result->cost = NAN;
+	result->n_iterations = 0;
+	result->n_passes = 0.0;
+	result->converged = 0;
+	if ((data->n_data < 1) || (data->n_features < 1)) {
+		printf("Logistic regression needs at least one row and one feature\n");
+		return -1;
+	}
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+	if (logistic_pool_start(&pool, data, n_threads) != 0) {
+		printf("Error allocating threads\n");
+		return -1;
+	}
+	if (settings->method == LOGISTIC_SGD) status = logistic_sgd(&pool, settings, w, result);
+	else status = logistic_lbfgs(&pool, settings, w, result);
+	result->n_passes = pool.rows_read/data->n_data;
+	logistic_pool_stop(&pool);
+	return status;
+}
+
+#endif
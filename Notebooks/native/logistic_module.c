@@ -0,0 +1,307 @@
+/*
+A Python extension module, logistic, which trains the logistic regression of
+logistic.h in-process, in place of LR_cost_function(), grad_LR_cost_function()
+and the gradient_descent() loop of data_science_classics.ipynb.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('native')
+	import logistic
+	result = logistic.fit(X_nl, y, reg=0.0)
+	result['w'] # (n_features)
+	cost, grad = logistic.cost_grad(w, X_nl, y, reg=0.0)
+
+X and y are read directly from the NumPy buffers passed in when they are
+C-contiguous float64 arrays, which includes an np.memmap of a file; anything else
+is converted once. Datasets larger than memory are better written as one binary
+file of float64 rows, each the features of a point followed by its label,
+
+	np.hstack([X, y[:, None]]).astype(np.float64).tofile('train.bin')
+
+and trained by fit_file('train.bin', n_features), which maps the file into
+memory. The GIL is released while training runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "logistic.h"
+
+int parse_method(const char *method, logistic_settings *settings){
+	/*Set the method of settings from its keyword argument, raising ValueError
+	and returning -1 if it is invalid*/
+	if (strcmp(method, "lbfgs") == 0) settings->method = LOGISTIC_LBFGS;
+	else if (strcmp(method, "sgd") == 0) settings->method = LOGISTIC_SGD;
+	else{
+		PyErr_SetString(PyExc_ValueError, "method must be 'lbfgs' or 'sgd'");
+		return -1;
+	}
+	if ((settings->max_iterations < 0) || (settings->n_threads < 0) ||
+		(settings->memory < 1) || (settings->batch_size < 1)) {
+		PyErr_SetString(PyExc_ValueError,
+			"max_iterations and n_threads must not be negative, memory and "
+			"batch_size must be positive");
+		return -1;
+	}
+	return 0;
+}
+
+int parse_data(PyObject *x_object, PyObject *y_object, PyArrayObject **x,
+	PyArrayObject **y, logistic_data *data){
+	/*Point data at X, (n_data X n_features), and y, (n_data), converting them
+	if needed. The arrays are returned in x and y, for the caller to release.
+
+	Returns
+	----------------
+	0 on success, -1 with a Python exception set otherwise
+	*/
+	*x = (PyArrayObject*)PyArray_FROMANY(x_object, NPY_DOUBLE, 2, 2,
+		NPY_ARRAY_IN_ARRAY);
+	if (*x == NULL) return -1;
+	*y = (PyArrayObject*)PyArray_FROMANY(y_object, NPY_DOUBLE, 1, 1,
+		NPY_ARRAY_IN_ARRAY);
+	if (*y == NULL) {Py_DECREF(*x); return -1;}
+	if ((PyArray_DIM(*x, 0) != PyArray_DIM(*y, 0)) || (PyArray_DIM(*x, 0) < 1) ||
+		(PyArray_DIM(*x, 1) < 1)) {
+		PyErr_SetString(PyExc_ValueError,
+			"X must have one row per label, and at least one row and column");
+		Py_DECREF(*x);
+		Py_DECREF(*y);
+		return -1;
+	}
+	memset(data, 0, sizeof(logistic_data));
+	data->n_data = (long)PyArray_DIM(*x, 0);
+	data->n_features = (int)PyArray_DIM(*x, 1);
+	data->x = (const double*)PyArray_DATA(*x);
+	data->x_stride = data->n_features;
+	data->y = (const double*)PyArray_DATA(*y);
+	data->y_stride = 1;
+	return 0;
+}
+
+PyObject *train(const logistic_data *data, PyObject *w0_object,
+	const logistic_settings *settings){
+	/*Train from w0 (zeros if None) with the GIL released, returning a dict of
+	the weights and the result*/
+	PyArrayObject *w0;
+	PyObject *w, *dict, *item = NULL;
+	logistic_result result;
+	npy_intp n_features = data->n_features;
+	int status;
+
+	w = PyArray_ZEROS(1, &n_features, NPY_DOUBLE, 0);
+	if (w == NULL) return NULL;
+	if ((w0_object != NULL) && (w0_object != Py_None)) {
+		w0 = (PyArrayObject*)PyArray_FROMANY(w0_object, NPY_DOUBLE, 1, 1,
+			NPY_ARRAY_IN_ARRAY);
+		if (w0 == NULL) {Py_DECREF(w); return NULL;}
+		if (PyArray_DIM(w0, 0) != n_features) {
+			PyErr_Format(PyExc_ValueError, "w0 must have %d element(s)",
+				data->n_features);
+			Py_DECREF(w0);
+			Py_DECREF(w);
+			return NULL;
+		}
+		memcpy(PyArray_DATA((PyArrayObject*)w), PyArray_DATA(w0),
+			n_features*sizeof(double));
+		Py_DECREF(w0);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = logistic_fit(data, settings, (double*)PyArray_DATA((PyArrayObject*)w),
+		&result);
+	Py_END_ALLOW_THREADS
+
+	if (status != 0) {
+		Py_DECREF(w);
+		PyErr_SetString(PyExc_RuntimeError, "Logistic regression failed");
+		return NULL;
+	}
+	dict = PyDict_New();
+	if (dict == NULL) {Py_DECREF(w); return NULL;}
+	if (PyDict_SetItemString(dict, "w", w) != 0) goto fail;
+
+	item = PyFloat_FromDouble(result.cost);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "cost", item) != 0)) goto fail;
+	Py_DECREF(item);
+
+	item = PyLong_FromLong(result.n_iterations);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "n_iterations", item) != 0)) goto fail;
+	Py_DECREF(item);
+
+	item = PyFloat_FromDouble(result.n_passes);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "n_passes", item) != 0)) goto fail;
+	Py_DECREF(item);
+
+	item = PyBool_FromLong(result.converged);
+	if ((item == NULL) || (PyDict_SetItemString(dict, "converged", item) != 0)) goto fail;
+	Py_DECREF(item);
+	Py_DECREF(w);
+	return dict;
+
+fail:
+	Py_XDECREF(item);
+	Py_DECREF(w);
+	Py_DECREF(dict);
+	return NULL;
+}
+
+PyObject *logistic_py_fit(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Train on arrays X and y, see the module docstring*/
+	static char *keywords[] = {"X", "y", "w0", "reg", "method", "max_iterations",
+		"tolerance", "learning_rate", "batch_size", "memory", "n_threads", "seed",
+		"verbose", NULL};
+	PyObject *x_object, *y_object, *w0_object = NULL, *result;
+	PyArrayObject *x, *y;
+	const char *method = "lbfgs";
+	logistic_settings settings = logistic_default_settings();
+	logistic_data data;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|Odsiddliikp", keywords,
+			&x_object, &y_object, &w0_object, &settings.reg, &method,
+			&settings.max_iterations, &settings.tolerance, &settings.learning_rate,
+			&settings.batch_size, &settings.memory, &settings.n_threads,
+			&settings.seed, &settings.verbose)) {
+		return NULL;
+	}
+	if ((parse_method(method, &settings) != 0) ||
+		(parse_data(x_object, y_object, &x, &y, &data) != 0)) {
+		return NULL;
+	}
+	result = train(&data, w0_object, &settings);
+	Py_DECREF(x);
+	Py_DECREF(y);
+	return result;
+}
+
+PyObject *logistic_py_fit_file(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Train on a mapped binary file, see the module docstring*/
+	static char *keywords[] = {"filename", "n_features", "w0", "reg", "method",
+		"max_iterations", "tolerance", "learning_rate", "batch_size", "memory",
+		"n_threads", "seed", "verbose", NULL};
+	PyObject *w0_object = NULL, *result;
+	const char *filename;
+	const char *method = "lbfgs";
+	int n_features;
+	logistic_settings settings = logistic_default_settings();
+	logistic_data data;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "si|Odsiddliikp", keywords,
+			&filename, &n_features, &w0_object, &settings.reg, &method,
+			&settings.max_iterations, &settings.tolerance, &settings.learning_rate,
+			&settings.batch_size, &settings.memory, &settings.n_threads,
+			&settings.seed, &settings.verbose)) {
+		return NULL;
+	}
+	if (parse_method(method, &settings) != 0) return NULL;
+	if (n_features < 1) {
+		PyErr_SetString(PyExc_ValueError, "n_features must be positive");
+		return NULL;
+	}
+	if (logistic_data_map(filename, n_features, &data) != 0) {
+		PyErr_Format(PyExc_OSError, "Could not map %s as rows of %d float64 values",
+			filename, n_features + 1);
+		return NULL;
+	}
+	result = train(&data, w0_object, &settings);
+	logistic_data_unmap(&data);
+	return result;
+}
+
+PyObject *logistic_py_cost_grad(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*The cost and its gradient, see the module docstring*/
+	static char *keywords[] = {"w", "X", "y", "reg", "n_threads", NULL};
+	PyObject *w_object, *x_object, *y_object, *grad;
+	PyArrayObject *w, *x, *y;
+	double reg = 0.0, cost;
+	int n_threads = 0, status;
+	npy_intp n_features;
+	logistic_data data;
+	logistic_pool pool;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|di", keywords,
+			&w_object, &x_object, &y_object, &reg, &n_threads)) {
+		return NULL;
+	}
+	if (parse_data(x_object, y_object, &x, &y, &data) != 0) return NULL;
+	w = (PyArrayObject*)PyArray_FROMANY(w_object, NPY_DOUBLE, 1, 1,
+		NPY_ARRAY_IN_ARRAY);
+	n_features = data.n_features;
+	grad = (w == NULL) ? NULL : PyArray_ZEROS(1, &n_features, NPY_DOUBLE, 0);
+	if ((w == NULL) || (grad == NULL) || (PyArray_DIM(w, 0) != n_features)) {
+		if ((w != NULL) && (grad != NULL)) {
+			PyErr_Format(PyExc_ValueError, "w must have %d element(s)",
+				data.n_features);
+		}
+		Py_XDECREF(w);
+		Py_XDECREF(grad);
+		Py_DECREF(x);
+		Py_DECREF(y);
+		return NULL;
+	}
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+
+	Py_BEGIN_ALLOW_THREADS
+	status = logistic_pool_start(&pool, &data, n_threads);
+	if (status == 0) {
+		cost = logistic_cost(&pool, (const double*)PyArray_DATA(w), reg,
+			(double*)PyArray_DATA((PyArrayObject*)grad));
+		logistic_pool_stop(&pool);
+	}
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(w);
+	Py_DECREF(x);
+	Py_DECREF(y);
+	if (status != 0) {
+		Py_DECREF(grad);
+		return PyErr_NoMemory();
+	}
+	return Py_BuildValue("dN", cost, grad);
+}
+
+PyMethodDef logistic_methods[] = {
+	{"fit", (PyCFunction)(void(*)(void))logistic_py_fit,
+		METH_VARARGS | METH_KEYWORDS,
+		"fit(X, y, w0=None, reg=0.0, method='lbfgs', max_iterations=1000,\n"
+		"    tolerance=1e-6, learning_rate=0.1, batch_size=256, memory=10,\n"
+		"    n_threads=0, seed=1, verbose=False)\n\n"
+		"Train logistic regression on X (data X features) and labels y in\n"
+		"{0, 1}, from w0 (zeros if None), minimising LR_cost_function(w, X, y,\n"
+		"reg). method is 'lbfgs' (L-BFGS keeping memory correction pairs) or\n"
+		"'sgd' (mini-batch SGD over batches of batch_size consecutive rows in a\n"
+		"random order, drawn from seed, with a constant learning_rate). Training\n"
+		"stops once the cost changes by less than tolerance (relative) between\n"
+		"iterations, or epochs of SGD, or after max_iterations of them. Each pass\n"
+		"over the data is split between n_threads threads (0 for one per\n"
+		"processor). Returns a dict of w, the final cost, n_iterations,\n"
+		"n_passes (the rows read, in passes over the data) and converged."},
+	{"fit_file", (PyCFunction)(void(*)(void))logistic_py_fit_file,
+		METH_VARARGS | METH_KEYWORDS,
+		"fit_file(filename, n_features, w0=None, reg=0.0, method='lbfgs',\n"
+		"    max_iterations=1000, tolerance=1e-6, learning_rate=0.1,\n"
+		"    batch_size=256, memory=10, n_threads=0, seed=1, verbose=False)\n\n"
+		"As fit(), on a binary file of native float64 rows, each n_features\n"
+		"features followed by the label, which is mapped into memory rather\n"
+		"than read, so it may be larger than memory."},
+	{"cost_grad", (PyCFunction)(void(*)(void))logistic_py_cost_grad,
+		METH_VARARGS | METH_KEYWORDS,
+		"cost_grad(w, X, y, reg=0.0, n_threads=0)\n\n"
+		"LR_cost_function(w, X, y, reg) and its gradient, from one pass over X.\n"
+		"The gradient's penalty is 2 reg w/n_data, the derivative of the cost,\n"
+		"where grad_LR_cost_function() adds reg w/n_data."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef logistic_module = {
+	PyModuleDef_HEAD_INIT, "logistic",
+	"Multithreaded logistic regression by L-BFGS or mini-batch SGD, run in-process",
+	-1, logistic_methods
+};
+
+PyMODINIT_FUNC PyInit_logistic(void){
+	import_array();
+	return PyModule_Create(&logistic_module);
+}
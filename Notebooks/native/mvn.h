@@ -0,0 +1,181 @@
+/*
+Batched multivariate Gaussian log-densities, for multivariate_gaussian() of
+utls.py on large grids and datasets.
+
+An mvn_model holds n_components Gaussians N(mu_k, Sigma_k) of dim dimensions,
+each factorised once by mvn_factorise() into its Cholesky factor L_k and
+
+	log_norm_k = -(dim/2) log(2 pi) - sum_f log(L_k,ff),
+
+so that every later evaluation costs a triangular solve per point and component,
+
+	log N(x | mu_k, Sigma_k) = log_norm_k - |L_k^-1 (x - mu_k)|^2/2,
+
+where the notebooks invert Sigma and take its determinant on every call.
+Log-densities are returned as they are, so that points far in the tails do not
+underflow to 0, and mvn_density() takes their exp.
+
+Points are taken MVN_BLOCK at a time and stored by dimension, (dim X MVN_BLOCK),
+so that each step of the forward substitution is a loop over the points of the
+block which the compiler vectorises. The blocks are taken in turn by n_threads
+threads.
+*/
+
+#ifndef MVN_H
+#define MVN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "native_parallel.h"
+
+#define MVN_BLOCK 64
+
+typedef struct {
+	int n_components;
+	int dim;
+	double *mean; // (n_components X dim)
+	double *cholesky; // (n_components X dim X dim), lower
+	double *log_norm; // (n_components)
+} mvn_model;
+
+void mvn_free(mvn_model *model){
+	free(model->mean);
+	free(model->cholesky);
+	free(model->log_norm);
+}
+
+int mvn_factorise(mvn_model *model, int n_components, int dim,
+	const double *mean, const double *covariance){
+	/*Copy the means, (n_components X dim), and factorise the covariances,
+	(n_components X dim X dim), of which only the lower triangles are read.
+
+	Returns
+	----------------
+	0 on success, -1 if a covariance is not positive definite or on failure to
+	allocate
+	*/
+	double *l, sum;
+	int k, i, j, f;
+	model->n_components = n_components;
+	model->dim = dim;
+	model->mean = malloc((size_t)n_components*dim*sizeof(double));
+	model->cholesky = malloc((size_t)n_components*dim*dim*sizeof(double));
+	model->log_norm = malloc(n_components*sizeof(double));
+	if ((model->mean == NULL) || (model->cholesky == NULL) || (model->log_norm == NULL)) {
+		printf("Error allocating the Gaussians\n");
+		mvn_free(model);
+		return -1;
+	}
+	memcpy(model->mean, mean, (size_t)n_components*dim*sizeof(double));
+	memcpy(model->cholesky, covariance, (size_t)n_components*dim*dim*sizeof(double));
+	for (k = 0; k < n_components; k++) {
+		l = model->cholesky + (size_t)k*dim*dim;
+		model->log_norm[k] = -0.5*dim*log(2.0*M_PI);
+		for (j = 0; j < dim; j++) {
+			for (i = j; i < dim; i++) {
+				sum = l[i*dim + j];
+				for (f = 0; f < j; f++) sum -= l[i*dim + f]*l[j*dim + f];
+				if (i == j) {
+					if (!(sum > 0.0)) {
+						printf("Covariance %d is not positive definite\n", k);
+						mvn_free(model);
+						return -1;
+					}
+					l[j*dim + j] = sqrt(sum);
+				}
+				else l[i*dim + j] = sum/l[j*dim + j];
+			}
+			for (i = 0; i < j; i++) l[i*dim + j] = 0.0;
+			model->log_norm[k] -= log(l[j*dim + j]);
+		}
+	}
+	return 0;
+}
+
+typedef struct {
+	const mvn_model *model;
+	long n;
+	const double *x; // (n X dim)
+	double *out; // (n X n_components)
+	int exponentiate;
+	int failed;
+} mvn_context;
+
+void mvn_worker(void *arg, int thread, int n_threads){
+	/*The log-densities of the thread's blocks of points*/
+	mvn_context *context = (mvn_context*)arg;
+	const mvn_model *model = context->model;
+	int dim = model->dim, n_k = model->n_components, k, f, g, b, n_b;
+	double *solve, *squared, *y_f, l_fg, inverse;
+	const double *l, *mu;
+	long i0;
+
+	solve = malloc(((size_t)dim + 1)*MVN_BLOCK*sizeof(double));
+	if (solve == NULL) {
+		printf("Error allocating the solves\n");
+		context->failed = 1;
+		return;
+	}
+	squared = solve + (size_t)dim*MVN_BLOCK;
+	for (i0 = (long)thread*MVN_BLOCK; i0 < context->n; i0 += (long)n_threads*MVN_BLOCK) {
+		n_b = (context->n - i0 < MVN_BLOCK) ? (int)(context->n - i0) : MVN_BLOCK;
+		for (k = 0; k < n_k; k++) {
+			l = model->cholesky + (size_t)k*dim*dim;
+			mu = model->mean + (size_t)k*dim;
+			/*L y = x - mu, a dimension at a time for every point of the block*/
+			for (b = 0; b < n_b; b++) squared[b] = 0.0;
+			for (f = 0; f < dim; f++) {
+				y_f = solve + (size_t)f*MVN_BLOCK;
+				for (b = 0; b < n_b; b++) y_f[b] = context->x[(i0 + b)*dim + f] - mu[f];
+				for (g = 0; g < f; g++) {
+					l_fg = l[f*dim + g];
+					for (b = 0; b < n_b; b++) y_f[b] -= l_fg*solve[(size_t)g*MVN_BLOCK + b];
+				}
+				inverse = 1.0/l[f*dim + f];
+				for (b = 0; b < n_b; b++) {
+					y_f[b] *= inverse;
+					squared[b] += y_f[b]*y_f[b];
+				}
+			}
+			for (b = 0; b < n_b; b++) {
+				context->out[(i0 + b)*n_k + k] = model->log_norm[k] - 0.5*squared[b];
+			}
+		}
+		if (context->exponentiate) {
+			for (b = 0; b < n_b*n_k; b++) context->out[i0*n_k + b] = exp(context->out[i0*n_k + b]);
+		}
+	}
+	free(solve);
+}
+
+int mvn_evaluate(const mvn_model *model, long n, const double *x, double *out,
+	int n_threads, int exponentiate){
+	/*mvn_log_density(), taking the exp of the log-densities if exponentiate is
+	set, as each block is finished*/
+	mvn_context context = {model, n, x, out, exponentiate, 0};
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+	if (n_threads > (n + MVN_BLOCK - 1)/MVN_BLOCK) n_threads = (int)((n + MVN_BLOCK - 1)/MVN_BLOCK);
+	if (n_threads < 1) return 0;
+	native_parallel(mvn_worker, &context, n_threads);
+	return context.failed ? -1 : 0;
+}
+
+int mvn_log_density(const mvn_model *model, long n, const double *x, double *out,
+	int n_threads){
+	/*Fill out, (n X n_components), with the log-density of every component at
+	each of n points x, (n X dim). Returns 0 on success, -1 otherwise*/
+	return mvn_evaluate(model, n, x, out, n_threads, 0);
+}
+
+int mvn_density(const mvn_model *model, long n, const double *x, double *out,
+	int n_threads){
+	/*As mvn_log_density(), for the densities*/
+	return mvn_evaluate(model, n, x, out, n_threads, 1);
+}
+
+#endif
@@ -0,0 +1,184 @@
+/*
+A Python extension module, mvn, which evaluates the multivariate Gaussian
+densities of mvn.h in-process, in place of the einsum of multivariate_gaussian()
+in utls.py, which uses it when it has been built.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('native')
+	import mvn
+	gaussian = mvn.factorise(mu, Sigma)
+	Z = mvn.density(gaussian, pos) # as utls.multivariate_gaussian(pos, mu, Sigma)
+	log_Z = mvn.log_density(gaussian, pos)
+
+pos packs the coordinates of the points into its last dimension, as for
+multivariate_gaussian(). The handle from factorise() holds the Cholesky factors of
+the covariances, which every later call reuses, and is freed with the handle. The
+GIL is released while the engine runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "mvn.h"
+
+#define CAPSULE_NAME "mvn.model"
+
+typedef struct {
+	mvn_model model;
+	int single; // a single Gaussian, whose densities drop the component axis
+} mvn_handle;
+
+void capsule_destructor(PyObject *capsule){
+	/*Free the mvn_handle owned by a capsule*/
+	mvn_handle *handle = (mvn_handle*)PyCapsule_GetPointer(capsule, CAPSULE_NAME);
+	mvn_free(&handle->model);
+	free(handle);
+}
+
+PyObject *mvn_py_factorise(PyObject *self, PyObject *args){
+	/*Factorise the covariances, see the module docstring*/
+	PyObject *mean_object, *covariance_object, *capsule;
+	PyArrayObject *mean, *covariance;
+	mvn_handle *handle;
+	int single, n_components, dim, status;
+
+	if (!PyArg_ParseTuple(args, "OO", &mean_object, &covariance_object)) return NULL;
+	mean = (PyArrayObject*)PyArray_FROMANY(mean_object, NPY_DOUBLE, 1, 2,
+		NPY_ARRAY_IN_ARRAY);
+	if (mean == NULL) return NULL;
+	covariance = (PyArrayObject*)PyArray_FROMANY(covariance_object, NPY_DOUBLE, 2, 3,
+		NPY_ARRAY_IN_ARRAY);
+	if (covariance == NULL) {Py_DECREF(mean); return NULL;}
+	single = (PyArray_NDIM(mean) == 1);
+	n_components = single ? 1 : (int)PyArray_DIM(mean, 0);
+	dim = (int)PyArray_DIM(mean, single ? 0 : 1);
+	if ((n_components < 1) || (dim < 1) ||
+		(PyArray_NDIM(covariance) != PyArray_NDIM(mean) + 1) ||
+		(!single && (PyArray_DIM(covariance, 0) != n_components)) ||
+		(PyArray_DIM(covariance, single ? 0 : 1) != dim) ||
+		(PyArray_DIM(covariance, single ? 1 : 2) != dim)) {
+		PyErr_SetString(PyExc_ValueError, "mu and Sigma must have shapes (dim) and "
+			"(dim, dim), or (n_components, dim) and (n_components, dim, dim)");
+		Py_DECREF(mean);
+		Py_DECREF(covariance);
+		return NULL;
+	}
+	handle = malloc(sizeof(mvn_handle));
+	if (handle == NULL) {
+		Py_DECREF(mean);
+		Py_DECREF(covariance);
+		return PyErr_NoMemory();
+	}
+	handle->single = single;
+	status = mvn_factorise(&handle->model, n_components, dim,
+		(double*)PyArray_DATA(mean), (double*)PyArray_DATA(covariance));
+	Py_DECREF(mean);
+	Py_DECREF(covariance);
+	if (status != 0) {
+		free(handle);
+		PyErr_SetString(PyExc_ValueError, "Sigma must be positive definite");
+		return NULL;
+	}
+	capsule = PyCapsule_New(handle, CAPSULE_NAME, capsule_destructor);
+	if (capsule == NULL) {
+		mvn_free(&handle->model);
+		free(handle);
+	}
+	return capsule;
+}
+
+PyObject *evaluate(PyObject *args, PyObject *kwargs, int exponentiate){
+	/*The densities, or log-densities, of points at every component of a handle,
+	of shape pos.shape[:-1], followed by (n_components) unless the handle is of
+	one Gaussian*/
+	static char *keywords[] = {"handle", "pos", "n_threads", NULL};
+	PyObject *capsule, *pos_object, *out;
+	PyArrayObject *pos;
+	mvn_handle *handle;
+	npy_intp shape[NPY_MAXDIMS];
+	int n_threads = 0, ndim, d, status;
+	long n = 1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|i", keywords,
+			&capsule, &pos_object, &n_threads)) {
+		return NULL;
+	}
+	if (!PyCapsule_IsValid(capsule, CAPSULE_NAME)) {
+		PyErr_SetString(PyExc_TypeError, "Expected a handle from factorise()");
+		return NULL;
+	}
+	handle = (mvn_handle*)PyCapsule_GetPointer(capsule, CAPSULE_NAME);
+	pos = (PyArrayObject*)PyArray_FROMANY(pos_object, NPY_DOUBLE, 1, NPY_MAXDIMS - 1,
+		NPY_ARRAY_IN_ARRAY);
+	if (pos == NULL) return NULL;
+	ndim = PyArray_NDIM(pos);
+	if (PyArray_DIM(pos, ndim - 1) != handle->model.dim) {
+		PyErr_Format(PyExc_ValueError, "The last dimension of pos must be %d",
+			handle->model.dim);
+		Py_DECREF(pos);
+		return NULL;
+	}
+	for (d = 0; d < ndim - 1; d++) {
+		shape[d] = PyArray_DIM(pos, d);
+		n *= (long)shape[d];
+	}
+	shape[ndim - 1] = handle->model.n_components;
+	out = PyArray_SimpleNew(handle->single ? ndim - 1 : ndim, shape, NPY_DOUBLE);
+	if (out == NULL) {Py_DECREF(pos); return NULL;}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = mvn_evaluate(&handle->model, n, (double*)PyArray_DATA(pos),
+		(double*)PyArray_DATA((PyArrayObject*)out), n_threads, exponentiate);
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(pos);
+	if (status != 0) {
+		Py_DECREF(out);
+		return PyErr_NoMemory();
+	}
+	return out;
+}
+
+PyObject *mvn_py_log_density(PyObject *self, PyObject *args, PyObject *kwargs){
+	return evaluate(args, kwargs, 0);
+}
+
+PyObject *mvn_py_density(PyObject *self, PyObject *args, PyObject *kwargs){
+	return evaluate(args, kwargs, 1);
+}
+
+PyMethodDef mvn_methods[] = {
+	{"factorise", (PyCFunction)mvn_py_factorise, METH_VARARGS,
+		"factorise(mu, Sigma)\n\n"
+		"Factorise a Gaussian of mean mu, (dim), and covariance Sigma,\n"
+		"(dim X dim), or n_components of them, (n_components X dim) and\n"
+		"(n_components X dim X dim), once, and return a handle for density()\n"
+		"and log_density()."},
+	{"log_density", (PyCFunction)(void(*)(void))mvn_py_log_density,
+		METH_VARARGS | METH_KEYWORDS,
+		"log_density(handle, pos, n_threads=0)\n\n"
+		"The log-densities at the points packed into the last dimension of pos,\n"
+		"of shape pos.shape[:-1], with a last axis of the components if the\n"
+		"handle holds several. n_threads is the number of threads (0 for one\n"
+		"per processor)."},
+	{"density", (PyCFunction)(void(*)(void))mvn_py_density,
+		METH_VARARGS | METH_KEYWORDS,
+		"density(handle, pos, n_threads=0)\n\n"
+		"The exp of log_density(), as multivariate_gaussian(pos, mu, Sigma)."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef mvn_module = {
+	PyModuleDef_HEAD_INIT, "mvn",
+	"Batched multivariate Gaussian densities with cached factorisations, run "
+	"in-process",
+	-1, mvn_methods
+};
+
+PyMODINIT_FUNC PyInit_mvn(void){
+	import_array();
+	return PyModule_Create(&mvn_module);
+}
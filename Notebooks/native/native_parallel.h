@@ -0,0 +1,68 @@
+/*
+The thread helpers shared by the engines of native/.
+
+native_parallel() runs a function once per thread, native_work(context, t,
+n_threads) for t = 0, ..., n_threads - 1, and returns once every thread has
+finished. Each engine splits its work between the threads by t, so that no
+locking is needed.
+*/
+
+#ifndef NATIVE_PARALLEL_H
+#define NATIVE_PARALLEL_H
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+typedef void (*native_work)(void *context, int thread, int n_threads);
+
+typedef struct {
+	native_work work;
+	void *context;
+	int index;
+	int n_threads;
+	pthread_t thread;
+	int started;
+} native_thread;
+
+int native_default_n_threads(void){
+	/*The number of online processors, or 1 if it cannot be determined*/
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+}
+
+void *native_thread_main(void *arg){
+	native_thread *thread = (native_thread*)arg;
+	thread->work(thread->context, thread->index, thread->n_threads);
+	return NULL;
+}
+
+void native_parallel(native_work work, void *context, int n_threads){
+	/*Run work(context, t, n_threads) for t = 0, ..., n_threads - 1, with one
+	thread per processor if n_threads <= 0. The calling thread does the work of
+	thread 0, and of any thread which could not be started*/
+	native_thread *thread;
+	int t;
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+	thread = (n_threads > 1) ? calloc(n_threads, sizeof(native_thread)) : NULL;
+	if (thread == NULL) {
+		for (t = 0; t < n_threads; t++) work(context, t, n_threads);
+		return;
+	}
+	for (t = 1; t < n_threads; t++) {
+		thread[t].work = work;
+		thread[t].context = context;
+		thread[t].index = t;
+		thread[t].n_threads = n_threads;
+		thread[t].started = (pthread_create(&thread[t].thread, NULL, native_thread_main,
+			&thread[t]) == 0);
+	}
+	work(context, 0, n_threads);
+	for (t = 1; t < n_threads; t++) {
+		if (thread[t].started) pthread_join(thread[t].thread, NULL);
+		else work(context, t, n_threads);
+	}
+	free(thread);
+}
+
+#endif
@@ -0,0 +1,559 @@
+/*
+The radial basis function kernel of kernel_machines.ipynb,
+
+	RBF(x1, x2) = exp(-|x1 - x2|^2/(2 sigma^2)),
+
+as Gram matrices of 10^4 to 10^5 points, and as explicit features for kernel
+machines whose Gram matrix would not fit in memory.
+
+rbf_gram() expands the squared distance as |x1|^2 + |x2|^2 - 2 x1.x2, so that a
+Gram matrix costs a matrix product and an exp per entry rather than the
+notebook's Python loop over pairs. The inputs are first centred on the mean of
+x1, which leaves the distances unchanged but keeps the expansion from losing
+them to cancellation when the data are far from the origin. The matrix is built
+RBF_TILE X RBF_TILE tiles at a time, the tiles taken in turn by the threads.
+Each tile reads a tile of x2 stored by feature, (dim X RBF_TILE), and
+accumulates the products of four rows of x1 at a time in loops over the tile's
+columns which the compiler vectorises, then takes the exp of the tile's columns
+in one tight loop over libm's exp, which was as fast as a vectorised polynomial
+at the SSE2 width of the build. The Gram matrix of one set of inputs is
+symmetric, and only its tiles on or below the diagonal are computed, then
+mirrored (RBF_FULL), or stored as the lower triangle of a square array
+(RBF_LOWER) or packed by row, row i starting at i(i + 1)/2 (RBF_PACKED).
+
+An rbf_features maps inputs to n_features features phi(x) with
+phi(x1).phi(x2) ~ RBF(x1, x2), so that a kernel ridge regression or SVM on n
+points needs O(n n_features) memory rather than O(n^2):
+- rbf_nystrom() takes n_features landmarks Z, given or drawn from the data,
+	and phi(x) = L^-1 k_Z(x), where L is the Cholesky factor of
+	K_ZZ + jitter I, so that phi(x1).phi(x2) = k_Z(x1)^T K_ZZ^-1 k_Z(x2), the
+	Nystrom approximation
+- rbf_fourier() draws random Fourier features (Rahimi and Recht 2007),
+	phi(x) = sqrt(2/n_features) cos(W x + b), with the rows of W drawn from
+	N(0, I/sigma^2) and b from U(0, 2 pi).
+rbf_transform() computes the features of any inputs, and rbf_ridge() solves
+the ridge regression (Phi^T Phi + alpha I) w = Phi^T y on the features, each
+thread accumulating Phi^T Phi over its own range of points, a tile at a time,
+without storing Phi.
+*/
+
+#ifndef RBF_H
+#define RBF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "native_parallel.h"
+
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#define RBF_TILE 64
+
+enum {RBF_FULL, RBF_LOWER, RBF_PACKED};
+enum {RBF_NYSTROM, RBF_FOURIER};
+
+typedef struct {
+	int type; // RBF_NYSTROM or RBF_FOURIER
+	int dim;
+	int n_features;
+	double sigma;
+	double jitter;
+	int n_threads;
+	double *landmarks; // (n_features X dim), Z for RBF_NYSTROM
+	double *cholesky; // (n_features X n_features), L for RBF_NYSTROM
+	double *weights; // (n_features X dim), W for RBF_FOURIER
+	double *offsets; // (n_features), b for RBF_FOURIER
+} rbf_features;
+
+double rbf_kernel(const double *x1, const double *x2, int dim, double sigma){
+	/*RBF_kernel() of the notebook*/
+	double squared = 0.0, difference;
+	int f;
+	for (f = 0; f < dim; f++) {
+		difference = x1[f] - x2[f];
+		squared += difference*difference;
+	}
+	return exp(-squared/(2.0*sigma*sigma));
+}
+
+typedef struct {
+	double *x; // (n X dim), centred
+	double *norms; // (n), the squared norms of the centred rows
+	long n;
+} rbf_inputs;
+
+void rbf_inputs_free(rbf_inputs *inputs){
+	free(inputs->x);
+	free(inputs->norms);
+}
+
+int rbf_centre(const double *x, long n, int dim, const double *centre,
+	rbf_inputs *inputs){
+	/*Copy n inputs x, (n X dim), less centre, with their squared norms.
+	Returns 0 on success, -1 otherwise*/
+	long i;
+	int f;
+	double difference;
+	inputs->n = n;
+	inputs->x = malloc((size_t)n*dim*sizeof(double));
+	inputs->norms = malloc((size_t)n*sizeof(double));
+	if ((inputs->x == NULL) || (inputs->norms == NULL)) {
+		printf("Error allocating the inputs\n");
+		rbf_inputs_free(inputs);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		inputs->norms[i] = 0.0;
+		for (f = 0; f < dim; f++) {
+			difference = x[i*dim + f] - centre[f];
+			inputs->x[i*dim + f] = difference;
+			inputs->norms[i] += difference*difference;
+		}
+	}
+	return 0;
+}
+
+void rbf_tile(const rbf_inputs *x1, long i0, long n_i, const rbf_inputs *x2,
+	long j0, long n_j, int dim, double gamma, double *x2_t, double *out,
+	long ld){
+	/*out[i*ld + j] = exp(-gamma |x1_(i0 + i) - x2_(j0 + j)|^2) for n_i rows
+	and n_j <= RBF_TILE columns, through x2_t, (dim X RBF_TILE), the tile of x2
+	stored by feature. Four rows are accumulated at a time, each feature of x2_t
+	read once for the four*/
+	double acc[4][RBF_TILE], a_0, a_1, a_2, a_3, squared, *row_f;
+	const double *x_i;
+	long i, j;
+	int f, r, n_r;
+	for (j = 0; j < n_j; j++) {
+		for (f = 0; f < dim; f++) x2_t[f*RBF_TILE + j] = x2->x[(j0 + j)*dim + f];
+	}
+	for (i = 0; i < n_i; i += 4) {
+		n_r = (n_i - i < 4) ? (int)(n_i - i) : 4;
+		x_i = x1->x + (i0 + i)*dim;
+		for (r = 0; r < 4; r++) {
+			for (j = 0; j < n_j; j++) acc[r][j] = 0.0;
+		}
+		for (f = 0; f < dim; f++) {
+			row_f = x2_t + f*RBF_TILE;
+			a_0 = x_i[f];
+			a_1 = (n_r > 1) ? x_i[dim + f] : 0.0;
+			a_2 = (n_r > 2) ? x_i[2*dim + f] : 0.0;
+			a_3 = (n_r > 3) ? x_i[3*dim + f] : 0.0;
+			for (j = 0; j < n_j; j++) {
+				acc[0][j] += a_0*row_f[j];
+				acc[1][j] += a_1*row_f[j];
+				acc[2][j] += a_2*row_f[j];
+				acc[3][j] += a_3*row_f[j];
+			}
+		}
+		for (r = 0; r < n_r; r++) {
+			for (j = 0; j < n_j; j++) {
+				squared = x1->norms[i0 + i + r] + x2->norms[j0 + j] - 2.0*acc[r][j];
+				out[(i + r)*ld + j] = exp(-gamma*((squared > 0.0) ? squared : 0.0));
+			}
+		}
+	}
+}
+
+typedef struct {
+	const rbf_inputs *x1;
+	const rbf_inputs *x2; // x1 for the Gram matrix of one set of inputs
+	int dim;
+	double gamma;
+	int layout;
+	double *out;
+	long ld;
+	int failed;
+} rbf_gram_context;
+
+void rbf_gram_worker(void *arg, int thread, int n_threads){
+	/*The tiles of the thread, taken in turn*/
+	rbf_gram_context *context = (rbf_gram_context*)arg;
+	long n1 = context->x1->n, n2 = context->x2->n, ld = context->ld;
+	long n_column_tiles = (n2 + RBF_TILE - 1)/RBF_TILE;
+	long n_tiles = ((n1 + RBF_TILE - 1)/RBF_TILE)*n_column_tiles;
+	long tile, i0, j0, n_i, n_j, n_row, i, j;
+	int symmetric = (context->x1 == context->x2);
+	double tile_out[RBF_TILE*RBF_TILE], *x2_t;
+	x2_t = malloc((size_t)context->dim*RBF_TILE*sizeof(double));
+	if (x2_t == NULL) {
+		printf("Error allocating the tiles\n");
+		context->failed = 1;
+		return;
+	}
+	for (tile = thread; tile < n_tiles; tile += n_threads) {
+		i0 = (tile/n_column_tiles)*RBF_TILE;
+		j0 = (tile % n_column_tiles)*RBF_TILE;
+		if (symmetric && (j0 > i0)) continue;
+		n_i = (n1 - i0 < RBF_TILE) ? n1 - i0 : RBF_TILE;
+		n_j = (n2 - j0 < RBF_TILE) ? n2 - j0 : RBF_TILE;
+		if (!symmetric) {
+			rbf_tile(context->x1, i0, n_i, context->x2, j0, n_j, context->dim,
+				context->gamma, x2_t, context->out + i0*ld + j0, ld);
+			continue;
+		}
+		rbf_tile(context->x1, i0, n_i, context->x2, j0, n_j, context->dim,
+			context->gamma, x2_t, tile_out, RBF_TILE);
+		if (i0 == j0) {
+			for (i = 0; i < n_i; i++) tile_out[i*RBF_TILE + i] = 1.0;
+		}
+		for (i = 0; i < n_i; i++) {
+			n_row = (i0 == j0) ? i + 1 : n_j;
+			if (context->layout == RBF_PACKED) {
+				memcpy(context->out + (i0 + i)*(i0 + i + 1)/2 + j0,
+					tile_out + i*RBF_TILE, n_row*sizeof(double));
+				continue;
+			}
+			memcpy(context->out + (i0 + i)*ld + j0, tile_out + i*RBF_TILE,
+				n_row*sizeof(double));
+			if (context->layout == RBF_FULL) {
+				for (j = 0; j < n_row; j++) {
+					context->out[(j0 + j)*ld + i0 + i] = tile_out[i*RBF_TILE + j];
+				}
+			}
+		}
+	}
+	free(x2_t);
+}
+
+int rbf_gram(const double *x1, long n1, const double *x2, long n2, int dim,
+	double sigma, int layout, double *out, int n_threads){
+	/*The Gram matrix RBF(x1_i, x2_j) of inputs x1, (n1 X dim), and x2,
+	(n2 X dim).
+
+	Parameters
+	----------------
+	x2 : NULL for the Gram matrix of x1 with itself, which is stored by layout
+	layout : For x2 NULL, RBF_FULL for the (n1 X n1) matrix, RBF_LOWER for its
+		lower triangle, leaving the upper one of out untouched, or RBF_PACKED
+		for the n1(n1 + 1)/2 entries of its lower triangle, by row
+	out : (n1 X n2) otherwise
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	rbf_inputs inputs1, inputs2;
+	double *centre;
+	rbf_gram_context context = {&inputs1, &inputs1, dim,
+		1.0/(2.0*sigma*sigma), layout, out, (x2 == NULL) ? n1 : n2, 0};
+	long i;
+	int f, status = 0;
+
+	centre = calloc(dim, sizeof(double));
+	if (centre == NULL) {
+		printf("Error allocating the centre\n");
+		return -1;
+	}
+	for (i = 0; i < n1; i++) {
+		for (f = 0; f < dim; f++) centre[f] += x1[i*dim + f];
+	}
+	for (f = 0; f < dim; f++) centre[f] /= n1;
+	status = rbf_centre(x1, n1, dim, centre, &inputs1);
+	if ((status == 0) && (x2 != NULL)) {
+		status = rbf_centre(x2, n2, dim, centre, &inputs2);
+		if (status == 0) context.x2 = &inputs2;
+		else rbf_inputs_free(&inputs1);
+	}
+	free(centre);
+	if (status != 0) return -1;
+
+	native_parallel(rbf_gram_worker, &context, n_threads);
+	rbf_inputs_free(&inputs1);
+	if (x2 != NULL) rbf_inputs_free(&inputs2);
+	return context.failed ? -1 : 0;
+}
+
+int rbf_cholesky(double *a, int n){
+	/*Factorise the (n X n) positive definite a in place into its lower
+	Cholesky factor. Returns 0 on success, -1 if a is not positive definite*/
+	double sum;
+	int i, j, k;
+	for (j = 0; j < n; j++) {
+		sum = a[j*n + j];
+		for (k = 0; k < j; k++) sum -= a[j*n + k]*a[j*n + k];
+		if (!(sum > 0.0)) return -1;
+		a[j*n + j] = sqrt(sum);
+		for (i = j + 1; i < n; i++) {
+			sum = a[i*n + j];
+			for (k = 0; k < j; k++) sum -= a[i*n + k]*a[j*n + k];
+			a[i*n + j] = sum/a[j*n + j];
+		}
+		for (i = 0; i < j; i++) a[i*n + j] = 0.0;
+	}
+	return 0;
+}
+
+void rbf_features_free(rbf_features *features){
+	free(features->landmarks);
+	free(features->cholesky);
+	free(features->weights);
+	free(features->offsets);
+}
+
+int rbf_nystrom(rbf_features *features, int dim, double sigma, double jitter,
+	int n_threads, int n_features, const double *landmarks, long n,
+	const double *x, gsl_rng *r){
+	/*The Nystrom features of n_features landmarks.
+
+	Parameters
+	----------------
+	landmarks : (n_features X dim), or NULL to draw n_features of the n inputs
+		x, (n X dim), without replacement with r
+	jitter : Added to the diagonal of K_ZZ, which keeps it positive definite
+		when landmarks are close together
+
+	Returns
+	----------------
+	0 on success, -1 otherwise
+	*/
+	long *chosen;
+	long i;
+	int a, status;
+	memset(features, 0, sizeof(rbf_features));
+	features->type = RBF_NYSTROM;
+	features->dim = dim;
+	features->n_features = n_features;
+	features->sigma = sigma;
+	features->jitter = jitter;
+	features->n_threads = n_threads;
+	features->landmarks = malloc((size_t)n_features*dim*sizeof(double));
+	features->cholesky = malloc((size_t)n_features*n_features*sizeof(double));
+	if ((features->landmarks == NULL) || (features->cholesky == NULL)) {
+		printf("Error allocating the features\n");
+		rbf_features_free(features);
+		return -1;
+	}
+	if (landmarks != NULL) {
+		memcpy(features->landmarks, landmarks, (size_t)n_features*dim*sizeof(double));
+	}
+	else{
+		if (n < n_features) {
+			printf("Cannot draw %d landmarks from %ld points\n", n_features, n);
+			rbf_features_free(features);
+			return -1;
+		}
+		chosen = malloc((size_t)n*sizeof(long));
+		if (chosen == NULL) {
+			printf("Error allocating the landmarks\n");
+			rbf_features_free(features);
+			return -1;
+		}
+		for (i = 0; i < n; i++) chosen[i] = i;
+		gsl_ran_choose(r, chosen, n_features, chosen, n, sizeof(long));
+		for (a = 0; a < n_features; a++) {
+			memcpy(features->landmarks + (size_t)a*dim, x + chosen[a]*dim,
+				dim*sizeof(double));
+		}
+		free(chosen);
+	}
+
+	status = rbf_gram(features->landmarks, n_features, NULL, 0, dim, sigma,
+		RBF_FULL, features->cholesky, n_threads);
+	if (status == 0) {
+		for (a = 0; a < n_features; a++) {
+			features->cholesky[a*n_features + a] += jitter;
+		}
+		status = rbf_cholesky(features->cholesky, n_features);
+		if (status != 0) printf("K_ZZ is not positive definite, increase the jitter\n");
+	}
+	if (status != 0) {
+		rbf_features_free(features);
+		return -1;
+	}
+	return 0;
+}
+
+int rbf_fourier(rbf_features *features, int dim, double sigma, int n_threads,
+	int n_features, gsl_rng *r){
+	/*Draw n_features random Fourier features with r. Returns 0 on success, -1
+	otherwise*/
+	int a, f;
+	memset(features, 0, sizeof(rbf_features));
+	features->type = RBF_FOURIER;
+	features->dim = dim;
+	features->n_features = n_features;
+	features->sigma = sigma;
+	features->n_threads = n_threads;
+	features->weights = malloc((size_t)n_features*dim*sizeof(double));
+	features->offsets = malloc((size_t)n_features*sizeof(double));
+	if ((features->weights == NULL) || (features->offsets == NULL)) {
+		printf("Error allocating the features\n");
+		rbf_features_free(features);
+		return -1;
+	}
+	for (a = 0; a < n_features; a++) {
+		for (f = 0; f < dim; f++) {
+			features->weights[a*dim + f] = gsl_ran_gaussian_ziggurat(r, 1.0/sigma);
+		}
+		features->offsets[a] = 2.0*M_PI*gsl_rng_uniform(r);
+	}
+	return 0;
+}
+
+void rbf_transform_tile(const rbf_features *features, const double *x, long n_i,
+	double *phi, double *scratch){
+	/*The features phi, (n_i X n_features), of n_i <= RBF_TILE inputs x, through
+	scratch, (n_features X RBF_TILE)*/
+	int m = features->n_features, dim = features->dim, a, b, f;
+	double scale, l_ab, *k_a;
+	const double *l_a;
+	long i;
+	if (features->type == RBF_FOURIER) {
+		scale = sqrt(2.0/m);
+		for (i = 0; i < n_i; i++) {
+			for (a = 0; a < m; a++) phi[i*m + a] = features->offsets[a];
+			for (a = 0; a < m; a++) {
+				for (f = 0; f < dim; f++) phi[i*m + a] += features->weights[a*dim + f]*x[i*dim + f];
+			}
+			for (a = 0; a < m; a++) phi[i*m + a] = scale*cos(phi[i*m + a]);
+		}
+		return;
+	}
+	/*L Phi^T = K_Z(x), by forward substitution for all the inputs at once,
+	with Phi^T in scratch*/
+	for (a = 0; a < m; a++) {
+		k_a = scratch + (size_t)a*RBF_TILE;
+		for (i = 0; i < n_i; i++) {
+			k_a[i] = rbf_kernel(x + i*dim, features->landmarks + a*dim, dim,
+				features->sigma);
+		}
+	}
+	for (a = 0; a < m; a++) {
+		k_a = scratch + (size_t)a*RBF_TILE;
+		l_a = features->cholesky + (size_t)a*m;
+		for (b = 0; b < a; b++) {
+			l_ab = l_a[b];
+			for (i = 0; i < n_i; i++) k_a[i] -= l_ab*scratch[(size_t)b*RBF_TILE + i];
+		}
+		scale = 1.0/l_a[a];
+		for (i = 0; i < n_i; i++) phi[i*m + a] = k_a[i] *= scale;
+	}
+}
+
+typedef struct {
+	const rbf_features *features;
+	long n;
+	const double *x;
+	const double *y; // NULL to store the features in phi
+	double *phi; // (n X n_features), or the per-thread (n_features X
+	// n_features) Phi^T Phi and (n_features) Phi^T y for rbf_ridge()
+	int failed;
+} rbf_transform_context;
+
+void rbf_transform_worker(void *arg, int thread, int n_threads){
+	/*The features of the thread's tiles of inputs, or their contributions to
+	Phi^T Phi and Phi^T y*/
+	rbf_transform_context *context = (rbf_transform_context*)arg;
+	const rbf_features *features = context->features;
+	int m = features->n_features, a, b;
+	long i0, i, n_i;
+	double *phi, *scratch, *gram = NULL, *phi_y = NULL, *gram_a, phi_ia;
+	size_t stride = (size_t)m*m + m;
+
+	scratch = malloc((size_t)m*RBF_TILE*sizeof(double)*((context->y == NULL) ? 1 : 2));
+	if (scratch == NULL) {
+		printf("Error allocating the features\n");
+		context->failed = 1;
+		return;
+	}
+	phi = scratch + (size_t)m*RBF_TILE;
+	if (context->y != NULL) {
+		gram = context->phi + thread*stride;
+		phi_y = gram + (size_t)m*m;
+	}
+	for (i0 = (long)thread*RBF_TILE; i0 < context->n; i0 += (long)n_threads*RBF_TILE) {
+		n_i = (context->n - i0 < RBF_TILE) ? context->n - i0 : RBF_TILE;
+		if (context->y == NULL) {
+			rbf_transform_tile(features, context->x + i0*features->dim, n_i,
+				context->phi + i0*m, scratch);
+			continue;
+		}
+		rbf_transform_tile(features, context->x + i0*features->dim, n_i, phi,
+			scratch);
+		/*The lower triangle of Phi^T Phi, a row at a time, which stays in
+		cache over the tile's inputs*/
+		for (a = 0; a < m; a++) {
+			gram_a = gram + (size_t)a*m;
+			for (i = 0; i < n_i; i++) {
+				phi_ia = phi[i*m + a];
+				for (b = 0; b <= a; b++) gram_a[b] += phi_ia*phi[i*m + b];
+				phi_y[a] += phi_ia*context->y[i0 + i];
+			}
+		}
+	}
+	free(scratch);
+}
+
+int rbf_transform(const rbf_features *features, long n, const double *x,
+	double *phi){
+	/*The features phi, (n X n_features), of n inputs x, (n X dim). Returns 0 on success, -1 otherwise*/
+	rbf_transform_context context = {features, n, x, NULL, phi, 0};
+	int n_threads = features->n_threads;
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+	if (n_threads > (n + RBF_TILE - 1)/RBF_TILE) n_threads = (int)((n + RBF_TILE - 1)/RBF_TILE);
+	if (n_threads < 1) return 0;
+	native_parallel(rbf_transform_worker, &context, n_threads);
+	return context.failed ? -1 : 0;
+}
+
+int rbf_ridge(const rbf_features *features, long n, const double *x,
+	const double *y, double alpha, double *w){
+	/*The weights w, (n_features), of the ridge regression of the n observations
+	y on the features of the inputs x, (n X dim), minimising
+	|Phi w - y|^2 + alpha |w|^2, so that predictions are phi(x).w. Returns 0 on
+	success, -1 otherwise*/
+	rbf_transform_context context = {features, n, x, y, NULL, 0};
+	int m = features->n_features, n_threads = features->n_threads, a, b, t;
+	size_t stride = (size_t)m*m + m;
+	double *gram, *phi_y, sum;
+
+	if (n_threads <= 0) n_threads = native_default_n_threads();
+	if (n_threads > (n + RBF_TILE - 1)/RBF_TILE) n_threads = (int)((n + RBF_TILE - 1)/RBF_TILE);
+	if (n_threads < 1) n_threads = 1;
+	context.phi = calloc((size_t)n_threads*stride, sizeof(double));
+	if (context.phi == NULL) {
+		printf("Error allocating Phi^T Phi\n");
+		return -1;
+	}
+	native_parallel(rbf_transform_worker, &context, n_threads);
+	if (context.failed) {
+		free(context.phi);
+		return -1;
+	}
+
+	/*Merge into the first thread's sums, then solve by Cholesky*/
+	gram = context.phi;
+	phi_y = gram + (size_t)m*m;
+	for (t = 1; t < n_threads; t++) {
+		for (a = 0; a < (int)stride; a++) gram[a] += context.phi[t*stride + a];
+	}
+	for (a = 0; a < m; a++) {
+		gram[a*m + a] += alpha;
+		for (b = 0; b < a; b++) gram[b*m + a] = gram[a*m + b];
+	}
+	if (rbf_cholesky(gram, m) != 0) {
+		printf("Phi^T Phi + alpha I is not positive definite, increase alpha\n");
+		free(context.phi);
+		return -1;
+	}
+	for (a = 0; a < m; a++) {
+		sum = phi_y[a];
+		for (b = 0; b < a; b++) sum -= gram[a*m + b]*w[b];
+		w[a] = sum/gram[a*m + a];
+	}
+	for (a = m - 1; a >= 0; a--) {
+		sum = w[a];
+		for (b = a + 1; b < m; b++) sum -= gram[b*m + a]*w[b];
+		w[a] = sum/gram[a*m + a];
+	}
+	free(context.phi);
+	return 0;
+}
+
+#endif
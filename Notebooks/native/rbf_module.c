@@ -0,0 +1,386 @@
+/*
+A Python extension module, rbf, which computes the radial basis function kernel
+of rbf.h in-process, in place of the RBF_kernel() loops of kernel_machines.ipynb.
+
+Build it with `./build_module.sh`, then from Python (or a notebook):
+
+	import sys; sys.path.append('native')
+	import rbf
+	K = rbf.gram(X_train, sigma=sigma) # (n_train X n_train)
+	K_test = rbf.gram(X_test, X_train, sigma=sigma) # (n_test X n_train)
+	phi_train = rbf.gram(X_train, mu, sigma=sigma) # the notebook's features
+
+	features = rbf.nystrom(X_train, n_landmarks=200, sigma=sigma)
+	w = rbf.ridge(features, X_train, y_train, alpha=1e-3)
+	y_pred = rbf.transform(features, X_test) @ w
+
+Inputs are arrays of shape (n) or (n X dim). nystrom() and fourier() return a
+handle for transform() and ridge(), which holds the landmarks and their factor,
+or the random frequencies, and is freed with the handle. The GIL is released
+while the engine runs.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "rbf.h"
+
+#define FEATURES_CAPSULE_NAME "rbf.features"
+
+void features_capsule_destructor(PyObject *capsule){
+	/*Free the rbf_features owned by a capsule*/
+	rbf_features *features = (rbf_features*)PyCapsule_GetPointer(capsule,
+		FEATURES_CAPSULE_NAME);
+	rbf_features_free(features);
+	free(features);
+}
+
+PyArrayObject *parse_inputs(PyObject *object, int dim, const char *name){
+	/*Inputs of shape (n) or (n X dim) as a C-contiguous float64 array. dim 0
+	accepts any dimension.
+
+	Returns
+	----------------
+	The array, or NULL with a Python exception set
+	*/
+	PyArrayObject *array = (PyArrayObject*)PyArray_FROMANY(object, NPY_DOUBLE, 1,
+		2, NPY_ARRAY_IN_ARRAY);
+	int array_dim;
+	if (array == NULL) return NULL;
+	array_dim = (PyArray_NDIM(array) == 2) ? (int)PyArray_DIM(array, 1) : 1;
+	if ((PyArray_DIM(array, 0) < 1) || (array_dim < 1) ||
+		((dim > 0) && (array_dim != dim))) {
+		if (dim > 0) PyErr_Format(PyExc_ValueError, "%s must have shape (n, %d)", name, dim);
+		else PyErr_Format(PyExc_ValueError, "%s must not be empty", name);
+		Py_DECREF(array);
+		return NULL;
+	}
+	return array;
+}
+
+int input_dim(PyArrayObject *array){
+	return (PyArray_NDIM(array) == 2) ? (int)PyArray_DIM(array, 1) : 1;
+}
+
+PyObject *rbf_py_gram(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*The Gram matrix, see the module docstring*/
+	static char *keywords[] = {"x1", "x2", "sigma", "output", "n_threads", NULL};
+	PyObject *x1_object, *x2_object = Py_None, *out;
+	PyArrayObject *x1, *x2 = NULL;
+	double sigma = 1.0;
+	const char *output = "full";
+	int n_threads = 0, layout, status;
+	npy_intp shape[2];
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Odsi", keywords,
+			&x1_object, &x2_object, &sigma, &output, &n_threads)) {
+		return NULL;
+	}
+	if (strcmp(output, "full") == 0) layout = RBF_FULL;
+	else if (strcmp(output, "lower") == 0) layout = RBF_LOWER;
+	else if (strcmp(output, "packed") == 0) layout = RBF_PACKED;
+	else{
+		PyErr_SetString(PyExc_ValueError,
+			"output must be 'full', 'lower' or 'packed'");
+		return NULL;
+	}
+	if (!(sigma > 0.0)) {
+		PyErr_SetString(PyExc_ValueError, "sigma must be positive");
+		return NULL;
+	}
+	if ((x2_object != Py_None) && (layout != RBF_FULL)) {
+		PyErr_SetString(PyExc_ValueError,
+			"output 'lower' and 'packed' are for the Gram matrix of x1 alone");
+		return NULL;
+	}
+	x1 = parse_inputs(x1_object, 0, "x1");
+	if (x1 == NULL) return NULL;
+	if (x2_object != Py_None) {
+		x2 = parse_inputs(x2_object, input_dim(x1), "x2");
+		if (x2 == NULL) {Py_DECREF(x1); return NULL;}
+	}
+	shape[0] = PyArray_DIM(x1, 0);
+	shape[1] = (x2 == NULL) ? shape[0] : PyArray_DIM(x2, 0);
+	if (layout == RBF_PACKED) {
+		shape[0] = shape[0]*(shape[0] + 1)/2;
+		out = PyArray_SimpleNew(1, shape, NPY_DOUBLE);
+	}
+	else if (layout == RBF_LOWER) out = PyArray_ZEROS(2, shape, NPY_DOUBLE, 0);
+	else out = PyArray_SimpleNew(2, shape, NPY_DOUBLE);
+	if (out == NULL) {
+		Py_DECREF(x1);
+		Py_XDECREF(x2);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = rbf_gram((double*)PyArray_DATA(x1), (long)PyArray_DIM(x1, 0),
+		(x2 == NULL) ? NULL : (double*)PyArray_DATA(x2),
+		(x2 == NULL) ? 0 : (long)PyArray_DIM(x2, 0), input_dim(x1), sigma, layout,
+		(double*)PyArray_DATA((PyArrayObject*)out), n_threads);
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x1);
+	Py_XDECREF(x2);
+	if (status != 0) {
+		Py_DECREF(out);
+		return PyErr_NoMemory();
+	}
+	return out;
+}
+
+PyObject *features_capsule(rbf_features *features){
+	/*A handle owning features, or NULL with a Python exception set*/
+	PyObject *capsule = PyCapsule_New(features, FEATURES_CAPSULE_NAME,
+		features_capsule_destructor);
+	if (capsule == NULL) {
+		rbf_features_free(features);
+		free(features);
+	}
+	return capsule;
+}
+
+PyObject *rbf_py_nystrom(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Nystrom features, see the module docstring*/
+	static char *keywords[] = {"x", "n_landmarks", "sigma", "landmarks", "jitter",
+		"seed", "n_threads", NULL};
+	PyObject *x_object, *landmarks_object = Py_None;
+	PyArrayObject *x, *landmarks = NULL;
+	double sigma = 1.0, jitter = 1e-8;
+	unsigned long int seed = 1;
+	int n_landmarks = 100, n_threads = 0, status;
+	rbf_features *features;
+	gsl_rng *r;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|idOdki", keywords,
+			&x_object, &n_landmarks, &sigma, &landmarks_object, &jitter, &seed,
+			&n_threads)) {
+		return NULL;
+	}
+	if (!(sigma > 0.0) || (jitter < 0.0)) {
+		PyErr_SetString(PyExc_ValueError,
+			"sigma must be positive, jitter not negative");
+		return NULL;
+	}
+	x = parse_inputs(x_object, 0, "x");
+	if (x == NULL) return NULL;
+	if (landmarks_object != Py_None) {
+		landmarks = parse_inputs(landmarks_object, input_dim(x), "landmarks");
+		if (landmarks == NULL) {Py_DECREF(x); return NULL;}
+		n_landmarks = (int)PyArray_DIM(landmarks, 0);
+	}
+	else if ((n_landmarks < 1) || (n_landmarks > PyArray_DIM(x, 0))) {
+		PyErr_SetString(PyExc_ValueError,
+			"n_landmarks must be between 1 and the number of inputs");
+		Py_DECREF(x);
+		return NULL;
+	}
+	features = malloc(sizeof(rbf_features));
+	r = gsl_rng_alloc(gsl_rng_mt19937);
+	if ((features == NULL) || (r == NULL)) {
+		free(features);
+		if (r != NULL) gsl_rng_free(r);
+		Py_DECREF(x);
+		Py_XDECREF(landmarks);
+		return PyErr_NoMemory();
+	}
+	gsl_rng_set(r, seed);
+
+	Py_BEGIN_ALLOW_THREADS
+	status = rbf_nystrom(features, input_dim(x), sigma, jitter, n_threads,
+		n_landmarks, (landmarks == NULL) ? NULL : (double*)PyArray_DATA(landmarks),
+		(long)PyArray_DIM(x, 0), (double*)PyArray_DATA(x), r);
+	Py_END_ALLOW_THREADS
+
+	gsl_rng_free(r);
+	Py_DECREF(x);
+	Py_XDECREF(landmarks);
+	if (status != 0) {
+		free(features);
+		PyErr_SetString(PyExc_RuntimeError,
+			"The landmark Gram matrix could not be factorised, increase the jitter");
+		return NULL;
+	}
+	return features_capsule(features);
+}
+
+PyObject *rbf_py_fourier(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Random Fourier features, see the module docstring*/
+	static char *keywords[] = {"dim", "n_features", "sigma", "seed", "n_threads",
+		NULL};
+	double sigma = 1.0;
+	unsigned long int seed = 1;
+	int dim, n_features = 100, n_threads = 0, status;
+	rbf_features *features;
+	gsl_rng *r;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|idki", keywords,
+			&dim, &n_features, &sigma, &seed, &n_threads)) {
+		return NULL;
+	}
+	if ((dim < 1) || (n_features < 1) || !(sigma > 0.0)) {
+		PyErr_SetString(PyExc_ValueError,
+			"dim, n_features and sigma must be positive");
+		return NULL;
+	}
+	features = malloc(sizeof(rbf_features));
+	r = gsl_rng_alloc(gsl_rng_mt19937);
+	if ((features == NULL) || (r == NULL)) {
+		free(features);
+		if (r != NULL) gsl_rng_free(r);
+		return PyErr_NoMemory();
+	}
+	gsl_rng_set(r, seed);
+	status = rbf_fourier(features, dim, sigma, n_threads, n_features, r);
+	gsl_rng_free(r);
+	if (status != 0) {
+		free(features);
+		return PyErr_NoMemory();
+	}
+	return features_capsule(features);
+}
+
+rbf_features *parse_handle(PyObject *handle){
+	/*The features held by a handle from nystrom() or fourier(), or NULL with a
+	Python exception set*/
+	if (!PyCapsule_IsValid(handle, FEATURES_CAPSULE_NAME)) {
+		PyErr_SetString(PyExc_TypeError,
+			"Expected a handle from nystrom() or fourier()");
+		return NULL;
+	}
+	return (rbf_features*)PyCapsule_GetPointer(handle, FEATURES_CAPSULE_NAME);
+}
+
+PyObject *rbf_py_transform(PyObject *self, PyObject *args){
+	/*The features of inputs, see the module docstring*/
+	PyObject *handle, *x_object, *out;
+	PyArrayObject *x;
+	rbf_features *features;
+	npy_intp shape[2];
+	int status;
+
+	if (!PyArg_ParseTuple(args, "OO", &handle, &x_object)) return NULL;
+	features = parse_handle(handle);
+	if (features == NULL) return NULL;
+	x = parse_inputs(x_object, features->dim, "x");
+	if (x == NULL) return NULL;
+	shape[0] = PyArray_DIM(x, 0);
+	shape[1] = features->n_features;
+	out = PyArray_SimpleNew(2, shape, NPY_DOUBLE);
+	if (out == NULL) {Py_DECREF(x); return NULL;}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = rbf_transform(features, (long)shape[0], (double*)PyArray_DATA(x),
+		(double*)PyArray_DATA((PyArrayObject*)out));
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x);
+	if (status != 0) {
+		Py_DECREF(out);
+		return PyErr_NoMemory();
+	}
+	return out;
+}
+
+PyObject *rbf_py_ridge(PyObject *self, PyObject *args, PyObject *kwargs){
+	/*Ridge regression on the features, see the module docstring*/
+	static char *keywords[] = {"handle", "x", "y", "alpha", NULL};
+	PyObject *handle, *x_object, *y_object, *w;
+	PyArrayObject *x, *y;
+	rbf_features *features;
+	double alpha = 1.0;
+	npy_intp m;
+	int status;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|d", keywords,
+			&handle, &x_object, &y_object, &alpha)) {
+		return NULL;
+	}
+	features = parse_handle(handle);
+	if (features == NULL) return NULL;
+	if (!(alpha > 0.0)) {
+		PyErr_SetString(PyExc_ValueError, "alpha must be positive");
+		return NULL;
+	}
+	x = parse_inputs(x_object, features->dim, "x");
+	if (x == NULL) return NULL;
+	y = (PyArrayObject*)PyArray_FROMANY(y_object, NPY_DOUBLE, 1, 1,
+		NPY_ARRAY_IN_ARRAY);
+	if ((y != NULL) && (PyArray_DIM(y, 0) != PyArray_DIM(x, 0))) {
+		PyErr_SetString(PyExc_ValueError, "y must have one observation per input");
+		Py_CLEAR(y);
+	}
+	if (y == NULL) {Py_DECREF(x); return NULL;}
+	m = features->n_features;
+	w = PyArray_SimpleNew(1, &m, NPY_DOUBLE);
+	if (w == NULL) {
+		Py_DECREF(x);
+		Py_DECREF(y);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	status = rbf_ridge(features, (long)PyArray_DIM(x, 0), (double*)PyArray_DATA(x),
+		(double*)PyArray_DATA(y), alpha, (double*)PyArray_DATA((PyArrayObject*)w));
+	Py_END_ALLOW_THREADS
+
+	Py_DECREF(x);
+	Py_DECREF(y);
+	if (status != 0) {
+		Py_DECREF(w);
+		PyErr_SetString(PyExc_RuntimeError,
+			"The ridge regression could not be solved, increase alpha");
+		return NULL;
+	}
+	return w;
+}
+
+PyMethodDef rbf_methods[] = {
+	{"gram", (PyCFunction)(void(*)(void))rbf_py_gram,
+		METH_VARARGS | METH_KEYWORDS,
+		"gram(x1, x2=None, sigma=1.0, output='full', n_threads=0)\n\n"
+		"The kernel RBF_kernel(x1_i, x2_j) = exp(-|x1_i - x2_j|^2/(2 sigma^2))\n"
+		"between inputs of shape (n1) or (n1 X dim) and (n2) or (n2 X dim), as\n"
+		"an (n1 X n2) array. With x2 None, the symmetric Gram matrix of x1 is\n"
+		"computed once per pair, and output 'lower' returns its lower triangle\n"
+		"with zeros above, 'packed' the n1(n1 + 1)/2 entries of the lower\n"
+		"triangle by row. n_threads is the number of threads (0 for one per\n"
+		"processor)."},
+	{"nystrom", (PyCFunction)(void(*)(void))rbf_py_nystrom,
+		METH_VARARGS | METH_KEYWORDS,
+		"nystrom(x, n_landmarks=100, sigma=1.0, landmarks=None, jitter=1e-8,\n"
+		"    seed=1, n_threads=0)\n\n"
+		"Nystrom features phi(x) = L^-1 k_Z(x), for landmarks Z (n_landmarks\n"
+		"of the inputs x drawn without replacement, if None) and L the Cholesky\n"
+		"factor of K_ZZ + jitter I, so that phi(x1).phi(x2) approximates the\n"
+		"kernel. Returns a handle for transform() and ridge()."},
+	{"fourier", (PyCFunction)(void(*)(void))rbf_py_fourier,
+		METH_VARARGS | METH_KEYWORDS,
+		"fourier(dim, n_features=100, sigma=1.0, seed=1, n_threads=0)\n\n"
+		"Random Fourier features phi(x) = sqrt(2/n_features) cos(W x + b) of\n"
+		"inputs of dimension dim, whose dot products approximate the kernel.\n"
+		"Returns a handle for transform() and ridge()."},
+	{"transform", (PyCFunction)(void(*)(void))rbf_py_transform, METH_VARARGS,
+		"transform(handle, x)\n\n"
+		"The features of the inputs x, as an (n X n_features) array."},
+	{"ridge", (PyCFunction)(void(*)(void))rbf_py_ridge,
+		METH_VARARGS | METH_KEYWORDS,
+		"ridge(handle, x, y, alpha=1.0)\n\n"
+		"The weights w minimising |Phi w - y|^2 + alpha |w|^2 for the features\n"
+		"Phi of the inputs x, which are never stored, so that kernel ridge\n"
+		"predictions are transform(handle, x_new) @ w."},
+	{NULL, NULL, 0, NULL}
+};
+
+struct PyModuleDef rbf_module = {
+	PyModuleDef_HEAD_INIT, "rbf",
+	"Radial basis function Gram matrices and kernel features, run in-process",
+	-1, rbf_methods
+};
+
+PyMODINIT_FUNC PyInit_rbf(void){
+	import_array();
+	return PyModule_Create(&rbf_module);
+}
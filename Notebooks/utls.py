@@ -37,15 +37,44 @@ def remove_tex_axis(ax, xtick_fmt = '%d', ytick_fmt = '%d'):
 	ax.xaxis.set_major_formatter(FormatStrFormatter(xtick_fmt))
 	ax.yaxis.set_major_formatter(FormatStrFormatter(ytick_fmt))
 
-def multivariate_gaussian(pos, mu, Sigma):
+try:
+    import os
+    import sys
+    sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), 'native'))
+    import mvn # built by native/build_module.sh
+except ImportError:
+    mvn = None
+
+_mvn_handles = {}
+
+def _mvn_handle(mu, Sigma):
+    """The factorised Gaussian of mu and Sigma, cached across calls"""
+    key = (mu.shape, mu.tobytes(), Sigma.tobytes())
+    if key not in _mvn_handles:
+        if len(_mvn_handles) >= 16:
+            _mvn_handles.pop(next(iter(_mvn_handles)))
+        _mvn_handles[key] = mvn.factorise(mu, Sigma)
+    return _mvn_handles[key]
+
+def multivariate_gaussian(pos, mu, Sigma, log=False):
     """Return the multivariate Gaussian distribution on array pos.
 
     pos is an array constructed by packing the meshed arrays of variables
     x_1, x_2, x_3, ..., x_k into its _last_ dimension.
 
+    If the native mvn module has been built, Sigma is factorised once per
+    (mu, Sigma) and the densities are evaluated in C. With log=True, the
+    log-densities are returned, which do not underflow in the tails.
+
     Source: https://scipython.com/blog/visualizing-the-bivariate-gaussian-distribution/
     """
 
+    mu = np.asarray(mu, dtype=float)
+    Sigma = np.asarray(Sigma, dtype=float)
+    if mvn is not None:
+        handle = _mvn_handle(mu, Sigma)
+        return mvn.log_density(handle, pos) if log else mvn.density(handle, pos)
+
     n = mu.shape[0]
     Sigma_det = np.linalg.det(Sigma)
     Sigma_inv = np.linalg.inv(Sigma)
@@ -54,6 +83,8 @@ def multivariate_gaussian(pos, mu, Sigma):
     # way across all the input variables.
     fac = np.einsum('...k,kl,...l->...', pos-mu, Sigma_inv, pos-mu)
 
+    if log:
+        return -fac / 2 - np.log(N)
     return np.exp(-fac / 2) / N
 
 def standardize(X):